@@ -7,27 +7,80 @@
 #include <math.h>
 #include <time.h>
 #include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
 
-#include "../utils/list.h"
+#include "../utils/arena.h"
 #include "../utils/utils.h"
 
+#define HUGE_PAGE (1ULL << 21)
+
 QuantumCircuit *circuit_create(int nb_qbits) {
-    QuantumCircuit *circuit = malloc(sizeof(QuantumCircuit));
-    circuit->gates = list_create();
+    QuantumCircuit *circuit = malloc_custom(sizeof(QuantumCircuit));
     circuit->nb_qbits = nb_qbits;
+    circuit->nb_gates = 0;
+    circuit->capacity = 0;
+    circuit->gates = NULL;
+    circuit->arena = arena_create();
+    circuit->shared = NULL;
+    circuit->nb_shared = 0;
+    circuit->shared_capacity = 0;
+    circuit->condition = NULL;
+    circuit->last_label = NULL;
+    circuit->mapping = NULL;
+    circuit->mapping_size = 0;
     return circuit;
 }
 void circuit_free(QuantumCircuit *circuit) {
-    ListIterator iter = list_iterator_begin(circuit->gates);
-    while (list_iterator_has_next(&iter)) {
-        Gate *gate = list_iterator_next(&iter);
-        if(gate->class == CUSTOM) {
-            free(gate->gate.custom.qbits);
-        }
-        free(gate);
+    for(int i = 0; i < circuit->nb_shared; i++) shared_matrix_release(circuit->shared[i]);
+    if(circuit->shared) free_custom(circuit->shared);
+    if(circuit->gates) free_custom(circuit->gates);
+    arena_free(circuit->arena);
+    if(circuit->mapping) munmap(circuit->mapping, circuit->mapping_size);
+    free_custom(circuit);
+}
+int circuit_size(const QuantumCircuit *circuit) {
+    return circuit->nb_gates;
+}
+void circuit_remove_gate(QuantumCircuit *circuit, int index) {
+    assert(index >= 0 && index < circuit->nb_gates);
+    memmove(circuit->gates + index, circuit->gates + index + 1, (circuit->nb_gates - index - 1) * sizeof(Gate));
+    circuit->nb_gates--;
+}
+
+void circuit_reserve(QuantumCircuit *circuit, int capacity) {
+    if(capacity <= circuit->capacity) return;
+    circuit->capacity = capacity;
+    circuit->gates = realloc(circuit->gates, circuit->capacity * sizeof(Gate));
+    assert(circuit->gates != NULL && "Memory allocation failed");
+#ifdef MADV_HUGEPAGE
+    // A large reservation (a loaded file) : transparent huge pages, 512 times fewer page faults on the first touch
+    uintptr_t start = ((uintptr_t)circuit->gates + HUGE_PAGE - 1) & ~(uintptr_t)(HUGE_PAGE - 1);
+    uintptr_t end = ((uintptr_t)(circuit->gates + circuit->capacity)) & ~(uintptr_t)(HUGE_PAGE - 1);
+    if(end > start) madvise((void *)start, end - start, MADV_HUGEPAGE);
+#endif
+}
+
+// The slot of the next gate, written in place by the caller
+static Gate *next_gate(QuantumCircuit *circuit) {
+    if(circuit->nb_gates == circuit->capacity) {
+        circuit->capacity = circuit->capacity ? 2 * circuit->capacity : 64;
+        circuit->gates = realloc(circuit->gates, circuit->capacity * sizeof(Gate));
+        assert(circuit->gates != NULL && "Memory allocation failed");
     }
-    list_destroy(circuit->gates);
-    free(circuit);
+    return &circuit->gates[circuit->nb_gates++];
+}
+
+Gate *circuit_append_gate(QuantumCircuit *circuit, const Gate *gate) {
+    Gate *copy = next_gate(circuit);
+    *copy = *gate;
+    if(copy->class == CUSTOM) {
+        copy->gate.custom.qbits = arena_copy(circuit->arena, gate->gate.custom.qbits, gate->gate.custom.nb_qbits * sizeof(int));
+    }
+    if(copy->class == DIAGONAL) {
+        copy->gate.diagonal.qbits = arena_copy(circuit->arena, gate->gate.diagonal.qbits, gate->gate.diagonal.nb_qbits * sizeof(int));
+    }
+    return copy;
 }
 
 char *get_symbol(SingleBitGate gt, double phase) {
@@ -49,9 +102,8 @@ void circuit_print(FILE *channel, QuantumCircuit *circuit) {
     for(int i = 0; i < circuit->nb_qbits; i++) {
         fprintf(channel, "q%.2d: ", i);
 
-        ListIterator iter = list_iterator_begin(circuit->gates);
-        while (list_iterator_has_next(&iter)) {
-            Gate *gate = list_iterator_next(&iter);
+        for(int g = 0; g < circuit->nb_gates; g++) {
+            Gate *gate = &circuit->gates[g];
 
             switch(gate->class) {
                 case MEAS:
@@ -69,6 +121,17 @@ void circuit_print(FILE *channel, QuantumCircuit *circuit) {
                     }
                     if(!found) fprintf(channel, "---------");
                     continue;
+                case DIAGONAL:
+                    found = false;
+                    for(int j = 0; j < gate->gate.diagonal.nb_qbits; j++) {
+                        if(gate->gate.diagonal.qbits[j] == i) {
+                            fprintf(channel, "-|%-5.5s|-", gate->gate.diagonal.label);
+                            found = true;
+                            break;
+                        }
+                    }
+                    if(!found) fprintf(channel, "---------");
+                    continue;
                 case UNITARY: 
                     if(gate->gate.unitary.qbit == i) fprintf(channel, get_symbol(gate->gate.unitary.type, gate->gate.unitary.phase));
                     else fprintf(channel, "---------");
@@ -84,18 +147,120 @@ void circuit_print(FILE *channel, QuantumCircuit *circuit) {
     }
 }
 
+// The gates of a circuit repeat a few labels : the last copy is shared while the label is the same
+static char *copy_label(QuantumCircuit *circuit, const char *label) {
+    if(!label) return NULL;
+    if(!circuit->last_label || strcmp(circuit->last_label, label) != 0) circuit->last_label = arena_strdup(circuit->arena, label);
+    return circuit->last_label;
+}
+
+// A gate built by an add_* function, under the current condition
+static void append_new(QuantumCircuit *circuit, Gate *gate) {
+    gate->condition = circuit->condition;
+    circuit_append_gate(circuit, gate);
+}
+
+// A custom or diagonal gate : its entries and its qubits in one arena block, no second copy of the qubits.
+// Returns the entries, filled by the caller
+static double complex *append_matrix_gate(QuantumCircuit *circuit, int class, int nb_qbits, const int *t, uint64_t entries, const char *label) {
+    double complex *values = arena_alloc(circuit->arena, entries * sizeof(double complex) + nb_qbits * sizeof(int));
+    int *qbits = memcpy(values + entries, t, nb_qbits * sizeof(int));
+    Gate *gate = next_gate(circuit);
+    if(class == CUSTOM) *gate = (Gate){.class = CUSTOM, .gate.custom = {nb_qbits, qbits, values, copy_label(circuit, label)}};
+    else *gate = (Gate){.class = DIAGONAL, .gate.diagonal = {nb_qbits, qbits, values, copy_label(circuit, label)}};
+    gate->condition = circuit->condition;
+    return values;
+}
+
+void circuit_set_condition(QuantumCircuit *circuit, int first_cbit, int width, uint64_t value) {
+    assert(width >= 0 && width <= 64);
+    if(width == 0) {
+        circuit->condition = NULL;
+        return;
+    }
+    GateCondition *condition = arena_alloc(circuit->arena, sizeof(GateCondition));
+    *condition = (GateCondition){first_cbit, width, value};
+    circuit->condition = condition;
+}
+
 void add_unitary_gate(QuantumCircuit *circuit, int t, SingleBitGate tg, double phase) {
-    list_append(circuit->gates, create_unitary_gate(t, tg, phase));
+    Gate gate = {.class = UNITARY, .gate.unitary = {t, tg, phase}};
+    append_new(circuit, &gate);
 }
 void add_control_gate(QuantumCircuit *circuit, int c, int t, SingleBitGate tg, double phase) {
-    list_append(circuit->gates, create_control_gate(c, t, tg, phase));
+    Gate gate = {.class = CONTROL, .gate.control = {c, t, tg, phase}};
+    append_new(circuit, &gate);
 }
-// Mat size must be 2^nb_qbits !
 void add_custom_gate(QuantumCircuit *circuit, int nb_qbits, int *t, double complex *mat, char *label) {
-    Gate *gate = create_custom_gate(nb_qbits, t, mat, label);
-    list_append(circuit->gates, gate);
+    uint64_t dim = 1ULL << nb_qbits;
+    if(matrix_is_diagonal(nb_qbits, mat)) {
+        // Only the diagonal is kept : O(2^n) instead of a dense product
+        double complex *phases = append_matrix_gate(circuit, DIAGONAL, nb_qbits, t, dim, label);
+        for(uint64_t i = 0; i < dim; i++) phases[i] = mat[i * dim + i];
+        return;
+    }
+    memcpy(append_matrix_gate(circuit, CUSTOM, nb_qbits, t, dim * dim, label), mat, dim * dim * sizeof(double complex));
+}
+void add_diagonal_gate(QuantumCircuit *circuit, int nb_qbits, int *t, double complex *phases, char *label) {
+    uint64_t dim = 1ULL << nb_qbits;
+    memcpy(append_matrix_gate(circuit, DIAGONAL, nb_qbits, t, dim, label), phases, dim * sizeof(double complex));
 }
 void add_measure(QuantumCircuit *circuit, int qbit, int cbit) {
-    Gate *gate = create_measure(qbit, cbit);
-    list_append(circuit->gates, gate);
-}
\ No newline at end of file
+    Gate gate = {.class = MEAS, .gate.measure = {qbit, cbit}};
+    append_new(circuit, &gate);
+}
+
+/* -------- shared matrices -------- */
+
+static SharedMatrix *shared_create(int nb_qbits, bool diagonal, uint64_t entries) {
+    SharedMatrix *matrix = malloc_custom(sizeof(SharedMatrix));
+    matrix->nb_qbits = nb_qbits;
+    matrix->diagonal = diagonal;
+    matrix->values = malloc_custom(entries * sizeof(double complex));
+    atomic_init(&matrix->references, 1);
+    return matrix;
+}
+SharedMatrix *shared_matrix_create(int nb_qbits, const double complex *mat) {
+    uint64_t dim = 1ULL << nb_qbits;
+    if(matrix_is_diagonal(nb_qbits, mat)) {
+        SharedMatrix *matrix = shared_create(nb_qbits, true, dim);
+        for(uint64_t i = 0; i < dim; i++) matrix->values[i] = mat[i * dim + i];
+        return matrix;
+    }
+    SharedMatrix *matrix = shared_create(nb_qbits, false, dim * dim);
+    memcpy(matrix->values, mat, dim * dim * sizeof(double complex));
+    return matrix;
+}
+SharedMatrix *shared_diagonal_create(int nb_qbits, const double complex *phases) {
+    uint64_t dim = 1ULL << nb_qbits;
+    SharedMatrix *matrix = shared_create(nb_qbits, true, dim);
+    memcpy(matrix->values, phases, dim * sizeof(double complex));
+    return matrix;
+}
+void shared_matrix_release(SharedMatrix *matrix) {
+    if(atomic_fetch_sub(&matrix->references, 1) > 1) return;
+    free_custom(matrix->values);
+    free_custom(matrix);
+}
+void add_shared_gate(QuantumCircuit *circuit, int *t, SharedMatrix *matrix, char *label) {
+    // One reference per circuit, however many gates use the matrix
+    bool held = false;
+    for(int i = 0; i < circuit->nb_shared && !held; i++) held = circuit->shared[i] == matrix;
+    if(!held) {
+        if(circuit->nb_shared == circuit->shared_capacity) {
+            circuit->shared_capacity = circuit->shared_capacity ? 2 * circuit->shared_capacity : 4;
+            circuit->shared = realloc(circuit->shared, circuit->shared_capacity * sizeof(SharedMatrix *));
+            assert(circuit->shared != NULL && "Memory allocation failed");
+        }
+        atomic_fetch_add(&matrix->references, 1);
+        circuit->shared[circuit->nb_shared++] = matrix;
+    }
+
+    Gate gate;
+    if(matrix->diagonal) {
+        gate = (Gate){.class = DIAGONAL, .gate.diagonal = {matrix->nb_qbits, t, matrix->values, copy_label(circuit, label)}};
+    } else {
+        gate = (Gate){.class = CUSTOM, .gate.custom = {matrix->nb_qbits, t, matrix->values, copy_label(circuit, label)}};
+    }
+    append_new(circuit, &gate);
+}
@@ -3,22 +3,52 @@
 
 #include "gaterep.h"
 #include <stdbool.h>
-#include "../utils/list.h"
 
 #include <complex.h>
 #include <stdio.h>
+#include <stdint.h>
 
 typedef struct QuantumCircuit QuantumCircuit;
+typedef struct SharedMatrix SharedMatrix;
 
+/* A circuit owns everything its gates use : the matrices, diagonals, qubit
+   lists and labels passed to the add_* functions are copied into its arena
+   (the caller keeps its arrays), and circuit_free releases it all at once,
+   whatever the number of gates */
 QuantumCircuit *circuit_create(int nb_qbits);
 void circuit_free(QuantumCircuit *circuit);
+int circuit_size(const QuantumCircuit *circuit);
+// Removes the gate at index (its storage stays in the arena until circuit_free)
+void circuit_remove_gate(QuantumCircuit *circuit, int index);
 
 void circuit_print(FILE *channel, QuantumCircuit *circuit);
 
 void add_unitary_gate(QuantumCircuit *circuit, int t, SingleBitGate tg, double phase);
 void add_control_gate(QuantumCircuit *circuit, int c, int t, SingleBitGate tg, double phase);
-// Mat size must be 2^nb_qbits !
+// Mat size must be 2^nb_qbits x 2^nb_qbits, copied. A diagonal mat is stored as a diagonal gate
 void add_custom_gate(QuantumCircuit *circuit, int nb_qbits, int *t, double complex *mat, char *label);
+// Diagonal gate : phases[i] multiplies the amplitudes whose target bits read i (size 2^nb_qbits, copied)
+void add_diagonal_gate(QuantumCircuit *circuit, int nb_qbits, int *t, double complex *phases, char *label);
 void add_measure(QuantumCircuit *circuit, int qbit, int cbit);
+/* The gates added from now on only act if the classical bits first_cbit ..
+   first_cbit + width - 1 read value (bit first_cbit the least significant,
+   see GateCondition). width 0 removes the condition */
+void circuit_set_condition(QuantumCircuit *circuit, int first_cbit, int width, uint64_t value);
+
+/* -------- shared matrices --------
+   A large matrix used by many gates, or by several circuits, is stored once
+   : the circuits reference it instead of copying it. It is reference
+   counted : the creator holds one reference (dropped with
+   shared_matrix_release, possibly right after adding the gates), every
+   circuit using it holds one until circuit_free. The count is atomic,
+   circuits on different threads may share a matrix.
+*/
+// Copy of mat (2^nb_qbits x 2^nb_qbits), only its diagonal if it has nothing else
+SharedMatrix *shared_matrix_create(int nb_qbits, const double complex *mat);
+// Copy of the diagonal of a matrix (2^nb_qbits entries)
+SharedMatrix *shared_diagonal_create(int nb_qbits, const double complex *phases);
+void shared_matrix_release(SharedMatrix *matrix);
+// A custom (or diagonal) gate on the nb_qbits of the matrix, targets t
+void add_shared_gate(QuantumCircuit *circuit, int *t, SharedMatrix *matrix, char *label);
 
 #endif
\ No newline at end of file
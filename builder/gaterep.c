@@ -3,42 +3,84 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include "../utils/utils.h"
 
-Gate *create_unitary_gate(int t, SingleBitGate tg, double phase) {
-    Gate *gate = malloc_custom(sizeof(Gate));
-    gate->class = UNITARY;
-    gate->gate.unitary.type = tg;
-    gate->gate.unitary.qbit = t;
-    gate->gate.unitary.phase = phase;
-    return gate;
-}
-Gate *create_control_gate(int c, int t, SingleBitGate tg, double phase) {
-    Gate *gate = malloc_custom(sizeof(Gate));
-    gate->class = CONTROL;
-    gate->gate.control.control = c;
-    gate->gate.control.qbit = t;
-    gate->gate.control.type = tg;
-    gate->gate.control.phase = phase;
-    return gate;
-}
-// Mat size must be 2^nb_qbits !
-Gate *create_custom_gate(int nb_qbits, int *t, double complex *mat, char *label) {
-    Gate *gate = malloc_custom(sizeof(Gate));
-    gate->class = CUSTOM;
-    gate->gate.custom.nb_qbits = nb_qbits;
-    gate->gate.custom.qbits = malloc_custom(nb_qbits * sizeof(int));
-    for(int i = 0; i < nb_qbits; i++) {
-        gate->gate.custom.qbits[i] = t[i];
+static int *view_qubits(const int *qbits, int nb_qbits, const int *map, int shift, int *view) {
+    for(int i = 0; i < nb_qbits; i++) view[i] = (map ? map[qbits[i]] : qbits[i]) - shift;
+    return view;
+}
+static int view_size(const Gate *gate) {
+    if(gate->class == CUSTOM) return gate->gate.custom.nb_qbits;
+    if(gate->class == DIAGONAL) return gate->gate.diagonal.nb_qbits;
+    return 0;
+}
+Gate *create_gate_view(Gate *gate, const int *map, int shift) {
+    Gate *view = malloc_custom(sizeof(Gate));
+    int size = view_size(gate);
+    gate_view_init(view, gate, map, shift, size ? malloc_custom(size * sizeof(int)) : NULL);
+    return view;
+}
+void gate_view_init(Gate *view, const Gate *gate, const int *map, int shift, int *qbits) {
+    *view = *gate;
+    switch(view->class) {
+        case UNITARY:
+            view->gate.unitary.qbit = (map ? map[gate->gate.unitary.qbit] : gate->gate.unitary.qbit) - shift;
+            break;
+        case CONTROL:
+            view->gate.control.control = (map ? map[gate->gate.control.control] : gate->gate.control.control) - shift;
+            view->gate.control.qbit = (map ? map[gate->gate.control.qbit] : gate->gate.control.qbit) - shift;
+            break;
+        case CUSTOM:
+            view->gate.custom.qbits = view_qubits(gate->gate.custom.qbits, gate->gate.custom.nb_qbits, map, shift, qbits);
+            break;
+        case DIAGONAL:
+            view->gate.diagonal.qbits = view_qubits(gate->gate.diagonal.qbits, gate->gate.diagonal.nb_qbits, map, shift, qbits);
+            break;
+        case MEAS:
+            view->gate.measure.qbit = (map ? map[gate->gate.measure.qbit] : gate->gate.measure.qbit) - shift;
+            break;
+    }
+}
+void free_gate_view(Gate *view) {
+    if(view->class == CUSTOM) free_custom(view->gate.custom.qbits);
+    if(view->class == DIAGONAL) free_custom(view->gate.diagonal.qbits);
+    free_custom(view);
+}
+bool matrix_is_diagonal(int nb_qbits, const double complex *mat) {
+    uint64_t dim = 1ULL << nb_qbits;
+    for(uint64_t r = 0; r < dim; r++) {
+        for(uint64_t c = 0; c < dim; c++) {
+            if(r != c && mat[r * dim + c] != 0.0) return false;
+        }
     }
-    gate->gate.custom.mat = mat;
-    gate->gate.custom.label = label;
-    return gate;
-}
-Gate *create_measure(int qbit, int cbit) {
-    Gate *gate = malloc_custom(sizeof(Gate));
-    gate->class = MEAS;
-    gate->gate.measure.cbit = cbit;
-    gate->gate.measure.qbit = qbit;
-    return gate;
-}
\ No newline at end of file
+    return true;
+}
+bool gate_condition_holds(const Gate *gate, const int *bits) {
+    const GateCondition *condition = gate->condition;
+    if(!condition) return true;
+    uint64_t value = 0;
+    for(int i = 0; bits && i < condition->width; i++) value |= (uint64_t)(bits[condition->first + i] & 1) << i;
+    return value == condition->value;
+}
+int gate_get_qubits(Gate *gate, int *qbits) {
+    switch(gate->class) {
+        case UNITARY:
+            qbits[0] = gate->gate.unitary.qbit;
+            return 1;
+        case CONTROL:
+            qbits[0] = gate->gate.control.control;
+            qbits[1] = gate->gate.control.qbit;
+            return 2;
+        case CUSTOM:
+            for(int i = 0; i < gate->gate.custom.nb_qbits; i++) qbits[i] = gate->gate.custom.qbits[i];
+            return gate->gate.custom.nb_qbits;
+        case DIAGONAL:
+            for(int i = 0; i < gate->gate.diagonal.nb_qbits; i++) qbits[i] = gate->gate.diagonal.qbits[i];
+            return gate->gate.diagonal.nb_qbits;
+        case MEAS:
+            qbits[0] = gate->gate.measure.qbit;
+            return 1;
+    }
+    return 0;
+}
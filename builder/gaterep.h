@@ -2,6 +2,8 @@
 #define GATEREP_H
 
 #include <complex.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 typedef enum {
     GATE_I,
@@ -14,10 +16,29 @@ typedef enum {
 
 typedef struct Gate Gate;
 
-Gate *create_unitary_gate(int t, SingleBitGate tg, double phase);
-Gate *create_control_gate(int c, int t, SingleBitGate tg, double phase);
-// Mat size must be 2^nb_qbits !
-Gate *create_custom_gate(int nb_qbits, int *t, double complex *mat, char *label);
-Gate *create_measure(int qbit, int cbit);
+/* Classical condition : the gate only acts if the classical bits first ..
+   first + width - 1 read value (bit first the least significant, as
+   if(creg == value) in OpenQASM) */
+typedef struct {
+    int first;
+    int width;
+    uint64_t value;
+} GateCondition;
+
+/* Same gate on other qubits : qubit q becomes map[q] - shift (q - shift if
+   map is NULL). The matrix / phases are shared with the original gate, the
+   view is released with free_gate_view */
+Gate *create_gate_view(Gate *gate, const int *map, int shift);
+void free_gate_view(Gate *view);
+/* The same view written into view, without allocation : the qubit list of
+   a custom or diagonal gate goes into qbits (room for its qubits), nothing
+   is released */
+void gate_view_init(Gate *view, const Gate *gate, const int *map, int shift, int *qbits);
+// True if the 2^nb_qbits x 2^nb_qbits matrix has only zeros off the diagonal
+bool matrix_is_diagonal(int nb_qbits, const double complex *mat);
+// True if the gate has no condition or if bits (NULL : all 0) satisfy it
+bool gate_condition_holds(const Gate *gate, const int *bits);
+// Writes the qubits of the gate in qbits (large enough) and returns their number
+int gate_get_qubits(Gate *gate, int *qbits);
 
 #endif
\ No newline at end of file
@@ -2,8 +2,13 @@
 #define INTERNAL_H
 
 #include <complex.h>
-#include "../utils/list.h"
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "../utils/arena.h"
+#include "../utils/precision.h"
 #include "gaterep.h"
+#include "circuit.h"
+#include "register.h"
 
 // Note: SingleBitGate is exposed in gaterep.h
 
@@ -13,17 +18,44 @@ struct ClassicalRegister {
 };
 
 struct QuantumRegister {
-    double complex *statevector;
+    amplitude *statevector;
     int nb_qbits;
+    /* Physical position of each logical qubit : the executor may leave the
+    bits of the statevector permuted, see qregister_restore_layout */
+    int *layout;
+    // Backing file of a mapped statevector (qregister_create_mapped), -1 in RAM
+    int fd;
+    char *path;
+    StatePages pages; // Of the allocation, freed accordingly
 };
 
+/* The circuit owns its gates : the Gate structs sit in one array, their
+   qubit lists, matrices, diagonals and labels in the arena (freed at once
+   by circuit_free), or in shared matrices the circuit holds a reference on */
 struct QuantumCircuit {
     int nb_qbits;
-    List* gates;
+    int nb_gates;
+    int capacity;
+    Gate *gates;            // In order. An append may move them : no pointer is kept across one
+    Arena *arena;
+    SharedMatrix **shared;  // References held, released by circuit_free
+    int nb_shared;
+    int shared_capacity;
+    const GateCondition *condition; // Of the gates added from now on (circuit_set_condition)
+    char *last_label;       // Arena copy of the last label, shared by the next gates with the same one
+    void *mapping;          // File the gates point into (circuit_map), unmapped by circuit_free
+    size_t mapping_size;
+};
+
+struct SharedMatrix {
+    int nb_qbits;
+    bool diagonal;              // Only the 2^nb_qbits entries of the diagonal are stored
+    double complex *values;     // Row-major 2^nb_qbits x 2^nb_qbits matrix, or its diagonal
+    atomic_int references;
 };
 
 struct Gate {
-    enum {MEAS, UNITARY, CONTROL, CUSTOM} class;
+    enum {MEAS, UNITARY, CONTROL, CUSTOM, DIAGONAL} class;
     union {
         struct {
             int qbit;
@@ -46,7 +78,21 @@ struct Gate {
             double complex *mat;
             char *label;
         } custom;
+        struct {
+            int nb_qbits;
+            int *qbits;
+            double complex *phases; // Diagonal of the matrix (2^nb_qbits entries)
+            char *label;
+        } diagonal;
     } gate;
+    const GateCondition *condition; // NULL : always applied. Stored with the circuit
 };
 
+/* Appends a copy of gate (its qubit list copied into the arena, the matrix,
+   phases and label shared with the original) and returns it : the source
+   of the matrix must outlive the circuit */
+Gate *circuit_append_gate(QuantumCircuit *circuit, const Gate *gate);
+// Room for capacity gates without reallocation (the pages are only touched when used)
+void circuit_reserve(QuantumCircuit *circuit, int capacity);
+
 #endif
@@ -0,0 +1,1323 @@
+#include "qasm.h"
+#include "internal.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <setjmp.h>
+#include <assert.h>
+#include <complex.h>
+#include <math.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../utils/arena.h"
+#include "../utils/utils.h"
+
+#define QASM_MAX_PARAMS 16
+#define QASM_MAX_ARGS 64
+
+/* -------- tokens -------- */
+
+enum {
+    TOK_END = 256,
+    TOK_IDENT,
+    TOK_INT,
+    TOK_REAL,
+    TOK_STRING,
+    TOK_ARROW,              // ->
+    TOK_EQ,                 // ==
+    TOK_POW                 // ^ and **
+};                          // Other punctuation : the character itself
+
+typedef struct {
+    int kind;
+    const char *start;
+    int length;
+    int line;
+    uint64_t integer;       // TOK_INT
+    double number;          // TOK_INT and TOK_REAL
+} Token;
+
+typedef struct {
+    const char *p, *end;
+    int line;
+} Lexer;
+
+/* -------- symbols -------- */
+
+enum {SYM_KEYWORD, SYM_QREG, SYM_CREG, SYM_GATE, SYM_CONSTANT, SYM_FUNCTION};
+
+enum {KW_OPENQASM, KW_INCLUDE, KW_QREG, KW_CREG, KW_QUBIT, KW_BIT, KW_GATE, KW_OPAQUE, KW_MEASURE, KW_BARRIER,
+      KW_RESET, KW_IF};
+
+enum {B_ID, B_H, B_X, B_Y, B_Z, B_S, B_SDG, B_T, B_TDG, B_SX, B_SXDG, B_RX, B_RY, B_RZ, B_P, B_U2, B_U3, B_CX, B_CY, B_CZ,
+      B_CH, B_CP, B_CRX, B_CRY, B_CRZ, B_CU3, B_CU, B_SWAP, B_CCX, B_CSWAP, B_RZZ, B_USER};
+
+enum {F_SIN, F_COS, F_TAN, F_ASIN, F_ACOS, F_ATAN, F_EXP, F_LN, F_SQRT};
+
+typedef struct {
+    const char *start;
+    int length;
+} Span;
+
+typedef struct {
+    int nb_params, nb_args;
+    Span *params, *args;
+    const char *body, *body_end;
+    int line;               // Of the body
+    int order;              // Definitions only call the gates defined before them
+    bool opaque;
+} GateDef;
+
+typedef struct {
+    const char *name;
+    int length;
+    int kind;
+    int id;                 // Keyword, builtin gate or function
+    int nb_params, nb_args; // Gates
+    GateDef *def;           // User gates
+    int offset, size;       // Registers
+    double value;           // Constants
+} Symbol;
+
+typedef struct {
+    Symbol *slots;          // Open addressing, name NULL : empty
+    int capacity;
+    int count;
+} SymbolTable;
+
+// Binding of a user gate being expanded
+typedef struct {
+    const GateDef *def;
+    const double *params;
+    const int *qubits;
+} Scope;
+
+typedef struct {
+    Lexer lex;
+    Token token;
+    Scope *scope;
+    SymbolTable table;
+    Arena *arena;           // Gate definitions
+    QuantumCircuit *circuit;
+    int version;
+    int nb_cbits;
+    int nb_defs;
+    const GateCondition *condition;
+    SharedMatrix *swap, *ccx, *cswap;
+    QasmInfo *info;
+    jmp_buf failure;
+} Parser;
+
+static void vfail(Parser *parser, int line, const char *format, va_list args) {
+    QasmInfo *info = parser->info;
+    int used = snprintf(info->error, sizeof(info->error), "line %d: ", line);
+    vsnprintf(info->error + used, sizeof(info->error) - used, format, args);
+    longjmp(parser->failure, 1);
+}
+
+// The error on the line of the current token
+static void fail(Parser *parser, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfail(parser, parser->token.line, format, args);
+    va_end(args);
+}
+
+// The error on a given line : checks of a statement once its ';' is consumed, the token is already the next one
+static void fail_line(Parser *parser, int line, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfail(parser, line, format, args);
+    va_end(args);
+}
+
+/* -------- symbol table -------- */
+
+static uint32_t hash_name(const char *name, int length) {
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i < length; i++) hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    return hash;
+}
+
+// The names are short : cheaper than a call to memcmp
+static bool same_name(const char *a, const char *b, int length) {
+    for(int i = 0; i < length; i++) if(a[i] != b[i]) return false;
+    return true;
+}
+
+static Symbol *table_slot(SymbolTable *table, const char *name, int length) {
+    uint32_t mask = table->capacity - 1;
+    for(uint32_t i = hash_name(name, length) & mask;; i = (i + 1) & mask) {
+        Symbol *slot = &table->slots[i];
+        if(!slot->name || (slot->length == length && same_name(slot->name, name, length))) return slot;
+    }
+}
+
+static Symbol *table_find(SymbolTable *table, const char *name, int length) {
+    Symbol *slot = table_slot(table, name, length);
+    return slot->name ? slot : NULL;
+}
+
+// A new symbol, NULL if the name is taken
+static Symbol *table_add(SymbolTable *table, const char *name, int length, int kind) {
+    if(2 * (table->count + 1) > table->capacity) {
+        SymbolTable grown = {calloc_custom(2 * table->capacity, sizeof(Symbol)), 2 * table->capacity, table->count};
+        for(int i = 0; i < table->capacity; i++) {
+            if(table->slots[i].name) *table_slot(&grown, table->slots[i].name, table->slots[i].length) = table->slots[i];
+        }
+        free_custom(table->slots);
+        *table = grown;
+    }
+    Symbol *slot = table_slot(table, name, length);
+    if(slot->name) return NULL;
+    *slot = (Symbol){.name = name, .length = length, .kind = kind};
+    table->count++;
+    return slot;
+}
+
+static void table_init(SymbolTable *table) {
+    table->capacity = 256;
+    table->count = 0;
+    table->slots = calloc_custom(table->capacity, sizeof(Symbol));
+
+    static const char *keywords[] = {"OPENQASM", "include", "qreg", "creg", "qubit", "bit", "gate", "opaque", "measure",
+                                     "barrier", "reset", "if"};
+    for(int k = 0; k < (int)(sizeof(keywords) / sizeof(keywords[0])); k++) {
+        table_add(table, keywords[k], strlen(keywords[k]), SYM_KEYWORD)->id = k;
+    }
+
+    static const struct {const char *name; int id, nb_params, nb_args;} builtins[] = {
+        {"id", B_ID, 0, 1}, {"h", B_H, 0, 1}, {"x", B_X, 0, 1}, {"y", B_Y, 0, 1}, {"z", B_Z, 0, 1},
+        {"s", B_S, 0, 1}, {"sdg", B_SDG, 0, 1}, {"t", B_T, 0, 1}, {"tdg", B_TDG, 0, 1},
+        {"sx", B_SX, 0, 1}, {"sxdg", B_SXDG, 0, 1},
+        {"rx", B_RX, 1, 1}, {"ry", B_RY, 1, 1}, {"rz", B_RZ, 1, 1},
+        {"p", B_P, 1, 1}, {"u1", B_P, 1, 1}, {"phase", B_P, 1, 1},
+        {"u2", B_U2, 2, 1}, {"u3", B_U3, 3, 1}, {"u", B_U3, 3, 1}, {"U", B_U3, 3, 1},
+        {"cx", B_CX, 0, 2}, {"CX", B_CX, 0, 2}, {"cnot", B_CX, 0, 2}, {"cy", B_CY, 0, 2}, {"cz", B_CZ, 0, 2},
+        {"ch", B_CH, 0, 2}, {"cp", B_CP, 1, 2}, {"cu1", B_CP, 1, 2}, {"cphase", B_CP, 1, 2},
+        {"crx", B_CRX, 1, 2}, {"cry", B_CRY, 1, 2}, {"crz", B_CRZ, 1, 2}, {"cu3", B_CU3, 3, 2}, {"cu", B_CU, 4, 2},
+        {"swap", B_SWAP, 0, 2}, {"ccx", B_CCX, 0, 3}, {"cswap", B_CSWAP, 0, 3}, {"rzz", B_RZZ, 1, 2}
+    };
+    for(int b = 0; b < (int)(sizeof(builtins) / sizeof(builtins[0])); b++) {
+        Symbol *symbol = table_add(table, builtins[b].name, strlen(builtins[b].name), SYM_GATE);
+        symbol->id = builtins[b].id;
+        symbol->nb_params = builtins[b].nb_params;
+        symbol->nb_args = builtins[b].nb_args;
+    }
+
+    static const char *functions[] = {"sin", "cos", "tan", "arcsin", "arccos", "arctan", "exp", "ln", "sqrt"};
+    for(int f = 0; f < (int)(sizeof(functions) / sizeof(functions[0])); f++) {
+        table_add(table, functions[f], strlen(functions[f]), SYM_FUNCTION)->id = f;
+    }
+
+    static const struct {const char *name; double value;} constants[] = {
+        {"pi", M_PI}, {"\xcf\x80", M_PI}, {"tau", 2 * M_PI}, {"\xcf\x84", 2 * M_PI}, {"euler", 2.71828182845904523536}
+    };
+    for(int c = 0; c < (int)(sizeof(constants) / sizeof(constants[0])); c++) {
+        table_add(table, constants[c].name, strlen(constants[c].name), SYM_CONSTANT)->value = constants[c].value;
+    }
+}
+
+/* -------- lexer -------- */
+
+static bool is_ident_start(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c >= 0x80;
+}
+static bool is_ident_char(unsigned char c) {
+    return is_ident_start(c) || (c >= '0' && c <= '9');
+}
+
+static void skip_blanks(Parser *parser) {
+    Lexer *lex = &parser->lex;
+    const char *p = lex->p, *end = lex->end;
+    for(;;) {
+        while(p < end && (unsigned char)*p <= ' ') {
+            if(*p == '\n') lex->line++;
+            p++;
+        }
+        if(p + 1 < end && p[0] == '/' && p[1] == '/') {
+            p = memchr(p, '\n', end - p);
+            if(!p) p = end;
+            continue;
+        }
+        if(p + 1 < end && p[0] == '/' && p[1] == '*') {
+            for(p += 2; p + 1 < end && !(p[0] == '*' && p[1] == '/'); p++) {
+                if(*p == '\n') lex->line++;
+            }
+            if(p + 1 >= end) {
+                parser->token.line = lex->line;
+                fail(parser, "unterminated comment");
+            }
+            p += 2;
+            continue;
+        }
+        break;
+    }
+    lex->p = p;
+}
+
+static const double POWERS_OF_TEN[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                       1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* Up to 15 digits and 10^22 : mantissa and power of ten are exact doubles,
+   their product / quotient is correctly rounded without strtod */
+static void lex_number(Parser *parser, Token *token) {
+    const char *p = parser->lex.p, *end = parser->lex.end;
+    uint64_t mantissa = 0;
+    int digits = 0, scale = 0;
+    bool real = false;
+    for(; p < end && *p >= '0' && *p <= '9'; p++) {
+        if(digits < 19) mantissa = 10 * mantissa + (*p - '0');
+        else scale++;
+        digits += (digits > 0 || *p != '0');
+    }
+    if(p < end && *p == '.') {
+        real = true;
+        for(p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            if(digits < 19) {
+                mantissa = 10 * mantissa + (*p - '0');
+                scale--;
+            }
+            digits += (digits > 0 || *p != '0');
+        }
+    }
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        bool negative = q < end && *q == '-';
+        if(q < end && (*q == '+' || *q == '-')) q++;
+        if(q < end && *q >= '0' && *q <= '9') {
+            real = true;
+            int exponent = 0;
+            for(p = q; p < end && *p >= '0' && *p <= '9'; p++) if(exponent < 10000) exponent = 10 * exponent + (*p - '0');
+            scale += negative ? -exponent : exponent;
+        }
+    }
+    token->kind = real ? TOK_REAL : TOK_INT;
+    token->length = p - token->start;
+    parser->lex.p = p;
+    if(!real) {
+        if(digits > 19 || scale) fail(parser, "integer too large");
+        token->integer = mantissa;
+        token->number = (double)mantissa;
+    } else if(digits <= 15 && scale >= -22 && scale <= 22) {
+        token->number = (scale < 0) ? mantissa / POWERS_OF_TEN[-scale] : mantissa * POWERS_OF_TEN[scale];
+    } else {
+        // The text may not be NUL terminated
+        char buffer[64];
+        if(token->length >= (int)sizeof(buffer)) fail(parser, "number too long");
+        memcpy(buffer, token->start, token->length);
+        buffer[token->length] = '\0';
+        token->number = strtod(buffer, NULL);
+    }
+}
+
+static void advance(Parser *parser) {
+    Lexer *lex = &parser->lex;
+    const char *p = lex->p, *end = lex->end;
+    // The line in a local : a store through lex would reload p at every character
+    int line = lex->line;
+    while(p < end && (unsigned char)*p <= ' ') line += (*p++ == '\n');
+    lex->p = p;
+    lex->line = line;
+    if(p + 1 < end && p[0] == '/' && (p[1] == '/' || p[1] == '*')) {
+        skip_blanks(parser);
+        p = lex->p;
+    }
+    Token *token = &parser->token;
+    token->start = p;
+    token->line = lex->line;
+    if(p == end) {
+        token->kind = TOK_END;
+        token->length = 0;
+        return;
+    }
+    unsigned char c = *p;
+    // Half of the tokens : single characters first
+    switch(c) {
+        case '(': case ')': case '[': case ']': case '{': case '}': case ';': case ',': case '+': case '!':
+            token->kind = c;
+            token->length = 1;
+            lex->p = p + 1;
+            return;
+    }
+    if(is_ident_start(c)) {
+        for(p++; p < end && is_ident_char(*p); p++);
+        token->kind = TOK_IDENT;
+        token->length = p - token->start;
+        lex->p = p;
+        return;
+    }
+    if((c >= '0' && c <= '9') || (c == '.' && p + 1 < end && p[1] >= '0' && p[1] <= '9')) {
+        lex_number(parser, token);
+        return;
+    }
+    if(c == '"') {
+        const char *close = memchr(p + 1, '"', end - p - 1);
+        if(!close) fail(parser, "unterminated string");
+        token->kind = TOK_STRING;
+        token->length = close + 1 - p;
+        lex->p = close + 1;
+        return;
+    }
+    char next = (p + 1 < end) ? p[1] : '\0';
+    token->length = 2;
+    if(c == '-' && next == '>') token->kind = TOK_ARROW;
+    else if(c == '=' && next == '=') token->kind = TOK_EQ;
+    else if(c == '*' && next == '*') token->kind = TOK_POW;
+    else {
+        token->length = 1;
+        switch(c) {
+            case '^': token->kind = TOK_POW; break;
+            case '-': case '*': case '/': case '=': token->kind = c; break;
+            default: fail(parser, "unexpected character '%c'", c);
+        }
+    }
+    lex->p += token->length;
+}
+
+static const char *token_name(int kind) {
+    static char single[4];
+    switch(kind) {
+        case TOK_END: return "end of file";
+        case TOK_IDENT: return "identifier";
+        case TOK_INT: return "integer";
+        case TOK_REAL: return "number";
+        case TOK_STRING: return "string";
+        case TOK_ARROW: return "'->'";
+        case TOK_EQ: return "'=='";
+        case TOK_POW: return "'^'";
+    }
+    snprintf(single, sizeof(single), "'%c'", kind);
+    return single;
+}
+
+static Token expect(Parser *parser, int kind) {
+    Token token = parser->token;
+    if(token.kind != kind) {
+        fail(parser, "%s expected, found '%.*s'", token_name(kind), token.length ? token.length : 3,
+             token.length ? token.start : "EOF");
+    }
+    advance(parser);
+    return token;
+}
+
+static bool accept(Parser *parser, int kind) {
+    if(parser->token.kind != kind) return false;
+    advance(parser);
+    return true;
+}
+
+/* -------- expressions -------- */
+
+static double parse_expression(Parser *parser);
+
+static double parse_primary(Parser *parser) {
+    Token token = parser->token;
+    if(token.kind == TOK_INT || token.kind == TOK_REAL) {
+        advance(parser);
+        return token.number;
+    }
+    if(accept(parser, '(')) {
+        double value = parse_expression(parser);
+        expect(parser, ')');
+        return value;
+    }
+    if(token.kind != TOK_IDENT) fail(parser, "expression expected");
+    advance(parser);
+    if(parser->scope) {
+        const GateDef *def = parser->scope->def;
+        for(int i = 0; i < def->nb_params; i++) {
+            if(def->params[i].length == token.length && memcmp(def->params[i].start, token.start, token.length) == 0) {
+                return parser->scope->params[i];
+            }
+        }
+    }
+    Symbol *symbol = table_find(&parser->table, token.start, token.length);
+    if(symbol && symbol->kind == SYM_CONSTANT) return symbol->value;
+    if(!symbol || symbol->kind != SYM_FUNCTION) fail(parser, "unknown parameter '%.*s'", token.length, token.start);
+    expect(parser, '(');
+    double x = parse_expression(parser);
+    expect(parser, ')');
+    switch(symbol->id) {
+        case F_SIN: return sin(x);
+        case F_COS: return cos(x);
+        case F_TAN: return tan(x);
+        case F_ASIN: return asin(x);
+        case F_ACOS: return acos(x);
+        case F_ATAN: return atan(x);
+        case F_EXP: return exp(x);
+        case F_LN: return log(x);
+        default: return sqrt(x);
+    }
+}
+
+// Unary signs bind looser than ^ (-2^2 is -4), ^ is right associative
+static double parse_unary(Parser *parser) {
+    if(accept(parser, '-')) return -parse_unary(parser);
+    if(accept(parser, '+')) return parse_unary(parser);
+    double value = parse_primary(parser);
+    if(accept(parser, TOK_POW)) return pow(value, parse_unary(parser));
+    return value;
+}
+
+static double parse_term(Parser *parser) {
+    double value = parse_unary(parser);
+    for(;;) {
+        if(accept(parser, '*')) value *= parse_unary(parser);
+        else if(accept(parser, '/')) value /= parse_unary(parser);
+        else return value;
+    }
+}
+
+static double parse_expression(Parser *parser) {
+    double value = parse_term(parser);
+    for(;;) {
+        if(accept(parser, '+')) value += parse_term(parser);
+        else if(accept(parser, '-')) value -= parse_term(parser);
+        else return value;
+    }
+}
+
+/* -------- arguments -------- */
+
+static void check_index(Parser *parser, const Symbol *symbol, uint64_t index) {
+    if(index >= (uint64_t)symbol->size) {
+        fail(parser, "index %llu out of %.*s[%d]", (unsigned long long)index, symbol->length, symbol->name, symbol->size);
+    }
+}
+
+// name or name[index] : first bit / qubit and size (1 with an index)
+static void parse_register_argument(Parser *parser, int kind, int *first, int *size) {
+    Token name = parser->token;
+    if(name.kind != TOK_IDENT) expect(parser, TOK_IDENT);
+    Symbol *symbol = table_find(&parser->table, name.start, name.length);
+    if(!symbol || symbol->kind != kind) {
+        fail(parser, "'%.*s' is not a %s register", name.length, name.start, (kind == SYM_QREG) ? "quantum" : "classical");
+    }
+    *first = symbol->offset;
+    *size = symbol->size;
+
+    // name[digits] without blanks, as the tools write it : read at once instead of 3 tokens
+    const char *p = parser->lex.p, *end = parser->lex.end;
+    if(p < end && *p == '[') {
+        uint64_t index = 0;
+        const char *q = p + 1;
+        for(; q < end && *q >= '0' && *q <= '9' && q - p <= 18; q++) index = 10 * index + (*q - '0');
+        if(q > p + 1 && q < end && *q == ']') {
+            check_index(parser, symbol, index);
+            parser->lex.p = q + 1;
+            advance(parser);
+            *first += (int)index;
+            *size = 1;
+            return;
+        }
+    }
+    advance(parser);
+    if(accept(parser, '[')) {
+        Token index = expect(parser, TOK_INT);
+        check_index(parser, symbol, index.integer);
+        expect(parser, ']');
+        *first += (int)index.integer;
+        *size = 1;
+    }
+}
+
+// An argument of a gate call : a qubit of a register, a whole register, or a qubit of the gate being expanded
+static void parse_qubit_argument(Parser *parser, int *first, int *size) {
+    if(parser->scope) {
+        Token token = expect(parser, TOK_IDENT);
+        const GateDef *def = parser->scope->def;
+        for(int i = 0; i < def->nb_args; i++) {
+            if(def->args[i].length == token.length && memcmp(def->args[i].start, token.start, token.length) == 0) {
+                *first = parser->scope->qubits[i];
+                *size = 1;
+                return;
+            }
+        }
+        fail(parser, "unknown qubit '%.*s'", token.length, token.start);
+    }
+    parse_register_argument(parser, SYM_QREG, first, size);
+}
+
+// Size of the broadcast : the registers passed whole must have the same size
+static int broadcast_size(Parser *parser, const int *sizes, int count, int line) {
+    int width = 1;
+    for(int i = 0; i < count; i++) {
+        if(sizes[i] == 1) continue;
+        if(width != 1 && sizes[i] != width) fail_line(parser, line, "registers of different sizes");
+        width = sizes[i];
+    }
+    return width;
+}
+
+/* -------- gates -------- */
+
+static void add_matrix(Parser *parser, int nb_qbits, int *qubits, double complex *mat, char *label) {
+    add_custom_gate(parser->circuit, nb_qbits, qubits, mat, label);
+}
+
+// exp(i angle) : the same values as cexp, at about half the cost
+static double complex phase(double angle) {
+    return cos(angle) + I * sin(angle);
+}
+
+static void u3_matrix(double theta, double phi, double lambda, double complex *m) {
+    double c = cos(theta / 2), s = sin(theta / 2);
+    m[0] = c;
+    m[1] = -phase(lambda) * s;
+    m[2] = phase(phi) * s;
+    m[3] = phase(phi + lambda) * c;
+}
+
+// u on target when control is set (4 x 4, control the most significant)
+static void add_controlled_matrix(Parser *parser, int control, int target, const double complex *u, char *label) {
+    double complex mat[16] = {0};
+    mat[0] = mat[5] = 1.0;
+    mat[10] = u[0];
+    mat[11] = u[1];
+    mat[14] = u[2];
+    mat[15] = u[3];
+    int qubits[2] = {control, target};
+    add_matrix(parser, 2, qubits, mat, label);
+}
+
+static SharedMatrix *permutation_matrix(int nb_qbits, const int *permutation) {
+    int dim = 1 << nb_qbits;
+    double complex mat[64] = {0};
+    for(int i = 0; i < dim; i++) mat[permutation[i] * dim + i] = 1.0;
+    return shared_matrix_create(nb_qbits, mat);
+}
+
+static void expand_gate(Parser *parser, const GateDef *def, const double *params, const int *qubits);
+
+static void apply_builtin(Parser *parser, int id, const double *params, int *q) {
+    QuantumCircuit *circuit = parser->circuit;
+    double complex m[4];
+    double c, s;
+    switch(id) {
+        case B_ID: break;
+        case B_H: add_unitary_gate(circuit, q[0], GATE_H, 0.0); break;
+        case B_X: add_unitary_gate(circuit, q[0], GATE_X, 0.0); break;
+        case B_Y: add_unitary_gate(circuit, q[0], GATE_Y, 0.0); break;
+        case B_Z: add_unitary_gate(circuit, q[0], GATE_Z, 0.0); break;
+        case B_S: add_unitary_gate(circuit, q[0], GATE_PHASE, M_PI / 2); break;
+        case B_SDG: add_unitary_gate(circuit, q[0], GATE_PHASE, -M_PI / 2); break;
+        case B_T: add_unitary_gate(circuit, q[0], GATE_PHASE, M_PI / 4); break;
+        case B_TDG: add_unitary_gate(circuit, q[0], GATE_PHASE, -M_PI / 4); break;
+        case B_SX:
+        case B_SXDG:
+            // qelib1.inc : sdg h sdg (rx(pi / 2)), stdgates.inc : the square root of x
+            s = (id == B_SX) ? 1.0 : -1.0;
+            if(parser->version < 3) {
+                m[0] = m[3] = M_SQRT1_2;
+                m[1] = m[2] = -I * s * M_SQRT1_2;
+            } else {
+                m[0] = m[3] = 0.5 * (1 + I * s);
+                m[1] = m[2] = 0.5 * (1 - I * s);
+            }
+            add_matrix(parser, 1, q, m, (id == B_SX) ? "sx" : "sxdg");
+            break;
+        case B_RX:
+            c = cos(params[0] / 2), s = sin(params[0] / 2);
+            m[0] = m[3] = c;
+            m[1] = m[2] = -I * s;
+            add_matrix(parser, 1, q, m, "rx");
+            break;
+        case B_RY:
+            c = cos(params[0] / 2), s = sin(params[0] / 2);
+            m[0] = m[3] = c;
+            m[1] = -s;
+            m[2] = s;
+            add_matrix(parser, 1, q, m, "ry");
+            break;
+        case B_RZ:
+            // qelib1.inc : u1
+            if(parser->version < 3) {
+                add_unitary_gate(circuit, q[0], GATE_PHASE, params[0]);
+                break;
+            }
+            m[0] = phase(-params[0] / 2);
+            m[1] = phase(params[0] / 2);
+            add_diagonal_gate(circuit, 1, q, m, "rz");
+            break;
+        case B_P: add_unitary_gate(circuit, q[0], GATE_PHASE, params[0]); break;
+        case B_U2:
+            u3_matrix(M_PI / 2, params[0], params[1], m);
+            add_matrix(parser, 1, q, m, "u2");
+            break;
+        case B_U3:
+            u3_matrix(params[0], params[1], params[2], m);
+            add_matrix(parser, 1, q, m, "u3");
+            break;
+        case B_CX: add_control_gate(circuit, q[0], q[1], GATE_X, 0.0); break;
+        case B_CY: add_control_gate(circuit, q[0], q[1], GATE_Y, 0.0); break;
+        case B_CZ: add_control_gate(circuit, q[0], q[1], GATE_Z, 0.0); break;
+        case B_CH: add_control_gate(circuit, q[0], q[1], GATE_H, 0.0); break;
+        case B_CP: add_control_gate(circuit, q[0], q[1], GATE_PHASE, params[0]); break;
+        case B_CRX:
+            c = cos(params[0] / 2), s = sin(params[0] / 2);
+            m[0] = m[3] = c;
+            m[1] = m[2] = -I * s;
+            add_controlled_matrix(parser, q[0], q[1], m, "crx");
+            break;
+        case B_CRY:
+            c = cos(params[0] / 2), s = sin(params[0] / 2);
+            m[0] = m[3] = c;
+            m[1] = -s;
+            m[2] = s;
+            add_controlled_matrix(parser, q[0], q[1], m, "cry");
+            break;
+        case B_CRZ: {
+            double complex phases[4] = {1.0, 1.0, phase(-params[0] / 2), phase(params[0] / 2)};
+            add_diagonal_gate(circuit, 2, q, phases, "crz");
+            break;
+        }
+        case B_CU3:
+        case B_CU:
+            u3_matrix(params[0], params[1], params[2], m);
+            if(id == B_CU) for(int i = 0; i < 4; i++) m[i] *= phase(params[3]);
+            add_controlled_matrix(parser, q[0], q[1], m, (id == B_CU) ? "cu" : "cu3");
+            break;
+        case B_SWAP: add_shared_gate(circuit, q, parser->swap, "swap"); break;
+        case B_CCX: add_shared_gate(circuit, q, parser->ccx, "ccx"); break;
+        case B_CSWAP: add_shared_gate(circuit, q, parser->cswap, "cswap"); break;
+        case B_RZZ: {
+            // qelib1.inc : cx, u1 on the target, cx
+            double complex even = (parser->version < 3) ? 1.0 : phase(-params[0] / 2);
+            double complex odd = (parser->version < 3) ? phase(params[0]) : phase(params[0] / 2);
+            double complex phases[4] = {even, odd, odd, even};
+            add_diagonal_gate(circuit, 2, q, phases, "rzz");
+            break;
+        }
+    }
+}
+
+static void apply_gate(Parser *parser, const Symbol *gate, const double *params, int *qubits, int line) {
+    for(int i = 0; i < gate->nb_args; i++) {
+        for(int j = 0; j < i; j++) {
+            if(qubits[i] == qubits[j]) fail_line(parser, line, "qubit %d repeated in %.*s", qubits[i], gate->length, gate->name);
+        }
+    }
+    if(gate->id != B_USER) apply_builtin(parser, gate->id, params, qubits);
+    else expand_gate(parser, gate->def, params, qubits);
+}
+
+static void parse_gate_call(Parser *parser, const Symbol *gate) {
+    double params[QASM_MAX_PARAMS];
+    int nb_params = 0;
+    advance(parser);
+    if(accept(parser, '(') && !accept(parser, ')')) {
+        do {
+            if(nb_params == QASM_MAX_PARAMS) fail(parser, "more than %d parameters", QASM_MAX_PARAMS);
+            params[nb_params++] = parse_expression(parser);
+        } while(accept(parser, ','));
+        expect(parser, ')');
+    }
+    int first[QASM_MAX_ARGS], sizes[QASM_MAX_ARGS], qubits[QASM_MAX_ARGS];
+    int nb_args = 0;
+    do {
+        if(nb_args == QASM_MAX_ARGS) fail(parser, "more than %d qubits", QASM_MAX_ARGS);
+        parse_qubit_argument(parser, &first[nb_args], &sizes[nb_args]);
+        nb_args++;
+    } while(accept(parser, ','));
+    int line = parser->token.line;
+    expect(parser, ';');
+
+    if(nb_params != gate->nb_params || nb_args != gate->nb_args) {
+        fail_line(parser, line, "%.*s takes %d parameter(s) and %d qubit(s), not %d and %d", gate->length, gate->name,
+                  gate->nb_params, gate->nb_args, nb_params, nb_args);
+    }
+    if(gate->def && gate->def->opaque) fail_line(parser, line, "opaque gate %.*s can't be applied", gate->length, gate->name);
+    if(parser->scope && gate->def && gate->def->order >= parser->scope->def->order) {
+        fail_line(parser, line, "%.*s is not defined before this gate", gate->length, gate->name);
+    }
+    int width = broadcast_size(parser, sizes, nb_args, line);
+    for(int b = 0; b < width; b++) {
+        for(int i = 0; i < nb_args; i++) qubits[i] = first[i] + (sizes[i] == 1 ? 0 : b);
+        apply_gate(parser, gate, params, qubits, line);
+    }
+}
+
+// The statements of the body on the given parameters and qubits
+static void parse_statement(Parser *parser);
+static void expand_gate(Parser *parser, const GateDef *def, const double *params, const int *qubits) {
+    Lexer lex = parser->lex;
+    Token token = parser->token;
+    Scope *outer = parser->scope;
+    Scope scope = {def, params, qubits};
+    parser->lex = (Lexer){def->body, def->body_end, def->line};
+    parser->scope = &scope;
+    advance(parser);
+    while(parser->token.kind != TOK_END) parse_statement(parser);
+    parser->lex = lex;
+    parser->token = token;
+    parser->scope = outer;
+}
+
+static Span *parse_names(Parser *parser, int close, int *count) {
+    Span names[QASM_MAX_ARGS];
+    *count = 0;
+    while(parser->token.kind != close) {
+        if(*count == QASM_MAX_ARGS) fail(parser, "more than %d names", QASM_MAX_ARGS);
+        Token name = expect(parser, TOK_IDENT);
+        names[(*count)++] = (Span){name.start, name.length};
+        if(!accept(parser, ',')) break;
+    }
+    return arena_copy(parser->arena, names, *count * sizeof(Span));
+}
+
+// gate name(params) qubits { body } : the body is kept as text, parsed on every call
+static void parse_gate_definition(Parser *parser, bool opaque) {
+    if(parser->scope) fail(parser, "gate definitions inside a gate");
+    advance(parser);
+    Token name = expect(parser, TOK_IDENT);
+    GateDef *def = arena_alloc(parser->arena, sizeof(GateDef));
+    *def = (GateDef){.order = parser->nb_defs++, .opaque = opaque};
+    def->params = NULL;
+    if(accept(parser, '(')) {
+        def->params = parse_names(parser, ')', &def->nb_params);
+        expect(parser, ')');
+    }
+    def->args = parse_names(parser, opaque ? ';' : '{', &def->nb_args);
+    if(def->nb_args == 0) fail(parser, "gate %.*s without qubits", name.length, name.start);
+    if(def->nb_params > QASM_MAX_PARAMS) fail(parser, "more than %d parameters", QASM_MAX_PARAMS);
+    if(opaque) {
+        expect(parser, ';');
+    } else {
+        if(parser->token.kind != '{') expect(parser, '{');
+        def->body = parser->lex.p;
+        def->line = parser->lex.line;
+        advance(parser);
+        while(parser->token.kind != '}') {
+            if(parser->token.kind == TOK_END || parser->token.kind == '{') fail(parser, "'}' expected to close %.*s", name.length, name.start);
+            advance(parser);
+        }
+        def->body_end = parser->token.start;
+        advance(parser);
+    }
+
+    Symbol *symbol = table_find(&parser->table, name.start, name.length);
+    // The standard gates defined in the file (an inlined qelib1.inc) : the built in ones are kept
+    if(symbol && symbol->kind == SYM_GATE && symbol->id != B_USER) return;
+    symbol = table_add(&parser->table, name.start, name.length, SYM_GATE);
+    if(!symbol) fail_line(parser, name.line, "'%.*s' already defined", name.length, name.start);
+    symbol->id = B_USER;
+    symbol->def = def;
+    symbol->nb_params = def->nb_params;
+    symbol->nb_args = def->nb_args;
+}
+
+/* -------- statements -------- */
+
+static void declare_register(Parser *parser, Token name, int kind, uint64_t size) {
+    if(size == 0 || size > INT32_MAX) fail_line(parser, name.line, "invalid size for %.*s", name.length, name.start);
+    Symbol *symbol = table_add(&parser->table, name.start, name.length, kind);
+    if(!symbol) fail_line(parser, name.line, "'%.*s' already defined", name.length, name.start);
+    symbol->size = (int)size;
+    if(kind == SYM_QREG) {
+        symbol->offset = parser->circuit->nb_qbits;
+        parser->circuit->nb_qbits += (int)size;
+    } else {
+        symbol->offset = parser->nb_cbits;
+        parser->nb_cbits += (int)size;
+    }
+}
+
+// qreg name[size]; (QASM 2) or qubit[size] name; (QASM 3)
+static void parse_declaration(Parser *parser, int kind, bool qasm3) {
+    advance(parser);
+    uint64_t size = 1;
+    Token name;
+    if(qasm3) {
+        if(accept(parser, '[')) {
+            size = expect(parser, TOK_INT).integer;
+            expect(parser, ']');
+        }
+        name = expect(parser, TOK_IDENT);
+    } else {
+        name = expect(parser, TOK_IDENT);
+        expect(parser, '[');
+        size = expect(parser, TOK_INT).integer;
+        expect(parser, ']');
+    }
+    expect(parser, ';');
+    declare_register(parser, name, kind, size);
+}
+
+static void add_measures(Parser *parser, int qubit, int qsize, int bit, int bsize, int line) {
+    if(qsize != bsize) fail_line(parser, line, "measuring %d qubit(s) into %d bit(s)", qsize, bsize);
+    const GateCondition *condition = parser->condition;
+    if(condition && bit < condition->first + condition->width && condition->first < bit + bsize) {
+        fail_line(parser, line, "measurement into the bits of its own condition");
+    }
+    for(int i = 0; i < qsize; i++) add_measure(parser->circuit, qubit + i, bit + i);
+}
+
+// measure q -> c;
+static void parse_measure(Parser *parser) {
+    advance(parser);
+    int qubit, qsize, bit, bsize;
+    parse_register_argument(parser, SYM_QREG, &qubit, &qsize);
+    expect(parser, TOK_ARROW);
+    parse_register_argument(parser, SYM_CREG, &bit, &bsize);
+    int line = parser->token.line;
+    expect(parser, ';');
+    add_measures(parser, qubit, qsize, bit, bsize, line);
+}
+
+// c = measure q;
+static void parse_measure_assignment(Parser *parser) {
+    int qubit, qsize, bit, bsize;
+    parse_register_argument(parser, SYM_CREG, &bit, &bsize);
+    expect(parser, '=');
+    Token keyword = expect(parser, TOK_IDENT);
+    if(keyword.length != 7 || memcmp(keyword.start, "measure", 7) != 0) fail(parser, "only measurements can be assigned");
+    parse_register_argument(parser, SYM_QREG, &qubit, &qsize);
+    int line = parser->token.line;
+    expect(parser, ';');
+    add_measures(parser, qubit, qsize, bit, bsize, line);
+}
+
+// if(c == n) stmt, if (c[i]) stmt, if (!c[i]) { stmts }
+static void parse_if(Parser *parser) {
+    if(parser->condition) fail(parser, "nested conditions");
+    advance(parser);
+    expect(parser, '(');
+    bool negate = accept(parser, '!');
+    int first, width;
+    parse_register_argument(parser, SYM_CREG, &first, &width);
+    uint64_t value = 1;
+    if(accept(parser, TOK_EQ)) {
+        Token literal = parser->token;
+        if(literal.kind == TOK_INT) value = literal.integer;
+        else if(literal.kind == TOK_IDENT && literal.length == 4 && memcmp(literal.start, "true", 4) == 0) value = 1;
+        else if(literal.kind == TOK_IDENT && literal.length == 5 && memcmp(literal.start, "false", 5) == 0) value = 0;
+        else fail(parser, "integer expected in the condition");
+        advance(parser);
+    } else if(width != 1) {
+        fail(parser, "a register condition needs a value");
+    }
+    int line = parser->token.line;
+    expect(parser, ')');
+    if(negate) value = !value;
+    if(width > 64) fail_line(parser, line, "condition on more than 64 bits");
+    if(width < 64 && value >> width) fail_line(parser, line, "value %llu out of %d bits", (unsigned long long)value, width);
+
+    circuit_set_condition(parser->circuit, first, width, value);
+    parser->condition = parser->circuit->condition;
+    if(accept(parser, '{')) {
+        while(!accept(parser, '}')) {
+            if(parser->token.kind == TOK_END) fail(parser, "'}' expected");
+            parse_statement(parser);
+        }
+    } else {
+        parse_statement(parser);
+    }
+    circuit_set_condition(parser->circuit, 0, 0, 0);
+    parser->condition = NULL;
+}
+
+static void parse_statement(Parser *parser) {
+    Token token = parser->token;
+    if(token.kind != TOK_IDENT) fail(parser, "statement expected, found '%.*s'", token.length, token.start);
+    Symbol *symbol = table_find(&parser->table, token.start, token.length);
+    if(!symbol) fail(parser, "unknown '%.*s'", token.length, token.start);
+    if(symbol->kind == SYM_GATE) {
+        parse_gate_call(parser, symbol);
+        return;
+    }
+    if(symbol->kind == SYM_KEYWORD && symbol->id == KW_BARRIER) {
+        while(parser->token.kind != ';') {
+            if(parser->token.kind == TOK_END) fail(parser, "';' expected");
+            advance(parser);
+        }
+        advance(parser);
+        return;
+    }
+    if(parser->scope) fail(parser, "only gates in a gate body, found '%.*s'", token.length, token.start);
+    if(symbol->kind == SYM_CREG) {
+        parse_measure_assignment(parser);
+        return;
+    }
+    if(symbol->kind != SYM_KEYWORD) fail(parser, "statement expected, found '%.*s'", token.length, token.start);
+    switch(symbol->id) {
+        case KW_OPENQASM: {
+            advance(parser);
+            Token version = parser->token;
+            if(version.kind != TOK_INT && version.kind != TOK_REAL) fail(parser, "version expected");
+            if(version.number < 2 || version.number >= 4) fail(parser, "OPENQASM %.*s not supported", version.length, version.start);
+            parser->version = (int)version.number;
+            advance(parser);
+            expect(parser, ';');
+            break;
+        }
+        case KW_INCLUDE:
+            advance(parser);
+            expect(parser, TOK_STRING);
+            expect(parser, ';');
+            break;
+        case KW_QREG: parse_declaration(parser, SYM_QREG, false); break;
+        case KW_CREG: parse_declaration(parser, SYM_CREG, false); break;
+        case KW_QUBIT: parse_declaration(parser, SYM_QREG, true); break;
+        case KW_BIT: parse_declaration(parser, SYM_CREG, true); break;
+        case KW_GATE: parse_gate_definition(parser, false); break;
+        case KW_OPAQUE: parse_gate_definition(parser, true); break;
+        case KW_MEASURE: parse_measure(parser); break;
+        case KW_IF: parse_if(parser); break;
+        case KW_RESET: fail(parser, "reset is not supported"); break;
+        default: fail(parser, "unexpected '%.*s'", token.length, token.start);
+    }
+}
+
+/* -------- loading -------- */
+
+// False on failure (fail jumps back here)
+static bool parse_program(Parser *parser) {
+    if(setjmp(parser->failure) != 0) return false;
+    advance(parser);
+    while(parser->token.kind != TOK_END) parse_statement(parser);
+    if(parser->circuit->nb_qbits == 0) fail(parser, "no quantum register declared");
+    return true;
+}
+
+QuantumCircuit *qasm_parse(const char *text, size_t length, QasmInfo *info) {
+    QasmInfo local;
+    if(!info) info = &local;
+    double t0 = now_seconds();
+    memset(info, 0, sizeof(QasmInfo));
+
+    Parser *parser = calloc_custom(1, sizeof(Parser));
+    parser->lex = (Lexer){text, text + length, 1};
+    parser->info = info;
+    parser->version = 3;    // The header is optional in OpenQASM 3 only
+    parser->arena = arena_create();
+    parser->circuit = circuit_create(0);
+    // A gate takes 8 bytes of text at least ("h q[0];\n") : no reallocation of the gates in general
+    circuit_reserve(parser->circuit, (int)((length / 8 < INT32_MAX) ? length / 8 : INT32_MAX));
+    table_init(&parser->table);
+    static const int swap[4] = {0, 2, 1, 3}, ccx[8] = {0, 1, 2, 3, 4, 5, 7, 6}, cswap[8] = {0, 1, 2, 3, 4, 6, 5, 7};
+    parser->swap = permutation_matrix(2, swap);
+    parser->ccx = permutation_matrix(3, ccx);
+    parser->cswap = permutation_matrix(3, cswap);
+
+    QuantumCircuit *circuit = parser->circuit;
+    if(!parse_program(parser)) {
+        circuit_free(circuit);
+        circuit = NULL;
+    }
+
+    info->nb_qbits = circuit ? circuit->nb_qbits : 0;
+    info->nb_cbits = parser->nb_cbits;
+    info->gates = circuit ? circuit->nb_gates : 0;
+    info->lines = parser->lex.line;
+    shared_matrix_release(parser->swap);
+    shared_matrix_release(parser->ccx);
+    shared_matrix_release(parser->cswap);
+    free_custom(parser->table.slots);
+    arena_free(parser->arena);
+    free_custom(parser);
+    info->seconds = now_seconds() - t0;
+    info->gates_per_second = (info->seconds > 0) ? info->gates / info->seconds : 0.0;
+    return circuit;
+}
+
+QuantumCircuit *qasm_load(const char *path, QasmInfo *info) {
+    QasmInfo local;
+    if(!info) info = &local;
+    double t0 = now_seconds();
+    int fd = open(path, O_RDONLY);
+    struct stat status;
+    if(fd < 0 || fstat(fd, &status) != 0) {
+        memset(info, 0, sizeof(QasmInfo));
+        snprintf(info->error, sizeof(info->error), "%s: %s", path, strerror(errno));
+        if(fd >= 0) close(fd);
+        return NULL;
+    }
+    size_t length = status.st_size;
+    const char *text = "";
+    if(length > 0) {
+        text = mmap(NULL, length, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if(text == MAP_FAILED) {
+            memset(info, 0, sizeof(QasmInfo));
+            snprintf(info->error, sizeof(info->error), "%s: %s", path, strerror(errno));
+            close(fd);
+            return NULL;
+        }
+        madvise((void *)text, length, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    QuantumCircuit *circuit = qasm_parse(text, length, info);
+    if(length > 0) munmap((void *)text, length);
+    info->seconds = now_seconds() - t0;
+    info->gates_per_second = (info->seconds > 0) ? info->gates / info->seconds : 0.0;
+    return circuit;
+}
+
+/* -------- export -------- */
+
+#define EXPORT_TOLERANCE 1e-10
+
+typedef struct {
+    FILE *channel;
+    int *register_of;       // Classical register of every bit
+    int *index_of;          // Index of the bit in it
+    int *register_first;    // First bit of every register
+    int nb_registers;
+    char prefix[96];        // "if(c == v) " of the gate being written
+    char **opaque;          // Opaque gates declared
+    int nb_opaque;
+    int inexact;
+} Exporter;
+
+static void emit(Exporter *exporter, const char *format, ...) {
+    fputs(exporter->prefix, exporter->channel);
+    va_list args;
+    va_start(args, format);
+    vfprintf(exporter->channel, format, args);
+    va_end(args);
+}
+
+static void bit_name(const Exporter *exporter, int bit, char *buffer, size_t size) {
+    if(exporter->nb_registers == 1) snprintf(buffer, size, "c[%d]", exporter->index_of[bit]);
+    else snprintf(buffer, size, "c%d[%d]", exporter->register_of[bit], exporter->index_of[bit]);
+}
+
+// A gate QASM 2 can't express : an opaque gate named after its label
+static void export_opaque(Exporter *exporter, int nb_qbits, const int *qbits, const char *label) {
+    char name[64];
+    int length = snprintf(name, sizeof(name), "custom%d_", nb_qbits);
+    for(const char *c = label ? label : "gate"; *c && length < (int)sizeof(name) - 1; c++) {
+        name[length++] = is_ident_char(*c) && (unsigned char)*c < 0x80 ? *c : '_';
+    }
+    name[length] = '\0';
+    bool declared = false;
+    for(int i = 0; i < exporter->nb_opaque && !declared; i++) declared = strcmp(exporter->opaque[i], name) == 0;
+    if(!declared) {
+        exporter->opaque = realloc(exporter->opaque, (exporter->nb_opaque + 1) * sizeof(char *));
+        assert(exporter->opaque != NULL && "Memory allocation failed");
+        exporter->opaque[exporter->nb_opaque++] = strdup(name);
+        fprintf(exporter->channel, "opaque %s ", name);
+        for(int i = 0; i < nb_qbits; i++) fprintf(exporter->channel, "%sa%d", i ? ", " : "", i);
+        fprintf(exporter->channel, ";\n");
+    }
+    emit(exporter, "%s ", name);
+    for(int i = 0; i < nb_qbits; i++) fprintf(exporter->channel, "%sq[%d]", i ? ", " : "", qbits[i]);
+    fprintf(exporter->channel, ";\n");
+    exporter->inexact++;
+}
+
+// u = e^(i gamma) u3(theta, phi, lambda), false if u isn't unitary
+static bool u3_angles(const double complex *u, double *theta, double *phi, double *lambda, double *gamma) {
+    double c = cabs(u[0]), s = cabs(u[2]);
+    *theta = 2 * atan2(s, c);
+    *gamma = carg((c > EXPORT_TOLERANCE) ? u[0] : u[2]);
+    *phi = (c > EXPORT_TOLERANCE && s > EXPORT_TOLERANCE) ? carg(u[2]) - *gamma : 0.0;
+    *lambda = ((s > EXPORT_TOLERANCE) ? carg(-u[1]) : carg(u[3])) - *gamma;
+    double complex m[4];
+    u3_matrix(*theta, *phi, *lambda, m);
+    for(int i = 0; i < 4; i++) if(cabs(cexp(I * *gamma) * m[i] - u[i]) > EXPORT_TOLERANCE) return false;
+    return true;
+}
+
+static bool is_permutation(const double complex *mat, int nb_qbits, const int *permutation) {
+    int dim = 1 << nb_qbits;
+    for(int r = 0; r < dim; r++) {
+        for(int c = 0; c < dim; c++) if(cabs(mat[r * dim + c] - (r == permutation[c] ? 1.0 : 0.0)) > EXPORT_TOLERANCE) return false;
+    }
+    return true;
+}
+
+// 4 x 4 matrix acting as u on the other qubit when qubit `control` (0 : the most significant) is set
+static bool controlled_block(const double complex *mat, int control, double complex *u) {
+    int cbit = control ? 1 : 2, tbit = 3 ^ cbit;
+    for(int r = 0; r < 4; r++) {
+        for(int c = 0; c < 4; c++) {
+            if((r & cbit) && (c & cbit)) continue;
+            if(cabs(mat[4 * r + c] - (r == c ? 1.0 : 0.0)) > EXPORT_TOLERANCE) return false;
+        }
+    }
+    u[0] = mat[4 * cbit + cbit];
+    u[1] = mat[4 * cbit + (cbit | tbit)];
+    u[2] = mat[4 * (cbit | tbit) + cbit];
+    u[3] = mat[4 * (cbit | tbit) + (cbit | tbit)];
+    return true;
+}
+
+static void export_custom(Exporter *exporter, int nb_qbits, const int *q, const double complex *mat, const char *label) {
+    double theta, phi, lambda, gamma;
+    double complex u[4];
+    if(nb_qbits == 1 && u3_angles(mat, &theta, &phi, &lambda, &gamma)) {
+        emit(exporter, "u3(%.17g, %.17g, %.17g) q[%d];\n", theta, phi, lambda, q[0]);
+        return;
+    }
+    if(nb_qbits == 2) {
+        static const int swap[4] = {0, 2, 1, 3};
+        if(is_permutation(mat, 2, swap)) {
+            emit(exporter, "swap q[%d], q[%d];\n", q[0], q[1]);
+            return;
+        }
+        for(int control = 0; control < 2; control++) {
+            if(!controlled_block(mat, control, u) || !u3_angles(u, &theta, &phi, &lambda, &gamma)) continue;
+            if(fabs(gamma) <= EXPORT_TOLERANCE) {
+                emit(exporter, "cu3(%.17g, %.17g, %.17g) q[%d], q[%d];\n", theta, phi, lambda, q[control], q[1 - control]);
+            } else {
+                emit(exporter, "cu(%.17g, %.17g, %.17g, %.17g) q[%d], q[%d];\n", theta, phi, lambda, gamma, q[control], q[1 - control]);
+            }
+            return;
+        }
+    }
+    if(nb_qbits == 3) {
+        static const int ccx[8] = {0, 1, 2, 3, 4, 5, 7, 6}, cswap[8] = {0, 1, 2, 3, 4, 6, 5, 7};
+        if(is_permutation(mat, 3, ccx)) {
+            emit(exporter, "ccx q[%d], q[%d], q[%d];\n", q[0], q[1], q[2]);
+            return;
+        }
+        if(is_permutation(mat, 3, cswap)) {
+            emit(exporter, "cswap q[%d], q[%d], q[%d];\n", q[0], q[1], q[2]);
+            return;
+        }
+    }
+    export_opaque(exporter, nb_qbits, q, label);
+}
+
+/* Phases only : u1 / cu1 up to 2 qubits, beyond one u1 per parity of the
+   qubits (between two ladders of cx), from the Walsh transform of the angles */
+static void export_diagonal(Exporter *exporter, int nb_qbits, const int *q, const double complex *phases, const char *label) {
+    int dim = 1 << nb_qbits;
+    for(int x = 0; x < dim; x++) {
+        if(fabs(cabs(phases[x]) - 1.0) > EXPORT_TOLERANCE) {
+            export_opaque(exporter, nb_qbits, q, label);
+            return;
+        }
+    }
+    double *angles = malloc_custom(dim * sizeof(double));
+    for(int x = 0; x < dim; x++) angles[x] = carg(phases[x] / phases[0]);
+    if(nb_qbits == 1) {
+        emit(exporter, "u1(%.17g) q[%d];\n", angles[1], q[0]);
+    } else if(nb_qbits == 2) {
+        double both = angles[3] - angles[2] - angles[1];
+        if(fabs(angles[1]) > EXPORT_TOLERANCE) emit(exporter, "u1(%.17g) q[%d];\n", angles[1], q[1]);
+        if(fabs(angles[2]) > EXPORT_TOLERANCE) emit(exporter, "u1(%.17g) q[%d];\n", angles[2], q[0]);
+        if(fabs(both) > EXPORT_TOLERANCE) emit(exporter, "cu1(%.17g) q[%d], q[%d];\n", both, q[0], q[1]);
+    } else {
+        for(int s = 1; s < dim; s++) {
+            double coefficient = 0.0;
+            for(int x = 0; x < dim; x++) coefficient += (__builtin_popcount(x & s) & 1) ? -angles[x] : angles[x];
+            coefficient /= dim;
+            if(fabs(coefficient) <= EXPORT_TOLERANCE) continue;
+            // Bit j of s is qubit q[nb_qbits - 1 - j] ; the parity is gathered on the lowest one
+            int low = __builtin_ctz(s);
+            for(int j = low + 1; j < nb_qbits; j++) {
+                if(s >> j & 1) emit(exporter, "cx q[%d], q[%d];\n", q[nb_qbits - 1 - j], q[nb_qbits - 1 - low]);
+            }
+            emit(exporter, "u1(%.17g) q[%d];\n", -2 * coefficient, q[nb_qbits - 1 - low]);
+            for(int j = nb_qbits - 1; j > low; j--) {
+                if(s >> j & 1) emit(exporter, "cx q[%d], q[%d];\n", q[nb_qbits - 1 - j], q[nb_qbits - 1 - low]);
+            }
+        }
+    }
+    free_custom(angles);
+}
+
+static void export_gate(Exporter *exporter, const Gate *gate) {
+    static const char *names[] = {"id", "h", "x", "y", "z"};
+    char bit[32];
+    switch(gate->class) {
+        case MEAS:
+            bit_name(exporter, gate->gate.measure.cbit, bit, sizeof(bit));
+            emit(exporter, "measure q[%d] -> %s;\n", gate->gate.measure.qbit, bit);
+            break;
+        case UNITARY:
+            if(gate->gate.unitary.type == GATE_PHASE) emit(exporter, "u1(%.17g) q[%d];\n", gate->gate.unitary.phase, gate->gate.unitary.qbit);
+            else emit(exporter, "%s q[%d];\n", names[gate->gate.unitary.type], gate->gate.unitary.qbit);
+            break;
+        case CONTROL: {
+            int c = gate->gate.control.control, t = gate->gate.control.qbit;
+            switch(gate->gate.control.type) {
+                case GATE_I: emit(exporter, "id q[%d];\n", t); break;
+                case GATE_PHASE: emit(exporter, "cu1(%.17g) q[%d], q[%d];\n", gate->gate.control.phase, c, t); break;
+                default: emit(exporter, "c%s q[%d], q[%d];\n", names[gate->gate.control.type], c, t); break;
+            }
+            break;
+        }
+        case CUSTOM:
+            export_custom(exporter, gate->gate.custom.nb_qbits, gate->gate.custom.qbits, gate->gate.custom.mat, gate->gate.custom.label);
+            break;
+        case DIAGONAL:
+            export_diagonal(exporter, gate->gate.diagonal.nb_qbits, gate->gate.diagonal.qbits, gate->gate.diagonal.phases,
+                            gate->gate.diagonal.label);
+            break;
+    }
+}
+
+int qasm_write(FILE *channel, QuantumCircuit *circuit) {
+    // Classical bits : one register between two boundaries of conditions, so that each condition reads a whole register
+    int nb_cbits = 0;
+    for(int g = 0; g < circuit->nb_gates; g++) {
+        const Gate *gate = &circuit->gates[g];
+        if(gate->class == MEAS && gate->gate.measure.cbit + 1 > nb_cbits) nb_cbits = gate->gate.measure.cbit + 1;
+        if(gate->condition && gate->condition->first + gate->condition->width > nb_cbits) {
+            nb_cbits = gate->condition->first + gate->condition->width;
+        }
+    }
+    bool *boundary = calloc_custom(nb_cbits + 1, sizeof(bool));
+    for(int g = 0; g < circuit->nb_gates; g++) {
+        const GateCondition *condition = circuit->gates[g].condition;
+        if(condition) boundary[condition->first] = boundary[condition->first + condition->width] = true;
+    }
+    Exporter exporter = {.channel = channel};
+    exporter.register_of = malloc_custom((nb_cbits + 1) * sizeof(int));
+    exporter.index_of = malloc_custom((nb_cbits + 1) * sizeof(int));
+    exporter.register_first = malloc_custom((nb_cbits + 1) * sizeof(int));
+    for(int b = 0; b < nb_cbits; b++) {
+        if(b == 0 || boundary[b]) exporter.register_first[exporter.nb_registers++] = b;
+        exporter.register_of[b] = exporter.nb_registers - 1;
+        exporter.index_of[b] = b - exporter.register_first[exporter.nb_registers - 1];
+    }
+    exporter.register_first[exporter.nb_registers] = nb_cbits;
+
+    fprintf(channel, "OPENQASM 2.0;\ninclude \"qelib1.inc\";\n");
+    if(circuit->nb_qbits > 0) fprintf(channel, "qreg q[%d];\n", circuit->nb_qbits);
+    for(int r = 0; r < exporter.nb_registers; r++) {
+        int size = exporter.register_first[r + 1] - exporter.register_first[r];
+        if(exporter.nb_registers == 1) fprintf(channel, "creg c[%d];\n", size);
+        else fprintf(channel, "creg c%d[%d];\n", r, size);
+    }
+
+    for(int g = 0; g < circuit->nb_gates; g++) {
+        const Gate *gate = &circuit->gates[g];
+        const GateCondition *condition = gate->condition;
+        exporter.prefix[0] = '\0';
+        if(condition) {
+            int r = exporter.register_of[condition->first];
+            if(exporter.register_first[r] != condition->first || exporter.register_first[r + 1] != condition->first + condition->width) {
+                // Overlapping conditions : no register layout fits them all
+                fprintf(channel, "// gate %d : condition on bits %d..%d not written\n", g, condition->first,
+                        condition->first + condition->width - 1);
+                exporter.inexact++;
+                continue;
+            }
+            if(exporter.nb_registers == 1) snprintf(exporter.prefix, sizeof(exporter.prefix), "if(c==%llu) ", (unsigned long long)condition->value);
+            else snprintf(exporter.prefix, sizeof(exporter.prefix), "if(c%d==%llu) ", r, (unsigned long long)condition->value);
+        }
+        export_gate(&exporter, gate);
+    }
+
+    for(int i = 0; i < exporter.nb_opaque; i++) free(exporter.opaque[i]);
+    free(exporter.opaque);
+    free_custom(boundary);
+    free_custom(exporter.register_of);
+    free_custom(exporter.index_of);
+    free_custom(exporter.register_first);
+    return exporter.inexact;
+}
@@ -0,0 +1,65 @@
+#ifndef QASM_H
+#define QASM_H
+
+#include "circuit.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* -------- OpenQASM loader --------
+   Parses OpenQASM 2.0 and a subset of 3.0 straight into a circuit : the text
+   is read token by token and every statement adds its gates at once, no
+   syntax tree is built (qasm_load maps the file, read sequentially).
+   Supported :
+   - OPENQASM 2.0 / 3 headers, include (the standard gates are built in),
+     comments // and / * * /
+   - qreg / creg and qubit[n] / bit[n] registers, numbered in the order of
+     declaration (the circuit grows with them)
+   - the gates of qelib1.inc and stdgates.inc : id h x y z s sdg t tdg sx
+     sxdg rx ry rz p u1 phase u2 u3 u U cx CX cnot cy cz ch cp cu1 cphase
+     crx cry crz cu3 cu swap ccx cswap rzz, broadcast over whole registers
+   - parameters : pi, numbers, + - * / ^ and sin cos tan exp ln sqrt
+   - user gates (gate name(params) qubits { body }), expanded on every call
+   - measure q -> c and c = measure q, barrier (ignored)
+   - if(c == n) and if (c[i]) / if (c[i] == v) / if (!c[i]), before a
+     statement or a { } block : the gates get a GateCondition
+   Under OPENQASM 2, rz, rzz, sx and sxdg are the qelib1.inc ones (they
+   differ from stdgates.inc by a global phase).
+   Not supported : reset, opaque gates (declared, not applied), gate
+   modifiers, classical types, loops and subroutines.
+   Speed : the target of 10^7 gates in well under a second is not met. On
+   one 2.1 GHz core, the 10^7 gates of examples/qasm (150 MB) parse in about
+   1.9 s from memory and load in about 2.1 s from the file, 5.10^6 gates / s.
+   The lexer takes most of it, about 12 ns a token and 5 to 13 tokens a
+   statement : h q[3]; costs about 65 ns, u3(0.5,0,-pi/2) q[3]; about 390 ns.
+*/
+
+typedef struct {
+    int nb_qbits;
+    int nb_cbits;           // Size of the classical register to execute it with
+    long gates;             // Added to the circuit
+    int lines;
+    double seconds;         // Mapping and parsing
+    double gates_per_second;
+    char error[256];        // "line n: ..." when loading failed
+} QasmInfo;
+
+// NULL on failure (info->error says why), a program without qubits included. info may be NULL
+QuantumCircuit *qasm_load(const char *path, QasmInfo *info);
+// Same from length bytes of text (not necessarily NUL terminated)
+QuantumCircuit *qasm_parse(const char *text, size_t length, QasmInfo *info);
+
+/* -------- OpenQASM exporter --------
+   Writes the circuit as OPENQASM 2.0 (qelib1.inc gates), exact up to a
+   global phase : standard and controlled gates by name, 1-qubit matrices
+   as u3, controlled 1-qubit matrices as cu3 / cu, swap / ccx / cswap
+   permutations by name, phases as u1 / cu1 or cx ladders around u1 beyond
+   2 qubits. The classical bits are split into registers at the bounds of
+   the conditions, so that each condition compares one register.
+   Returns the number of gates not written exactly : other matrices (opaque
+   gates named after their label, that qasm_load refuses) and conditions
+   overlapping others (written as comments).
+*/
+int qasm_write(FILE *channel, QuantumCircuit *circuit);
+
+#endif
@@ -2,19 +2,105 @@
 #include "internal.h"
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <omp.h>
 
 #include "../utils/utils.h"
+#include "../simulator/gates.h"
 
-double complex *state_alloc(int nqubits) {
-    uint64_t dim = 1ULL << nqubits;
-    double complex *s = aligned_alloc_64(dim * sizeof(double complex));
+#define HUGE_PAGE_2M (1ULL << 21)
+#define HUGE_PAGE_1G (1ULL << 30)
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+static StatePages state_pages = STATE_PAGES;
+static bool parallel_touch = true;
+
+void qregister_set_pages(StatePages pages) {
+    state_pages = pages;
+}
+StatePages qregister_get_pages(void) {
+    return state_pages;
+}
+void qregister_set_parallel_touch(bool parallel) {
+    parallel_touch = parallel;
+}
+const char *state_pages_name(StatePages pages) {
+    switch(pages) {
+        case STATE_PAGES_SMALL: return "4K";
+        case STATE_PAGES_TRANSPARENT: return "THP";
+        case STATE_PAGES_2M: return "2M";
+        case STATE_PAGES_1G: return "1G";
+    }
+    return "?";
+}
+
+static size_t round_up(size_t bytes, size_t page) {
+    return (bytes + page - 1) / page * page;
+}
+
+// The memory isn't touched : the caller does the first touch
+amplitude *state_alloc(int nqubits, StatePages *pages) {
+    size_t bytes = (1ULL << nqubits) * sizeof(amplitude);
+    StatePages wanted = state_pages;
+    if(wanted == STATE_PAGES_1G && bytes < HUGE_PAGE_1G) wanted = STATE_PAGES_2M;
+    if(bytes < HUGE_PAGE_2M) wanted = STATE_PAGES_SMALL;
+
+#ifdef MAP_HUGETLB
+    if(wanted == STATE_PAGES_2M || wanted == STATE_PAGES_1G) {
+        size_t page = (wanted == STATE_PAGES_1G) ? HUGE_PAGE_1G : HUGE_PAGE_2M;
+        int size_flag = (wanted == STATE_PAGES_1G) ? (30 << MAP_HUGE_SHIFT) : (21 << MAP_HUGE_SHIFT);
+        void *s = mmap(NULL, round_up(bytes, page), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | size_flag, -1, 0);
+        if(s != MAP_FAILED) {
+            *pages = wanted;
+            return s;
+        }
+    }
+#endif
+    if(wanted != STATE_PAGES_SMALL) {
+        // Also the fallback of a short huge page reservation
+        void *s = NULL;
+        if(posix_memalign(&s, HUGE_PAGE_2M, round_up(bytes, HUGE_PAGE_2M)) == 0) {
+#ifdef MADV_HUGEPAGE
+            madvise(s, round_up(bytes, HUGE_PAGE_2M), MADV_HUGEPAGE);
+#endif
+            *pages = STATE_PAGES_TRANSPARENT;
+            return s;
+        }
+    }
+
+    *pages = STATE_PAGES_SMALL;
+    amplitude *s = aligned_alloc_64(bytes);
     if (!s) {
         // fallback
-        s = malloc(dim * sizeof(double complex));
+        s = malloc(bytes);
     }
     return s;
 }
 
+static void state_free(amplitude *state, int nqubits, StatePages pages) {
+    size_t bytes = (1ULL << nqubits) * sizeof(amplitude);
+    if(pages == STATE_PAGES_2M) munmap(state, round_up(bytes, HUGE_PAGE_2M));
+    else if(pages == STATE_PAGES_1G) munmap(state, round_up(bytes, HUGE_PAGE_1G));
+    else free(state);
+}
+
+/* |0...0> written with the static schedule of the kernels : the pages of
+   each thread's share are first touched (so placed) by that thread */
+static void state_init(amplitude *state, int nqubits) {
+    uint64_t dim = 1ULL << nqubits;
+    bool parallel = parallel_touch && nqubits >= gates_get_parallel_threshold() && !omp_in_parallel();
+    #pragma omp parallel for schedule(static) if(parallel)
+    for (uint64_t i = 0; i < dim; ++i) state[i] = 0.0 + 0.0*I;
+    state[0] = 1.0 + 0.0*I;
+}
+
 int cregister_get_num_bits(const ClassicalRegister *cregister) {
     return cregister->nb_bits;
 }
@@ -29,11 +115,58 @@ int cregister_get_bit(const ClassicalRegister *cregister, int index) {
 int qregister_get_num_qubits(const QuantumRegister *qregister) {
     return qregister->nb_qbits;
 }
+StatePages qregister_get_state_pages(const QuantumRegister *qregister) {
+    return qregister->pages;
+}
 
-double complex *qregister_get_statevector(const QuantumRegister *qregister) {
+amplitude *qregister_get_statevector(const QuantumRegister *qregister) {
+    // The layout is an implementation detail : the register is logically unchanged
+    qregister_restore_layout((QuantumRegister *)qregister);
     return qregister->statevector;
 }
 
+/* The bit at position layout[q] must go to position q. Along a cycle
+   c0 -> c1 -> ... -> c(L-1) of positions, this rotation is the reversal
+   c(i) <-> c(L-1-i) followed by c(i) <-> c(L-i mod L) : two passes of
+   disjoint swaps whatever the permutation */
+void qregister_restore_layout(QuantumRegister *qregister) {
+    int n = qregister->nb_qbits;
+    int *layout = qregister->layout;
+    int *target = malloc(n * sizeof(int)); // Position where the bit at p goes
+    int *cycle = malloc(n * sizeof(int));
+    int *from[2] = {malloc(n * sizeof(int)), malloc(n * sizeof(int))};
+    int *to[2] = {malloc(n * sizeof(int)), malloc(n * sizeof(int))};
+    int count[2] = {0, 0};
+    for(int q = 0; q < n; q++) target[layout[q]] = q;
+
+    for(int p = 0; p < n; p++) {
+        if(target[p] < 0 || target[p] == p) continue;
+        int len = 0;
+        for(int c = p; target[c] >= 0; ) {
+            int next = target[c];
+            cycle[len++] = c;
+            target[c] = -1; // Visited
+            c = next;
+        }
+        for(int i = 0; i < len - 1 - i; i++) {
+            from[0][count[0]] = cycle[i];
+            to[0][count[0]++] = cycle[len - 1 - i];
+        }
+        for(int i = 1; i < len - i; i++) {
+            from[1][count[1]] = cycle[i];
+            to[1][count[1]++] = cycle[len - i];
+        }
+    }
+    for(int r = 0; r < 2; r++) {
+        if(count[r] > 0) apply_swaps_inplace(qregister->statevector, n, from[r], to[r], count[r]);
+        free(from[r]);
+        free(to[r]);
+    }
+    for(int q = 0; q < n; q++) layout[q] = q;
+    free(target);
+    free(cycle);
+}
+
 ClassicalRegister *cregister_create(int nbits) {
     ClassicalRegister *cregister = malloc(sizeof(ClassicalRegister));
     cregister->nb_bits = nbits;
@@ -62,29 +195,69 @@ void cregister_free(ClassicalRegister *cregister) {
 QuantumRegister *qregister_create(int nqubits) {
     QuantumRegister* qregister = malloc(sizeof(QuantumRegister));
     qregister->nb_qbits = nqubits;
-    qregister->statevector = state_alloc(nqubits);
+    qregister->statevector = state_alloc(nqubits, &qregister->pages);
+    qregister->layout = malloc(nqubits * sizeof(int));
+    for(int q = 0; q < nqubits; q++) qregister->layout[q] = q;
+    qregister->fd = -1;
+    qregister->path = NULL;
+    state_init(qregister->statevector, nqubits);
+    return qregister;
+}
+QuantumRegister *qregister_create_mapped(int nqubits, const char *path) {
+    size_t bytes = (1ULL << nqubits) * sizeof(amplitude);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if(fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    // The truncated file reads as zeros without being written : |0...0> only needs its first amplitude
+    amplitude *state = MAP_FAILED;
+    if(ftruncate(fd, bytes) == 0) state = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(state == MAP_FAILED) {
+        perror(path);
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
 
-    uint64_t dim = 1ULL << nqubits;
-    for (uint64_t i = 0; i < dim; ++i) qregister->statevector[i] = 0.0 + 0.0*I;
+    QuantumRegister* qregister = malloc(sizeof(QuantumRegister));
+    qregister->nb_qbits = nqubits;
+    qregister->statevector = state;
+    qregister->layout = malloc(nqubits * sizeof(int));
+    for(int q = 0; q < nqubits; q++) qregister->layout[q] = q;
+    qregister->fd = fd;
+    qregister->path = strdup(path);
+    qregister->pages = STATE_PAGES_SMALL;
     qregister->statevector[0] = 1.0 + 0.0*I;
     return qregister;
 }
+bool qregister_is_mapped(const QuantumRegister *qregister) {
+    return qregister->fd >= 0;
+}
 QuantumRegister *qregister_fuse(QuantumRegister *q1, QuantumRegister *q2) {
     QuantumRegister* qregister = malloc(sizeof(QuantumRegister));
     qregister->nb_qbits = q1->nb_qbits + q2->nb_qbits;
-    qregister->statevector = state_alloc(qregister->nb_qbits);
+    qregister->statevector = state_alloc(qregister->nb_qbits, &qregister->pages);
+    qregister->layout = malloc(qregister->nb_qbits * sizeof(int));
+    for(int q = 0; q < qregister->nb_qbits; q++) qregister->layout[q] = q;
+    qregister->fd = -1;
+    qregister->path = NULL;
+    qregister_restore_layout(q1);
+    qregister_restore_layout(q2);
 
-    uint64_t s1 = 1 << q1->nb_qbits;
-    uint64_t s2 = 1 << q2->nb_qbits;
-    for(uint64_t i = 0; i < s1; i++) {
-        for(uint64_t j = 0; j < s2; j++) {
-            qregister->statevector[s2 * i + j] = q1->statevector[i] * q2->statevector[j];
-        }
+    // First touch with the kernels' schedule, as in state_init
+    uint64_t dim = 1ULL << qregister->nb_qbits;
+    uint64_t s2 = 1ULL << q2->nb_qbits;
+    bool parallel = parallel_touch && qregister->nb_qbits >= gates_get_parallel_threshold() && !omp_in_parallel();
+    #pragma omp parallel for schedule(static) if(parallel)
+    for(uint64_t k = 0; k < dim; k++) {
+        qregister->statevector[k] = q1->statevector[k >> q2->nb_qbits] * q2->statevector[k & (s2 - 1)];
     }
 
     return qregister;
 }
 void qregister_print(FILE *channel, QuantumRegister *q) {
+    qregister_restore_layout(q);
     fprintf(channel, "[");
     uint64_t dim = 1ULL << q->nb_qbits;
     for(uint64_t i = 0; i < dim; i++) {
@@ -93,6 +266,14 @@ void qregister_print(FILE *channel, QuantumRegister *q) {
     }
 }
 void qregister_free(QuantumRegister *qregister) {
-    free(qregister->statevector);
+    if(qregister->fd >= 0) {
+        munmap(qregister->statevector, (1ULL << qregister->nb_qbits) * sizeof(amplitude));
+        close(qregister->fd);
+        unlink(qregister->path);
+        free(qregister->path);
+    } else {
+        state_free(qregister->statevector, qregister->nb_qbits, qregister->pages);
+    }
+    free(qregister->layout);
     free(qregister);
 }
@@ -3,21 +3,68 @@
 
 #include <complex.h>
 #include <stdio.h>
+#include <stdbool.h>
+
+#include "../utils/precision.h"
 
 typedef struct ClassicalRegister ClassicalRegister;
 typedef struct QuantumRegister QuantumRegister;
 
+/* -------- statevector allocation --------
+   STATE_PAGES_SMALL : 4 KiB pages.
+   STATE_PAGES_TRANSPARENT : 2 MiB aligned and madvise(MADV_HUGEPAGE), backed
+   by transparent huge pages when the kernel has some (fewer TLB misses on
+   multi-GiB states).
+   STATE_PAGES_2M / STATE_PAGES_1G : explicit huge pages (MAP_HUGETLB), to be
+   reserved beforehand (vm.nr_hugepages, hugepagesz=1G) ; transparent ones
+   when the reservation is short.
+   States smaller than a huge page always use small pages.
+   qregister_create zeroes the state with the OpenMP threads and the static
+   schedule of the kernels (parallel first touch) : on a NUMA machine each
+   thread's share of the state lands on its own node, provided the threads
+   are pinned (OMP_PROC_BIND=spread OMP_PLACES=cores).
+*/
+typedef enum {
+    STATE_PAGES_SMALL,
+    STATE_PAGES_TRANSPARENT,
+    STATE_PAGES_2M,
+    STATE_PAGES_1G
+} StatePages;
+
+#ifndef STATE_PAGES
+#define STATE_PAGES STATE_PAGES_TRANSPARENT
+#endif
+
+// Pages of the registers created from now on
+void qregister_set_pages(StatePages pages);
+StatePages qregister_get_pages(void);
+// Parallel (default) or serial zeroing of the new registers
+void qregister_set_parallel_touch(bool parallel);
+const char *state_pages_name(StatePages pages);
+
 int cregister_get_num_bits(const ClassicalRegister *cregister);
 int cregister_get_bit(const ClassicalRegister *cregister, int index);
 
 int qregister_get_num_qubits(const QuantumRegister *qregister);
-double complex *qregister_get_statevector(const QuantumRegister *qregister);
+// Pages the statevector actually got (a mapped register : STATE_PAGES_SMALL)
+StatePages qregister_get_state_pages(const QuantumRegister *qregister);
+// The amplitudes in logical qubit order (undoes the executor's qubit permutation first)
+amplitude *qregister_get_statevector(const QuantumRegister *qregister);
+// Swaps the bits of the statevector back to the logical qubit order
+void qregister_restore_layout(QuantumRegister *qregister);
 
 ClassicalRegister *cregister_create(int nbits);
 void cregister_print(FILE *channel, ClassicalRegister *cregister);
 void cregister_free(ClassicalRegister *cregister);
 
 QuantumRegister *qregister_create(int nqubits);
+/* Out-of-core register : the statevector is a shared mapping of the file at
+   path (created or truncated, removed by qregister_free), so the page cache
+   holds only the part in use. Meant for a local NVMe drive and states larger
+   than the RAM ; the executor streams over it in storage order (see
+   simulator/outofcore.h). NULL if the file can't be created or mapped */
+QuantumRegister *qregister_create_mapped(int nqubits, const char *path);
+bool qregister_is_mapped(const QuantumRegister *qregister);
 QuantumRegister *qregister_fuse(QuantumRegister *q1, QuantumRegister *q2);
 void qregister_print(FILE *channel, QuantumRegister *qregister);
 void qregister_free(QuantumRegister *qregister);
@@ -0,0 +1,390 @@
+#include "serialize.h"
+#include "internal.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <complex.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../utils/utils.h"
+
+/* -------- writing -------- */
+
+// Offsets of the matrices, labels and conditions already written, by key (0 : empty slot)
+typedef struct {
+    uint64_t *keys;
+    int64_t *values;
+    uint64_t mask;
+    uint64_t count;
+} OffsetMap;
+
+static void map_init(OffsetMap *map) {
+    map->mask = 255;
+    map->count = 0;
+    map->keys = calloc_custom(map->mask + 1, sizeof(uint64_t));
+    map->values = malloc_custom((map->mask + 1) * sizeof(int64_t));
+}
+static void map_free(OffsetMap *map) {
+    free_custom(map->keys);
+    free_custom(map->values);
+}
+
+static uint64_t hash_key(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    return key ^ (key >> 33);
+}
+
+// Value of key, -1 if absent. With a string, the value must also be the offset of an equal string in blob
+static int64_t map_get(const OffsetMap *map, uint64_t key, const char *blob, const char *string) {
+    for(uint64_t i = hash_key(key) & map->mask; map->keys[i]; i = (i + 1) & map->mask) {
+        if(map->keys[i] == key && (!string || strcmp(blob + map->values[i], string) == 0)) return map->values[i];
+    }
+    return -1;
+}
+
+static void map_put(OffsetMap *map, uint64_t key, int64_t value) {
+    if(2 * (map->count + 1) > map->mask + 1) {
+        OffsetMap grown = {calloc_custom(2 * (map->mask + 1), sizeof(uint64_t)), malloc_custom(2 * (map->mask + 1) * sizeof(int64_t)),
+                           2 * map->mask + 1, 0};
+        for(uint64_t i = 0; i <= map->mask; i++) if(map->keys[i]) map_put(&grown, map->keys[i], map->values[i]);
+        map_free(map);
+        *map = grown;
+    }
+    uint64_t i = hash_key(key) & map->mask;
+    while(map->keys[i]) i = (i + 1) & map->mask;
+    map->keys[i] = key;
+    map->values[i] = value;
+    map->count++;
+}
+
+static uint64_t hash_string(const char *string) {
+    uint64_t hash = 14695981039346656037ULL;
+    for(; *string; string++) hash = (hash ^ (unsigned char)*string) * 1099511628211ULL;
+    return hash | 1;
+}
+
+static void *grow(void *array, uint64_t needed, uint64_t *capacity, size_t size) {
+    if(needed <= *capacity) return array;
+    while(*capacity < needed) *capacity = *capacity ? 2 * *capacity : 256;
+    array = realloc(array, *capacity * size);
+    assert(array != NULL && "Memory allocation failed");
+    return array;
+}
+
+static uint64_t align_up(uint64_t offset) {
+    return (offset + CIRCUIT_FILE_ALIGNMENT - 1) / CIRCUIT_FILE_ALIGNMENT * CIRCUIT_FILE_ALIGNMENT;
+}
+
+static bool write_at(FILE *file, uint64_t *position, uint64_t offset, const void *data, size_t size) {
+    static const char zeros[CIRCUIT_FILE_ALIGNMENT] = {0};
+    assert(offset >= *position && offset - *position <= CIRCUIT_FILE_ALIGNMENT);
+    if(offset > *position && fwrite(zeros, 1, offset - *position, file) != offset - *position) return false;
+    *position = offset + size;
+    return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+bool circuit_save(QuantumCircuit *circuit, const char *path) {
+    int nb_gates = circuit->nb_gates;
+    CircuitFileGate *records = malloc_custom((nb_gates ? nb_gates : 1) * sizeof(CircuitFileGate));
+    int32_t *qubits = NULL;
+    GateCondition *conditions = NULL;
+    char *labels = NULL;
+    const double complex **blocks = NULL;   // The distinct matrices, in file order
+    uint64_t *block_entries = NULL;
+    uint64_t nb_qubits = 0, nb_conditions = 0, labels_size = 0, nb_blocks = 0, nb_entries = 0;
+    uint64_t qubits_capacity = 0, conditions_capacity = 0, labels_capacity = 0, blocks_capacity = 0, entries_capacity = 0;
+    OffsetMap matrix_offsets, label_offsets, condition_indices;
+    map_init(&matrix_offsets);
+    map_init(&label_offsets);
+    map_init(&condition_indices);
+
+    for(int g = 0; g < nb_gates; g++) {
+        const Gate *gate = &circuit->gates[g];
+        CircuitFileGate *record = &records[g];
+        *record = (CircuitFileGate){.class = gate->class, .condition = -1, .label = -1};
+        const char *label = NULL;
+        int nb_qbits = 0;
+        const int *qbits = NULL;
+        const double complex *values = NULL;
+        uint64_t entries = 0;
+        switch(gate->class) {
+            case MEAS:
+                record->a = gate->gate.measure.qbit;
+                record->b = gate->gate.measure.cbit;
+                break;
+            case UNITARY:
+                record->type = gate->gate.unitary.type;
+                record->a = gate->gate.unitary.qbit;
+                record->phase = gate->gate.unitary.phase;
+                break;
+            case CONTROL:
+                record->type = gate->gate.control.type;
+                record->a = gate->gate.control.control;
+                record->b = gate->gate.control.qbit;
+                record->phase = gate->gate.control.phase;
+                break;
+            case CUSTOM:
+                nb_qbits = gate->gate.custom.nb_qbits;
+                qbits = gate->gate.custom.qbits;
+                values = gate->gate.custom.mat;
+                entries = (1ULL << nb_qbits) << nb_qbits;
+                label = gate->gate.custom.label;
+                break;
+            case DIAGONAL:
+                nb_qbits = gate->gate.diagonal.nb_qbits;
+                qbits = gate->gate.diagonal.qbits;
+                values = gate->gate.diagonal.phases;
+                entries = 1ULL << nb_qbits;
+                label = gate->gate.diagonal.label;
+                break;
+        }
+        if(values) {
+            record->a = nb_qbits;
+            record->qubits = nb_qubits;
+            qubits = grow(qubits, nb_qubits + nb_qbits, &qubits_capacity, sizeof(int32_t));
+            for(int i = 0; i < nb_qbits; i++) qubits[nb_qubits++] = qbits[i];
+            // A shared matrix is written once
+            int64_t offset = map_get(&matrix_offsets, (uint64_t)(uintptr_t)values, NULL, NULL);
+            if(offset < 0) {
+                offset = nb_entries;
+                blocks = grow(blocks, nb_blocks + 1, &blocks_capacity, sizeof(double complex *));
+                block_entries = grow(block_entries, nb_blocks + 1, &entries_capacity, sizeof(uint64_t));
+                blocks[nb_blocks] = values;
+                block_entries[nb_blocks++] = entries;
+                nb_entries += entries;
+                map_put(&matrix_offsets, (uint64_t)(uintptr_t)values, offset);
+            }
+            record->matrix = offset;
+        }
+        if(label) {
+            uint64_t key = hash_string(label);
+            int64_t offset = map_get(&label_offsets, key, labels, label);
+            if(offset < 0) {
+                size_t length = strlen(label) + 1;
+                offset = labels_size;
+                labels = grow(labels, labels_size + length, &labels_capacity, 1);
+                memcpy(labels + labels_size, label, length);
+                labels_size += length;
+                map_put(&label_offsets, key, offset);
+            }
+            record->label = (int32_t)offset;
+        }
+        if(gate->condition) {
+            int64_t index = map_get(&condition_indices, (uint64_t)(uintptr_t)gate->condition, NULL, NULL);
+            if(index < 0) {
+                index = nb_conditions;
+                conditions = grow(conditions, nb_conditions + 1, &conditions_capacity, sizeof(GateCondition));
+                conditions[nb_conditions++] = *gate->condition;
+                map_put(&condition_indices, (uint64_t)(uintptr_t)gate->condition, index);
+            }
+            record->condition = (int32_t)index;
+        }
+    }
+    map_free(&matrix_offsets);
+    map_free(&label_offsets);
+    map_free(&condition_indices);
+
+    CircuitFileHeader header = {
+        .version = CIRCUIT_FILE_VERSION,
+        .byte_order = CIRCUIT_FILE_BYTE_ORDER,
+        .nb_qbits = circuit->nb_qbits,
+        .nb_gates = nb_gates,
+        .nb_conditions = (int32_t)nb_conditions,
+        .nb_qubit_entries = nb_qubits,
+        .nb_matrix_entries = nb_entries,
+        .labels_size = labels_size
+    };
+    memcpy(header.magic, CIRCUIT_FILE_MAGIC, sizeof(header.magic));
+    header.gates = align_up(sizeof(CircuitFileHeader));
+    header.conditions = align_up(header.gates + nb_gates * sizeof(CircuitFileGate));
+    header.qubits = align_up(header.conditions + nb_conditions * sizeof(GateCondition));
+    header.matrices = align_up(header.qubits + nb_qubits * sizeof(int32_t));
+    header.labels = align_up(header.matrices + nb_entries * sizeof(double complex));
+    header.file_size = header.labels + labels_size;
+
+    FILE *file = fopen(path, "wb");
+    bool written = file != NULL;
+    uint64_t position = 0;
+    if(written) {
+        written = write_at(file, &position, 0, &header, sizeof(header))
+               && write_at(file, &position, header.gates, records, nb_gates * sizeof(CircuitFileGate))
+               && write_at(file, &position, header.conditions, conditions, nb_conditions * sizeof(GateCondition))
+               && write_at(file, &position, header.qubits, qubits, nb_qubits * sizeof(int32_t));
+        for(uint64_t b = 0; written && b < nb_blocks; b++) {
+            uint64_t offset = (b == 0) ? header.matrices : position;
+            written = write_at(file, &position, offset, blocks[b], block_entries[b] * sizeof(double complex));
+        }
+        if(nb_blocks == 0) written = written && write_at(file, &position, header.matrices, NULL, 0);
+        written = written && write_at(file, &position, header.labels, labels, labels_size);
+        written = (fclose(file) == 0) && written;
+    }
+    if(!written) perror(path);
+
+    free_custom(records);
+    free(qubits);
+    free(conditions);
+    free(labels);
+    free(blocks);
+    free(block_entries);
+    return written;
+}
+
+/* -------- mapping -------- */
+
+// Offset and count of a section inside the file
+static bool section_fits(const CircuitFileHeader *header, uint64_t offset, uint64_t count, size_t size, size_t alignment) {
+    return offset % alignment == 0 && offset <= header->file_size && count <= (header->file_size - offset) / size;
+}
+
+static const char *check_header(const CircuitFileHeader *header, uint64_t file_size) {
+    if(file_size < sizeof(CircuitFileHeader) || memcmp(header->magic, CIRCUIT_FILE_MAGIC, sizeof(header->magic)) != 0) {
+        return "not a circuit file";
+    }
+    if(header->byte_order != CIRCUIT_FILE_BYTE_ORDER) return "written with another byte order";
+    if(header->version != CIRCUIT_FILE_VERSION) return "unsupported version";
+    if(header->file_size != file_size) return "truncated";
+    if(header->nb_qbits < 0 || header->nb_gates < 0 || header->nb_conditions < 0) return "invalid sizes";
+    if(!section_fits(header, header->gates, header->nb_gates, sizeof(CircuitFileGate), 8)
+       || !section_fits(header, header->conditions, header->nb_conditions, sizeof(GateCondition), 8)
+       || !section_fits(header, header->qubits, header->nb_qubit_entries, sizeof(int32_t), 4)
+       || !section_fits(header, header->matrices, header->nb_matrix_entries, sizeof(double complex), 16)
+       || !section_fits(header, header->labels, header->labels_size, 1, 1)) {
+        return "section out of the file";
+    }
+    if(header->labels_size > 0 && ((const char *)header)[header->labels + header->labels_size - 1] != '\0') return "unterminated label";
+    return NULL;
+}
+
+static bool qubit_valid(const CircuitFileHeader *header, int32_t qubit) {
+    return qubit >= 0 && qubit < header->nb_qbits;
+}
+
+// The gate of a record, its pointers into the mapping. An error message if the record is invalid
+static const char *map_gate(const CircuitFileHeader *header, const char *base, const CircuitFileGate *record, Gate *gate) {
+    const GateCondition *conditions = (const GateCondition *)(base + header->conditions);
+    int32_t *qubits = (int32_t *)(base + header->qubits);
+    double complex *matrices = (double complex *)(base + header->matrices);
+    char *labels = (char *)(base + header->labels);
+
+    if(record->condition < -1 || record->condition >= header->nb_conditions) return "invalid condition";
+    if(record->label < -1 || (record->label >= 0 && (uint64_t)record->label >= header->labels_size)) return "invalid label";
+    char *label = (record->label >= 0) ? labels + record->label : NULL;
+    gate->condition = (record->condition >= 0) ? &conditions[record->condition] : NULL;
+    switch(record->class) {
+        case MEAS:
+            if(!qubit_valid(header, record->a) || record->b < 0) return "invalid measurement";
+            gate->class = MEAS;
+            gate->gate.measure.qbit = record->a;
+            gate->gate.measure.cbit = record->b;
+            return NULL;
+        case UNITARY:
+            if(!qubit_valid(header, record->a) || record->type < GATE_I || record->type > GATE_PHASE) return "invalid gate";
+            gate->class = UNITARY;
+            gate->gate.unitary.qbit = record->a;
+            gate->gate.unitary.type = record->type;
+            gate->gate.unitary.phase = record->phase;
+            return NULL;
+        case CONTROL:
+            if(!qubit_valid(header, record->a) || !qubit_valid(header, record->b) || record->a == record->b
+               || record->type < GATE_I || record->type > GATE_PHASE) {
+                return "invalid controlled gate";
+            }
+            gate->class = CONTROL;
+            gate->gate.control.control = record->a;
+            gate->gate.control.qbit = record->b;
+            gate->gate.control.type = record->type;
+            gate->gate.control.phase = record->phase;
+            return NULL;
+        case CUSTOM:
+        case DIAGONAL: {
+            int nb_qbits = record->a;
+            if(nb_qbits < 1 || nb_qbits > header->nb_qbits || nb_qbits > 30) return "invalid number of qubits";
+            uint64_t entries = (record->class == CUSTOM) ? (1ULL << nb_qbits) << nb_qbits : 1ULL << nb_qbits;
+            if(record->qubits < 0 || (uint64_t)record->qubits + nb_qbits > header->nb_qubit_entries
+               || record->matrix < 0 || (uint64_t)record->matrix > header->nb_matrix_entries
+               || entries > header->nb_matrix_entries - record->matrix) {
+                return "qubits or matrix out of their section";
+            }
+            int32_t *qbits = qubits + record->qubits;
+            for(int i = 0; i < nb_qbits; i++) {
+                if(!qubit_valid(header, qbits[i])) return "invalid qubit";
+                for(int j = 0; j < i; j++) if(qbits[i] == qbits[j]) return "repeated qubit";
+            }
+            if(record->class == CUSTOM) {
+                gate->class = CUSTOM;
+                gate->gate.custom.nb_qbits = nb_qbits;
+                gate->gate.custom.qbits = qbits;
+                gate->gate.custom.mat = matrices + record->matrix;
+                gate->gate.custom.label = label;
+            } else {
+                gate->class = DIAGONAL;
+                gate->gate.diagonal.nb_qbits = nb_qbits;
+                gate->gate.diagonal.qbits = qbits;
+                gate->gate.diagonal.phases = matrices + record->matrix;
+                gate->gate.diagonal.label = label;
+            }
+            return NULL;
+        }
+    }
+    return "unknown gate class";
+}
+
+QuantumCircuit *circuit_map(const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat status;
+    if(fd < 0 || fstat(fd, &status) != 0) {
+        perror(path);
+        if(fd >= 0) close(fd);
+        return NULL;
+    }
+    uint64_t size = status.st_size;
+    // Private : a kernel writing into a matrix would only change its own copy of the page
+    void *mapping = (size > 0) ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(mapping == MAP_FAILED) {
+        if(size == 0) fprintf(stderr, "%s: not a circuit file\n", path);
+        else perror(path);
+        return NULL;
+    }
+
+    const CircuitFileHeader *header = mapping;
+    const char *error = check_header(header, size);
+    if(error) {
+        fprintf(stderr, "%s: %s\n", path, error);
+        munmap(mapping, size);
+        return NULL;
+    }
+    for(int i = 0; i < header->nb_conditions; i++) {
+        const GateCondition *condition = (const GateCondition *)((char *)mapping + header->conditions) + i;
+        if(condition->first < 0 || condition->width < 1 || condition->width > 64) {
+            fprintf(stderr, "%s: invalid condition\n", path);
+            munmap(mapping, size);
+            return NULL;
+        }
+    }
+
+    QuantumCircuit *circuit = circuit_create(header->nb_qbits);
+    circuit->mapping = mapping;
+    circuit->mapping_size = size;
+    circuit_reserve(circuit, header->nb_gates);
+    const CircuitFileGate *records = (const CircuitFileGate *)((char *)mapping + header->gates);
+    for(int g = 0; g < header->nb_gates; g++) {
+        error = map_gate(header, mapping, &records[g], &circuit->gates[g]);
+        if(error) {
+            fprintf(stderr, "%s: gate %d : %s\n", path, g, error);
+            circuit_free(circuit);
+            return NULL;
+        }
+        circuit->nb_gates++;
+    }
+    return circuit;
+}
@@ -0,0 +1,64 @@
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include "circuit.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* -------- binary circuit files --------
+   A circuit saved once and mapped back by any later run, instead of being
+   built again : a header, a table of fixed-size gate records, then the
+   conditions, the qubit lists, the matrices / diagonals (64 bytes aligned)
+   and the labels, each section contiguous. The records refer to the other
+   sections by offsets, a matrix used by several gates (shared matrices)
+   is stored once.
+   circuit_map maps the file and the gates of the circuit point into the
+   mapping : matrices, qubit lists and labels are neither read nor copied
+   at load time (pages come from the page cache when a kernel or
+   circuit_compile first reads them). The mapping is private, released by
+   circuit_free. Native byte order, checked at load time.
+*/
+
+#define CIRCUIT_FILE_MAGIC "QSIMCIRC"
+#define CIRCUIT_FILE_VERSION 1
+#define CIRCUIT_FILE_BYTE_ORDER 0x01020304u
+#define CIRCUIT_FILE_ALIGNMENT 64
+
+typedef struct {
+    char magic[8];              // CIRCUIT_FILE_MAGIC, without its NUL
+    uint32_t version;
+    uint32_t byte_order;        // CIRCUIT_FILE_BYTE_ORDER as written
+    int32_t nb_qbits;
+    int32_t nb_gates;
+    int32_t nb_conditions;
+    int32_t reserved;
+    uint64_t gates;             // Offsets of the sections in the file
+    uint64_t conditions;
+    uint64_t qubits;
+    uint64_t matrices;
+    uint64_t labels;
+    uint64_t nb_qubit_entries;  // int32_t
+    uint64_t nb_matrix_entries; // double complex
+    uint64_t labels_size;       // Bytes, NUL terminated strings
+    uint64_t file_size;
+} CircuitFileHeader;
+
+typedef struct {
+    int32_t class;              // MEAS, UNITARY, CONTROL, CUSTOM, DIAGONAL (builder/internal.h)
+    int32_t type;               // SingleBitGate of UNITARY and CONTROL
+    int32_t a;                  // Qubit (MEAS, UNITARY), control (CONTROL), number of qubits (CUSTOM, DIAGONAL)
+    int32_t b;                  // Classical bit (MEAS), target (CONTROL)
+    int32_t condition;          // Index in the conditions, -1 : none
+    int32_t label;              // Offset in the labels, -1 : none
+    double phase;               // UNITARY and CONTROL
+    int64_t qubits;             // CUSTOM, DIAGONAL : first entry of the qubit list
+    int64_t matrix;             // CUSTOM, DIAGONAL : first entry of the matrix / diagonal
+} CircuitFileGate;              // Conditions : GateCondition records (builder/gaterep.h)
+
+// False (and errno / a message) if the file can't be written
+bool circuit_save(QuantumCircuit *circuit, const char *path);
+// NULL if the file can't be mapped or isn't a valid circuit file (message on stderr)
+QuantumCircuit *circuit_map(const char *path);
+
+#endif
@@ -0,0 +1,156 @@
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../simulator/gates.h"
+#include "../utils/utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <complex.h>
+
+#include <omp.h>
+
+/* Times every gate kernel on a n-qubit state, once on a single thread and
+   once with all the OpenMP threads, and prints the speedup.
+   Usage : benchmark [nqubits ...]   (default : 20 24 28) */
+
+typedef struct {
+    double single;
+    double h;
+    double x;
+    double phase;
+    double controlled;
+    double cphase;
+    double two;
+    double custom;
+    double diagonal;
+    double measure;
+    double joint;
+} KernelTimes;
+
+KernelTimes time_kernels(amplitude *state, int n, int threads) {
+    omp_set_num_threads(threads);
+    KernelTimes times;
+    double complex h[4], x[4];
+    gate_h(h);
+    gate_x(x);
+
+    double complex swap[16] = {
+        1, 0, 0, 0,
+        0, 0, 1, 0,
+        0, 1, 0, 0,
+        0, 0, 0, 1
+    };
+
+    /* Target on every qubit so that all the strides are covered */
+    double t0 = now_seconds();
+    for(int t = 0; t < n; t++) apply_single_qubit_inplace(state, n, t, h);
+    times.single = (now_seconds() - t0) / n;
+
+    t0 = now_seconds();
+    for(int t = 0; t < n; t++) apply_h_inplace(state, n, t);
+    times.h = (now_seconds() - t0) / n;
+
+    t0 = now_seconds();
+    for(int t = 0; t < n; t++) apply_x_inplace(state, n, t);
+    times.x = (now_seconds() - t0) / n;
+
+    t0 = now_seconds();
+    for(int t = 0; t < n; t++) apply_phase_inplace(state, n, t, I);
+    times.phase = (now_seconds() - t0) / n;
+
+    t0 = now_seconds();
+    for(int t = 0; t < n; t++) apply_controlled_u_inplace(state, n, t, (t + 1) % n, x);
+    times.controlled = (now_seconds() - t0) / n;
+
+    t0 = now_seconds();
+    for(int t = 0; t < n; t++) apply_controlled_phase_inplace(state, n, t, (t + 1) % n, I);
+    times.cphase = (now_seconds() - t0) / n;
+
+    t0 = now_seconds();
+    for(int t = 0; t < n; t++) apply_two_qubit_inplace(state, n, t, (t + 1) % n, swap);
+    times.two = (now_seconds() - t0) / n;
+
+    /* 3-qubit custom gate (Toffoli-like permutation) */
+    double complex perm[64] = {0};
+    for(int r = 0; r < 6; r++) perm[r * 8 + r] = 1.0;
+    perm[6 * 8 + 7] = 1.0;
+    perm[7 * 8 + 6] = 1.0;
+    t0 = now_seconds();
+    for(int t = 0; t < n; t++) {
+        int targets[3] = {t, (t + 1) % n, (t + 2) % n};
+        apply_custom_inplace(state, n, targets, 3, perm);
+    }
+    times.custom = (now_seconds() - t0) / n;
+
+    /* Diagonal gate on all the qubits (Grover oracle-like phases) */
+    uint64_t dim = 1ULL << n;
+    double complex *phases = malloc_custom(dim * sizeof(double complex));
+    int *all = malloc_custom(n * sizeof(int));
+    for(uint64_t i = 0; i < dim; i++) phases[i] = (i % 3) ? 1.0 : -1.0;
+    for(int t = 0; t < n; t++) all[t] = t;
+    t0 = now_seconds();
+    apply_diagonal_inplace(state, n, all, n, phases);
+    times.diagonal = now_seconds() - t0;
+    free_custom(all);
+    free_custom(phases);
+
+    t0 = now_seconds();
+    for(int t = 0; t < n; t++) measure_qubit_inplace(state, n, t, NULL);
+    times.measure = (now_seconds() - t0) / n;
+
+    /* Joint readout of (up to) MEASURE_JOINT_QUBITS qubits, to compare with as many single measurements */
+    int k = (n < MEASURE_JOINT_QUBITS) ? n : MEASURE_JOINT_QUBITS;
+    int *targets = malloc_custom(k * sizeof(int));
+    for(int t = 0; t < k; t++) targets[t] = n - 1 - t;
+    t0 = now_seconds();
+    measure_qubits_inplace(state, n, targets, k, NULL);
+    times.joint = now_seconds() - t0;
+    free_custom(targets);
+
+    return times;
+}
+
+void print_row(const char *name, double serial, double parallel) {
+    printf("  %-12s %10.4f s %10.4f s %8.2fx\n", name, serial, parallel, serial / parallel);
+}
+
+int main(int argc, char *argv[]) {
+    int default_sizes[] = {20, 24, 28};
+    int nb_sizes = (argc > 1) ? argc - 1 : 3;
+    int max_threads = omp_get_max_threads();
+
+    printf("Threads : %d, parallel threshold : %d qubits\n", max_threads, gates_get_parallel_threshold());
+
+    for(int i = 0; i < nb_sizes; i++) {
+        int n = (argc > 1) ? atoi(argv[i + 1]) : default_sizes[i];
+        QuantumRegister *qregister = qregister_create(n);
+        amplitude *state = qregister_get_statevector(qregister);
+
+        KernelTimes serial = time_kernels(state, n, 1);
+        KernelTimes parallel = time_kernels(state, n, max_threads);
+
+        printf("n = %d (%.2f GiB), time per gate :\n", n, (double)(1ULL << n) * sizeof(amplitude) / (1 << 30));
+        printf("  %-12s %12s %12s %9s\n", "kernel", "1 thread", "parallel", "speedup");
+        print_row("single", serial.single, parallel.single);
+        print_row("h", serial.h, parallel.h);
+        print_row("x", serial.x, parallel.x);
+        print_row("phase", serial.phase, parallel.phase);
+        print_row("controlled", serial.controlled, parallel.controlled);
+        print_row("cphase", serial.cphase, parallel.cphase);
+        print_row("two-qubit", serial.two, parallel.two);
+        print_row("custom (3q)", serial.custom, parallel.custom);
+        print_row("diagonal (n)", serial.diagonal, parallel.diagonal);
+        print_row("measure", serial.measure, parallel.measure);
+        char label[32];
+        int k = (n < MEASURE_JOINT_QUBITS) ? n : MEASURE_JOINT_QUBITS;
+        snprintf(label, sizeof(label), "measure x%d", k);
+        print_row(label, k * serial.measure, k * parallel.measure);
+        snprintf(label, sizeof(label), "joint (%d)", k);
+        print_row(label, serial.joint, parallel.joint);
+
+        qregister_free(qregister);
+    }
+
+    return EXIT_SUCCESS;
+}
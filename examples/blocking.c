@@ -0,0 +1,128 @@
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../simulator/opti_sim.h"
+#include "../simulator/blocking.h"
+#include "../utils/utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <complex.h>
+#include <math.h>
+
+#include <omp.h>
+
+/* Layers of H, phases and CNOT ladders on the last `width` qubits (the small
+   strides), run once streaming every gate over the state and then with cache
+   blocking for several chunk sizes. The same layers on the first `width`
+   qubits (the large strides) are then run with and without the qubit
+   remapping. The effective bandwidth counts one read and one write of the
+   whole state per gate ; the times include undoing the remapping.
+   Usage : blocking [nqubits] [width] [layers]   (default : 24 16 4) */
+
+#define TOLERANCE (4096 * AMPLITUDE_EPSILON) // 1e-12 in double precision
+
+// Layers on the qubits first .. first + width - 1
+void build_circuit(QuantumCircuit *qc, int n, int first, int width, int layers) {
+    int other = (first == 0) ? n - 1 : 0; // A qubit outside the layers
+    for(int l = 0; l < layers; l++) {
+        for(int q = first; q < first + width; q++) {
+            add_unitary_gate(qc, q, GATE_H, 0.0);
+            add_unitary_gate(qc, q, GATE_PHASE, 0.1 * (q + l + 1));
+        }
+        for(int q = first; q < first + width - 1; q++) add_control_gate(qc, q, q + 1, GATE_X, 0.0);
+        // One gate on another qubit between the layers
+        add_unitary_gate(qc, other, GATE_H, 0.0);
+    }
+}
+
+// Execution time, including putting the qubits back in the logical order
+double run(QuantumCircuit *qc, QuantumRegister *qregister, ExecOptions *options) {
+    double t0 = now_seconds();
+    circuit_execute_opts(qc, qregister, NULL, options);
+    qregister_restore_layout(qregister);
+    return now_seconds() - t0;
+}
+
+double max_error(QuantumRegister *a, QuantumRegister *b, uint64_t dim) {
+    amplitude *x = qregister_get_statevector(a);
+    amplitude *y = qregister_get_statevector(b);
+    double error = 0.0;
+    for(uint64_t i = 0; i < dim; i++) {
+        double e = cabs(x[i] - y[i]);
+        if(e > error) error = e;
+    }
+    return error;
+}
+
+int main(int argc, char *argv[]) {
+    int n = (argc > 1) ? atoi(argv[1]) : 24;
+    int width = (argc > 2) ? atoi(argv[2]) : 16;
+    int layers = (argc > 3) ? atoi(argv[3]) : 4;
+    if(width > n) width = n;
+    uint64_t dim = 1ULL << n;
+    double bytes = (double)dim * sizeof(amplitude);
+
+    QuantumCircuit *qc = circuit_create(n);
+    build_circuit(qc, n, n - width, width, layers);
+
+    ExecOptions options = exec_options_default();
+    ExecStats stats;
+    options.stats = &stats;
+    // The layers stay sparse from |0...0> : the statevector kernels are measured
+    options.sparse_fill = 0.0;
+
+    QuantumRegister *reference = qregister_create(n);
+    options.block_qubits = 0;
+    double time = run(qc, reference, &options);
+    int passes = stats.passes;
+    printf("n = %d (%.2f GiB), %d threads, %d gates (%d passes)\n", n, bytes / (1 << 30), omp_get_max_threads(), stats.gates, passes);
+    printf("\nlayers on qubits %d to %d\n", n - width, n - 1);
+    printf("%-14s %8s %6s %10s %10s %10s %12s\n", "chunk", "blocked", "swaps", "time (s)", "GB/s", "speedup", "max error");
+    printf("%-14s %8s %6s %10.4f %10.2f %10s %12s\n", "streaming", "-", "-", time, 2 * bytes * passes / time / 1e9, "1.00x", "-");
+
+    int failures = 0;
+    for(int b = BLOCK_QUBITS - 4; b <= BLOCK_QUBITS + 4; b += 2) {
+        if(b >= n) break;
+        options.block_qubits = b;
+        QuantumRegister *qregister = qregister_create(n);
+        double blocked_time = run(qc, qregister, &options);
+        double error = max_error(reference, qregister, dim);
+        if(error > TOLERANCE) failures++;
+
+        char label[32];
+        snprintf(label, sizeof(label), "2^%d%s", b, (b == BLOCK_QUBITS) ? " (def)" : "");
+        printf("%-14s %8d %6d %10.4f %10.2f %9.2fx %12.2e%s\n", label, stats.blocked_gates, stats.swaps, blocked_time,
+               2 * bytes * passes / blocked_time / 1e9, time / blocked_time, error, (error > TOLERANCE) ? "  MISMATCH" : "");
+        qregister_free(qregister);
+    }
+    qregister_free(reference);
+    circuit_free(qc);
+
+    // Same layers on the large strides : blocked only once remapped
+    qc = circuit_create(n);
+    build_circuit(qc, n, 0, width, layers);
+    reference = qregister_create(n);
+    options.block_qubits = 0;
+    time = run(qc, reference, &options);
+    passes = stats.passes;
+    printf("\nlayers on qubits 0 to %d\n", width - 1);
+    printf("%-14s %8s %6s %10.4f %10.2f %10s %12s\n", "streaming", "-", "-", time, 2 * bytes * passes / time / 1e9, "1.00x", "-");
+
+    for(int remap = 0; remap <= 1; remap++) {
+        options.block_qubits = BLOCK_QUBITS;
+        options.remap = remap;
+        QuantumRegister *qregister = qregister_create(n);
+        double blocked_time = run(qc, qregister, &options);
+        double error = max_error(reference, qregister, dim);
+        if(error > TOLERANCE) failures++;
+
+        printf("%-14s %8d %6d %10.4f %10.2f %9.2fx %12.2e%s\n", remap ? "2^16 remap" : "2^16 no remap", stats.blocked_gates, stats.swaps,
+               blocked_time, 2 * bytes * passes / blocked_time / 1e9, time / blocked_time, error, (error > TOLERANCE) ? "  MISMATCH" : "");
+        qregister_free(qregister);
+    }
+
+    qregister_free(reference);
+    circuit_free(qc);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
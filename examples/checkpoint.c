@@ -0,0 +1,166 @@
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../simulator/opti_sim.h"
+#include "../simulator/checkpoint.h"
+#include "../utils/utils.h"
+#include "../utils/rng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <complex.h>
+#include <math.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+/* Checkpoints of a long execution : a child process runs the circuit with a
+   checkpoint every gates / 8 gates and is killed (SIGKILL) once one past the
+   middle is on disk ; circuit_execute_resume continues from it and must end
+   in the same state and classical bits as an uninterrupted run. Then the
+   overhead of checkpoints every `seconds`, capped at `overhead` of the run
+   time, and a corrupted checkpoint, which must be refused.
+   Usage : checkpoint [nqubits] [gates] [seconds] [overhead]   (default : 22 1200 0.5 0.05) */
+
+#define CHECKPOINT "logs/checkpoint.qsim"
+#define CIRCUIT_SEED 0xc4e
+#define RNG_SEED 0x7e57
+
+// Random gates, two measurements in the middle and a correction conditioned on them
+QuantumCircuit *build_circuit(int n, int gates) {
+    Rng rng;
+    rng_seed(&rng, CIRCUIT_SEED);
+    QuantumCircuit *qc = circuit_create(n);
+    for(int g = 0; g < gates; g++) {
+        int q = (int)rng_below(&rng, n), r = (q + 1 + (int)rng_below(&rng, n - 1)) % n;
+        if(g == gates / 2) {
+            add_measure(qc, 0, 0);
+            add_measure(qc, n - 1, 1);
+            circuit_set_condition(qc, 0, 2, 1);
+            add_unitary_gate(qc, n / 2, GATE_X, 0.0);
+            circuit_set_condition(qc, 0, 0, 0);
+        }
+        switch(rng_below(&rng, 4)) {
+            case 0: add_unitary_gate(qc, q, GATE_H, 0.0); break;
+            case 1: add_unitary_gate(qc, q, GATE_PHASE, 2 * M_PI * rng_uniform(&rng)); break;
+            case 2: add_control_gate(qc, q, r, GATE_X, 0.0); break;
+            case 3: add_control_gate(qc, q, r, GATE_PHASE, 2 * M_PI * rng_uniform(&rng)); break;
+        }
+    }
+    return qc;
+}
+
+// Gate index of the checkpoint on disk, -1 if none
+long checkpoint_gate(void) {
+    CheckpointHeader header;
+    int fd = open(CHECKPOINT, O_RDONLY);
+    if(fd < 0) return -1;
+    long gate = (pread(fd, &header, sizeof(header), 0) == sizeof(header)) ? (long)header.gate : -1;
+    close(fd);
+    return gate;
+}
+
+bool same_state(QuantumRegister *a, ClassicalRegister *ca, QuantumRegister *b, ClassicalRegister *cb, int n) {
+    qregister_restore_layout(a);
+    qregister_restore_layout(b);
+    bool same = memcmp(qregister_get_statevector(a), qregister_get_statevector(b), (1ULL << n) * sizeof(amplitude)) == 0;
+    for(int i = 0; i < 2; i++) same = same && cregister_get_bit(ca, i) == cregister_get_bit(cb, i);
+    return same;
+}
+
+int main(int argc, char *argv[]) {
+    int n = (argc > 1) ? atoi(argv[1]) : 22;
+    int gates = (argc > 2) ? atoi(argv[2]) : 1200;
+    double seconds = (argc > 3) ? atof(argv[3]) : 0.5;
+    double overhead = (argc > 4) ? atof(argv[4]) : 0.05;
+    int failures = 0;
+    QuantumCircuit *qc = build_circuit(n, gates);
+    Rng rng;
+    ExecStats stats;
+    ExecOptions options = exec_options_default();
+    options.rng = &rng;
+    options.stats = &stats;
+    options.checkpoint_file = CHECKPOINT;
+    unlink(CHECKPOINT);
+
+    // Forked before any thread exists : the child runs until it is killed
+    options.checkpoint_gates = gates / 8;
+    options.checkpoint_overhead = 0.0;
+    pid_t child = fork();
+    if(child == 0) {
+        rng_seed(&rng, RNG_SEED);
+        QuantumRegister *qregister = qregister_create(n);
+        ClassicalRegister *cregister = cregister_create(2);
+        circuit_execute_opts(qc, qregister, cregister, &options);
+        _exit(EXIT_SUCCESS);
+    }
+    long killed_at = -1;
+    while(killed_at <= gates / 2) {
+        usleep(10000);
+        killed_at = checkpoint_gate();
+        if(waitpid(child, NULL, WNOHANG) == child) break;
+    }
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+
+    // Resumed from the last checkpoint of the child, against an uninterrupted run
+    QuantumRegister *resumed = qregister_create(n), *reference = qregister_create(n);
+    ClassicalRegister *resumed_bits = cregister_create(2), *reference_bits = cregister_create(2);
+    rng_seed(&rng, 0);  // Overwritten by the checkpoint
+    double resume_time = circuit_execute_resume(qc, resumed, resumed_bits, &options);
+    int resumed_gate = stats.resumed_gate;
+    options.checkpoint_file = NULL;
+    rng_seed(&rng, RNG_SEED);
+    double reference_time = circuit_execute_opts(qc, reference, reference_bits, &options);
+    bool same = resume_time >= 0.0 && same_state(resumed, resumed_bits, reference, reference_bits, n);
+    failures += !same;
+    printf("n = %d, %d gates (%d passes)\n", n, circuit_size(qc), stats.passes);
+    printf("killed with a checkpoint at gate %ld, resumed at gate %d in %.3f s : final state %s\n", killed_at, resumed_gate,
+           resume_time, same ? "bitwise equal" : "DIFFERENT");
+
+    // Overhead of periodic checkpoints
+    QuantumRegister *checkpointed = qregister_create(n);
+    ClassicalRegister *checkpointed_bits = cregister_create(2);
+    options.checkpoint_file = CHECKPOINT;
+    options.checkpoint_gates = 0;
+    options.checkpoint_seconds = seconds;
+    options.checkpoint_overhead = overhead;
+    rng_seed(&rng, RNG_SEED);
+    double checkpointed_time = circuit_execute_opts(qc, checkpointed, checkpointed_bits, &options);
+    same = same_state(checkpointed, checkpointed_bits, reference, reference_bits, n);
+    failures += !same || stats.checkpoint_time > overhead * checkpointed_time;
+    printf("\n%-28s %10s %12s %10s\n", "execution", "time (s)", "checkpoints", "overhead");
+    printf("%-28s %10.3f %12s %10s\n", "without checkpoints", reference_time, "-", "-");
+    printf("%-28s %10.3f %12d %9.1f%%  (%.3f s writing, cap %.0f%%)%s\n", "checkpoint every period", checkpointed_time,
+           stats.checkpoints, 100.0 * stats.checkpoint_time / checkpointed_time, stats.checkpoint_time, 100.0 * overhead,
+           same ? "" : "  DIFFERENT");
+
+    // A flipped bit in the statevector is caught
+    int fd = open(CHECKPOINT, O_RDWR);
+    if(fd >= 0) {
+        CheckpointHeader header;
+        unsigned char byte;
+        if(pread(fd, &header, sizeof(header), 0) == sizeof(header) && pread(fd, &byte, 1, header.file_size / 2) == 1) {
+            byte ^= 0x10;
+            if(pwrite(fd, &byte, 1, header.file_size / 2) != 1) failures++;
+        }
+        close(fd);
+        double refused = circuit_execute_resume(qc, resumed, resumed_bits, &options);
+        failures += refused >= 0.0;
+        printf("corrupted checkpoint %s\n", (refused < 0.0) ? "refused" : "ACCEPTED");
+    }
+    unlink(CHECKPOINT);
+
+    qregister_free(resumed);
+    qregister_free(reference);
+    qregister_free(checkpointed);
+    cregister_free(resumed_bits);
+    cregister_free(reference_bits);
+    cregister_free(checkpointed_bits);
+    circuit_free(qc);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
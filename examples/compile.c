@@ -0,0 +1,123 @@
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../simulator/opti_sim.h"
+#include "../simulator/program.h"
+#include "../utils/utils.h"
+#include "../utils/rng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <complex.h>
+#include <math.h>
+
+#include <omp.h>
+
+/* A long circuit on a few qubits, where setting up every gate costs as much
+   as applying it : time to build and free the circuit, circuit_execute_opts
+   on every run against a program compiled once (circuit_compile) and
+   executed `runs` times, then on one register per thread at once. All the
+   final states must match.
+   Usage : compile [nqubits] [gates] [runs]   (default : 10 1000000 5) */
+
+#define TOLERANCE (4096 * AMPLITUDE_EPSILON)
+#define CIRCUIT_SEED 0xc0de
+
+// Random layers of H, PHASE, CNOT and controlled phases
+void build_circuit(QuantumCircuit *qc, int n, int gates) {
+    Rng rng;
+    rng_seed(&rng, CIRCUIT_SEED);
+    for(int g = 0; g < gates; g++) {
+        int q = (int)(rng_next(&rng) % n);
+        int r = (q + 1 + (int)(rng_next(&rng) % (n - 1))) % n;
+        switch(rng_next(&rng) % 4) {
+            case 0: add_unitary_gate(qc, q, GATE_H, 0.0); break;
+            case 1: add_unitary_gate(qc, q, GATE_PHASE, 2 * M_PI * rng_uniform(&rng)); break;
+            case 2: add_control_gate(qc, q, r, GATE_X, 0.0); break;
+            case 3: add_control_gate(qc, q, r, GATE_PHASE, 2 * M_PI * rng_uniform(&rng)); break;
+        }
+    }
+}
+
+double max_error(QuantumRegister *a, QuantumRegister *b, int n) {
+    amplitude *x = qregister_get_statevector(a);
+    amplitude *y = qregister_get_statevector(b);
+    double error = 0.0;
+    for(uint64_t i = 0; i < (1ULL << n); i++) error = fmax(error, cabs(x[i] - y[i]));
+    return error;
+}
+
+int main(int argc, char *argv[]) {
+    int n = (argc > 1) ? atoi(argv[1]) : 10;
+    int gates = (argc > 2) ? atoi(argv[2]) : 1000000;
+    int runs = (argc > 3) ? atoi(argv[3]) : 5;
+    int threads = omp_get_max_threads();
+    int failures = 0;
+
+    double t0 = now_seconds();
+    QuantumCircuit *qc = circuit_create(n);
+    build_circuit(qc, n, gates);
+    double build = now_seconds() - t0;
+    printf("n = %d, %d gates, %d runs, %d threads\n", n, gates, runs, threads);
+    printf("%-22s %12s %14s %10s\n", "execution", "time (s)", "ns per gate", "max error");
+    printf("%-22s %12.3f %14.1f %10s\n", "circuit build", build, 1e9 * build / gates, "-");
+
+    // Every gate on the statevector, as the program runs them
+    ExecStats stats;
+    ExecOptions options = exec_options_default();
+    options.sparse_fill = 0.0;
+    QuantumRegister *reference = NULL;
+    double interpreted = 0.0;
+    for(int r = 0; r < runs; r++) {
+        if(reference) qregister_free(reference);
+        reference = qregister_create(n);
+        interpreted += circuit_execute_opts(qc, reference, NULL, &options);
+    }
+    printf("%-22s %12.3f %14.1f %10s\n", "circuit_execute", interpreted / runs, 1e9 * interpreted / runs / gates, "-");
+
+    t0 = now_seconds();
+    options.stats = &stats;
+    Program *program = circuit_compile(qc, &options);
+    double compile = now_seconds() - t0;
+    printf("%-22s %12.3f %14.1f %10s  (%d ops, %d passes saved)\n", "circuit_compile", compile, 1e9 * compile / gates, "-",
+           program->size, stats.passes_saved);
+
+    QuantumRegister *qregister = NULL;
+    double compiled = 0.0;
+    for(int r = 0; r < runs; r++) {
+        if(qregister) qregister_free(qregister);
+        qregister = qregister_create(n);
+        compiled += program_execute(program, qregister, NULL, NULL);
+    }
+    double error = max_error(reference, qregister, n);
+    failures += error > TOLERANCE;
+    printf("%-22s %12.3f %14.1f %10.2e%s\n", "program_execute", compiled / runs, 1e9 * compiled / runs / gates, error,
+           (error > TOLERANCE) ? "  MISMATCH" : "");
+    qregister_free(qregister);
+
+    // The same program on one register per thread
+    QuantumRegister **registers = malloc_custom(threads * sizeof(QuantumRegister *));
+    for(int w = 0; w < threads; w++) registers[w] = qregister_create(n);
+    t0 = now_seconds();
+    #pragma omp parallel for schedule(static)
+    for(int w = 0; w < threads; w++) program_execute(program, registers[w], NULL, NULL);
+    double shared = now_seconds() - t0;
+    error = 0.0;
+    for(int w = 0; w < threads; w++) {
+        error = fmax(error, max_error(reference, registers[w], n));
+        qregister_free(registers[w]);
+    }
+    free_custom(registers);
+    failures += error > TOLERANCE;
+    printf("%-22s %12.3f %14.1f %10.2e%s\n", "shared by the threads", shared, 1e9 * shared / ((double)gates * threads), error,
+           (error > TOLERANCE) ? "  MISMATCH" : "");
+
+    printf("speedup of the compiled program : %.2fx\n", interpreted / compiled);
+    program_free(program);
+    qregister_free(reference);
+    t0 = now_seconds();
+    circuit_free(qc);
+    printf("circuit_free : %.3f ms\n", 1e3 * (now_seconds() - t0));
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
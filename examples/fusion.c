@@ -0,0 +1,79 @@
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../simulator/opti_sim.h"
+#include "../simulator/fusion.h"
+#include "../utils/utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <complex.h>
+#include <math.h>
+
+/* Runs a QFT (preceded by a layer of H and phases so the input isn't a basis
+   state) without fusion and with blocks of 1 to FUSION_MAX_QUBITS qubits,
+   and checks every fused result against the unfused one.
+   Usage : fusion [nqubits]   (default : 20) */
+
+#define TOLERANCE (4096 * AMPLITUDE_EPSILON) // 1e-12 in double precision
+
+void build_circuit(QuantumCircuit *qc, int n) {
+    for(int i = 0; i < n; i++) {
+        add_unitary_gate(qc, i, GATE_H, 0.0);
+        add_unitary_gate(qc, i, GATE_PHASE, 0.1 * (i + 1));
+    }
+    for(int i = 0; i < n; i++) {
+        add_unitary_gate(qc, i, GATE_H, 0.0);
+        for(int j = 2; j < n + 1 - i; j++) {
+            add_control_gate(qc, i + j - 1, i, GATE_PHASE, M_PI / (1 << (j - 1)));
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int n = (argc > 1) ? atoi(argv[1]) : 20;
+    uint64_t dim = 1ULL << n;
+
+    QuantumCircuit *qc = circuit_create(n);
+    build_circuit(qc, n);
+
+    ExecOptions options = exec_options_default();
+    ExecStats stats;
+    options.stats = &stats;
+    // The passes over the statevector are compared, none on a sparse state
+    options.sparse_fill = 0.0;
+
+    QuantumRegister *reference = qregister_create(n);
+    options.fuse = false;
+    double time = circuit_execute_opts(qc, reference, NULL, &options);
+    printf("n = %d, %d gates\n", n, stats.gates);
+    printf("%-10s %8s %10s %10s %12s\n", "fusion", "passes", "time (s)", "speedup", "max error");
+    printf("%-10s %8d %10.4f %10s %12s\n", "none", stats.passes, time, "1.00x", "-");
+
+    int failures = 0;
+    options.fuse = true;
+    for(int k = 1; k <= FUSION_MAX_QUBITS; k++) {
+        options.fusion_qubits = k;
+        QuantumRegister *qregister = qregister_create(n);
+        double fused_time = circuit_execute_opts(qc, qregister, NULL, &options);
+
+        amplitude *a = qregister_get_statevector(reference);
+        amplitude *b = qregister_get_statevector(qregister);
+        double error = 0.0;
+        for(uint64_t i = 0; i < dim; i++) {
+            double e = cabs(a[i] - b[i]);
+            if(e > error) error = e;
+        }
+        if(error > TOLERANCE) failures++;
+
+        char label[16];
+        snprintf(label, sizeof(label), "k = %d", k);
+        printf("%-10s %8d %10.4f %9.2fx %12.2e%s\n", label, stats.passes, fused_time, time / fused_time, error,
+               (error > TOLERANCE) ? "  MISMATCH" : "");
+        qregister_free(qregister);
+    }
+
+    qregister_free(reference);
+    circuit_free(qc);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,6 +1,7 @@
 #include "../builder/circuit.h"
 #include "../simulator/opti_sim.h"
 #include "../utils/utils.h"
+#include "../utils/rng.h"
 #include "../utils/gnuplot.h"
 
 #include <stdio.h>
@@ -20,34 +21,39 @@ const int nb_marked = 1;
 
 int targets[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
 
-/* Size 256 x 256 in a single line so 65536 */
-double complex *ORACLE_MAT;
-double complex *S0_MAT;
-
-void init_matrices(int n) {
+/* Both operators are diagonal : only the 2^n phases are stored, once for
+   all the iterations (shared by their gates) */
+SharedMatrix *create_s0(int n) {
     unsigned long size = 1 << n;
 
     /* Init S0 = 2|0><0| - In */
-    S0_MAT = calloc_custom(size * size, sizeof(double complex));
+    double complex *phases = malloc_custom(size * sizeof(double complex));
     for(unsigned long i = 0; i < size; i++) {
-        S0_MAT[i * size + i] = -1.0;
+        phases[i] = -1.0;
     }
-    S0_MAT[0] = 1.0;
+    phases[0] = 1.0;
+    SharedMatrix *s0 = shared_diagonal_create(n, phases);
+    free_custom(phases);
+    return s0;
+}
 
-    /* Init Oracle */
-    ORACLE_MAT = calloc_custom(size * size, sizeof(double complex));
+SharedMatrix *create_oracle(int n) {
+    unsigned long size = 1 << n;
+    double complex *phases = malloc_custom(size * sizeof(double complex));
     for(unsigned long i = 0; i < size; i++) {
-        ORACLE_MAT[i * size + i] = 1.0;
+        phases[i] = 1.0;
     }
     for(int i = 0; i < nb_marked; i++) {
-        int idx = marked[i];
-        ORACLE_MAT[idx * size + idx] = -1.0;
+        phases[marked[i]] = -1.0;
     }
+    SharedMatrix *oracle = shared_diagonal_create(n, phases);
+    free_custom(phases);
+    return oracle;
 }
 
 double run_grover(int n, int l) {
-    srand(time(NULL));
-    init_matrices(n);
+    SharedMatrix *oracle = create_oracle(n);
+    SharedMatrix *s0 = create_s0(n);
 
     ClassicalRegister *cregister = cregister_create(n);
     QuantumRegister *qregister = qregister_create(n);
@@ -58,11 +64,11 @@ double run_grover(int n, int l) {
     }
 
     for(int i = 0; i < l; i++) {
-        add_custom_gate(qc, n, targets, ORACLE_MAT, " ORA "); // Oracle
+        add_shared_gate(qc, targets, oracle, " ORA "); // Oracle
         for(int k = 0; k < n; k++) {
             add_unitary_gate(qc, k, GATE_H, 0.0);
         }
-        add_custom_gate(qc, n, targets, S0_MAT, "  S0 "); // Diffusion Operator
+        add_shared_gate(qc, targets, s0, "  S0 "); // Diffusion Operator
         for(int k = 0; k < n; k++) {
             add_unitary_gate(qc, k, GATE_H, 0.0);
         }
@@ -71,6 +77,9 @@ double run_grover(int n, int l) {
     for(int i = 0; i < n; i++) {
         add_measure(qc, i, i);
     }
+    // The circuit holds them now
+    shared_matrix_release(oracle);
+    shared_matrix_release(s0);
 
     double time = circuit_execute(qc, qregister, cregister, true);
     cregister_print(stdout, cregister);
@@ -85,14 +94,11 @@ double run_grover(int n, int l) {
 
     qregister_free(qregister);
 
-    free_custom(ORACLE_MAT);
-    free_custom(S0_MAT);
-
     return time;
 }
 
 int main() {
-    srand(time(NULL));
+    rng_seed(rng_default(), time(NULL));
 
     int n = 4;
     int N = 1 << n;
@@ -0,0 +1,97 @@
+#include "../builder/register.h"
+#include "../simulator/gates.h"
+#include "../simulator/simd.h"
+#include "../utils/utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <complex.h>
+#include <string.h>
+
+#include <omp.h>
+
+/* Effective bandwidth of the statevector kernels for every target qubit and
+   every instruction set the CPU supports, compared with the bandwidth of a
+   memcpy inside the state (read + write, the gates' access pattern).
+   Usage : kernel_bandwidth [nqubits] [repeats]   (default : 24 qubits, 5 repeats) */
+
+double peak_bandwidth(amplitude *state, uint64_t dim, int repeats) {
+    uint64_t half = dim / 2;
+    double best = 0.0;
+    for(int r = 0; r < repeats; r++) {
+        double t0 = now_seconds();
+        // Copy of the upper half onto the lower one, split between the threads
+        #pragma omp parallel
+        {
+            uint64_t nthreads = omp_get_num_threads(), id = omp_get_thread_num();
+            uint64_t lo = half * id / nthreads, hi = half * (id + 1) / nthreads;
+            memcpy(state + lo, state + half + lo, (hi - lo) * sizeof(amplitude));
+        }
+        double bw = (double)dim * sizeof(amplitude) / (now_seconds() - t0) / 1e9;
+        if(bw > best) best = bw;
+    }
+    return best;
+}
+
+// GB/s of amplitudes actually read and written
+double gbps(double bytes, double seconds) {
+    return bytes / seconds / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    int n = (argc > 1) ? atoi(argv[1]) : 24;
+    int repeats = (argc > 2) ? atoi(argv[2]) : 5;
+    uint64_t dim = 1ULL << n;
+    double bytes = (double)dim * sizeof(amplitude);
+
+    QuantumRegister *qregister = qregister_create(n);
+    amplitude *state = qregister_get_statevector(qregister);
+
+    double complex g[4] = {0.6, 0.8 * I, 0.8 * I, 0.6};
+    double peak = peak_bandwidth(state, dim, repeats);
+    printf("n = %d, %d threads, peak (memcpy) : %.2f GB/s\n", n, omp_get_max_threads(), peak);
+
+    SimdLevel supported = simd_detect();
+    for(int level = SIMD_SCALAR; level <= (int)supported; level++) {
+        simd_set_level(level);
+        printf("\n[%s] GB/s (%% of peak)\n", simd_level_name(level));
+        printf("%4s %16s %16s %16s %16s\n", "t", "single", "controlled", "diagonal", "measure");
+
+        for(int t = 0; t < n; t++) {
+            int c = (t + 1) % n;
+            // Best of `repeats` runs
+            double best[4] = {1e30, 1e30, 1e30, 1e30};
+            for(int r = 0; r < repeats; r++) {
+                double t0 = now_seconds();
+                apply_single_qubit_inplace(state, n, t, g);
+                double t1 = now_seconds();
+                apply_controlled_u_inplace(state, n, c, t, g);
+                double t2 = now_seconds();
+                apply_phase_inplace(state, n, t, I);
+                double t3 = now_seconds();
+                // Reduction of the |0> half, then the collapse
+                measure_qubit_inplace(state, n, t, NULL);
+                double t4 = now_seconds();
+                state[0] = 1.0; // Keep the state away from all zeros
+
+                double dt[4] = {t1 - t0, t2 - t1, t3 - t2, t4 - t3};
+                for(int k = 0; k < 4; k++) if(dt[k] < best[k]) best[k] = dt[k];
+            }
+
+            // Bytes read + written : all pairs, control = 1 half, |1> half, reduction + collapse
+            double bw[4] = {
+                gbps(2 * bytes, best[0]),
+                gbps(bytes, best[1]),
+                gbps(bytes, best[2]),
+                gbps(bytes / 2 + 2 * bytes, best[3])
+            };
+            printf("%4d", t);
+            for(int k = 0; k < 4; k++) printf(" %8.2f (%3.0f%%)", bw[k], 100.0 * bw[k] / peak);
+            printf("\n");
+        }
+    }
+
+    qregister_free(qregister);
+    return EXIT_SUCCESS;
+}
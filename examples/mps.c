@@ -0,0 +1,243 @@
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../simulator/opti_sim.h"
+#include "../simulator/mps.h"
+#include "../utils/utils.h"
+#include "../utils/rng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <complex.h>
+#include <math.h>
+
+/* The matrix product state backend : random circuits with gates on distant
+   qubits, custom and diagonal gates, measurements and conditions, run
+   exactly (no truncation) against the statevector ; a truncated brickwork
+   circuit, whose fidelity must match the one estimated from the discarded
+   weights ; then
+   a QFT of a basis state on nqubits, its amplitudes checked against
+   e^(2 i pi x y / 2^n) / 2^(n / 2), then a QFT of a product state and a
+   brickwork circuit on nqubits with the bond dimension capped.
+   Usage : mps [nqubits] [max bond] [depth]   (default : 80 64 10) */
+
+#define SMALL 14
+#define CIRCUIT_SEED 0x3a5
+// Against the statevector (single precision or double), and on the MPS alone (always double)
+#define TOLERANCE (4096 * AMPLITUDE_EPSILON)
+#define MPS_TOLERANCE 1e-10
+
+static double complex TOFFOLI[64];
+static double complex SWAP[16] = {
+    1, 0, 0, 0,
+    0, 0, 1, 0,
+    0, 1, 0, 0,
+    0, 0, 0, 1
+};
+
+QuantumCircuit *random_circuit(int n, int gates, int seed, int *qbits, double complex *phases) {
+    Rng rng;
+    rng_seed(&rng, seed);
+    QuantumCircuit *qc = circuit_create(n);
+    for(int g = 0; g < gates; g++) {
+        int q = (int)rng_below(&rng, n), r = (q + 1 + (int)rng_below(&rng, n - 1)) % n;
+        if(g % 32 == 31) {
+            add_measure(qc, q, 0);
+            circuit_set_condition(qc, 0, 1, 1);
+            add_unitary_gate(qc, r, GATE_H, 0.0);
+            circuit_set_condition(qc, 0, 0, 0);
+            continue;
+        }
+        switch(rng_below(&rng, 8)) {
+            case 0: add_unitary_gate(qc, q, GATE_H, 0.0); break;
+            case 1: add_unitary_gate(qc, q, GATE_PHASE, 2 * M_PI * rng_uniform(&rng)); break;
+            case 2: add_unitary_gate(qc, q, GATE_Y, 0.0); break;
+            case 3: add_control_gate(qc, q, r, GATE_X, 0.0); break;
+            case 4: add_control_gate(qc, q, r, GATE_PHASE, 2 * M_PI * rng_uniform(&rng)); break;
+            case 5:
+            case 6: {
+                // Three distinct qubits
+                qbits[0] = q;
+                qbits[1] = r;
+                do qbits[2] = (int)rng_below(&rng, n); while(qbits[2] == q || qbits[2] == r);
+                if(g % 2) add_custom_gate(qc, 3, qbits, TOFFOLI, "CCX");
+                else add_diagonal_gate(qc, 3, qbits, phases, "D3");
+                break;
+            }
+            case 7: add_custom_gate(qc, 2, (int[]){q, r}, SWAP, "SWAP"); break;
+        }
+    }
+    return qc;
+}
+
+// Layers of H and random phases on every qubit, then controlled phases on the even or odd neighbours
+QuantumCircuit *brickwork(int n, int depth, int seed) {
+    Rng rng;
+    rng_seed(&rng, seed);
+    QuantumCircuit *qc = circuit_create(n);
+    for(int layer = 0; layer < depth; layer++) {
+        for(int q = 0; q < n; q++) {
+            add_unitary_gate(qc, q, GATE_H, 0.0);
+            add_unitary_gate(qc, q, GATE_PHASE, 2 * M_PI * rng_uniform(&rng));
+        }
+        for(int q = layer % 2; q + 1 < n; q += 2) add_control_gate(qc, q, q + 1, GATE_PHASE, 2 * M_PI * rng_uniform(&rng));
+    }
+    return qc;
+}
+
+/* The QFT of qft.c, on the basis state x (bit q : qubit q) prepared first,
+   or on a product of random states (x NULL) */
+QuantumCircuit *qft(int n, const int *x, int seed) {
+    Rng rng;
+    rng_seed(&rng, seed);
+    QuantumCircuit *qc = circuit_create(n);
+    for(int q = 0; q < n; q++) {
+        if(x && x[q]) add_unitary_gate(qc, q, GATE_X, 0.0);
+        if(x) continue;
+        add_unitary_gate(qc, q, GATE_PHASE, 2 * M_PI * rng_uniform(&rng));
+        add_unitary_gate(qc, q, GATE_H, 0.0);
+        add_unitary_gate(qc, q, GATE_PHASE, 2 * M_PI * rng_uniform(&rng));
+    }
+    for(int i = 0; i < n; i++) {
+        add_unitary_gate(qc, i, GATE_H, 0.0);
+        for(int j = 2; j < n + 1 - i; j++) add_control_gate(qc, i + j - 1, i, GATE_PHASE, M_PI / pow(2.0, j - 1));
+    }
+    for(int i = 0; i < n / 2; i++) add_custom_gate(qc, 2, (int[]){i, n - 1 - i}, SWAP, "SWAP");
+    return qc;
+}
+
+// |<a|b>|^2 of two statevectors
+double overlap(QuantumRegister *a, QuantumRegister *b, int n) {
+    amplitude *x = qregister_get_statevector(a), *y = qregister_get_statevector(b);
+    double complex sum = 0.0;
+    for(uint64_t i = 0; i < (1ULL << n); i++) sum += conj(x[i]) * y[i];
+    return creal(sum) * creal(sum) + cimag(sum) * cimag(sum);
+}
+
+double max_error(QuantumRegister *a, QuantumRegister *b, int n) {
+    amplitude *x = qregister_get_statevector(a), *y = qregister_get_statevector(b);
+    double error = 0.0;
+    for(uint64_t i = 0; i < (1ULL << n); i++) error = fmax(error, cabs(x[i] - y[i]));
+    return error;
+}
+
+int main(int argc, char *argv[]) {
+    int n = (argc > 1) ? atoi(argv[1]) : 80;
+    int max_bond = (argc > 2) ? atoi(argv[2]) : 64;
+    int depth = (argc > 3) ? atoi(argv[3]) : 10;
+    int failures = 0;
+    for(int i = 0; i < 8; i++) {
+        for(int j = 0; j < 8; j++) TOFFOLI[i * 8 + j] = (i == j) != (i >= 6 && j >= 6);
+    }
+    Rng rng;
+    ExecOptions options = exec_options_default();
+    options.rng = &rng;
+
+    // Exact against the statevector
+    MpsOptions exact = {.max_bond = 1 << SMALL, .threshold = 0.0};
+    double worst = 0.0;
+    long swaps = 0;
+    int qbits[3];
+    double complex phases[8];
+    for(int i = 0; i < 8; i++) phases[i] = cexp(I * 0.7 * i * i);
+    for(int run = 0; run < 5; run++) {
+        QuantumCircuit *qc = random_circuit(SMALL, 300, CIRCUIT_SEED + run, qbits, phases);
+        QuantumRegister *reference = qregister_create(SMALL), *result = qregister_create(SMALL);
+        ClassicalRegister *ca = cregister_create(1), *cb = cregister_create(1);
+        Mps *mps = mps_create(SMALL, &exact);
+        rng_seed(&rng, run);
+        circuit_execute_mps(qc, mps, ca, &rng);
+        rng_seed(&rng, run);
+        circuit_execute_opts(qc, reference, cb, &options);
+        mps_get_statevector(mps, qregister_get_statevector(result));
+        worst = fmax(worst, max_error(result, reference, SMALL));
+        swaps += mps_get_stats(mps).swaps;
+        mps_free(mps);
+        qregister_free(reference);
+        qregister_free(result);
+        cregister_free(ca);
+        cregister_free(cb);
+        circuit_free(qc);
+    }
+    failures += worst > TOLERANCE;
+    printf("5 random circuits (%d qubits, 300 gates, %ld swaps) : MPS against statevector, max error %.2e%s\n", SMALL, swaps,
+           worst, (worst > TOLERANCE) ? "  MISMATCH" : "");
+
+    // Truncated : the fidelity against its estimate from the discarded weights
+    QuantumCircuit *qc = brickwork(SMALL, 3 * SMALL, CIRCUIT_SEED);
+    QuantumRegister *reference = qregister_create(SMALL), *result = qregister_create(SMALL);
+    circuit_execute_opts(qc, reference, NULL, &options);
+    MpsOptions capped = {.max_bond = 16, .threshold = 0.0};
+    Mps *mps = mps_create(SMALL, &capped);
+    circuit_execute_mps(qc, mps, NULL, NULL);
+    mps_get_statevector(mps, qregister_get_statevector(result));
+    MpsStats stats = mps_get_stats(mps);
+    double fidelity = overlap(reference, result, SMALL);
+    bool bounded = stats.truncation_error > 0.0 && fabs(fidelity - stats.fidelity) <= 0.1 * (1.0 - stats.fidelity);
+    failures += !bounded;
+    printf("brickwork (%d qubits, depth %d), bond <= %d : fidelity %.4f, estimated %.4f (truncation error %.3e)%s\n", SMALL,
+           3 * SMALL, capped.max_bond, fidelity, stats.fidelity, stats.truncation_error, bounded ? "" : "  MISMATCH");
+    mps_free(mps);
+    qregister_free(reference);
+    qregister_free(result);
+    circuit_free(qc);
+
+    // QFT of a basis state on n qubits
+    MpsOptions options_mps = mps_options_default();
+    options_mps.max_bond = max_bond;
+    int *x = malloc_custom(n * sizeof(int)), *y = malloc_custom(n * sizeof(int));
+    rng_seed(&rng, CIRCUIT_SEED);
+    for(int q = 0; q < n; q++) x[q] = (int)rng_below(&rng, 2);
+    qc = qft(n, x, 0);
+    mps = mps_create(n, &options_mps);
+    double time = circuit_execute_mps(qc, mps, NULL, NULL);
+    stats = mps_get_stats(mps);
+    // x y / 2^n mod 1, bit q weighing 2^(n - 1 - q)
+    double error = 0.0;
+    for(int sample = 0; sample < 100; sample++) {
+        for(int q = 0; q < n; q++) y[q] = (int)rng_below(&rng, 2);
+        long double turns = 0.0L;
+        for(int a = 0; a < n; a++) {
+            for(int b = 0; b < n && x[a]; b++) {
+                int exponent = n - 2 - a - b;
+                if(y[b] && exponent < 0) turns += ldexpl(1.0L, exponent);
+            }
+        }
+        turns = fmodl(turns, 1.0L);
+        double complex expected = cexp(2 * M_PI * I * (double)turns);
+        error = fmax(error, cabs(mps_amplitude(mps, y) * pow(2.0, n / 2.0) - expected));
+    }
+    failures += error > MPS_TOLERANCE;
+    printf("\n%-28s %10s %8s %10s %12s %14s\n", "circuit", "time (s)", "bond", "swaps", "SVDs", "trunc. error");
+    printf("%-28s %10.3f %8d %10ld %12ld %14.3e   amplitudes : max error %.2e%s\n", "QFT of a basis state", time, stats.max_bond,
+           stats.swaps, stats.svds, stats.truncation_error, error, (error > MPS_TOLERANCE) ? "  MISMATCH" : "");
+    mps_free(mps);
+    circuit_free(qc);
+
+    // QFT of a product state on n qubits
+    qc = qft(n, NULL, CIRCUIT_SEED);
+    mps = mps_create(n, &options_mps);
+    time = circuit_execute_mps(qc, mps, NULL, NULL);
+    stats = mps_get_stats(mps);
+    printf("%-28s %10.3f %8d %10ld %12ld %14.3e   fidelity ~ %.4f\n", "QFT of a product state", time, stats.max_bond,
+           stats.swaps, stats.svds, stats.truncation_error, stats.fidelity);
+    mps_free(mps);
+    circuit_free(qc);
+
+    // Brickwork on n qubits
+    qc = brickwork(n, depth, CIRCUIT_SEED);
+    mps = mps_create(n, &options_mps);
+    time = circuit_execute_mps(qc, mps, NULL, NULL);
+    stats = mps_get_stats(mps);
+    char name[64];
+    snprintf(name, sizeof(name), "brickwork, depth %d", depth);
+    printf("%-28s %10.3f %8d %10ld %12ld %14.3e   fidelity ~ %.4f\n", name, time, stats.max_bond, stats.swaps, stats.svds,
+           stats.truncation_error, stats.fidelity);
+    printf("(%d qubits, bond dimension <= %d, threshold %.0e)\n", n, max_bond, options_mps.threshold);
+    mps_free(mps);
+    circuit_free(qc);
+    free_custom(x);
+    free_custom(y);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../simulator/opti_sim.h"
+#include "../simulator/outofcore.h"
+#include "../utils/utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <complex.h>
+#include <math.h>
+
+/* The same circuit on a register in RAM and on registers mapped from a file,
+   streamed by I/O chunks of 2^chunk amplitudes : with the remapping (high
+   qubits swapped into the chunks) and without it (every gate on a high
+   qubit applied by exchange of chunks). The final states must match.
+   The page cache hides the disk while the file fits in RAM : the timings
+   mean something for states larger than the memory (drop the RAM run with
+   a last argument of 0).
+   Usage : outofcore [nqubits] [chunk qubits] [file] [ram]
+           (default : 24 20 logs/outofcore.state 1) */
+
+#define TOLERANCE (4096 * AMPLITUDE_EPSILON)
+
+// Cyclic shift of the 3-qubit basis states : a gate with 3 high qubits streams over the mapping
+double complex SHIFT[64];
+
+void build_circuit(QuantumCircuit *qc, int n) {
+    for(int i = 0; i < 8; i++) SHIFT[8 * ((i + 1) % 8) + i] = 1.0;
+    for(int l = 0; l < 3; l++) {
+        for(int q = 0; q < n; q++) {
+            add_unitary_gate(qc, q, GATE_H, 0.0);
+            add_unitary_gate(qc, q, GATE_PHASE, 0.1 * (q + l + 1));
+        }
+        for(int q = l % 2; q < n - 1; q += 2) add_control_gate(qc, q, q + 1, GATE_X, 0.0);
+        add_control_gate(qc, 0, n - 1, GATE_PHASE, 0.7);
+    }
+    int targets[3] = {0, 1, 2};
+    add_custom_gate(qc, 3, targets, SHIFT, "SHIFT");
+}
+
+double run(QuantumCircuit *qc, QuantumRegister *qregister, int chunk, bool remap, ExecStats *stats) {
+    ExecOptions options = exec_options_default();
+    options.chunk_qubits = chunk;
+    options.remap = remap;
+    options.stats = stats;
+    // The register in RAM on the statevector too, as the mapped ones
+    options.sparse_fill = 0.0;
+    return circuit_execute_opts(qc, qregister, NULL, &options);
+}
+
+int main(int argc, char *argv[]) {
+    int n = (argc > 1) ? atoi(argv[1]) : 24;
+    int chunk = (argc > 2) ? atoi(argv[2]) : n - 4;
+    const char *path = (argc > 3) ? argv[3] : "logs/outofcore.state";
+    bool ram = (argc > 4) ? atoi(argv[4]) != 0 : true;
+    uint64_t dim = 1ULL << n;
+
+    QuantumCircuit *qc = circuit_create(n);
+    build_circuit(qc, n);
+
+    printf("n = %d (%.2f GiB in %s), chunks of 2^%d amplitudes\n", n, (double)dim * sizeof(amplitude) / (1 << 30), path, chunk);
+    printf("%-18s %10s %9s %7s %10s %10s\n", "register", "time (s)", "segments", "swaps", "exchanges", "max error");
+
+    QuantumRegister *reference = NULL;
+    ExecStats stats;
+    if(ram) {
+        reference = qregister_create(n);
+        double time = run(qc, reference, chunk, true, &stats);
+        printf("%-18s %10.3f %9d %7d %10d %10s\n", "RAM", time, stats.segments, stats.swaps, stats.exchanges, "-");
+    }
+
+    int failures = 0;
+    for(int remap = 1; remap >= 0; remap--) {
+        QuantumRegister *qregister = qregister_create_mapped(n, path);
+        if(!qregister) return EXIT_FAILURE;
+        double time = run(qc, qregister, chunk, remap, &stats);
+        printf("%-18s %10.3f %9d %7d %10d", remap ? "mapped" : "mapped, no remap", time, stats.segments, stats.swaps, stats.exchanges);
+        if(reference) {
+            amplitude *a = qregister_get_statevector(reference);
+            amplitude *b = qregister_get_statevector(qregister);
+            double error = 0.0;
+            for(uint64_t i = 0; i < dim; i++) error = fmax(error, cabs(a[i] - b[i]));
+            printf(" %10.2e%s\n", error, (error > TOLERANCE) ? "  MISMATCH" : "");
+            if(error > TOLERANCE) failures++;
+        } else {
+            printf(" %10s\n", "-");
+        }
+        qregister_free(qregister);
+    }
+
+    if(reference) qregister_free(reference);
+    circuit_free(qc);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,87 @@
+#include "../builder/register.h"
+#include "../simulator/gates.h"
+#include "../utils/utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <omp.h>
+
+/* Allocation of the statevector : time of qregister_create (allocation and
+   first touch) and bandwidth of the kernels afterwards, with 4 KiB pages
+   zeroed by one thread (the old behaviour), 4 KiB pages zeroed by all the
+   threads, transparent huge pages, and explicit 2 MiB / 1 GiB pages (which
+   fall back to transparent ones without a reservation). The huge pages
+   column is what the kernel actually gave (/proc/self/smaps_rollup).
+   On a NUMA machine, pin the threads : OMP_PROC_BIND=spread OMP_PLACES=cores
+   Usage : pages [nqubits] [repeats]   (default : 26 3) */
+
+typedef struct {
+    const char *name;
+    StatePages pages;
+    bool parallel;
+} Config;
+
+// AnonHugePages + Private_Hugetlb of the process, in MiB
+double huge_pages_mib(void) {
+    FILE *file = fopen("/proc/self/smaps_rollup", "r");
+    if(!file) return -1.0;
+    char line[256];
+    double kib = 0.0;
+    while(fgets(line, sizeof(line), file)) {
+        unsigned long value;
+        if(sscanf(line, "AnonHugePages: %lu kB", &value) == 1) kib += value;
+        if(sscanf(line, "Private_Hugetlb: %lu kB", &value) == 1) kib += value;
+    }
+    fclose(file);
+    return kib / 1024;
+}
+
+int main(int argc, char *argv[]) {
+    int n = (argc > 1) ? atoi(argv[1]) : 26;
+    int repeats = (argc > 2) ? atoi(argv[2]) : 3;
+    double bytes = (double)(1ULL << n) * sizeof(amplitude);
+    int targets[3] = {0, n / 2, n - 1};
+
+    Config configs[] = {
+        {"4K, serial touch", STATE_PAGES_SMALL, false},
+        {"4K", STATE_PAGES_SMALL, true},
+        {"THP", STATE_PAGES_TRANSPARENT, true},
+        {"2M", STATE_PAGES_2M, true},
+        {"1G", STATE_PAGES_1G, true}
+    };
+    int count = sizeof(configs) / sizeof(configs[0]);
+
+    printf("n = %d (%.2f GiB), %d threads, H on qubits %d, %d, %d\n", n, bytes / (1 << 30), omp_get_max_threads(),
+           targets[0], targets[1], targets[2]);
+    printf("%-18s %6s %10s %10s %12s\n", "pages", "got", "huge MiB", "create (s)", "kernel GB/s");
+
+    for(int c = 0; c < count; c++) {
+        qregister_set_pages(configs[c].pages);
+        qregister_set_parallel_touch(configs[c].parallel);
+        double before = huge_pages_mib();
+
+        double t0 = now_seconds();
+        QuantumRegister *qregister = qregister_create(n);
+        double create = now_seconds() - t0;
+        double huge = huge_pages_mib() - before;
+
+        amplitude *state = qregister_get_statevector(qregister);
+        t0 = now_seconds();
+        for(int r = 0; r < repeats; r++) {
+            for(int t = 0; t < 3; t++) apply_h_inplace(state, n, targets[t]);
+        }
+        double bandwidth = 2 * bytes * 3 * repeats / (now_seconds() - t0) / 1e9;
+
+        printf("%-18s %6s %10.0f %10.3f %12.2f\n", configs[c].name, state_pages_name(qregister_get_state_pages(qregister)),
+               huge, create, bandwidth);
+        qregister_free(qregister);
+    }
+
+    qregister_set_pages(STATE_PAGES);
+    qregister_set_parallel_touch(true);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,198 @@
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../simulator/opti_sim.h"
+#include "../utils/utils.h"
+#include "../utils/rng.h"
+#include "../utils/precision.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <complex.h>
+#include <math.h>
+
+/* Accuracy of the statevector precision on a few circuits : norm drift
+   |1 - <psi|psi>| of the final state, and when a double precision reference
+   is available, 1 - |<ref|psi>|^2 (states normalized) and the largest
+   amplitude error.
+   The double build (make all) writes its final states as references in
+   logs/precision_<circuit>_<n>.state, the single build
+   (make PRECISION=single all) compares against them :
+     bin/examples/precision 16 && bin/single/examples/precision 16
+   Usage : precision [nqubits]   (default : 16) */
+
+#define CIRCUIT_SEED 0xc1c
+
+double complex SWAP[16] = {
+    1, 0, 0, 0,
+    0, 0, 1, 0,
+    0, 1, 0, 0,
+    0, 0, 0, 1
+};
+
+void build_qft(QuantumCircuit *qc, int n) {
+    // Not a basis state at the input
+    for(int i = 0; i < n; i++) {
+        add_unitary_gate(qc, i, GATE_H, 0.0);
+        add_unitary_gate(qc, i, GATE_PHASE, 0.1 * (i + 1));
+    }
+    for(int i = 0; i < n; i++) {
+        add_unitary_gate(qc, i, GATE_H, 0.0);
+        for(int j = 2; j < n + 1 - i; j++) {
+            add_control_gate(qc, i + j - 1, i, GATE_PHASE, M_PI / (1 << (j - 1)));
+        }
+    }
+    for(int i = 0; i < n / 2; i++) {
+        int targets[2] = {i, n - i - 1};
+        add_custom_gate(qc, 2, targets, SWAP, "SWAP");
+    }
+}
+
+// Layers of H / random phases and a CNOT ladder, the same circuit in both builds
+void build_random(QuantumCircuit *qc, int n, int depth) {
+    Rng rng;
+    rng_seed(&rng, CIRCUIT_SEED);
+    for(int l = 0; l < depth; l++) {
+        for(int q = 0; q < n; q++) {
+            add_unitary_gate(qc, q, GATE_H, 0.0);
+            add_unitary_gate(qc, q, GATE_PHASE, 2 * M_PI * rng_uniform(&rng));
+        }
+        for(int q = l % 2; q < n - 1; q += 2) add_control_gate(qc, q, q + 1, GATE_X, 0.0);
+    }
+}
+
+// Grover search of |1>, the optimal number of iterations, diagonal oracle and reflection
+void build_grover(QuantumCircuit *qc, int n) {
+    uint64_t size = 1ULL << n;
+    int *targets = malloc_custom(n * sizeof(int));
+    for(int i = 0; i < n; i++) targets[i] = i;
+    double complex *oracle = malloc_custom(size * sizeof(double complex));
+    double complex *s0 = malloc_custom(size * sizeof(double complex));
+    for(uint64_t i = 0; i < size; i++) {
+        oracle[i] = (i == 1) ? -1.0 : 1.0;
+        s0[i] = (i == 0) ? 1.0 : -1.0;
+    }
+
+    for(int i = 0; i < n; i++) add_unitary_gate(qc, i, GATE_H, 0.0);
+    int iterations = (int)(M_PI / 4 * sqrt((double)size));
+    for(int it = 0; it < iterations; it++) {
+        add_diagonal_gate(qc, n, targets, oracle, " ORA ");
+        for(int i = 0; i < n; i++) add_unitary_gate(qc, i, GATE_H, 0.0);
+        add_diagonal_gate(qc, n, targets, s0, " S0 ");
+        for(int i = 0; i < n; i++) add_unitary_gate(qc, i, GATE_H, 0.0);
+    }
+    free_custom(oracle);
+    free_custom(s0);
+    free_custom(targets);
+}
+
+/* Reference file : the number of qubits, then the real and imaginary
+   parts of every amplitude as doubles */
+void reference_path(char *path, size_t size, const char *name, int n) {
+    snprintf(path, size, "logs/precision_%s_%d.state", name, n);
+}
+
+bool write_reference(const char *path, const amplitude *state, int n) {
+    FILE *file = fopen(path, "wb");
+    if(!file) return false;
+    uint64_t dim = 1ULL << n;
+    bool ok = fwrite(&n, sizeof(int), 1, file) == 1;
+    for(uint64_t i = 0; ok && i < dim; i++) {
+        double parts[2] = {creal(state[i]), cimag(state[i])};
+        ok = fwrite(parts, sizeof(double), 2, file) == 2;
+    }
+    fclose(file);
+    return ok;
+}
+
+double complex *read_reference(const char *path, int n) {
+    FILE *file = fopen(path, "rb");
+    if(!file) return NULL;
+    int stored = 0;
+    uint64_t dim = 1ULL << n;
+    double complex *reference = NULL;
+    if(fread(&stored, sizeof(int), 1, file) == 1 && stored == n) {
+        reference = malloc_custom(dim * sizeof(double complex));
+        for(uint64_t i = 0; i < dim; i++) {
+            double parts[2];
+            if(fread(parts, sizeof(double), 2, file) != 2) {
+                free_custom(reference);
+                reference = NULL;
+                break;
+            }
+            reference[i] = CMPLX(parts[0], parts[1]);
+        }
+    }
+    fclose(file);
+    return reference;
+}
+
+void run(const char *name, QuantumCircuit *qc, int n) {
+    QuantumRegister *qregister = qregister_create(n);
+    ExecStats stats;
+    ExecOptions options = exec_options_default();
+    options.stats = &stats;
+    // The accuracy of the statevector kernels, the whole circuit on them
+    options.sparse_fill = 0.0;
+    double time = circuit_execute_opts(qc, qregister, NULL, &options);
+    amplitude *state = qregister_get_statevector(qregister);
+    uint64_t dim = 1ULL << n;
+
+    double norm = 0.0;
+    for(uint64_t i = 0; i < dim; i++) norm += creal(state[i]) * creal(state[i]) + cimag(state[i]) * cimag(state[i]);
+    printf("%-12s %8d %10.3f %12.2e", name, stats.gates, time, fabs(1.0 - norm));
+
+    char path[256];
+    reference_path(path, sizeof(path), name, n);
+#ifdef SINGLE_PRECISION
+    double complex *reference = read_reference(path, n);
+    if(reference) {
+        double complex overlap = 0.0;
+        double reference_norm = 0.0, max_error = 0.0;
+        for(uint64_t i = 0; i < dim; i++) {
+            overlap += conj(reference[i]) * state[i];
+            reference_norm += creal(reference[i] * conj(reference[i]));
+            double error = cabs(reference[i] - state[i]);
+            if(error > max_error) max_error = error;
+        }
+        double fidelity = creal(overlap * conj(overlap)) / (reference_norm * norm);
+        printf(" %14.2e %12.2e\n", 1.0 - fidelity, max_error);
+        free_custom(reference);
+    } else {
+        printf(" %14s %12s  (no reference, run the double build first)\n", "-", "-");
+    }
+#else
+    printf(" %14s %12s  %s\n", "-", "-", write_reference(path, state, n) ? path : "(reference not written)");
+#endif
+    qregister_free(qregister);
+}
+
+int main(int argc, char *argv[]) {
+    int n = (argc > 1) ? atoi(argv[1]) : 16;
+
+    printf("%s precision, n = %d, %.2f MiB per state\n", PRECISION_NAME, n, (double)(1ULL << n) * sizeof(amplitude) / (1 << 20));
+    printf("%-12s %8s %10s %12s %14s %12s\n", "circuit", "gates", "time (s)", "norm drift", "1 - fidelity", "max |error|");
+
+    QuantumCircuit *qc = circuit_create(n);
+    build_qft(qc, n);
+    run("qft", qc, n);
+    circuit_free(qc);
+
+    qc = circuit_create(n);
+    build_random(qc, n, 10);
+    run("random_10", qc, n);
+    circuit_free(qc);
+
+    qc = circuit_create(n);
+    build_random(qc, n, 500);
+    run("random_500", qc, n);
+    circuit_free(qc);
+
+    qc = circuit_create(n);
+    build_grover(qc, n);
+    run("grover", qc, n);
+    circuit_free(qc);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,183 @@
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../builder/qasm.h"
+#include "../simulator/opti_sim.h"
+#include "../utils/utils.h"
+#include "../utils/rng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <complex.h>
+#include <math.h>
+
+/* The OpenQASM loader : a generated file of random standard gates (h, x,
+   cx, rz with pi expressions, u3, measurements at the end) loaded at the
+   gates / s printed, a small program with a user gate and broadcasts
+   against the same circuit built with the add_* functions, and the
+   teleportation with its corrections under if(...). A last argument loads a
+   file of your own.
+   Usage : qasm [gates] [file]   (default : 1000000, the generated file in logs/) */
+
+#define TOLERANCE (4096 * AMPLITUDE_EPSILON)
+#define GENERATED "logs/generated.qasm"
+
+int generate(const char *path, int n, long gates) {
+    FILE *file = fopen(path, "w");
+    if(!file) return 0;
+    Rng rng;
+    rng_seed(&rng, 0x9a5);
+    fprintf(file, "OPENQASM 2.0;\ninclude \"qelib1.inc\";\nqreg q[%d];\ncreg c[%d];\n", n, n);
+    for(long g = 0; g < gates - n; g++) {
+        int a = (int)rng_below(&rng, n);
+        int b = (a + 1 + (int)rng_below(&rng, n - 1)) % n;
+        switch(rng_below(&rng, 6)) {
+            case 0: fprintf(file, "h q[%d];\n", a); break;
+            case 1: fprintf(file, "x q[%d];\n", a); break;
+            case 2:
+            case 3: fprintf(file, "cx q[%d],q[%d];\n", a, b); break;
+            case 4: fprintf(file, "rz(pi/%d) q[%d];\n", 1 + (int)rng_below(&rng, 16), a); break;
+            case 5: fprintf(file, "u3(%.6f,0,-pi/2) q[%d];\n", rng_uniform(&rng), a); break;
+        }
+    }
+    fprintf(file, "measure q -> c;\n");
+    fclose(file);
+    return 1;
+}
+
+double max_error(QuantumRegister *a, QuantumRegister *b, int n) {
+    amplitude *x = qregister_get_statevector(a);
+    amplitude *y = qregister_get_statevector(b);
+    double error = 0.0;
+    for(uint64_t i = 0; i < (1ULL << n); i++) error = fmax(error, cabs(x[i] - y[i]));
+    return error;
+}
+
+void print_info(const char *name, const QasmInfo *info) {
+    printf("%-12s %8d %8d %10ld %10d %10.3f %14.0f\n", name, info->nb_qbits, info->nb_cbits, info->gates, info->lines,
+           info->seconds, info->gates_per_second);
+}
+
+const char *PROGRAM =
+    "OPENQASM 2.0;\n"
+    "include \"qelib1.inc\";\n"
+    "/* a user gate, expanded on every call */\n"
+    "gate mix(theta) a, b { h a; cx a, b; rz(theta / 2) b; cu1(-theta) a, b; }\n"
+    "qreg q[3];\n"
+    "qreg r[3];\n"
+    "h q;                  // broadcast : h on q[0], q[1], q[2]\n"
+    "mix(pi / 3) q[0], r[1];\n"
+    "cx q, r;\n"
+    "u3(0.5, -pi / 4, 2 * pi ^ 2) r[2];\n"
+    "ccx q[2], r[0], q[1];\n"
+    "swap q[0], r[2];\n"
+    "crz(sqrt(2)) r[0], q[2];\n";
+
+// The same, with the add_* functions (qelib1.inc : rz is u1)
+QuantumCircuit *build_program(void) {
+    QuantumCircuit *qc = circuit_create(6);
+    for(int q = 0; q < 3; q++) add_unitary_gate(qc, q, GATE_H, 0.0);
+    add_unitary_gate(qc, 0, GATE_H, 0.0);
+    add_control_gate(qc, 0, 4, GATE_X, 0.0);
+    add_unitary_gate(qc, 4, GATE_PHASE, M_PI / 6);
+    add_control_gate(qc, 0, 4, GATE_PHASE, -M_PI / 3);
+    for(int q = 0; q < 3; q++) add_control_gate(qc, q, 3 + q, GATE_X, 0.0);
+    double theta = 0.5, phi = -M_PI / 4, lambda = 2 * M_PI * M_PI;
+    double complex u3[4] = {cos(theta / 2), -cexp(I * lambda) * sin(theta / 2), cexp(I * phi) * sin(theta / 2),
+                            cexp(I * (phi + lambda)) * cos(theta / 2)};
+    add_custom_gate(qc, 1, (int[]){5}, u3, "u3");
+    double complex ccx[64] = {0};
+    for(int i = 0; i < 8; i++) ccx[8 * (i < 6 ? i : 13 - i) + i] = 1.0;
+    add_custom_gate(qc, 3, (int[]){2, 3, 1}, ccx, "ccx");
+    double complex swap[16] = {[0] = 1.0, [6] = 1.0, [9] = 1.0, [15] = 1.0};
+    add_custom_gate(qc, 2, (int[]){0, 5}, swap, "swap");
+    add_diagonal_gate(qc, 2, (int[]){3, 2}, (double complex[]){1.0, 1.0, cexp(-I * M_SQRT2 / 2), cexp(I * M_SQRT2 / 2)}, "crz");
+    return qc;
+}
+
+// Alice's qubit q[0] prepared by u3, sent to q[2] : Bob's corrections depend on her measurements
+const char *TELEPORTATION =
+    "OPENQASM 2.0;\n"
+    "include \"qelib1.inc\";\n"
+    "qreg q[3];\n"
+    "creg m0[1];\n"
+    "creg m1[1];\n"
+    "u3(1.1, 0.4, -0.7) q[0];\n"
+    "h q[1];\n"
+    "cx q[1], q[2];\n"
+    "cx q[0], q[1];\n"
+    "h q[0];\n"
+    "measure q[0] -> m0[0];\n"
+    "measure q[1] -> m1[0];\n"
+    "if(m1 == 1) x q[2];\n"
+    "if(m0 == 1) z q[2];\n";
+
+int main(int argc, char *argv[]) {
+    long gates = (argc > 1) ? atol(argv[1]) : 1000000;
+    const char *path = (argc > 2) ? argv[2] : GENERATED;
+    int failures = 0;
+    QasmInfo info;
+
+    if(argc <= 2 && !generate(path, 20, gates)) {
+        printf("can't write %s\n", path);
+        return EXIT_FAILURE;
+    }
+    printf("%-12s %8s %8s %10s %10s %10s %14s\n", "source", "qubits", "bits", "gates", "lines", "load (s)", "gates / s");
+    QuantumCircuit *loaded = qasm_load(path, &info);
+    if(!loaded) {
+        printf("%s\n", info.error);
+        return EXIT_FAILURE;
+    }
+    print_info("file", &info);
+    circuit_free(loaded);
+
+    // A user gate, broadcasts, expressions
+    QuantumCircuit *parsed = qasm_parse(PROGRAM, strlen(PROGRAM), &info);
+    if(!parsed) {
+        printf("%s\n", info.error);
+        return EXIT_FAILURE;
+    }
+    print_info("program", &info);
+    QuantumCircuit *built = build_program();
+    QuantumRegister *a = qregister_create(6), *b = qregister_create(6);
+    circuit_execute(parsed, a, NULL, false);
+    circuit_execute(built, b, NULL, false);
+    double error = max_error(a, b, 6);
+    failures += error > TOLERANCE;
+    printf("program against the add_* functions : max error %.2e%s\n", error, (error > TOLERANCE) ? "  MISMATCH" : "");
+    qregister_free(a);
+    qregister_free(b);
+    circuit_free(parsed);
+    circuit_free(built);
+
+    // Bob's qubit must end in the state Alice prepared, whatever she measured
+    QuantumCircuit *teleport = qasm_parse(TELEPORTATION, strlen(TELEPORTATION), &info);
+    if(!teleport) {
+        printf("%s\n", info.error);
+        return EXIT_FAILURE;
+    }
+    print_info("teleport", &info);
+    double complex sent[2] = {cos(0.55), cexp(I * 0.4) * sin(0.55)};
+    double worst = 0.0;
+    for(int run = 0; run < 16; run++) {
+        QuantumRegister *qregister = qregister_create(3);
+        ClassicalRegister *cregister = cregister_create(info.nb_cbits);
+        circuit_execute(teleport, qregister, cregister, false);
+        amplitude *state = qregister_get_statevector(qregister);
+        int measured = 4 * cregister_get_bit(cregister, 0) + 2 * cregister_get_bit(cregister, 1);
+        double complex overlap = conj(sent[0]) * state[measured] + conj(sent[1]) * state[measured + 1];
+        worst = fmax(worst, 1.0 - cabs(overlap));
+        qregister_free(qregister);
+        cregister_free(cregister);
+    }
+    failures += worst > TOLERANCE;
+    printf("teleportation : 1 - |<sent|received>| = %.2e over 16 runs%s\n", worst, (worst > TOLERANCE) ? "  MISMATCH" : "");
+    circuit_free(teleport);
+
+    // Errors carry their line
+    const char *wrong = "OPENQASM 2.0;\nqreg q[2];\nh q[0];\ncx q[0], q[2];\n";
+    if(qasm_parse(wrong, strlen(wrong), &info) || strncmp(info.error, "line 4", 6) != 0) failures++;
+    printf("error : %s\n", info.error);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,6 +1,7 @@
 #include "../builder/circuit.h"
 #include "../simulator/opti_sim.h"
 #include "../utils/utils.h"
+#include "../utils/rng.h"
 #include "../utils/gnuplot.h"
 #include "../utils/logger.h"
 
@@ -41,7 +42,7 @@ int **add_qft_gate(QuantumCircuit* qc, int n) {
 }
 
 int main(int argc, char *argv[]) {
-    srand(time(NULL));
+    rng_seed(rng_default(), time(NULL));
 
     if(argc < 2) {
         printf("Usage: %s <number of qubits>\n", argv[0]);
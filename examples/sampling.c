@@ -0,0 +1,202 @@
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../simulator/opti_sim.h"
+#include "../simulator/sampling.h"
+#include "../utils/utils.h"
+#include "../utils/rng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <complex.h>
+#include <math.h>
+#include <time.h>
+
+/* Measurement statistics of a circuit measuring all its qubits at the end :
+   circuit_sample (unitary part simulated once) against one circuit_execute
+   per shot, the time of the latter extrapolated from a few shots. The most
+   frequent outcomes are shown with their exact probabilities ; the
+   frequencies of the most probable ones (chosen from the statevector, not
+   from the counts, which would favour the lucky ones) must be within 5
+   standard deviations of their probabilities.
+   Then a GHZ state with a mid-circuit measurement (one execution per shot),
+   sampled twice from generators with the same seed : same histograms.
+   Then deterministic circuits measuring twice into the same bit : every
+   shot must give the bits of circuit_execute (the last write wins). Last,
+   a measurement under a condition, of a qubit in |+> : half the shots 1.
+   Usage : sampling [nqubits] [shots] [seed]   (default : 20 1000000 time) */
+
+#define EXECUTE_SHOTS 5
+
+void build_circuit(QuantumCircuit *qc, int n, bool measure) {
+    for(int l = 0; l < 3; l++) {
+        for(int q = 0; q < n; q++) {
+            add_unitary_gate(qc, q, GATE_H, 0.0);
+            add_unitary_gate(qc, q, GATE_PHASE, 0.3 * (q + l + 1));
+        }
+        for(int q = 0; q < n - 1; q++) add_control_gate(qc, q, q + 1, GATE_X, 0.0);
+    }
+    if(measure) {
+        for(int q = 0; q < n; q++) add_measure(qc, q, q);
+    }
+}
+
+// The frequency of count over shots is within 5 standard deviations of the probability p
+bool frequency_matches(uint64_t count, uint64_t shots, double p) {
+    return fabs((double)count / (double)shots - p) <= 5 * sqrt(p * (1 - p) / (double)shots) + 1e-12;
+}
+
+// Classical bits after one circuit_execute, bit 0 the most significant as in the histograms
+uint64_t execute_outcome(QuantumCircuit *qc, int n, int nb_bits) {
+    QuantumRegister *qregister = qregister_create(n);
+    ClassicalRegister *cregister = cregister_create(nb_bits);
+    circuit_execute(qc, qregister, cregister, false);
+    uint64_t outcome = 0;
+    for(int c = 0; c < nb_bits; c++) outcome = (outcome << 1) | (uint64_t)cregister_get_bit(cregister, c);
+    qregister_free(qregister);
+    cregister_free(cregister);
+    return outcome;
+}
+
+int main(int argc, char *argv[]) {
+    int n = (argc > 1) ? atoi(argv[1]) : 20;
+    uint64_t shots = (argc > 2) ? strtoull(argv[2], NULL, 10) : 1000000;
+    uint64_t seed = (argc > 3) ? strtoull(argv[3], NULL, 10) : (uint64_t)time(NULL);
+    rng_seed(rng_default(), seed);
+
+    QuantumCircuit *qc = circuit_create(n);
+    build_circuit(qc, n, true);
+
+    double t0 = now_seconds();
+    for(int s = 0; s < EXECUTE_SHOTS; s++) {
+        QuantumRegister *qregister = qregister_create(n);
+        ClassicalRegister *cregister = cregister_create(n);
+        circuit_execute(qc, qregister, cregister, false);
+        qregister_free(qregister);
+        cregister_free(cregister);
+    }
+    double execute_time = (now_seconds() - t0) / EXECUTE_SHOTS * (double)shots;
+
+    t0 = now_seconds();
+    Histogram *histogram = circuit_sample(qc, shots, NULL);
+    double sample_time = now_seconds() - t0;
+
+    printf("n = %d, %llu shots, seed %llu\n", n, (unsigned long long)shots, (unsigned long long)seed);
+    printf("circuit_execute per shot : %10.2f s (extrapolated from %d shots)\n", execute_time, EXECUTE_SHOTS);
+    printf("circuit_sample           : %10.2f s (%.0fx)\n\n", sample_time, execute_time / sample_time);
+
+    // Exact probabilities of the most frequent outcomes (cbit i = qubit i, the same bit order)
+    QuantumCircuit *unitary = circuit_create(n);
+    build_circuit(unitary, n, false);
+    QuantumRegister *reference = qregister_create(n);
+    circuit_execute(unitary, reference, NULL, false);
+    amplitude *state = qregister_get_statevector(reference);
+
+    histogram_print(stdout, histogram, 8);
+    int failures = 0;
+    printf("exact probabilities :");
+    HistogramEntry *top = malloc_custom(histogram->size * sizeof(HistogramEntry));
+    for(uint64_t e = 0; e < histogram->size; e++) top[e] = histogram->entries[e];
+    for(int k = 0; k < 8 && (uint64_t)k < histogram->size; k++) {
+        // Selection of the k-th most frequent outcome
+        uint64_t best = k;
+        for(uint64_t e = k + 1; e < histogram->size; e++) if(top[e].count > top[best].count) best = e;
+        HistogramEntry tmp = top[k];
+        top[k] = top[best];
+        top[best] = tmp;
+        double p = cabs(state[top[k].outcome]);
+        printf(" %.6f", p * p);
+    }
+    printf("\n");
+    free_custom(top);
+
+    // The 8 most probable outcomes, sampled as often as they should be
+    uint64_t likely[8] = {0};
+    uint64_t dim = 1ULL << n;
+    for(uint64_t i = 0; i < dim; i++) {
+        int k = (i < 8) ? (int)i : 8;
+        for(; k > 0 && cabs(state[i]) > cabs(state[likely[k - 1]]); k--) {
+            if(k < 8) likely[k] = likely[k - 1];
+        }
+        if(k < 8) likely[k] = i;
+    }
+    printf("most probable (exact / sampled) :");
+    for(int k = 0; k < 8 && (uint64_t)k < dim; k++) {
+        double p = cabs(state[likely[k]]) * cabs(state[likely[k]]);
+        uint64_t count = histogram_get_count(histogram, likely[k]);
+        bool ok = frequency_matches(count, histogram->shots, p);
+        printf(" %.6f / %.6f%s", p, (double)count / (double)histogram->shots, ok ? "" : " (MISMATCH)");
+        failures += !ok;
+    }
+    printf("\n\n");
+    histogram_free(histogram);
+    qregister_free(reference);
+    circuit_free(unitary);
+    circuit_free(qc);
+
+    // GHZ, qubit 0 measured before the CNOTs : only 000 and 111
+    qc = circuit_create(3);
+    add_unitary_gate(qc, 0, GATE_H, 0.0);
+    add_measure(qc, 0, 0);
+    add_control_gate(qc, 0, 1, GATE_X, 0.0);
+    add_control_gate(qc, 1, 2, GATE_X, 0.0);
+    add_measure(qc, 1, 1);
+    add_measure(qc, 2, 2);
+    ExecOptions options = exec_options_default();
+    Rng rng;
+    options.rng = &rng;
+    rng_seed(&rng, seed);
+    histogram = circuit_sample(qc, 1000, &options);
+    printf("GHZ with a mid-circuit measurement, ");
+    histogram_print(stdout, histogram, 0);
+    bool ghz = histogram_get_count(histogram, 0) + histogram_get_count(histogram, 7) == histogram->shots;
+    failures += !ghz;
+    if(!ghz) printf("MISMATCH : outcomes other than 000 and 111\n");
+
+    rng_seed(&rng, seed);
+    Histogram *again = circuit_sample(qc, 1000, &options);
+    bool same = again->size == histogram->size;
+    for(uint64_t e = 0; same && e < histogram->size; e++) {
+        same = again->entries[e].outcome == histogram->entries[e].outcome && again->entries[e].count == histogram->entries[e].count;
+    }
+    printf("same seed, same histogram : %s\n", same ? "yes" : "NO");
+    if(!same) failures++;
+    histogram_free(again);
+    histogram_free(histogram);
+    circuit_free(qc);
+
+    // X q0 ; q0 -> c0 ; q1 -> c0 (then X q1, or nothing) : c0 = 0
+    for(int i = 0; i < 2; i++) {
+        qc = circuit_create(2);
+        add_unitary_gate(qc, 0, GATE_X, 0.0);
+        add_measure(qc, 0, 0);
+        add_measure(qc, 1, 0);
+        if(i == 0) add_unitary_gate(qc, 1, GATE_X, 0.0);
+        uint64_t expected = execute_outcome(qc, 2, 1);
+        histogram = circuit_sample(qc, 100, &options);
+        bool ok = histogram_get_count(histogram, expected) == histogram->shots;
+        printf("bit measured twice%s : c0 = %llu on %llu of %llu shots%s\n", (i == 0) ? ", mid-circuit" : "",
+               (unsigned long long)expected, (unsigned long long)histogram_get_count(histogram, expected),
+               (unsigned long long)histogram->shots, ok ? "" : "  MISMATCH");
+        failures += !ok;
+        histogram_free(histogram);
+        circuit_free(qc);
+    }
+
+    // H q0 ; if(c0 == 0) q0 -> c0 : the condition holds, c0 = 1 with probability 1/2
+    qc = circuit_create(1);
+    add_unitary_gate(qc, 0, GATE_H, 0.0);
+    circuit_set_condition(qc, 0, 1, 0);
+    add_measure(qc, 0, 0);
+    circuit_set_condition(qc, 0, 0, 0);
+    histogram = circuit_sample(qc, 10000, &options);
+    bool half = frequency_matches(histogram_get_count(histogram, 1), histogram->shots, 0.5);
+    printf("conditional measurement : c0 = 1 on %llu of %llu shots%s\n", (unsigned long long)histogram_get_count(histogram, 1),
+           (unsigned long long)histogram->shots, half ? "" : "  MISMATCH");
+    failures += !half;
+    histogram_free(histogram);
+    circuit_free(qc);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,207 @@
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../builder/serialize.h"
+#include "../builder/qasm.h"
+#include "../simulator/opti_sim.h"
+#include "../simulator/program.h"
+#include "../utils/utils.h"
+#include "../utils/rng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <complex.h>
+#include <math.h>
+
+#include <sys/stat.h>
+
+/* Binary circuit files and the QASM exporter : a circuit of every kind of
+   gate (shared matrices, diagonals, conditions) saved, mapped back and
+   executed with the same random stream as the original, the final states
+   must be equal bit for bit. Exported as QASM and loaded again, the states
+   must match up to a global phase. Then a long circuit : time to build it,
+   to map its file and to load its QASM export, with the sizes of the files.
+   Usage : serialize [gates]   (default : 1000000) */
+
+#define TOLERANCE (4096 * AMPLITUDE_EPSILON)
+#define BINARY "logs/circuit.qsim"
+#define EXPORTED "logs/circuit.qasm"
+#define SEED 0x5e71
+
+void random_unitary(Rng *rng, double complex *u) {
+    double theta = M_PI * rng_uniform(rng), phi = 2 * M_PI * rng_uniform(rng), lambda = 2 * M_PI * rng_uniform(rng);
+    double complex phase = cexp(I * 2 * M_PI * rng_uniform(rng));
+    u[0] = phase * cos(theta / 2);
+    u[1] = -phase * cexp(I * lambda) * sin(theta / 2);
+    u[2] = phase * cexp(I * phi) * sin(theta / 2);
+    u[3] = phase * cexp(I * (phi + lambda)) * cos(theta / 2);
+}
+
+// Every class of gate, on 8 qubits. dense : also a 2-qubit matrix QASM 2 can only declare opaque
+QuantumCircuit *build_mixed(bool dense) {
+    Rng rng;
+    rng_seed(&rng, SEED);
+    QuantumCircuit *qc = circuit_create(8);
+    double complex ccx[64] = {0}, u[4], cu[16] = {0}, phases[8];
+    for(int i = 0; i < 8; i++) ccx[8 * (i < 6 ? i : 13 - i) + i] = 1.0;
+    SharedMatrix *toffoli = shared_matrix_create(3, ccx);
+    for(int q = 0; q < 8; q++) add_unitary_gate(qc, q, GATE_H, 0.0);
+    for(int layer = 0; layer < 4; layer++) {
+        for(int q = 0; q < 8; q++) {
+            int r = (q + 1 + layer) % 8;
+            add_unitary_gate(qc, q, GATE_PHASE, 2 * M_PI * rng_uniform(&rng));
+            add_control_gate(qc, q, r, (layer & 1) ? GATE_Y : GATE_X, 0.0);
+            add_control_gate(qc, r, q, GATE_PHASE, 2 * M_PI * rng_uniform(&rng));
+            random_unitary(&rng, u);
+            add_custom_gate(qc, 1, (int[]){q}, u, "u");
+        }
+        add_shared_gate(qc, (int[]){layer, layer + 2, layer + 4}, toffoli, "ccx");
+        // Controlled by its least significant qubit
+        random_unitary(&rng, u);
+        cu[0] = cu[10] = 1.0;
+        cu[5] = u[0], cu[7] = u[1], cu[13] = u[2], cu[15] = u[3];
+        add_custom_gate(qc, 2, (int[]){layer + 1, layer + 3}, cu, "cu");
+        for(int x = 0; x < 8; x++) phases[x] = cexp(I * 2 * M_PI * rng_uniform(&rng));
+        add_diagonal_gate(qc, 3, (int[]){7 - layer, layer, layer + 2}, phases, "phases");
+        add_diagonal_gate(qc, 2, (int[]){layer, 7 - layer}, phases + 4, "phases");
+    }
+    if(dense) {
+        double complex m[16];
+        for(int i = 0; i < 16; i++) m[i] = (i % 5 == 0) ? 0.5 : 0.5 * cexp(I * i);
+        add_custom_gate(qc, 2, (int[]){2, 6}, m, "dense");
+    }
+    // Two conditions, on bits 0..1 and 2
+    add_measure(qc, 0, 0);
+    add_measure(qc, 1, 1);
+    add_measure(qc, 2, 2);
+    circuit_set_condition(qc, 0, 2, 2);
+    add_unitary_gate(qc, 3, GATE_X, 0.0);
+    add_shared_gate(qc, (int[]){4, 5, 6}, toffoli, "ccx");
+    circuit_set_condition(qc, 2, 1, 1);
+    add_control_gate(qc, 5, 7, GATE_PHASE, 0.7);
+    circuit_set_condition(qc, 0, 0, 0);
+    add_unitary_gate(qc, 7, GATE_H, 0.0);
+    shared_matrix_release(toffoli);
+    return qc;
+}
+
+// Compiled, measurements drawn from the same stream
+QuantumRegister *run(QuantumCircuit *qc) {
+    Rng rng;
+    rng_seed(&rng, SEED);
+    Program *program = circuit_compile(qc, NULL);
+    QuantumRegister *qregister = qregister_create(8);
+    ClassicalRegister *cregister = cregister_create(3);
+    program_execute(program, qregister, cregister, &rng);
+    cregister_free(cregister);
+    program_free(program);
+    return qregister;
+}
+
+// 1 - |<a|b>|
+double distance(QuantumRegister *a, QuantumRegister *b, int n) {
+    amplitude *x = qregister_get_statevector(a);
+    amplitude *y = qregister_get_statevector(b);
+    double complex overlap = 0.0;
+    for(uint64_t i = 0; i < (1ULL << n); i++) overlap += conj(x[i]) * y[i];
+    return fabs(1.0 - cabs(overlap));
+}
+
+long file_size(const char *path) {
+    struct stat status;
+    return (stat(path, &status) == 0) ? (long)status.st_size : -1;
+}
+
+bool export_file(QuantumCircuit *qc, const char *path, int *inexact) {
+    FILE *file = fopen(path, "w");
+    if(!file) return false;
+    *inexact = qasm_write(file, qc);
+    return fclose(file) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    int gates = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int failures = 0, inexact;
+
+    QuantumCircuit *original = build_mixed(false);
+    if(!circuit_save(original, BINARY)) return EXIT_FAILURE;
+    QuantumCircuit *mapped = circuit_map(BINARY);
+    if(!mapped) return EXIT_FAILURE;
+    QuantumRegister *a = run(original), *b = run(mapped);
+    bool same = memcmp(qregister_get_statevector(a), qregister_get_statevector(b), (1ULL << 8) * sizeof(amplitude)) == 0;
+    failures += !same || circuit_size(mapped) != circuit_size(original);
+    printf("mapped : %d gates, %ld bytes, final state %s\n", circuit_size(mapped), file_size(BINARY),
+           same ? "bitwise equal" : "DIFFERENT");
+
+    if(!export_file(original, EXPORTED, &inexact)) return EXIT_FAILURE;
+    QasmInfo info;
+    QuantumCircuit *loaded = qasm_load(EXPORTED, &info);
+    if(!loaded) {
+        printf("%s\n", info.error);
+        return EXIT_FAILURE;
+    }
+    QuantumRegister *c = run(loaded);
+    double error = distance(a, c, 8);
+    failures += inexact != 0 || error > TOLERANCE;
+    printf("exported : %ld gates written as %ld, %d inexact, 1 - |<original|loaded>| = %.2e%s\n", (long)circuit_size(original),
+           info.gates, inexact, error, (error > TOLERANCE) ? "  MISMATCH" : "");
+    qregister_free(a);
+    qregister_free(b);
+    qregister_free(c);
+    circuit_free(original);
+    circuit_free(mapped);
+    circuit_free(loaded);
+
+    // A dense 2-qubit matrix has no QASM 2 form
+    QuantumCircuit *dense = build_mixed(true);
+    if(!export_file(dense, EXPORTED, &inexact)) return EXIT_FAILURE;
+    failures += inexact != 1;
+    printf("exported with a dense matrix : %d inexact (opaque)\n", inexact);
+    circuit_free(dense);
+
+    // Long circuit : build, save, map, export, load the export
+    Rng rng;
+    rng_seed(&rng, SEED);
+    double t0 = now_seconds();
+    QuantumCircuit *qc = circuit_create(20);
+    for(int g = 0; g < gates; g++) {
+        int q = (int)rng_below(&rng, 20), r = (q + 1 + (int)rng_below(&rng, 19)) % 20;
+        double complex u[4];
+        switch(rng_below(&rng, 5)) {
+            case 0: add_unitary_gate(qc, q, GATE_H, 0.0); break;
+            case 1: add_unitary_gate(qc, q, GATE_PHASE, 2 * M_PI * rng_uniform(&rng)); break;
+            case 2: add_control_gate(qc, q, r, GATE_X, 0.0); break;
+            case 3: add_control_gate(qc, q, r, GATE_PHASE, 2 * M_PI * rng_uniform(&rng)); break;
+            case 4:
+                random_unitary(&rng, u);
+                add_custom_gate(qc, 1, (int[]){q}, u, "u");
+                break;
+        }
+    }
+    double build = now_seconds() - t0;
+    t0 = now_seconds();
+    bool saved = circuit_save(qc, BINARY);
+    double save = now_seconds() - t0;
+    t0 = now_seconds();
+    QuantumCircuit *back = saved ? circuit_map(BINARY) : NULL;
+    double map = now_seconds() - t0;
+    t0 = now_seconds();
+    bool exported = export_file(qc, EXPORTED, &inexact);
+    double write = now_seconds() - t0;
+    QuantumCircuit *parsed = exported ? qasm_load(EXPORTED, &info) : NULL;
+    if(!back || !parsed) return EXIT_FAILURE;
+    failures += circuit_size(back) != gates || info.gates != gates;
+    printf("\n%d gates on 20 qubits\n", gates);
+    printf("%-22s %10s %14s %12s\n", "", "time (s)", "ns per gate", "bytes");
+    printf("%-22s %10.3f %14.1f %12s\n", "add_* functions", build, 1e9 * build / gates, "-");
+    printf("%-22s %10.3f %14.1f %12ld\n", "circuit_save", save, 1e9 * save / gates, file_size(BINARY));
+    printf("%-22s %10.3f %14.1f %12s\n", "circuit_map", map, 1e9 * map / gates, "-");
+    printf("%-22s %10.3f %14.1f %12ld\n", "qasm_write", write, 1e9 * write / gates, file_size(EXPORTED));
+    printf("%-22s %10.3f %14.1f %12s\n", "qasm_load", info.seconds, 1e9 * info.seconds / gates, "-");
+    circuit_free(qc);
+    circuit_free(back);
+    circuit_free(parsed);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
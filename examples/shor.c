@@ -8,7 +8,9 @@
 #include "../builder/circuit.h"
 #include "../builder/register.h"
 #include "../simulator/opti_sim.h"
+#include "../simulator/sampling.h"
 #include "../utils/utils.h"
+#include "../utils/rng.h"
 
 // Classical GCD
 int gcd(int a, int b) {
@@ -106,6 +108,7 @@ void build_shor_generalized(QuantumCircuit *circuit, int N, int a, int n_countin
     for (int j = 0; j < n_counting; j++) {
         int p = pow(2, j);
         int a_p = power_mod(a, p, N);
+        if (a_p == 1) continue; // U^{2^j} is the identity
         
         // The gate acts on 1 control bit + n_target bits
         int gate_qubits = 1 + n_target;
@@ -131,7 +134,8 @@ void build_shor_generalized(QuantumCircuit *circuit, int N, int a, int n_countin
         for(int k = 0; k < n_target; k++) q_indices[k+1] = n_counting + k;
         
         add_custom_gate(circuit, gate_qubits, q_indices, mat, "C-ModExp");
-        free_custom(q_indices); // Free it here since circuit deep copies it
+        free_custom(q_indices); // The circuit copies the qubits and the matrix
+        free_custom(mat);
     }
 
     // 4. Inverse QFT on the counting register
@@ -148,13 +152,16 @@ void build_shor_generalized(QuantumCircuit *circuit, int N, int a, int n_countin
     }
 }
 
-// Helper to free_custom dynamic matrices in shor
-void free_shor_matrices(QuantumCircuit *circuit);
+// Outcomes drawn for each base a
+#define SHOR_SHOTS 16
+// Larger states are kept out of core in SHOR_STATE_FILE (on a local NVMe drive)
+#define SHOR_RAM_QUBITS 25
+#define SHOR_STATE_FILE "logs/shor.state"
 
 int get_r(int N, int *a_out) {
-    int a = rand()%N;
+    int a = rng_below(rng_default(), N);
     while (gcd(a, N) != 1) {
-        a = rand()%N;
+        a = rng_below(rng_default(), N);
     }
     printf("Using base a = %d\n", a);
 
@@ -164,37 +171,34 @@ int get_r(int N, int *a_out) {
 
     printf("Qubits required: %d (Counting: %d, Target: %d)\n", total_qubits, n_counting, n_target);
 
-    if (total_qubits > 25) {
-        printf("Warning: This may exceed your RAM limit!\n");
+    // Beyond the RAM the statevector is mapped from a file, streamed by chunks
+    ExecOptions options = exec_options_default();
+    if (total_qubits > SHOR_RAM_QUBITS) {
+        options.state_file = SHOR_STATE_FILE;
+        printf("Statevector of %.1f GiB mapped from %s\n", (double)(1ULL << total_qubits) * sizeof(amplitude) / (1 << 30), SHOR_STATE_FILE);
     }
 
     QuantumCircuit *qc = circuit_create(total_qubits);
     build_shor_generalized(qc, N, a, n_counting, n_target);
 
-    QuantumRegister *qreg = qregister_create(total_qubits);
-    ClassicalRegister *creg = cregister_create(n_counting);
+    // The counting register is only measured at the end : one simulation for all the shots
+    Histogram *histogram = circuit_sample(qc, SHOR_SHOTS, &options);
 
-    circuit_execute(qc, qreg, creg, false);
+    // Bit i of the counting register is bit n_counting - 1 - i of y, as in the outcomes
+    int res = 0;
+    for (uint64_t e = 0; e < histogram->size; e++) {
+        long long y = histogram->entries[e].outcome;
+        double phase = (double)y / (1 << n_counting);
+        printf("Measured phase: %f (%llu shots)\n", phase, (unsigned long long)histogram->entries[e].count);
 
-    // Convert result bits to fractional phase
-    int y = 0;
-    for (int i = 0; i < n_counting; i++) {
-        if (cregister_get_bit(creg, i)) y |= (1 << (n_counting - 1 - i));
+        res = find_period_cfe(y, 1 << n_counting, a, N);
+        printf("%d\n", res);
+        // A period the post-processing accepts ends the search
+        if (res != 0 && res % 2 == 0 && power_mod(a, res / 2, N) != N - 1) break;
     }
-    
-    double phase = (double)y / (1 << n_counting);
-    printf("Measured phase: %f\n", phase);
-
-    // Note: To find 'r' from 'phase', one would typically use 
-    // a Continued Fractions expansion here.
-
-    int res = find_period_cfe(y, 1 << n_counting, a, N);
-    printf("%d\n", res);
 
-    free_shor_matrices(qc);
     circuit_free(qc);
-    qregister_free(qreg);
-    cregister_free(creg);
+    histogram_free(histogram);
 
     *a_out = a;
     return res;
@@ -231,7 +235,7 @@ void extract_factors(int N, int a, int r) {
 
 int main() {
     int N;
-    srand(time(NULL));
+    rng_seed(rng_default(), time(NULL));
     printf("Enter number to factor (N): ");
     scanf("%d", &N);
 
@@ -250,14 +254,3 @@ int main() {
 
     return 0;
 }
-
-#include "../builder/internal.h"
-void free_shor_matrices(QuantumCircuit *circuit) {
-    ListIterator iter = list_iterator_begin(circuit->gates);
-    while (list_iterator_has_next(&iter)) {
-        Gate *gate = list_iterator_next(&iter);
-        if(gate->class == CUSTOM) {
-            free_custom(gate->gate.custom.mat);
-        }
-    }
-}
\ No newline at end of file
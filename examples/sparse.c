@@ -0,0 +1,230 @@
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../simulator/opti_sim.h"
+#include "../simulator/sampling.h"
+#include "../simulator/sparse.h"
+#include "../utils/utils.h"
+#include "../utils/rng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <complex.h>
+#include <math.h>
+
+/* The sparse backend : random circuits of every gate class (permutations,
+   custom and diagonal gates, measurements and conditions) run on sparse
+   states, with one shard and with several, against the statevector from
+   the same seed ; a circuit that fills up, switched to the statevector by
+   circuit_execute. Then Shor's order finding : checked against the
+   statevector on a small modulus, then sampled on N = 221 (24 qubits)
+   without ever allocating the statevector when the period is a power of 2.
+   Usage : sparse [shards]   (default : 4) */
+
+#define TOLERANCE (4096 * AMPLITUDE_EPSILON)
+#define SEED 0x5ba5
+
+static double complex TOFFOLI[64];
+
+// Random gates, mostly permutations, on few superposed qubits : a measurement every 24 gates and a correction conditioned on it
+QuantumCircuit *random_circuit(int n, int gates, int seed) {
+    Rng rng;
+    rng_seed(&rng, seed);
+    QuantumCircuit *qc = circuit_create(n);
+    double complex phases[8], u[16];
+    for(int i = 0; i < 8; i++) phases[i] = cexp(I * 0.3 * i * i);
+    // H x H, its column 1 times i
+    for(int i = 0; i < 16; i++) u[i] = (__builtin_popcount((i / 4) & (i % 4)) % 2 ? -0.5 : 0.5) * ((i % 4 == 1) ? I : 1.0);
+    for(int g = 0; g < gates; g++) {
+        int q = (int)rng_below(&rng, n), r = (q + 1 + (int)rng_below(&rng, n - 1)) % n;
+        int qbits[3] = {q, r, q};
+        while(qbits[2] == q || qbits[2] == r) qbits[2] = (int)rng_below(&rng, n);
+        if(g % 24 == 23) {
+            add_measure(qc, q, 0);
+            add_measure(qc, r, 1);
+            circuit_set_condition(qc, 0, 2, 1);
+            add_unitary_gate(qc, r, GATE_X, 0.0);
+            circuit_set_condition(qc, 0, 0, 0);
+            continue;
+        }
+        switch(rng_below(&rng, 10)) {
+            case 0: add_unitary_gate(qc, q, GATE_H, 0.0); break;
+            case 1: add_unitary_gate(qc, q, GATE_PHASE, 2 * M_PI * rng_uniform(&rng)); break;
+            case 2: add_unitary_gate(qc, q, GATE_Y, 0.0); break;
+            case 3:
+            case 4: add_control_gate(qc, q, r, GATE_X, 0.0); break;
+            case 5: add_control_gate(qc, q, r, GATE_PHASE, 2 * M_PI * rng_uniform(&rng)); break;
+            case 6:
+            case 7: add_custom_gate(qc, 3, qbits, TOFFOLI, "CCX"); break;
+            case 8: add_diagonal_gate(qc, 3, qbits, phases, "D3"); break;
+            case 9: add_custom_gate(qc, 2, qbits, u, "U"); break;
+        }
+    }
+    return qc;
+}
+
+int power_mod(int base, int exp, int mod) {
+    long long result = 1, b = base % mod;
+    for(; exp > 0; exp /= 2) {
+        if(exp % 2) result = result * b % mod;
+        b = b * b % mod;
+    }
+    return (int)result;
+}
+
+/* Order finding of a modulo N, as in shor.c : m = 2t counting qubits in
+   superposition, the t target qubits from |1>, multiplied by a^(2^j) under
+   counting qubit j (permutation matrices), the inverse QFT on the counting
+   qubits, measured if measure */
+QuantumCircuit *order_finding(int N, int a, int t, bool measure) {
+    int m = 2 * t, dim = 1 << (t + 1);
+    QuantumCircuit *qc = circuit_create(m + t);
+    for(int i = 0; i < m; i++) add_unitary_gate(qc, i, GATE_H, 0.0);
+    add_unitary_gate(qc, m + t - 1, GATE_X, 0.0);
+    double complex *mat = malloc_custom((size_t)dim * dim * sizeof(double complex));
+    int *qbits = malloc_custom((t + 1) * sizeof(int));
+    for(int j = 0; j < m; j++) {
+        int factor = power_mod(a, 1 << j, N);
+        if(factor == 1) continue;
+        for(int i = 0; i < dim * dim; i++) mat[i] = 0.0;
+        for(int i = 0; i < dim; i++) {
+            int target = i & ((1 << t) - 1);
+            int next = (i >> t && target < N) ? (int)((long long)factor * target % N) : target;
+            mat[((i >> t << t) | next) * dim + i] = 1.0;
+        }
+        qbits[0] = j;
+        for(int k = 0; k < t; k++) qbits[k + 1] = m + k;
+        add_custom_gate(qc, t + 1, qbits, mat, "C-ModExp");
+    }
+    free_custom(mat);
+    free_custom(qbits);
+    for(int j = m - 1; j >= 0; j--) {
+        for(int k = m - 1; k > j; k--) add_control_gate(qc, k, j, GATE_PHASE, -M_PI / pow(2, k - j));
+        add_unitary_gate(qc, j, GATE_H, 0.0);
+    }
+    for(int i = 0; i < m && measure; i++) add_measure(qc, i, i);
+    return qc;
+}
+
+double max_error(const amplitude *x, const amplitude *y, int n) {
+    double error = 0.0;
+    for(uint64_t i = 0; i < (1ULL << n); i++) error = fmax(error, cabs(x[i] - y[i]));
+    return error;
+}
+
+/* The circuit on a sparse state of the given shards (never switched)
+   against the statevector, from the same seed. Without fusion, which may
+   split the runs of measurements (other draws) */
+double compare(QuantumCircuit *qc, int n, int shards, int seed, uint64_t *peak) {
+    Rng rng;
+    ExecOptions options = exec_options_default();
+    options.rng = &rng;
+    options.sparse_fill = 0.0;
+    options.fuse = false;
+    QuantumRegister *reference = qregister_create(n), *result = qregister_create(n);
+    ClassicalRegister *ca = cregister_create(2), *cb = cregister_create(2);
+    SparseState *state = sparse_create(n, shards);
+    rng_seed(&rng, seed);
+    circuit_execute_sparse(qc, state, ca, &rng, 1.0);
+    sparse_write_statevector(state, qregister_get_statevector(result));
+    rng_seed(&rng, seed);
+    circuit_execute_opts(qc, reference, cb, &options);
+    double error = max_error(qregister_get_statevector(result), qregister_get_statevector(reference), n);
+    *peak = sparse_get_peak(state);
+    sparse_free(state);
+    qregister_free(reference);
+    qregister_free(result);
+    cregister_free(ca);
+    cregister_free(cb);
+    return error;
+}
+
+int main(int argc, char *argv[]) {
+    int shards = (argc > 1) ? atoi(argv[1]) : 4;
+    int failures = 0;
+    for(int i = 0; i < 8; i++) {
+        for(int j = 0; j < 8; j++) TOFFOLI[i * 8 + j] = (i == j) != (i >= 6 && j >= 6);
+    }
+
+    // Sparse against statevector, one shard then several (past SPARSE_PARALLEL_SIZE nonzeros on 20 qubits)
+    int sizes[2] = {12, 20}, counts[2] = {1, shards};
+    for(int c = 0; c < 2; c++) {
+        double worst = 0.0;
+        uint64_t peak = 0, largest = 0;
+        for(int run = 0; run < 5; run++) {
+            QuantumCircuit *qc = random_circuit(sizes[c], 400, SEED + run);
+            worst = fmax(worst, compare(qc, sizes[c], counts[c], run, &peak));
+            if(peak > largest) largest = peak;
+            circuit_free(qc);
+        }
+        failures += worst > TOLERANCE;
+        printf("5 random circuits (%d qubits, 400 gates), %d shard%s : at most %llu nonzeros, max error %.2e%s\n", sizes[c],
+               counts[c], counts[c] > 1 ? "s" : "", (unsigned long long)largest, worst, (worst > TOLERANCE) ? "  MISMATCH" : "");
+    }
+
+    // Filled up : circuit_execute switches to the statevector
+    int n = 16;
+    QuantumCircuit *qc = circuit_create(n);
+    for(int q = 0; q < n; q++) add_unitary_gate(qc, q, GATE_H, 0.0);
+    for(int q = 0; q + 1 < n; q++) add_control_gate(qc, q, q + 1, GATE_PHASE, 0.1 * q);
+    ExecStats stats;
+    ExecOptions options = exec_options_default();
+    options.stats = &stats;
+    QuantumRegister *a = qregister_create(n), *b = qregister_create(n);
+    circuit_execute_opts(qc, a, NULL, &options);
+    ExecStats switched = stats;
+    options.sparse_fill = 0.0;
+    circuit_execute_opts(qc, b, NULL, &options);
+    double error = max_error(qregister_get_statevector(a), qregister_get_statevector(b), n);
+    bool ok = error <= TOLERANCE && switched.sparse_gates > 0 && switched.sparse_gates < circuit_size(qc);
+    failures += !ok;
+    printf("H on %d qubits : %d of %d gates on the sparse state (fill %.4f), then the statevector, max error %.2e%s\n", n,
+           switched.sparse_gates, circuit_size(qc), (double)switched.sparse_peak / (1 << n), error, ok ? "" : "  MISMATCH");
+    qregister_free(a);
+    qregister_free(b);
+    circuit_free(qc);
+
+    // Order finding, N = 21 (15 qubits) : its state against the statevector
+    uint64_t peak;
+    qc = order_finding(21, 2, 5, false);
+    error = compare(qc, 15, 1, SEED, &peak);
+    failures += error > TOLERANCE;
+    printf("order finding, N = 21 : at most %llu nonzeros out of %d, max error %.2e%s\n", (unsigned long long)peak, 1 << 15,
+           error, (error > TOLERANCE) ? "  MISMATCH" : "");
+    circuit_free(qc);
+
+    /* N = 221 (24 qubits) : a = 105 has period 16, a power of 2, the inverse
+       QFT leaves 16 x 16 nonzeros ; a = 2 has period 24, it spreads them
+       over the counting register, up to about 10% of the amplitudes */
+    Rng rng;
+    rng_seed(&rng, SEED);
+    options = exec_options_default();
+    options.rng = &rng;
+    options.stats = &stats;
+    printf("\n%-24s %10s %10s %14s %14s %10s\n", "N = 221, 24 qubits", "time (s)", "period", "sparse gates", "max nonzeros", "check");
+    int bases[2] = {105, 2}, periods[2] = {16, 24};
+    for(int i = 0; i < 2; i++) {
+        qc = order_finding(221, bases[i], 8, true);
+        double t0 = now_seconds();
+        Histogram *histogram = circuit_sample(qc, 256, &options);
+        double time = now_seconds() - t0;
+        // The outcomes y near the peaks k 2^16 / r : on them for r = 16, within 1 for most shots otherwise
+        uint64_t close = 0;
+        for(uint64_t e = 0; e < histogram->size; e++) {
+            double turns = (double)histogram->entries[e].outcome * periods[i] / 65536.0;
+            double distance = fabs(turns - round(turns)) * 65536.0 / periods[i];
+            if(distance <= ((periods[i] == 16) ? 0.0 : 1.0)) close += histogram->entries[e].count;
+        }
+        bool located = (periods[i] == 16) ? close == histogram->shots : close >= histogram->shots / 2;
+        failures += !located;
+        char name[64];
+        snprintf(name, sizeof(name), "a = %d", bases[i]);
+        printf("%-24s %10.3f %10d %8d / %-4d %14llu %10s\n", name, time, periods[i], stats.sparse_gates, stats.gates,
+               (unsigned long long)stats.sparse_peak, located ? "peaks" : "MISMATCH");
+        histogram_free(histogram);
+        circuit_free(qc);
+    }
+    printf("(statevector : %.0f MiB)\n", (double)(1ULL << 24) * sizeof(amplitude) / (1 << 20));
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,153 @@
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../simulator/opti_sim.h"
+#include "../simulator/stabilizer.h"
+#include "../utils/utils.h"
+#include "../utils/rng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <complex.h>
+#include <math.h>
+
+/* The stabilizer backend : random Clifford circuits with measurements and
+   conditions, run by circuit_execute on the tableau and on the statevector
+   (ExecOptions::stabilizer off) with the same random stream, must end in the
+   same state. Then circuits on thousands of qubits, without a register : a
+   GHZ state measured on every qubit (all bits equal) and rounds of a
+   repetition code whose syndromes must locate the injected bit flips.
+   Usage : stabilizer [nqubits]   (default : 5000) */
+
+#define TOLERANCE (4096 * AMPLITUDE_EPSILON)
+#define SEED 0x57ab
+
+// Random H, S, S^dagger, Paulis, CNOT, CY, CZ, a measurement every 16 gates and a correction conditioned on it
+QuantumCircuit *random_clifford(int n, int gates, int seed) {
+    Rng rng;
+    rng_seed(&rng, seed);
+    QuantumCircuit *qc = circuit_create(n);
+    for(int g = 0; g < gates; g++) {
+        int q = (int)rng_below(&rng, n), r = (q + 1 + (int)rng_below(&rng, n - 1)) % n;
+        if(g % 16 == 15) {
+            add_measure(qc, q, g / 16 % 2);
+            circuit_set_condition(qc, g / 16 % 2, 1, 1);
+            add_unitary_gate(qc, r, GATE_X, 0.0);
+            circuit_set_condition(qc, 0, 0, 0);
+            continue;
+        }
+        switch(rng_below(&rng, 9)) {
+            case 0:
+            case 1: add_unitary_gate(qc, q, GATE_H, 0.0); break;
+            case 2: add_unitary_gate(qc, q, GATE_PHASE, M_PI / 2); break;
+            case 3: add_unitary_gate(qc, q, GATE_PHASE, -M_PI / 2); break;
+            case 4: add_unitary_gate(qc, q, (SingleBitGate[]){GATE_X, GATE_Y, GATE_Z}[rng_below(&rng, 3)], 0.0); break;
+            case 5:
+            case 6: add_control_gate(qc, q, r, GATE_X, 0.0); break;
+            case 7: add_control_gate(qc, q, r, GATE_Y, 0.0); break;
+            case 8: add_control_gate(qc, q, r, GATE_PHASE, M_PI); break;
+        }
+    }
+    return qc;
+}
+
+double max_error(QuantumRegister *a, QuantumRegister *b, int n) {
+    amplitude *x = qregister_get_statevector(a);
+    amplitude *y = qregister_get_statevector(b);
+    double error = 0.0;
+    for(uint64_t i = 0; i < (1ULL << n); i++) error = fmax(error, cabs(x[i] - y[i]));
+    return error;
+}
+
+int main(int argc, char *argv[]) {
+    int n = (argc > 1) ? atoi(argv[1]) : 5000;
+    int failures = 0;
+    Rng rng;
+    ExecStats stats;
+    ExecOptions options = exec_options_default();
+    options.rng = &rng;
+    options.stats = &stats;
+
+    // Tableau against statevector
+    double worst = 0.0;
+    bool tableau_used = true;
+    for(int run = 0; run < 20; run++) {
+        int qubits = 2 + run % 11;
+        QuantumCircuit *qc = random_clifford(qubits, 400, SEED + run);
+        QuantumRegister *a = qregister_create(qubits), *b = qregister_create(qubits);
+        ClassicalRegister *ca = cregister_create(2), *cb = cregister_create(2);
+        options.stabilizer = true;
+        rng_seed(&rng, run);
+        circuit_execute_opts(qc, a, ca, &options);
+        tableau_used = tableau_used && stats.stabilizer;
+        options.stabilizer = false;
+        rng_seed(&rng, run);
+        circuit_execute_opts(qc, b, cb, &options);
+        worst = fmax(worst, max_error(a, b, qubits));
+        qregister_free(a);
+        qregister_free(b);
+        cregister_free(ca);
+        cregister_free(cb);
+        circuit_free(qc);
+    }
+    failures += !tableau_used || worst > TOLERANCE;
+    printf("20 random Clifford circuits (2 to 12 qubits, 400 gates) : tableau against statevector, max error %.2e%s\n", worst,
+           (!tableau_used || worst > TOLERANCE) ? "  MISMATCH" : "");
+    options.stabilizer = true;
+
+    // GHZ on n qubits, every qubit measured
+    QuantumCircuit *ghz = circuit_create(n);
+    add_unitary_gate(ghz, 0, GATE_H, 0.0);
+    for(int q = 1; q < n; q++) add_control_gate(ghz, q - 1, q, GATE_X, 0.0);
+    for(int q = 0; q < n; q++) add_measure(ghz, q, q);
+    ClassicalRegister *bits = cregister_create(n);
+    rng_seed(&rng, SEED);
+    double time = circuit_execute_opts(ghz, NULL, bits, &options);
+    int ones = 0;
+    for(int q = 0; q < n; q++) ones += cregister_get_bit(bits, q);
+    bool equal = ones == 0 || ones == n;
+    failures += !equal;
+    printf("\n%-32s %10s %12s\n", "circuit", "time (s)", "check");
+    printf("%-32s %10.3f %12s\n", "GHZ, n measurements", time, equal ? "all equal" : "MISMATCH");
+    cregister_free(bits);
+    circuit_free(ghz);
+
+    /* Repetition code : d data qubits (even positions), d - 1 ancillas
+       between them measuring Z Z of their neighbours, 3 rounds, a bit flip
+       injected on a data qubit before each round */
+    int d = (n + 1) / 2, rounds = 3;
+    QuantumCircuit *code = circuit_create(2 * d - 1);
+    int flipped[3] = {d / 3, 0, d - 1};
+    for(int round = 0; round < rounds; round++) {
+        add_unitary_gate(code, 2 * flipped[round], GATE_X, 0.0);
+        for(int a = 0; a < d - 1; a++) {
+            add_control_gate(code, 2 * a, 2 * a + 1, GATE_X, 0.0);
+            add_control_gate(code, 2 * a + 2, 2 * a + 1, GATE_X, 0.0);
+            add_measure(code, 2 * a + 1, round * (d - 1) + a);
+            // Ancilla back to |0>
+            circuit_set_condition(code, round * (d - 1) + a, 1, 1);
+            add_unitary_gate(code, 2 * a + 1, GATE_X, 0.0);
+            circuit_set_condition(code, 0, 0, 0);
+        }
+    }
+    bits = cregister_create(rounds * (d - 1));
+    time = circuit_execute_opts(code, NULL, bits, &options);
+    // The syndrome of a round flips around the data qubits flipped since the last one
+    bool located = true;
+    for(int round = 0; round < rounds; round++) {
+        for(int a = 0; a < d - 1; a++) {
+            int expected = 0;
+            for(int r = 0; r <= round; r++) expected ^= (flipped[r] == a || flipped[r] == a + 1);
+            located = located && cregister_get_bit(bits, round * (d - 1) + a) == expected;
+        }
+    }
+    failures += !located;
+    char name[64];
+    snprintf(name, sizeof(name), "repetition code, d = %d", d);
+    printf("%-32s %10.3f %12s\n", name, time, located ? "located" : "MISMATCH");
+    printf("(%d qubits, %d gates on the tableau)\n", 2 * d - 1, circuit_size(code));
+    cregister_free(bits);
+    circuit_free(code);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,6 +1,7 @@
 #include "../builder/circuit.h"
 #include "../simulator/opti_sim.h"
 #include "../utils/utils.h"
+#include "../utils/rng.h"
 
 #include <stdlib.h>
 #include <time.h>
@@ -18,7 +19,7 @@ QuantumRegister *create_bell_state() {
 }
 
 int main() {
-    srand(time(NULL));
+    rng_seed(rng_default(), time(NULL));
     QuantumRegister *sentqbit = qregister_create(1);
     QuantumRegister *bell_state = create_bell_state();
 
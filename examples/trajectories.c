@@ -0,0 +1,147 @@
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../simulator/opti_sim.h"
+#include "../simulator/sampling.h"
+#include "../utils/utils.h"
+#include "../utils/rng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+
+#include <omp.h>
+
+/* Teleportation of qubit 0 to qubit 2, Alice's measurements happening
+   before Bob's corrections (done as controlled gates) : every shot is a
+   trajectory of its own. The other qubits only make the state larger.
+   The shots run on one worker, then on all the OpenMP threads, from the
+   same seed : same histogram, and P(bit 2 = 1) must be sin^2(THETA / 2).
+   Then mid-circuit measurements sharing bits : the histogram must hold the
+   outcomes of circuit_execute, 000 and 111.
+   Usage : trajectories [nqubits] [shots] [seed]   (default : 12 20000 time) */
+
+#define THETA 1.0
+
+void build_circuit(QuantumCircuit *qc, int n) {
+    // State to send : H P(THETA) H |0> = cos(THETA / 2) |0> + ... |1> (up to phases)
+    add_unitary_gate(qc, 0, GATE_H, 0.0);
+    add_unitary_gate(qc, 0, GATE_PHASE, THETA);
+    add_unitary_gate(qc, 0, GATE_H, 0.0);
+    for(int q = 3; q < n; q++) {
+        add_unitary_gate(qc, q, GATE_H, 0.0);
+        add_unitary_gate(qc, q, GATE_PHASE, 0.2 * q);
+    }
+    for(int q = 3; q < n - 1; q++) add_control_gate(qc, q, q + 1, GATE_X, 0.0);
+
+    // Bell pair between Alice (1) and Bob (2)
+    add_unitary_gate(qc, 1, GATE_H, 0.0);
+    add_control_gate(qc, 1, 2, GATE_X, 0.0);
+
+    // Alice measures mid-circuit
+    add_control_gate(qc, 0, 1, GATE_X, 0.0);
+    add_unitary_gate(qc, 0, GATE_H, 0.0);
+    add_measure(qc, 0, 0);
+    add_measure(qc, 1, 1);
+
+    // Bob's corrections from the measured qubits
+    add_control_gate(qc, 1, 2, GATE_X, 0.0);
+    add_control_gate(qc, 0, 2, GATE_Z, 0.0);
+    add_measure(qc, 2, 2);
+}
+
+/* H q0 ; X q2 ; q2 -> c2 ; q0 -> c0 ; X q1 if c0 ; q1 -> c1 ; q0 -> c2 :
+   c2 overwritten by the value of c0, all three bits equal */
+void build_shared_bits(QuantumCircuit *qc) {
+    add_unitary_gate(qc, 0, GATE_H, 0.0);
+    add_unitary_gate(qc, 2, GATE_X, 0.0);
+    add_measure(qc, 2, 2);
+    add_measure(qc, 0, 0);
+    circuit_set_condition(qc, 0, 1, 1);
+    add_unitary_gate(qc, 1, GATE_X, 0.0);
+    circuit_set_condition(qc, 0, 0, 0);
+    add_measure(qc, 1, 1);
+    add_measure(qc, 0, 2);
+}
+
+double probability_bit2(Histogram *histogram) {
+    uint64_t ones = 0;
+    for(uint64_t e = 0; e < histogram->size; e++) {
+        if(histogram->entries[e].outcome & 1) ones += histogram->entries[e].count;
+    }
+    return (double)ones / (double)histogram->shots;
+}
+
+int main(int argc, char *argv[]) {
+    int n = (argc > 1) ? atoi(argv[1]) : 12;
+    uint64_t shots = (argc > 2) ? strtoull(argv[2], NULL, 10) : 20000;
+    uint64_t seed = (argc > 3) ? strtoull(argv[3], NULL, 10) : (uint64_t)time(NULL);
+    if(n < 3) n = 3;
+    int threads = omp_get_max_threads();
+
+    QuantumCircuit *qc = circuit_create(n);
+    build_circuit(qc, n);
+    ExecOptions options = exec_options_default();
+    Rng rng;
+    options.rng = &rng;
+
+    printf("n = %d, %llu shots, seed %llu, parallel trajectories up to %d qubits\n", n, (unsigned long long)shots,
+           (unsigned long long)seed, TRAJECTORY_PARALLEL_QUBITS);
+    printf("%-10s %10s %14s %12s\n", "workers", "time (s)", "shots / s", "P(bit 2)");
+
+    Histogram *histograms[2];
+    int counts[2] = {1, threads};
+    for(int i = 0; i < 2; i++) {
+        omp_set_num_threads(counts[i]);
+        rng_seed(&rng, seed);
+        double t0 = now_seconds();
+        histograms[i] = circuit_sample(qc, shots, &options);
+        double time = now_seconds() - t0;
+        printf("%-10d %10.3f %14.0f %12.4f\n", counts[i], time, shots / time, probability_bit2(histograms[i]));
+    }
+    omp_set_num_threads(threads);
+
+    bool same = histograms[0]->size == histograms[1]->size;
+    for(uint64_t e = 0; same && e < histograms[0]->size; e++) {
+        same = histograms[0]->entries[e].outcome == histograms[1]->entries[e].outcome
+            && histograms[0]->entries[e].count == histograms[1]->entries[e].count;
+    }
+    double expected = sin(THETA / 2) * sin(THETA / 2);
+    double error = fabs(probability_bit2(histograms[1]) - expected);
+    // 5 standard deviations of the estimate
+    bool close = error < 5 * sqrt(expected * (1 - expected) / (double)shots);
+    printf("\nexpected P(bit 2) = %.4f : %s, same histogram on 1 and %d workers : %s\n", expected,
+           close ? "ok" : "MISMATCH", threads, same ? "yes" : "NO");
+
+    histogram_free(histograms[0]);
+    histogram_free(histograms[1]);
+    circuit_free(qc);
+
+    // Every outcome of circuit_execute is sampled, and nothing else (both are 000 or 111, 64 runs see both)
+    qc = circuit_create(3);
+    build_shared_bits(qc);
+    rng_seed(&rng, seed);
+    Histogram *histogram = circuit_sample(qc, shots, &options);
+    rng_seed(rng_default(), seed);
+    uint64_t seen[8] = {0};
+    for(int s = 0; s < 64; s++) {
+        QuantumRegister *qregister = qregister_create(3);
+        ClassicalRegister *cregister = cregister_create(3);
+        circuit_execute(qc, qregister, cregister, false);
+        seen[cregister_get_bit(cregister, 0) << 2 | cregister_get_bit(cregister, 1) << 1 | cregister_get_bit(cregister, 2)]++;
+        qregister_free(qregister);
+        cregister_free(cregister);
+    }
+    bool shared = true;
+    for(uint64_t outcome = 0; outcome < 8; outcome++) {
+        shared = shared && (seen[outcome] > 0) == (histogram_get_count(histogram, outcome) > 0);
+    }
+    printf("bits shared by mid-circuit measurements : 000 %llu, 111 %llu of %llu shots : %s\n",
+           (unsigned long long)histogram_get_count(histogram, 0), (unsigned long long)histogram_get_count(histogram, 7),
+           (unsigned long long)histogram->shots, shared ? "ok" : "MISMATCH");
+    histogram_free(histogram);
+    circuit_free(qc);
+    return (same && close && shared) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -3,7 +3,7 @@
 #include "../simulator/opti_sim.h"
 #include "../builder/register.h"
 #include "../builder/gaterep.h"
-#include "../utils/list.h"
+#include "../builder/internal.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -73,12 +73,11 @@ void DrawCircuit(QuantumCircuit *circuit) {
     }
 
     // Draw Gates
-    struct ListNode *current = circuit->gates->head;
     int gate_step = GATE_SIZE + 20;
     int current_x = WIRE_START_X + 50;
 
-    while (current != NULL) {
-        Gate *g = (Gate *)current->data;
+    for (int index = 0; index < circuit_size(circuit); index++) {
+        Gate *g = &circuit->gates[index];
         
         if (g->class == UNITARY) {
             int y = WIRE_START_Y + g->gate.unitary.qbit * WIRE_SPACING;
@@ -113,6 +112,17 @@ void DrawCircuit(QuantumCircuit *circuit) {
              int textWidth = MeasureText(target_label, 20);
              DrawText(target_label, current_x + (GATE_SIZE - textWidth)/2, ty - 10, 20, BLACK);
         }
+        else if (g->class == DIAGONAL) {
+            for (int i = 0; i < g->gate.diagonal.nb_qbits; i++) {
+                int y = WIRE_START_Y + g->gate.diagonal.qbits[i] * WIRE_SPACING;
+                
+                DrawRectangle(current_x, y - GATE_SIZE/2, GATE_SIZE, GATE_SIZE, BEIGE);
+                DrawRectangleLines(current_x, y - GATE_SIZE/2, GATE_SIZE, GATE_SIZE, BLACK);
+                
+                const char *lbl = g->gate.diagonal.label ? g->gate.diagonal.label : "D";
+                DrawText(TextFormat("%.3s", lbl), current_x + 5, y - 10, 10, BLACK);
+            }
+        }
         else if (g->class == CUSTOM) {
             for (int i = 0; i < g->gate.custom.nb_qbits; i++) {
                 int q = g->gate.custom.qbits[i];
@@ -142,7 +152,6 @@ void DrawCircuit(QuantumCircuit *circuit) {
         }
 
         current_x += gate_step;
-        current = current->next;
     }
 }
 
@@ -207,13 +216,9 @@ void ParseAndAddCustomGate(QuantumCircuit *qc) {
         mat[i] = re + im * I;
     }
     
-    int *final_qubits = malloc_custom(q_count * sizeof(int));
-    for(int i=0; i<q_count; i++) final_qubits[i] = qubits[i];
-    
-    char *final_label = malloc_custom(strlen(customLabel) + 1);
-    strcpy(final_label, customLabel);
-    
-    add_custom_gate(qc, q_count, final_qubits, mat, final_label);
+    // The circuit copies the qubits, the matrix and the label
+    add_custom_gate(qc, q_count, qubits, mat, customLabel);
+    free_custom(mat);
 }
 
 void DrawCustomMenu(QuantumCircuit *qc) {
@@ -294,8 +299,9 @@ void DrawResults(QuantumCircuit *qc, QuantumRegister* qreg) {
     int start_y = winY + 60;
     int col_x = winX + 40;
 
+    amplitude *statevector = qregister_get_statevector(qreg);
     for (int i = 0; i < num_states; i++) {
-        double complex amp = qreg->statevector[i];
+        double complex amp = statevector[i];
         double prob = creal(amp)*creal(amp) + cimag(amp)*cimag(amp);
 
         if (prob > 0.0001) {
@@ -403,12 +409,11 @@ void HandleInput(QuantumCircuit *qc, QuantumRegister *qreg, ClassicalRegister *c
         } 
         else {
             if (currentTool == TOOL_ERASER) {
-                 ListIterator iter = list_iterator_begin(qc->gates);
                  int gate_step = GATE_SIZE + 20;
                  int current_x = WIRE_START_X + 50;
                  
-                 while (iter.current != NULL) {
-                     Gate *g = (Gate *)iter.current->data;
+                 for (int index = 0; index < circuit_size(qc); index++) {
+                     Gate *g = &qc->gates[index];
                      bool hit = false;
                      Rectangle hitBox = {0};
                      
@@ -425,6 +430,13 @@ void HandleInput(QuantumCircuit *qc, QuantumRegister *qreg, ClassicalRegister *c
                          Rectangle cBox = {current_x + GATE_SIZE/2 - 10, cy - 10, 20, 20};
                          if (CheckCollisionPointRec(mousePos, cBox)) hit = true;
                      }
+                     else if (g->class == DIAGONAL) {
+                         for (int i=0; i<g->gate.diagonal.nb_qbits; i++) {
+                             int y = WIRE_START_Y + g->gate.diagonal.qbits[i] * WIRE_SPACING;
+                             hitBox = (Rectangle){current_x, y - GATE_SIZE/2, GATE_SIZE, GATE_SIZE};
+                             if (CheckCollisionPointRec(mousePos, hitBox)) { hit = true; break; }
+                         }
+                     }
                      else if (g->class == CUSTOM) {
                          for (int i=0; i<g->gate.custom.nb_qbits; i++) {
                              int q = g->gate.custom.qbits[i];
@@ -435,18 +447,11 @@ void HandleInput(QuantumCircuit *qc, QuantumRegister *qreg, ClassicalRegister *c
                      }
 
                      if (hit) {
-                         if (g->class == CUSTOM) {
-                             free_custom(g->gate.custom.qbits);
-                             free_custom(g->gate.custom.mat);
-                             free_custom(g->gate.custom.label);
-                         }
-                         free_custom(g);
-                         list_iterator_remove_current(&iter);
+                         circuit_remove_gate(qc, index);
                          break;
                      }
 
                      current_x += gate_step;
-                     list_iterator_next(&iter);
                  }
                  return;
             }
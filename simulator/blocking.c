@@ -0,0 +1,83 @@
+#include "blocking.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <complex.h>
+#include <assert.h>
+
+#include <omp.h>
+
+#include "gates.h"
+#include "../builder/internal.h"
+#include "../utils/utils.h"
+
+bool gate_is_local(Gate *gate, int nqbits, int local) {
+    int first = nqbits - local; // Lowest local qubit index
+    if(gate->condition) return false; // Depends on the classical bits, applied on its own
+    switch(gate->class) {
+        case UNITARY:
+            return gate->gate.unitary.qbit >= first;
+        case CONTROL:
+            return gate->gate.control.control >= first && gate->gate.control.qbit >= first;
+        case CUSTOM:
+            for(int i = 0; i < gate->gate.custom.nb_qbits; i++) {
+                if(gate->gate.custom.qbits[i] < first) return false;
+            }
+            return true;
+        case DIAGONAL:
+            for(int i = 0; i < gate->gate.diagonal.nb_qbits; i++) {
+                if(gate->gate.diagonal.qbits[i] < first) return false;
+            }
+            return true;
+        case MEAS:
+            return false;
+    }
+    return false;
+}
+
+void apply_chunk_gate(amplitude *chunk, int local, Gate *gate) {
+    switch(gate->class) {
+        case UNITARY:
+            apply_unitary_gate_inplace(chunk, local, gate->gate.unitary.qbit, gate->gate.unitary.type, gate->gate.unitary.phase);
+            break;
+        case CONTROL:
+            apply_controlled_gate_inplace(chunk, local, gate->gate.control.control, gate->gate.control.qbit,
+                                          gate->gate.control.type, gate->gate.control.phase);
+            break;
+        case CUSTOM:
+            apply_custom_inplace(chunk, local, gate->gate.custom.qbits, gate->gate.custom.nb_qbits, gate->gate.custom.mat);
+            break;
+        case DIAGONAL:
+            apply_diagonal_inplace(chunk, local, gate->gate.diagonal.qbits, gate->gate.diagonal.nb_qbits, gate->gate.diagonal.phases);
+            break;
+        case MEAS:
+            break;
+    }
+}
+
+void apply_gates_blocked(amplitude *state, int nqbits, Gate **gates, int count, int local) {
+    assert(local > 0 && local <= nqbits);
+
+    Gate **chunk_gates = malloc_custom(count * sizeof(Gate *));
+    for(int g = 0; g < count; g++) {
+        assert(gate_is_local(gates[g], nqbits, local));
+        // Seen from a chunk (a state of `local` qubits), qubit t is t - (nqbits - local)
+        chunk_gates[g] = create_gate_view(gates[g], NULL, nqbits - local);
+    }
+
+    /* The kernels see omp_in_parallel() and stay on the calling thread. With
+    fewer chunks than threads, the chunks are done in turn by threaded kernels */
+    uint64_t chunks = 1ULL << (nqbits - local);
+    uint64_t size = 1ULL << local;
+    bool parallel = nqbits >= gates_get_parallel_threshold() && chunks >= (uint64_t)omp_get_max_threads();
+    #pragma omp parallel for schedule(static) if(parallel)
+    for(uint64_t c = 0; c < chunks; c++) {
+        amplitude *chunk = state + c * size;
+        for(int g = 0; g < count; g++) apply_chunk_gate(chunk, local, chunk_gates[g]);
+    }
+
+    for(int g = 0; g < count; g++) free_gate_view(chunk_gates[g]);
+    free_custom(chunk_gates);
+}
@@ -0,0 +1,31 @@
+#ifndef BLOCKING_H
+#define BLOCKING_H
+
+#include "../builder/circuit.h"
+#include "../utils/precision.h"
+
+#include <complex.h>
+#include <stdbool.h>
+
+/* -------- cache blocking --------
+   With the MSB-first convention, qubit t has the stride 2^(n - 1 - t) : the
+   gates acting only on the last `local` qubits (t >= n - local) never mix
+   two chunks of 2^local consecutive amplitudes. A run of such gates is
+   applied chunk by chunk, every gate of the run on a chunk while it is in
+   cache, instead of streaming the whole state once per gate.
+   The default chunk (2^16 amplitudes, 1 MiB) fits in a L2 cache.
+*/
+#ifndef BLOCK_QUBITS
+#define BLOCK_QUBITS 16
+#endif
+
+// True if all the qubits of the gate are local (measurements and conditional gates never are)
+bool gate_is_local(Gate *gate, int nqbits, int local);
+// Applies a gate (qubits numbered inside the chunk) to a chunk of `local` qubits, measurements are skipped
+void apply_chunk_gate(amplitude *chunk, int local, Gate *gate);
+
+/* Applies gates[0 .. count) (all local) chunk by chunk, the chunks being
+   split between the threads. Same result as applying them one after the other */
+void apply_gates_blocked(amplitude *state, int nqbits, Gate **gates, int count, int local);
+
+#endif
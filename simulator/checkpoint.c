@@ -0,0 +1,278 @@
+#include "checkpoint.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <complex.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <omp.h>
+
+#include "../builder/internal.h"
+#include "../utils/utils.h"
+
+#define IO_SIZE (1 << 30)
+
+/* -------- checksums -------- */
+
+static uint64_t mix(uint64_t hash, uint64_t word) {
+    hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+    return hash ^ (hash >> 29);
+}
+
+/* Fletcher-like over 64-bit words : two additions per word (the sums of
+   the chunks are independent, the threads each take some) */
+static uint64_t checksum(const void *data, size_t size, uint64_t seed) {
+    const unsigned char *bytes = data;
+    uint64_t a = seed, b = 0, word;
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8) {
+        memcpy(&word, bytes + i, 8);
+        a += word;
+        b += a;
+    }
+    if(i < size) {
+        word = 0;
+        memcpy(&word, bytes + i, size - i);
+        a += word;
+        b += a;
+    }
+    return mix(mix(size, a), b);
+}
+
+uint64_t circuit_fingerprint(const QuantumCircuit *circuit) {
+    uint64_t hash = mix(0, circuit->nb_qbits), bits;
+    for(int g = 0; g < circuit->nb_gates; g++) {
+        const Gate *gate = &circuit->gates[g];
+        hash = mix(hash, gate->class);
+        switch(gate->class) {
+            case MEAS:
+                hash = mix(mix(hash, gate->gate.measure.qbit), gate->gate.measure.cbit);
+                break;
+            case UNITARY:
+                memcpy(&bits, &gate->gate.unitary.phase, 8);
+                hash = mix(mix(mix(hash, gate->gate.unitary.qbit), gate->gate.unitary.type), bits);
+                break;
+            case CONTROL:
+                memcpy(&bits, &gate->gate.control.phase, 8);
+                hash = mix(mix(mix(mix(hash, gate->gate.control.control), gate->gate.control.qbit), gate->gate.control.type), bits);
+                break;
+            case CUSTOM: {
+                int k = gate->gate.custom.nb_qbits;
+                hash = mix(hash, checksum(gate->gate.custom.qbits, k * sizeof(int), k));
+                hash = mix(hash, checksum(gate->gate.custom.mat, ((size_t)1 << 2 * k) * sizeof(double complex), 0));
+                break;
+            }
+            case DIAGONAL: {
+                int k = gate->gate.diagonal.nb_qbits;
+                hash = mix(hash, checksum(gate->gate.diagonal.qbits, k * sizeof(int), k));
+                hash = mix(hash, checksum(gate->gate.diagonal.phases, ((size_t)1 << k) * sizeof(double complex), 0));
+                break;
+            }
+        }
+        if(gate->condition) hash = mix(hash, checksum(gate->condition, sizeof(GateCondition), 1));
+    }
+    return hash;
+}
+
+/* -------- files -------- */
+
+static bool write_all(int fd, const void *data, size_t size, uint64_t offset) {
+    const char *bytes = data;
+    while(size > 0) {
+        ssize_t written = pwrite(fd, bytes, size < IO_SIZE ? size : IO_SIZE, offset);
+        if(written < 0 && errno == EINTR) continue;
+        if(written <= 0) return false;
+        bytes += written;
+        offset += written;
+        size -= written;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void *data, size_t size, uint64_t offset) {
+    char *bytes = data;
+    while(size > 0) {
+        ssize_t got = pread(fd, bytes, size < IO_SIZE ? size : IO_SIZE, offset);
+        if(got < 0 && errno == EINTR) continue;
+        if(got <= 0) return false;
+        bytes += got;
+        offset += got;
+        size -= got;
+    }
+    return true;
+}
+
+static uint64_t align_up(uint64_t offset) {
+    return (offset + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+}
+
+// The rename of the file is only durable once its directory is synced
+static void sync_directory(const char *path) {
+    char *directory = strdup(path);
+    char *slash = strrchr(directory, '/');
+    if(slash == directory) slash[1] = '\0';
+    else if(slash) *slash = '\0';
+    int fd = open(slash ? directory : ".", O_RDONLY);
+    if(fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(directory);
+}
+
+// Sizes of the sections, the offsets in header
+static void layout_sections(CheckpointHeader *header, uint64_t *nb_chunks) {
+    *nb_chunks = 1ULL << (header->nb_qbits - header->chunk_qubits);
+    int nb_bits = header->nb_cbits > 0 ? header->nb_cbits : 0;
+    header->layout = sizeof(CheckpointHeader);
+    header->bits = header->layout + header->nb_qbits * sizeof(int32_t);
+    header->checksums = header->bits + nb_bits * sizeof(int32_t);
+    header->statevector = align_up(header->checksums + *nb_chunks * sizeof(uint64_t));
+    header->file_size = header->statevector + (sizeof(amplitude) << header->nb_qbits);
+}
+
+// The layout, bits and chunk checksums, one block
+static uint64_t header_checksum(const CheckpointHeader *header, const char *meta, size_t size) {
+    CheckpointHeader copy = *header;
+    copy.checksum = 0;
+    return checksum(meta, size, checksum(&copy, sizeof(copy), 0));
+}
+
+bool checkpoint_write(const char *path, CheckpointHeader *header, const QuantumRegister *qregister,
+                      const ClassicalRegister *cregister, const Rng *rng) {
+    int n = qregister->nb_qbits;
+    memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+    header->version = CHECKPOINT_VERSION;
+    header->amplitude_size = sizeof(amplitude);
+    header->nb_qbits = n;
+    header->nb_cbits = cregister ? cregister->nb_bits : -1;
+    header->chunk_qubits = n < CHECKPOINT_CHUNK_QUBITS ? n : CHECKPOINT_CHUNK_QUBITS;
+    if(rng) header->rng = *rng;
+    else memset(&header->rng, 0, sizeof(Rng));
+    uint64_t nb_chunks;
+    layout_sections(header, &nb_chunks);
+
+    size_t meta_size = header->statevector - header->layout;
+    char *meta = calloc_custom(meta_size, 1);
+    int32_t *layout = (int32_t *)meta;
+    int32_t *bits = (int32_t *)(meta + (header->bits - header->layout));
+    uint64_t *sums = (uint64_t *)(meta + (header->checksums - header->layout));
+    for(int q = 0; q < n; q++) layout[q] = qregister->layout[q];
+    for(int b = 0; b < header->nb_cbits; b++) bits[b] = cregister->bits[b];
+
+    size_t tmp_length = strlen(path) + 5;
+    char *tmp = malloc_custom(tmp_length);
+    snprintf(tmp, tmp_length, "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool written = fd >= 0 && ftruncate(fd, header->file_size) == 0;
+
+    // Every thread sums and writes its chunks
+    size_t chunk_size = sizeof(amplitude) << header->chunk_qubits;
+    const char *state = (const char *)qregister->statevector;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(&&:written) if(nb_chunks > 1 && !omp_in_parallel())
+    for(uint64_t c = 0; c < nb_chunks; c++) {
+        sums[c] = checksum(state + c * chunk_size, chunk_size, c);
+        written = written && write_all(fd, state + c * chunk_size, chunk_size, header->statevector + c * chunk_size);
+    }
+
+    header->checksum = header_checksum(header, meta, meta_size);
+    written = written && write_all(fd, meta, meta_size, header->layout) && write_all(fd, header, sizeof(CheckpointHeader), 0);
+    written = written && fsync(fd) == 0;
+    if(fd >= 0) written = (close(fd) == 0) && written;
+    written = written && rename(tmp, path) == 0;
+    if(written) {
+        sync_directory(path);
+    } else {
+        perror(tmp);
+        unlink(tmp);
+    }
+    free_custom(meta);
+    free_custom(tmp);
+    return written;
+}
+
+static CheckpointStatus invalid(const char *path, const char *error, int fd) {
+    fprintf(stderr, "%s: %s\n", path, error);
+    if(fd >= 0) close(fd);
+    return CHECKPOINT_INVALID;
+}
+
+CheckpointStatus checkpoint_read(const char *path, const CheckpointHeader *expected, CheckpointHeader *header,
+                                 QuantumRegister *qregister, ClassicalRegister *cregister, Rng *rng) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0 && errno == ENOENT) return CHECKPOINT_NONE;
+    struct stat status;
+    if(fd < 0 || fstat(fd, &status) != 0) {
+        perror(path);
+        if(fd >= 0) close(fd);
+        return CHECKPOINT_INVALID;
+    }
+    if((uint64_t)status.st_size < sizeof(CheckpointHeader) || !read_all(fd, header, sizeof(CheckpointHeader), 0)
+       || memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0 || header->version != CHECKPOINT_VERSION) {
+        return invalid(path, "not a checkpoint", fd);
+    }
+    int n = qregister->nb_qbits;
+    if(header->amplitude_size != sizeof(amplitude)) return invalid(path, "written in another precision", fd);
+    if(header->nb_qbits != n || header->nb_cbits != (cregister ? cregister->nb_bits : -1)) {
+        return invalid(path, "registers of another size", fd);
+    }
+    if(header->nb_gates != expected->nb_gates || header->plan_gates != expected->plan_gates
+       || header->fusion_qubits != expected->fusion_qubits || header->fingerprint != expected->fingerprint) {
+        return invalid(path, "checkpoint of another circuit or fusion", fd);
+    }
+    CheckpointHeader sections = *header;
+    uint64_t nb_chunks;
+    if(header->chunk_qubits < 0 || header->chunk_qubits > n) return invalid(path, "invalid chunks", fd);
+    layout_sections(&sections, &nb_chunks);
+    if(sections.layout != header->layout || sections.bits != header->bits || sections.checksums != header->checksums
+       || sections.statevector != header->statevector || sections.file_size != header->file_size
+       || header->file_size != (uint64_t)status.st_size) {
+        return invalid(path, "truncated", fd);
+    }
+
+    size_t meta_size = header->statevector - header->layout;
+    char *meta = malloc_custom(meta_size);
+    const int32_t *layout = (const int32_t *)meta;
+    const int32_t *bits = (const int32_t *)(meta + (header->bits - header->layout));
+    const uint64_t *sums = (const uint64_t *)(meta + (header->checksums - header->layout));
+    const char *error = NULL;
+    if(!read_all(fd, meta, meta_size, header->layout)) error = "truncated";
+    else if(header_checksum(header, meta, meta_size) != header->checksum) error = "checksum mismatch (header)";
+    else if(header->gate < 0 || header->gate > header->plan_gates) error = "invalid gate index";
+    for(int q = 0; q < n && !error; q++) {
+        if(layout[q] < 0 || layout[q] >= n) error = "invalid layout";
+        for(int p = 0; p < q && !error; p++) if(layout[p] == layout[q]) error = "invalid layout";
+    }
+    if(error) {
+        free_custom(meta);
+        return invalid(path, error, fd);
+    }
+
+    // Every thread reads and checks its chunks
+    size_t chunk_size = sizeof(amplitude) << header->chunk_qubits;
+    char *state = (char *)qregister->statevector;
+    bool valid = true;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(&&:valid) if(nb_chunks > 1 && !omp_in_parallel())
+    for(uint64_t c = 0; c < nb_chunks; c++) {
+        valid = valid && read_all(fd, state + c * chunk_size, chunk_size, header->statevector + c * chunk_size)
+                && checksum(state + c * chunk_size, chunk_size, c) == sums[c];
+    }
+    if(!valid) {
+        free_custom(meta);
+        return invalid(path, "checksum mismatch (statevector), the register is left undefined", fd);
+    }
+    close(fd);
+
+    for(int q = 0; q < n; q++) qregister->layout[q] = layout[q];
+    for(int b = 0; b < header->nb_cbits; b++) cregister->bits[b] = bits[b];
+    if(rng) *rng = header->rng;
+    free_custom(meta);
+    return CHECKPOINT_RESTORED;
+}
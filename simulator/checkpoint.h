@@ -0,0 +1,79 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../utils/rng.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* -------- checkpoints --------
+   The state of an execution between two gates : the statevector (in its
+   physical order, with the layout), the next gate, the classical register
+   and the random stream. The statevector is cut in chunks of
+   2^CHECKPOINT_CHUNK_QUBITS amplitudes, written (and read back) by all the
+   threads at once with pwrite / pread, each with its own checksum ; a last
+   checksum covers the header, the layout, the bits and the chunk checksums.
+   A checkpoint is written to "<path>.tmp", synced, then renamed over path :
+   the file at path is always the last complete checkpoint.
+   The gate index refers to the plan the executor runs (the fused circuit) :
+   the circuit, its fingerprint and the fusion options are checked at restore.
+*/
+#ifndef CHECKPOINT_CHUNK_QUBITS
+#define CHECKPOINT_CHUNK_QUBITS 22
+#endif
+
+/* Write speed assumed for the first checkpoint of an execution (bytes / s),
+   before its measured speed caps the overhead */
+#ifndef CHECKPOINT_BANDWIDTH
+#define CHECKPOINT_BANDWIDTH 512e6
+#endif
+
+#define CHECKPOINT_MAGIC "QSIMCKPT"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_ALIGNMENT 4096
+
+typedef struct {
+    char magic[8];              // CHECKPOINT_MAGIC, without its NUL
+    uint32_t version;
+    uint32_t amplitude_size;    // sizeof(amplitude) : single and double precision files differ
+    int32_t nb_qbits;
+    int32_t nb_cbits;           // -1 : executed without classical register
+    int32_t chunk_qubits;
+    int32_t fusion_qubits;      // 0 : without fusion
+    int64_t gate;               // Next gate of the plan to apply
+    int64_t nb_gates;           // Of the circuit
+    int64_t plan_gates;         // Of the plan
+    uint64_t fingerprint;       // circuit_fingerprint
+    Rng rng;
+    uint64_t layout;            // Offsets of the sections : int32_t layout, int32_t bits,
+    uint64_t bits;              // one uint64_t checksum per chunk, the statevector
+    uint64_t checksums;
+    uint64_t statevector;
+    uint64_t file_size;
+    uint64_t checksum;          // Of the above (this field at 0) and of the layout, bits and chunk checksums
+} CheckpointHeader;
+
+typedef enum {
+    CHECKPOINT_NONE,            // No file at path
+    CHECKPOINT_RESTORED,
+    CHECKPOINT_INVALID          // Unreadable, corrupted or of another execution (message on stderr)
+} CheckpointStatus;
+
+// Of the gates, qubits, phases and matrices of the circuit (not of the labels)
+uint64_t circuit_fingerprint(const QuantumCircuit *circuit);
+
+/* Writes the state of the execution described by header (nb_gates,
+   plan_gates, fusion_qubits, fingerprint and gate filled by the caller).
+   cregister and rng may be NULL. False (and a message) on failure, the
+   previous checkpoint at path left as it was */
+bool checkpoint_write(const char *path, CheckpointHeader *header, const QuantumRegister *qregister,
+                      const ClassicalRegister *cregister, const Rng *rng);
+/* Restores the register, the classical register and rng if the checkpoint
+   at path belongs to the execution described by expected (the fields the
+   caller fills for checkpoint_write, gate aside). header receives it */
+CheckpointStatus checkpoint_read(const char *path, const CheckpointHeader *expected, CheckpointHeader *header,
+                                 QuantumRegister *qregister, ClassicalRegister *cregister, Rng *rng);
+
+#endif
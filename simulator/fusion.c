@@ -0,0 +1,247 @@
+#include "fusion.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <complex.h>
+#include <math.h>
+#include <assert.h>
+
+#include "gates.h"
+#include "../builder/internal.h"
+#include "../utils/utils.h"
+
+/* Block of gates waiting to be fused, on at most max_qubits qubits.
+   The open blocks never share a qubit, so they commute with each other */
+typedef struct {
+    bool open;
+    int nb_qbits;
+    int qbits[FUSION_MAX_QUBITS];
+    int nb_gates;
+    int capacity;
+    Gate **gates;
+} Block;
+
+typedef struct {
+    QuantumCircuit *fused;
+    int max_qubits;
+    int *owner;         // Open block on each qubit, -1 if none
+    Block *blocks;
+    int nb_blocks;
+    int saved;
+} Fuser;
+
+/* Qubits a gate acts on (at most FUSION_MAX_QUBITS, -1 if more) */
+static int gate_qubits(Gate *gate, int *qbits) {
+    switch(gate->class) {
+        case UNITARY:
+            qbits[0] = gate->gate.unitary.qbit;
+            return 1;
+        case CONTROL:
+            qbits[0] = gate->gate.control.control;
+            qbits[1] = gate->gate.control.qbit;
+            return 2;
+        case CUSTOM:
+            if(gate->gate.custom.nb_qbits > FUSION_MAX_QUBITS) return -1;
+            for(int i = 0; i < gate->gate.custom.nb_qbits; i++) qbits[i] = gate->gate.custom.qbits[i];
+            return gate->gate.custom.nb_qbits;
+        case DIAGONAL:
+            if(gate->gate.diagonal.nb_qbits > FUSION_MAX_QUBITS) return -1;
+            for(int i = 0; i < gate->gate.diagonal.nb_qbits; i++) qbits[i] = gate->gate.diagonal.qbits[i];
+            return gate->gate.diagonal.nb_qbits;
+        case MEAS:
+            qbits[0] = gate->gate.measure.qbit;
+            return 1;
+    }
+    return -1;
+}
+
+/* Applies a gate to a state of the block's qubits only */
+static void apply_local(Gate *gate, amplitude *state, const Block *block) {
+    int local[FUSION_MAX_QUBITS];
+    int nb = gate_qubits(gate, local);
+    for(int i = 0; i < nb; i++) {
+        for(int j = 0; j < block->nb_qbits; j++) {
+            if(block->qbits[j] == local[i]) { local[i] = j; break; }
+        }
+    }
+
+    int n = block->nb_qbits;
+    switch(gate->class) {
+        case UNITARY:
+            apply_unitary_gate_inplace(state, n, local[0], gate->gate.unitary.type, gate->gate.unitary.phase);
+            break;
+        case CONTROL:
+            apply_controlled_gate_inplace(state, n, local[0], local[1], gate->gate.control.type, gate->gate.control.phase);
+            break;
+        case CUSTOM:
+            apply_custom_inplace(state, n, local, nb, gate->gate.custom.mat);
+            break;
+        case DIAGONAL:
+            apply_diagonal_inplace(state, n, local, nb, gate->gate.diagonal.phases);
+            break;
+        case MEAS:
+            break;
+    }
+}
+
+static bool is_identity(const double complex *m, uint64_t dim) {
+    for(uint64_t r = 0; r < dim; r++) {
+        for(uint64_t c = 0; c < dim; c++) {
+            if(cabs(m[r * dim + c] - (r == c ? 1.0 : 0.0)) > 1e-12) return false;
+        }
+    }
+    return true;
+}
+
+/* Emits an open block in the fused circuit and closes it */
+static void flush_block(Fuser *f, int b) {
+    Block *block = &f->blocks[b];
+    if(!block->open) return;
+    block->open = false;
+    for(int i = 0; i < block->nb_qbits; i++) f->owner[block->qbits[i]] = -1;
+
+    if(block->nb_gates == 1) {
+        circuit_append_gate(f->fused, block->gates[0]);
+        return;
+    }
+
+    /* Column j of the block matrix is the image of the basis state |j>
+    by the gates of the block, computed with the usual kernels */
+    uint64_t dim = 1ULL << block->nb_qbits;
+    double complex *mat = malloc_custom(dim * dim * sizeof(double complex));
+    amplitude *column = malloc_custom(dim * sizeof(amplitude));
+    for(uint64_t j = 0; j < dim; j++) {
+        for(uint64_t i = 0; i < dim; i++) column[i] = (i == j) ? 1.0 : 0.0;
+        for(int g = 0; g < block->nb_gates; g++) apply_local(block->gates[g], column, block);
+        for(uint64_t i = 0; i < dim; i++) mat[i * dim + j] = column[i];
+    }
+    free_custom(column);
+
+    if(is_identity(mat, dim)) {
+        f->saved += block->nb_gates;
+    } else {
+        // Copied into the fused circuit, as a diagonal gate if it is one
+        add_custom_gate(f->fused, block->nb_qbits, block->qbits, mat, "FUSED");
+        f->saved += block->nb_gates - 1;
+    }
+    free_custom(mat);
+}
+
+static void block_add_gate(Block *block, Gate *gate) {
+    if(block->nb_gates == block->capacity) {
+        block->capacity = block->capacity ? 2 * block->capacity : 8;
+        Gate **gates = malloc_custom(block->capacity * sizeof(Gate *));
+        for(int i = 0; i < block->nb_gates; i++) gates[i] = block->gates[i];
+        if(block->gates) free_custom(block->gates);
+        block->gates = gates;
+    }
+    block->gates[block->nb_gates++] = gate;
+}
+
+static int new_block(Fuser *f) {
+    for(int b = 0; b < f->nb_blocks; b++) {
+        if(!f->blocks[b].open) {
+            f->blocks[b].open = true;
+            f->blocks[b].nb_qbits = 0;
+            f->blocks[b].nb_gates = 0;
+            return b;
+        }
+    }
+    // At most one open block per qubit, so nb_qbits blocks are enough
+    assert(false && "No free fusion block");
+    return -1;
+}
+
+static void block_add_qubit(Fuser *f, int b, int q) {
+    Block *block = &f->blocks[b];
+    for(int i = 0; i < block->nb_qbits; i++) if(block->qbits[i] == q) return;
+    block->qbits[block->nb_qbits++] = q;
+    f->owner[q] = b;
+}
+
+static void fuse_gate(Fuser *f, Gate *gate) {
+    int qbits[FUSION_MAX_QUBITS];
+    int nb = gate_qubits(gate, qbits);
+
+    // Measurements, conditional gates and gates too large for a block end the blocks they touch
+    bool fusable = gate->class != MEAS && !gate->condition && nb > 0 && nb <= f->max_qubits;
+    if(!fusable) {
+        if(nb < 0) {
+            bool diagonal = gate->class == DIAGONAL;
+            int count = diagonal ? gate->gate.diagonal.nb_qbits : gate->gate.custom.nb_qbits;
+            for(int i = 0; i < count; i++) {
+                int q = diagonal ? gate->gate.diagonal.qbits[i] : gate->gate.custom.qbits[i];
+                if(f->owner[q] >= 0) flush_block(f, f->owner[q]);
+            }
+        } else {
+            for(int i = 0; i < nb; i++) if(f->owner[qbits[i]] >= 0) flush_block(f, f->owner[qbits[i]]);
+        }
+        circuit_append_gate(f->fused, gate);
+        return;
+    }
+
+    // Open blocks touched by the gate, and the size of their union with it
+    int touched[FUSION_MAX_QUBITS];
+    int nb_touched = 0;
+    int total = 0;
+    for(int i = 0; i < nb; i++) {
+        int b = f->owner[qbits[i]];
+        if(b < 0) {
+            total++;
+            continue;
+        }
+        bool seen = false;
+        for(int k = 0; k < nb_touched; k++) if(touched[k] == b) seen = true;
+        if(!seen) {
+            touched[nb_touched++] = b;
+            total += f->blocks[b].nb_qbits;
+        }
+    }
+
+    if(total > f->max_qubits) {
+        for(int k = 0; k < nb_touched; k++) flush_block(f, touched[k]);
+        nb_touched = 0;
+    }
+
+    // Merge the touched blocks (they commute, any order works) and add the gate
+    int b = (nb_touched > 0) ? touched[0] : new_block(f);
+    for(int k = 1; k < nb_touched; k++) {
+        Block *other = &f->blocks[touched[k]];
+        for(int g = 0; g < other->nb_gates; g++) block_add_gate(&f->blocks[b], other->gates[g]);
+        for(int i = 0; i < other->nb_qbits; i++) block_add_qubit(f, b, other->qbits[i]);
+        other->open = false;
+    }
+    for(int i = 0; i < nb; i++) block_add_qubit(f, b, qbits[i]);
+    block_add_gate(&f->blocks[b], gate);
+}
+
+QuantumCircuit *circuit_fuse(QuantumCircuit *circuit, int max_qubits, int *saved_passes) {
+    assert(max_qubits >= 1 && max_qubits <= FUSION_MAX_QUBITS);
+
+    Fuser f;
+    f.fused = circuit_create(circuit->nb_qbits);
+    f.max_qubits = max_qubits;
+    f.owner = malloc_custom(circuit->nb_qbits * sizeof(int));
+    for(int q = 0; q < circuit->nb_qbits; q++) f.owner[q] = -1;
+    f.nb_blocks = circuit->nb_qbits;
+    f.blocks = calloc_custom(f.nb_blocks, sizeof(Block));
+    f.saved = 0;
+
+    for(int g = 0; g < circuit->nb_gates; g++) fuse_gate(&f, &circuit->gates[g]);
+    for(int b = 0; b < f.nb_blocks; b++) flush_block(&f, b);
+
+    for(int b = 0; b < f.nb_blocks; b++) {
+        if(f.blocks[b].gates) free_custom(f.blocks[b].gates);
+    }
+    free_custom(f.blocks);
+    free_custom(f.owner);
+
+    if(saved_passes) *saved_passes = f.saved;
+    return f.fused;
+}
+
+QuantumCircuit *circuit_fuse_single_qubit(QuantumCircuit *circuit, int *saved_passes) {
+    return circuit_fuse(circuit, 1, saved_passes);
+}
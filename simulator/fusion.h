@@ -0,0 +1,26 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+#include "../builder/circuit.h"
+
+#define FUSION_MAX_QUBITS 5
+
+/* -------- gate fusion --------
+   Builds a new circuit where consecutive gates (unitary, controlled and
+   custom gates on at most max_qubits qubits) are grouped into blocks of up
+   to max_qubits qubits (1..FUSION_MAX_QUBITS), each block being multiplied
+   into one dense matrix applied as a single custom gate.
+   Gates on other qubits don't end a block, blocks that multiply to the
+   identity are dropped and blocks of a single gate are copied as is (they
+   keep their dedicated kernel). Measurements, conditional gates and larger
+   custom gates end the blocks they touch.
+   saved_passes (may be NULL) receives the number of passes over the
+   statevector saved. The matrices of the gates copied as is are shared with
+   circuit : free the result with circuit_free before circuit.
+*/
+QuantumCircuit *circuit_fuse(QuantumCircuit *circuit, int max_qubits, int *saved_passes);
+
+// circuit_fuse with blocks of 1 qubit : runs of single-qubit gates on each wire
+QuantumCircuit *circuit_fuse_single_qubit(QuantumCircuit *circuit, int *saved_passes);
+
+#endif
@@ -1,4 +1,5 @@
 #include "gates.h"
+#include "simd.h"
 
 #include "../builder/circuit.h"
 
@@ -11,13 +12,14 @@
 #include <math.h>
 #include <time.h>
 #include <assert.h>
+#include <stdbool.h>
 #include "../utils/utils.h"
 
 #include <omp.h>
 
 void apply_corresponding_gate(double complex g[4], SingleBitGate gt, double phase) {
     switch(gt) {
-        case GATE_I: break;
+        case GATE_I: gate_i(g); break;
         case GATE_H: gate_h(g); break;
         case GATE_X: gate_x(g); break;
         case GATE_Y: gate_y(g); break;
@@ -26,6 +28,10 @@ void apply_corresponding_gate(double complex g[4], SingleBitGate gt, double phas
     }
 }
 
+void gate_i(double complex g[4]) {
+    g[0] = 1.0; g[1] = 0.0;
+    g[2] = 0.0; g[3] = 1.0;
+}
 void gate_h(double complex g[4]) {
     double s = 1.0 / sqrt(2.0);
     g[0] = s; g[1] = s;
@@ -49,165 +55,637 @@ void gate_phase(double complex g[4], double phase) {
     g[2] = 0.0; g[3] = cexp(I * phase);
 }
 
+/* States with fewer qubits than this are updated on a single thread */
+static int parallel_threshold = PARALLEL_THRESHOLD_QUBITS;
+
+void gates_set_parallel_threshold(int nqubits) {
+    parallel_threshold = nqubits;
+}
+int gates_get_parallel_threshold(void) {
+    return parallel_threshold;
+}
+
+/* Threads are started for large states, unless the kernel already runs
+   inside a parallel region (cache blocks are dispatched over the threads) */
+static inline bool use_threads(int nqubits) {
+    return nqubits >= parallel_threshold && !omp_in_parallel();
+}
+
+/* Inserts a 0 at the position of the (single bit) mask in j :
+   bits below stay in place, bits above are shifted up by one */
+static inline uint64_t insert_zero_bit(uint64_t j, uint64_t bit) {
+    uint64_t low = j & (bit - 1);
+    return ((j ^ low) << 1) | low;
+}
+
 uint64_t get_bit(uint64_t x, int pos, int nqbits) {
     return (x >> (nqbits - 1 - pos)) & 1;
 }
 uint64_t set_bit(uint64_t x, int pos, int nqbits, int val) {
-    int mask = 1 << (nqbits - 1 - pos);
+    uint64_t mask = 1ULL << (nqbits - 1 - pos);
     return val ? (x | mask) : (x & ~mask);
 }
 
-void apply_single_qubit_inplace(double complex *state, int nqubits, int t, double complex g[4]) {
-    uint64_t size = 1ULL << nqubits;
+void apply_single_qubit_inplace(amplitude *state, int nqubits, int t, double complex g[4]) {
+    uint64_t half = 1ULL << (nqubits - 1);
     uint64_t bit = 1ULL << (nqubits - t - 1);
+    if(simd_single_qubit(state, nqubits, bit, g, use_threads(nqubits))) return;
+    if(simd_custom(state, nqubits, &t, 1, g, use_threads(nqubits))) return; // Stride below a vector
 
-    /* Parcours tous les b_1, ..., b_k-1, b_k+1, ..., b_n possibles en
-    effectuant la division euclidienne d'un indice par 2^(k-1) :
-    i0 = (i = 2^(k+1) * l) + r avec l < 2^(n - k - 1) et r < 2^k -> Terme en 2^k nul */
-    
-    //#pragma omp parallel for schedule(static)
-    for(uint64_t i = 0; i < size; i+= (bit << 1)) {
-        for(uint64_t r = 0; r < bit; r++) {
-            uint64_t i0 = i + r;
-            uint64_t i1 = i0 + bit; // Representation binaire pour b_k = 1
-            
-            double complex a0 = state[i0];
-            double complex a1 = state[i1];
-            
-            state[i0] = g[0] * a0 + g[1] * a1;
-            state[i1] = g[2] * a0 + g[3] * a1;
-        }
+    /* Parcours tous les b_1, ..., b_k-1, b_k+1, ..., b_n possibles :
+    chaque j < 2^(n-1) donne i0 en inserant un 0 a la position du bit k,
+    ce qui donne une seule boucle parallelisable quelle que soit la cible */
+    #pragma omp parallel for schedule(static) if(use_threads(nqubits))
+    for(uint64_t j = 0; j < half; j++) {
+        uint64_t i0 = insert_zero_bit(j, bit);
+        uint64_t i1 = i0 + bit; // Representation binaire pour b_k = 1
+
+        double complex a0 = state[i0];
+        double complex a1 = state[i1];
+
+        state[i0] = g[0] * a0 + g[1] * a1;
+        state[i1] = g[2] * a0 + g[3] * a1;
+    }
+}
+void apply_x_inplace(amplitude *state, int nqubits, int t) {
+    uint64_t half = 1ULL << (nqubits - 1);
+    uint64_t bit = 1ULL << (nqubits - t - 1);
+
+    // Pure swap of the two halves : no arithmetic
+    #pragma omp parallel for schedule(static) if(use_threads(nqubits))
+    for(uint64_t j = 0; j < half; j++) {
+        uint64_t i0 = insert_zero_bit(j, bit);
+        double complex a0 = state[i0];
+        state[i0] = state[i0 + bit];
+        state[i0 + bit] = a0;
+    }
+}
+void apply_y_inplace(amplitude *state, int nqubits, int t) {
+    uint64_t half = 1ULL << (nqubits - 1);
+    uint64_t bit = 1ULL << (nqubits - t - 1);
+
+    // Swap with a multiplication by -i / i, i.e. exchanging real and imaginary parts
+    #pragma omp parallel for schedule(static) if(use_threads(nqubits))
+    for(uint64_t j = 0; j < half; j++) {
+        uint64_t i0 = insert_zero_bit(j, bit);
+        uint64_t i1 = i0 + bit;
+        double complex a0 = state[i0];
+        double complex a1 = state[i1];
+        state[i0] = CMPLX(cimag(a1), -creal(a1));
+        state[i1] = CMPLX(-cimag(a0), creal(a0));
+    }
+}
+void apply_phase_inplace(amplitude *state, int nqubits, int t, double complex phase) {
+    uint64_t half = 1ULL << (nqubits - 1);
+    uint64_t bit = 1ULL << (nqubits - t - 1);
+    if(simd_diagonal(state, nqubits, bit, phase, use_threads(nqubits))) return;
+
+    // diag(1, phase) : the |0> half is left untouched
+    #pragma omp parallel for schedule(static) if(use_threads(nqubits))
+    for(uint64_t j = 0; j < half; j++) {
+        state[insert_zero_bit(j, bit) + bit] *= phase;
+    }
+}
+void apply_h_inplace(amplitude *state, int nqubits, int t) {
+    uint64_t half = 1ULL << (nqubits - 1);
+    uint64_t bit = 1ULL << (nqubits - t - 1);
+    double s = 1.0 / sqrt(2.0);
+
+    // Real butterfly : 2 additions and 2 real scalings per pair
+    #pragma omp parallel for schedule(static) if(use_threads(nqubits))
+    for(uint64_t j = 0; j < half; j++) {
+        uint64_t i0 = insert_zero_bit(j, bit);
+        uint64_t i1 = i0 + bit;
+        double complex a0 = state[i0];
+        double complex a1 = state[i1];
+        state[i0] = s * (a0 + a1);
+        state[i1] = s * (a0 - a1);
+    }
+}
+
+void apply_unitary_gate_inplace(amplitude *state, int nqubits, int t, SingleBitGate gt, double phase) {
+    switch(gt) {
+        case GATE_I: break;
+        case GATE_H: apply_h_inplace(state, nqubits, t); break;
+        case GATE_X: apply_x_inplace(state, nqubits, t); break;
+        case GATE_Y: apply_y_inplace(state, nqubits, t); break;
+        case GATE_Z: apply_phase_inplace(state, nqubits, t, -1.0); break;
+        case GATE_PHASE: apply_phase_inplace(state, nqubits, t, cexp(I * phase)); break;
+    }
+}
+void apply_controlled_gate_inplace(amplitude *state, int nqubits, int c, int t, SingleBitGate gt, double phase) {
+    double complex gm[4];
+    switch(gt) {
+        case GATE_I: break;
+        case GATE_Z: apply_controlled_phase_inplace(state, nqubits, c, t, -1.0); break;
+        case GATE_PHASE: apply_controlled_phase_inplace(state, nqubits, c, t, cexp(I * phase)); break;
+        default:
+            apply_corresponding_gate(gm, gt, phase);
+            apply_controlled_u_inplace(state, nqubits, c, t, gm);
+            break;
     }
 }
-void apply_two_qubit_inplace(double complex *state, int nqubits, int q0, int q1, double complex G[16]) {
+
+void apply_two_qubit_inplace(amplitude *state, int nqubits, int q0, int q1, double complex G[16]) {
     assert(q0 != q1);
     if(q1 < q0) {int temp = q1; q1 = q0; q0 = temp;}
 
-    uint64_t size = 1ULL << nqubits;
     uint64_t bit0 = 1ULL << (nqubits - q0 - 1);
     uint64_t bit1 = 1ULL << (nqubits - q1 - 1);
+    if(simd_two_qubit(state, nqubits, bit0, bit1, G, use_threads(nqubits))) return;
+    int targets[2] = {q1, q0}; // q1 > q0 is the MSB of the rows
+    if(simd_custom(state, nqubits, targets, 2, G, use_threads(nqubits))) return;
 
-    /* Même principe : 
-    i0 = (k * 2^(q1 + 1)) + (l * 2^(q0+1)) + r
-    avec l * 2^(q0+1) < 2^q1 et r < 2^q0
-    */
-    
-    //#pragma omp parallel for schedule(static)
-    for(uint64_t k = 0; k < size; k += (bit1 << 1)) {
-        for(uint64_t l = 0; l < bit1; l += (bit0 << 1)) {
-            for(uint64_t r = 0; r < bit0; r++) {
-                uint64_t i00 = k + l + r; // q1=0 q0=0
-                uint64_t i01 = i00 + bit0; // q1=0 q0=1
-                uint64_t i10 = i00 + bit1; // q1=1 q0=0
-                uint64_t i11 = i10 + bit0; // q1=1 q0=1
-
-                double complex v00 = state[i00];
-                double complex v01 = state[i01];
-                double complex v10 = state[i10];
-                double complex v11 = state[i11];
-
-                // multiply: new = G * vec([v00,v01,v10,v11])
-                state[i00] = G[0]*v00 + G[1]*v01 + G[2]*v10 + G[3]*v11;
-                state[i01] = G[4]*v00 + G[5]*v01 + G[6]*v10 + G[7]*v11;
-                state[i10] = G[8]*v00 + G[9]*v01 + G[10]*v10 + G[11]*v11;
-                state[i11] = G[12]*v00 + G[13]*v01 + G[14]*v10 + G[15]*v11;
-            }
-        }
+    /* Même principe, en inserant deux 0 (d'abord au bit de poids faible) */
+    uint64_t quarter = 1ULL << (nqubits - 2);
+
+    #pragma omp parallel for schedule(static) if(use_threads(nqubits))
+    for(uint64_t j = 0; j < quarter; j++) {
+        uint64_t i00 = insert_zero_bit(insert_zero_bit(j, bit1), bit0); // q1=0 q0=0
+        uint64_t i01 = i00 + bit0; // q1=0 q0=1
+        uint64_t i10 = i00 + bit1; // q1=1 q0=0
+        uint64_t i11 = i10 + bit0; // q1=1 q0=1
+
+        double complex v00 = state[i00];
+        double complex v01 = state[i01];
+        double complex v10 = state[i10];
+        double complex v11 = state[i11];
+
+        // multiply: new = G * vec([v00,v01,v10,v11])
+        state[i00] = G[0]*v00 + G[1]*v01 + G[2]*v10 + G[3]*v11;
+        state[i01] = G[4]*v00 + G[5]*v01 + G[6]*v10 + G[7]*v11;
+        state[i10] = G[8]*v00 + G[9]*v01 + G[10]*v10 + G[11]*v11;
+        state[i11] = G[12]*v00 + G[13]*v01 + G[14]*v10 + G[15]*v11;
     }
 }
-void apply_controlled_u_inplace(double complex *state, int nqubits, int c, int t, double complex U[4]) {
-    uint64_t size = 1ULL << nqubits;
+void apply_controlled_u_inplace(amplitude *state, int nqubits, int c, int t, double complex U[4]) {
+    uint64_t quarter = 1ULL << (nqubits - 2);
     uint64_t control = 1ULL << (nqubits - c - 1);
     uint64_t target = 1ULL << (nqubits - t - 1);
+    uint64_t low = (control < target) ? control : target;
+    uint64_t high = control ^ target ^ low;
+    if(simd_controlled_u(state, nqubits, control, target, U, use_threads(nqubits))) return;
+    double complex G[16] = {
+        1, 0, 0, 0,
+        0, 1, 0, 0,
+        0, 0, U[0], U[1],
+        0, 0, U[2], U[3]
+    };
+    int targets[2] = {c, t};
+    if(simd_custom(state, nqubits, targets, 2, G, use_threads(nqubits))) return;
+
+    /* Only the bases with control = 1 and target = 0 are visited : insert
+    a 0 at both positions (lowest first) then set the control bit */
+    #pragma omp parallel for schedule(static) if(use_threads(nqubits))
+    for(uint64_t j = 0; j < quarter; j++) {
+        uint64_t i0 = insert_zero_bit(insert_zero_bit(j, low), high) | control; // Control = 1, Target = 0
+        uint64_t i1 = i0 | target; // Control = 1, Target = 1
+
+        double complex a0 = state[i0];
+        double complex a1 = state[i1];
+
+        state[i0] = U[0] * a0 + U[1] * a1;
+        state[i1] = U[2] * a0 + U[3] * a1;
+    }
+}
+void apply_controlled_phase_inplace(amplitude *state, int nqubits, int c, int t, double complex phase) {
+    uint64_t quarter = 1ULL << (nqubits - 2);
+    uint64_t control = 1ULL << (nqubits - c - 1);
+    uint64_t target = 1ULL << (nqubits - t - 1);
+    uint64_t low = (control < target) ? control : target;
+    uint64_t high = control ^ target ^ low;
+    if(simd_diagonal(state, nqubits, control | target, phase, use_threads(nqubits))) return;
+
+    // diag(1, 1, 1, phase) : only the bases with control = target = 1 change
+    #pragma omp parallel for schedule(static) if(use_threads(nqubits))
+    for(uint64_t j = 0; j < quarter; j++) {
+        uint64_t i11 = insert_zero_bit(insert_zero_bit(j, low), high) | control | target;
+        state[i11] *= phase;
+    }
+}
+
+void apply_swap_inplace(amplitude *state, int nqubits, int q0, int q1) {
+    if(q0 == q1) return;
+    uint64_t quarter = 1ULL << (nqubits - 2);
+    uint64_t bit0 = 1ULL << (nqubits - q0 - 1);
+    uint64_t bit1 = 1ULL << (nqubits - q1 - 1);
+    uint64_t low = (bit0 < bit1) ? bit0 : bit1;
+    uint64_t high = bit0 ^ bit1 ^ low;
+
+    // |01> <-> |10>, the other half of the state isn't touched
+    #pragma omp parallel for schedule(static) if(use_threads(nqubits))
+    for(uint64_t j = 0; j < quarter; j++) {
+        uint64_t i00 = insert_zero_bit(insert_zero_bit(j, low), high);
+        amplitude tmp = state[i00 | bit0];
+        state[i00 | bit0] = state[i00 | bit1];
+        state[i00 | bit1] = tmp;
+    }
+}
+
+/* Tables of the flip mask of swap_partner : the partner of an index flips
+   both bits of every pair whose bits differ. That mask is linear in the
+   index bits (over GF(2)) so it is read byte by byte, like the diagonal
+   gate's phase index. pos0 / pos1 are bit positions (not qubits) */
+static uint64_t (*swap_tables(int nbits, const int *pos0, const int *pos1, int count))[256] {
+    uint64_t (*bytes)[256] = calloc_custom((nbits + 7) / 8, sizeof(*bytes));
+    for(int s = 0; s < count; s++) {
+        uint64_t flip = (1ULL << pos0[s]) | (1ULL << pos1[s]);
+        int pos[2] = {pos0[s], pos1[s]};
+        for(int b = 0; b < 2; b++) {
+            for(uint64_t v = 0; v < 256; v++) {
+                if((v >> (pos[b] % 8)) & 1) bytes[pos[b] / 8][v] ^= flip;
+            }
+        }
+    }
+    return bytes;
+}
+
+static inline uint64_t swap_partner(uint64_t i, uint64_t (*bytes)[256], int nbytes) {
+    uint64_t partner = i;
+    for(int b = 0; b < nbytes; b++) partner ^= bytes[b][(i >> (8 * b)) & 255];
+    return partner;
+}
+
+// Every pair of amplitudes is exchanged by the iteration of its lowest index
+static void swap_range(amplitude *state, uint64_t start, uint64_t end, uint64_t (*bytes)[256], int nbytes) {
+    for(uint64_t i = start; i < end; i++) {
+        uint64_t partner = swap_partner(i, bytes, nbytes);
+        if(partner > i) {
+            amplitude tmp = state[i];
+            state[i] = state[partner];
+            state[partner] = tmp;
+        }
+    }
+}
+
+/* Pairs mixing large and small strides would scatter the accesses over the
+   whole state. The state is cut into tiles of 2^rows rows of 2^r consecutive
+   amplitudes, the swapped bits at or above r selecting the row : partners
+   stay in their tile. A tile of at most 2^16 amplitudes is gathered, already
+   permuted, in a per-thread buffer that stays in cache, and copied back row
+   by row (rows far apart would also conflict in the cache sets). When the
+   pairs would need a larger tile, they are split in groups done in turn */
+void apply_swaps_inplace(amplitude *state, int nqubits, const int *q0, const int *q1, int count) {
+    // Rows needed by each pair with rows of 2^8 amplitudes
+    int needed = 0;
+    for(int s = 0; s < count; s++) needed += (nqubits - q0[s] - 1 >= 8) + (nqubits - q1[s] - 1 >= 8);
+    if(count > 1 && 8 + needed > 16) {
+        int first = 0, rows = 0;
+        for(int s = 0; s <= count; s++) {
+            int cost = (s < count) ? (nqubits - q0[s] - 1 >= 8) + (nqubits - q1[s] - 1 >= 8) : 0;
+            if(s == count || 8 + rows + cost > 16) {
+                apply_swaps_inplace(state, nqubits, q0 + first, q1 + first, s - first);
+                first = s;
+                rows = 0;
+            }
+            rows += cost;
+        }
+        return;
+    }
+
+    int *pos0 = malloc_custom(2 * count * sizeof(int));
+    int *pos1 = pos0 + count;
+    uint64_t swapped = 0;
+    for(int s = 0; s < count; s++) {
+        pos0[s] = nqubits - q0[s] - 1;
+        pos1[s] = nqubits - q1[s] - 1;
+        swapped |= (1ULL << pos0[s]) | (1ULL << pos1[s]);
+    }
 
-    //#pragma omp parallel for schedule(static)
-    for(uint64_t base = 0; base < size; base++) {
-        /* If control is 1 on this base and target is 0 
-        (to make sure that adding 2^(t) does not impact the rest) */
-        if((base & control) && !(base & target)) {
-            uint64_t i0 = base; // Control = 1, Target = 0
-            uint64_t i1 = base + target; // Control = 1, Target = 1
+    int r = (nqubits < 8) ? nqubits : 8;
+    for(int x = r + 1; x <= 16 && x <= nqubits; x++) {
+        if(x + __builtin_popcountll(swapped >> x) <= 16) r = x;
+    }
+    int rows = __builtin_popcountll(swapped >> r);
+    uint64_t row_masks[64];
+    int local_pos[64]; // Position of each bit inside a gathered tile
+    for(int pos = 0, nb = 0; pos < nqubits; pos++) {
+        if(pos < r) local_pos[pos] = pos;
+        else if((swapped >> pos) & 1) {
+            local_pos[pos] = r + nb;
+            row_masks[nb++] = 1ULL << pos;
+        }
+    }
+    uint64_t run = 1ULL << r;
+    uint64_t tiles = 1ULL << (nqubits - r - rows);
+    bool gather = rows > 0 && r + rows <= 16;
 
-            double complex a0 = state[i0];
-            double complex a1 = state[i1];
-            
-            state[i0] = U[0] * a0 + U[1] * a1;
-            state[i1] = U[2] * a0 + U[3] * a1;
+    int nbytes = (nqubits + 7) / 8, tile_bytes = (r + rows + 7) / 8;
+    uint64_t (*bytes)[256] = swap_tables(nqubits, pos0, pos1, count);
+    uint64_t (*tile_tables)[256] = NULL;
+    uint32_t *in_row = NULL;
+    if(gather) {
+        for(int s = 0; s < count; s++) {
+            pos0[s] = local_pos[pos0[s]];
+            pos1[s] = local_pos[pos1[s]];
         }
+        tile_tables = swap_tables(r + rows, pos0, pos1, count);
+        // The row and in-row bits are disjoint : partner(row + j) = partner(row) ^ partner(j)
+        in_row = malloc_custom(run * sizeof(uint32_t));
+        for(uint64_t j = 0; j < run; j++) in_row[j] = swap_partner(j, tile_tables, tile_bytes);
     }
+
+    #pragma omp parallel if(use_threads(nqubits))
+    {
+        amplitude *buffer = gather ? malloc_custom((run << rows) * sizeof(amplitude)) : NULL;
+
+        #pragma omp for schedule(static)
+        for(uint64_t t = 0; t < tiles; t++) {
+            // Tile t : the bits below r and the row bits at 0
+            uint64_t base = t << r;
+            for(int i = 0; i < rows; i++) base = insert_zero_bit(base, row_masks[i]);
+
+            for(uint64_t row = 0; row < (1ULL << rows); row++) {
+                uint64_t start = base;
+                for(int i = 0; i < rows; i++) if((row >> i) & 1) start |= row_masks[i];
+                if(!gather) {
+                    swap_range(state, start, start + run, bytes, nbytes);
+                    continue;
+                }
+                // Each amplitude goes straight to its partner's place in the buffer
+                uint64_t dest = swap_partner(row * run, tile_tables, tile_bytes);
+                for(uint64_t j = 0; j < run; j++) buffer[dest ^ in_row[j]] = state[start + j];
+            }
+            if(!gather) continue;
+
+            for(uint64_t row = 0; row < (1ULL << rows); row++) {
+                uint64_t start = base;
+                for(int i = 0; i < rows; i++) if((row >> i) & 1) start |= row_masks[i];
+                memcpy(state + start, buffer + row * run, run * sizeof(amplitude));
+            }
+        }
+        if(buffer) free_custom(buffer);
+    }
+    free_custom(bytes);
+    if(tile_tables) {
+        free_custom(tile_tables);
+        free_custom(in_row);
+    }
+    free_custom(pos0);
 }
 
-/* For index = x(0)...x(n) and targets = {t0...tk}, gives the number x(t0)...x(tk)*/
-uint64_t extract_subindex(uint64_t index, int *targets, int k, int nqbits) {
-    uint64_t sub = 0;
-    for (int i = 0; i < k; i++) {
-        sub <<= 1;
-        sub |= get_bit(index, targets[i], nqbits);
+/* Offset of each column of a 2^k matrix in the statevector : the column
+   index x(t0)...x(tk-1) is spread over the target bits (t0 is the MSB) */
+static void custom_offsets(uint64_t *offsets, int nqbits, int *targets, int k) {
+    uint64_t subdim = 1ULL << k;
+    for(uint64_t col = 0; col < subdim; col++) {
+        uint64_t off = 0;
+        for(int i = 0; i < k; i++) {
+            if((col >> (k - 1 - i)) & 1) off |= 1ULL << (nqbits - 1 - targets[i]);
+        }
+        offsets[col] = off;
     }
-    return sub;
 }
-/* Replaces the (x(ti)) in x(0)...x(n) by sub*/
-uint64_t replace_subindex(uint64_t index, int *targets, int k, int nqbits, uint64_t sub) {
-    for (int i = k - 1; i >= 0; i--) {
-        int bit = sub & 1;
-        sub >>= 1;
-        index = set_bit(index, targets[i], nqbits, bit);
+
+/* Index of the group-th basis with every target bit at 0 (masks sorted ascending) */
+static inline uint64_t custom_base(uint64_t group, uint64_t *masks, int k) {
+    for(int i = 0; i < k; i++) group = insert_zero_bit(group, masks[i]);
+    return group;
+}
+
+/* Row of U times the gathered amplitudes, with real arithmetic (no C99
+   complex multiply and its NaN checks in the inner loop) */
+static inline double complex custom_row(const double complex *u, const double complex *in, uint64_t subdim) {
+    double re = 0.0, im = 0.0;
+    for(uint64_t col = 0; col < subdim; col++) {
+        double ur = creal(u[col]), ui = cimag(u[col]);
+        double ar = creal(in[col]), ai = cimag(in[col]);
+        re += ur * ar - ui * ai;
+        im += ur * ai + ui * ar;
     }
-    return index;
+    return CMPLX(re, im);
 }
 
-void apply_custom_inplace(double complex *state, int nqbits, int *targets, int k, double complex *U) {
-    uint64_t dim = 1ULL << nqbits;
+static inline void custom_apply_group(amplitude *state, uint64_t base, uint64_t *offsets,
+                                      uint64_t subdim, double complex *U, double complex *in, double complex *out) {
+    for(uint64_t col = 0; col < subdim; col++) in[col] = state[base + offsets[col]];
+    for(uint64_t row = 0; row < subdim; row++) out[row] = custom_row(U + row * subdim, in, subdim);
+    for(uint64_t row = 0; row < subdim; row++) state[base + offsets[row]] = out[row];
+}
+
+void apply_custom_inplace(amplitude *state, int nqbits, int *targets, int k, double complex *U) {
+    // Small gates go to the dedicated kernels
+    if(k == 1) {
+        apply_single_qubit_inplace(state, nqbits, targets[0], U);
+        return;
+    }
+    if(k == 2) {
+        /* apply_two_qubit_inplace takes the highest qubit index as the MSB of
+        the row, swap the middle rows and columns when targets[0] is the lowest */
+        if(targets[0] > targets[1]) {
+            apply_two_qubit_inplace(state, nqbits, targets[0], targets[1], U);
+        } else {
+            int perm[4] = {0, 2, 1, 3};
+            double complex G[16];
+            for(int r = 0; r < 4; r++) {
+                for(int c = 0; c < 4; c++) G[4 * r + c] = U[4 * perm[r] + perm[c]];
+            }
+            apply_two_qubit_inplace(state, nqbits, targets[0], targets[1], G);
+        }
+        return;
+    }
+
+    bool parallel = use_threads(nqbits);
+    if(simd_custom(state, nqbits, targets, k, U, parallel)) return;
+
     uint64_t subdim = 1ULL << k;
+    uint64_t groups = 1ULL << (nqbits - k);
+
+    uint64_t *offsets = malloc_custom(subdim * sizeof(uint64_t));
+    custom_offsets(offsets, nqbits, targets, k);
+
+    uint64_t masks[64];
+    for(int i = 0; i < k; i++) masks[i] = 1ULL << (nqbits - 1 - targets[i]);
+    for(int i = 1; i < k; i++) { // insertion sort, k is small
+        uint64_t m = masks[i];
+        int j = i - 1;
+        for(; j >= 0 && masks[j] > m; j--) masks[j + 1] = masks[j];
+        masks[j + 1] = m;
+    }
+
+    if(!parallel || groups >= (uint64_t)omp_get_max_threads()) {
+        /* Gather / apply / scatter each group of 2^k amplitudes with a
+        per-thread scratch : no copy of the whole state */
+        #pragma omp parallel if(parallel)
+        {
+            double complex *in = malloc_custom(2 * subdim * sizeof(double complex));
+            double complex *out = in + subdim;
+
+            #pragma omp for schedule(static)
+            for(uint64_t g = 0; g < groups; g++) {
+                custom_apply_group(state, custom_base(g, masks, k), offsets, subdim, U, in, out);
+            }
+            free_custom(in);
+        }
+    } else {
+        /* Too few groups to feed the threads (k close to n) : split the rows instead */
+        double complex *in = malloc_custom(subdim * sizeof(double complex));
+        for(uint64_t g = 0; g < groups; g++) {
+            uint64_t base = custom_base(g, masks, k);
+            for(uint64_t col = 0; col < subdim; col++) in[col] = state[base + offsets[col]];
 
-    double complex *new_state = calloc_custom(dim, sizeof(double complex));
+            #pragma omp parallel for schedule(static)
+            for(uint64_t row = 0; row < subdim; row++) {
+                state[base + offsets[row]] = custom_row(U + row * subdim, in, subdim);
+            }
+        }
+        free_custom(in);
+    }
 
-    for (uint64_t i = 0; i < dim; i++) {
-        uint64_t row = extract_subindex(i, targets, k, nqbits);
+    free_custom(offsets);
+}
 
-        for (uint64_t col = 0; col < subdim; col++) {
-            uint64_t j = replace_subindex(i, targets, k, nqbits, col);
-            new_state[i] += U[row * subdim + col] * state[j];
+/* The index over the targets of an amplitude (targets[0] the most
+   significant bit) is read byte by byte from lookup tables : bytes[b][v]
+   holds the bits given by the value v of the b-th byte of the amplitude
+   index. The low byte is the only one that changes inside a run of 256
+   amplitudes */
+static uint64_t (*target_tables(int nqbits, const int *targets, int k))[256] {
+    uint64_t (*bytes)[256] = calloc_custom((nqbits + 7) / 8, sizeof(*bytes));
+    for(int i = 0; i < k; i++) {
+        int pos = nqbits - 1 - targets[i];
+        for(uint64_t v = 0; v < 256; v++) {
+            if((v >> (pos % 8)) & 1) bytes[pos / 8][v] |= 1ULL << (k - 1 - i);
         }
     }
+    return bytes;
+}
 
-    memcpy(state, new_state, dim * sizeof(double complex));
-    free_custom(new_state);
+static inline uint64_t target_high(uint64_t base, uint64_t (*bytes)[256], int nbytes) {
+    uint64_t high = 0;
+    for(int b = 1; b < nbytes; b++) high |= bytes[b][(base >> (8 * b)) & 255];
+    return high;
 }
 
-int measure_qubit_inplace(double complex *state, int nqubits, int t) {
-    uint64_t size = 1ULL << nqubits;
+void apply_diagonal_inplace(amplitude *state, int nqbits, int *targets, int k, double complex *phases) {
+    if(k == 1 && phases[0] == 1.0) {
+        apply_phase_inplace(state, nqbits, targets[0], phases[1]);
+        return;
+    }
+
+    int nbytes = (nqbits + 7) / 8;
+    uint64_t (*bytes)[256] = target_tables(nqbits, targets, k);
+
+    uint64_t dim = 1ULL << nqbits;
+    uint64_t run = (dim < 256) ? dim : 256;
+    #pragma omp parallel for schedule(static) if(use_threads(nqbits))
+    for(uint64_t base = 0; base < dim; base += run) {
+        uint64_t high = target_high(base, bytes, nbytes);
+        for(uint64_t j = 0; j < run; j++) {
+            // Real arithmetic, no Annex G checks of the complex product
+            double complex a = state[base + j], p = phases[high | bytes[0][j]];
+            state[base + j] = CMPLX(creal(a) * creal(p) - cimag(a) * cimag(p), creal(a) * cimag(p) + cimag(a) * creal(p));
+        }
+    }
+    free_custom(bytes);
+}
+
+int measure_qubit_inplace(amplitude *state, int nqubits, int t, Rng *rng) {
+    uint64_t half = 1ULL << (nqubits - 1);
     uint64_t bit = 1ULL << (nqubits - t - 1);
 
     // Compute Norm squared of P0 * phi (phi after projection of the bit on zero)
     double p0 = 0.0;
-    
-    //#pragma omp parallel for reduction(+:p0) schedule(static)
-    for (uint64_t i = 0; i < size; ++i) {
-        // If the t bit of the basis is 0
-        if (!(i & bit)) {
+
+    if(!simd_prob_zero(state, nqubits, bit, use_threads(nqubits), &p0)) {
+        #pragma omp parallel for reduction(+:p0) schedule(static) if(use_threads(nqubits))
+        for (uint64_t j = 0; j < half; ++j) {
+            // Basis with the t bit at 0
+            uint64_t i = insert_zero_bit(j, bit);
             double re = creal(state[i]), im = cimag(state[i]);
             p0 += re*re + im*im;
         }
     }
 
-    double r = (double)rand() / (double)RAND_MAX;
+    double r = rng_uniform(rng ? rng : rng_default());
     int result = (r < p0) ? 0 : 1;
     double keep_prob = (result == 0) ? p0 : (1.0 - p0);
     double norm = (keep_prob <= 0) ? 1.0 : 1.0 / sqrt(keep_prob);
     
     //printf("Measured %d on qbit %d with probability %.2f\n", result, t, keep_prob);
-            
+    
     // Collapse the qbit and norm it
-    //#pragma omp parallel for schedule(static)
-    for (uint64_t i = 0; i < size; ++i) {
-        // If the bit of this basis is not the result
-        if (((i & bit) ? 1 : 0) != result) {
-            state[i] = 0.0 + 0.0*I;
-        } else {
-            state[i] *= norm;
-        }
+    uint64_t kept = result ? bit : 0;
+    #pragma omp parallel for schedule(static) if(use_threads(nqubits))
+    for (uint64_t j = 0; j < half; ++j) {
+        uint64_t i0 = insert_zero_bit(j, bit);
+        state[i0 + kept] *= norm;
+        state[i0 + (bit - kept)] = 0.0 + 0.0*I;
     }
 
     return result;
-}
\ No newline at end of file
+}
+static inline void accumulate_run(double *marginal, const amplitude *amplitudes, uint64_t high, uint64_t run, const uint64_t *low) {
+    for(uint64_t j = 0; j < run; j++) {
+        double re = creal(amplitudes[j]), im = cimag(amplitudes[j]);
+        marginal[high | low[j]] += re * re + im * im;
+    }
+}
+
+void marginal_probabilities(const amplitude *state, int nqubits, const int *targets, int k, double *marginal) {
+    uint64_t dim = 1ULL << nqubits;
+    uint64_t size = 1ULL << k;
+    int nbytes = (nqubits + 7) / 8;
+    uint64_t (*bytes)[256] = target_tables(nqubits, targets, k);
+    memset(marginal, 0, size * sizeof(double));
+
+    uint64_t run = (dim < 256) ? dim : 256;
+    // The private copies of the reduction live on the stack : small marginals only
+    if(size <= MARGINAL_PARALLEL_SIZE) {
+        #pragma omp parallel for reduction(+:marginal[:size]) schedule(static) if(use_threads(nqubits))
+        for(uint64_t base = 0; base < dim; base += run) {
+            accumulate_run(marginal, state + base, target_high(base, bytes, nbytes), run, bytes[0]);
+        }
+    } else {
+        for(uint64_t base = 0; base < dim; base += run) {
+            accumulate_run(marginal, state + base, target_high(base, bytes, nbytes), run, bytes[0]);
+        }
+    }
+    free_custom(bytes);
+}
+
+/* One group of at most MEASURE_JOINT_QUBITS targets : a pass for the
+   marginal, the outcome drawn from it, a pass to collapse */
+static uint64_t measure_group_inplace(amplitude *state, int nqubits, const int *targets, int k, Rng *rng) {
+    uint64_t size = 1ULL << k;
+    double *marginal = malloc_custom(size * sizeof(double));
+    marginal_probabilities(state, nqubits, targets, k, marginal);
+
+    double total = 0.0;
+    for(uint64_t key = 0; key < size; key++) total += marginal[key];
+    double r = rng_uniform(rng) * total;
+    uint64_t outcome = 0;
+    double cumulative = marginal[0];
+    while(outcome + 1 < size && cumulative <= r) cumulative += marginal[++outcome];
+    // Never an outcome of probability 0, even with rounding errors
+    while(outcome > 0 && marginal[outcome] == 0.0) outcome--;
+    double keep_prob = marginal[outcome] / total;
+    double norm = (keep_prob <= 0) ? 1.0 : 1.0 / sqrt(keep_prob);
+    free_custom(marginal);
+
+    int nbytes = (nqubits + 7) / 8;
+    uint64_t (*bytes)[256] = target_tables(nqubits, targets, k);
+    uint64_t dim = 1ULL << nqubits;
+    uint64_t run = (dim < 256) ? dim : 256;
+    #pragma omp parallel for schedule(static) if(use_threads(nqubits))
+    for(uint64_t base = 0; base < dim; base += run) {
+        uint64_t high = target_high(base, bytes, nbytes);
+        for(uint64_t j = 0; j < run; j++) {
+            if((high | bytes[0][j]) == outcome) state[base + j] *= norm;
+            else state[base + j] = 0.0;
+        }
+    }
+    free_custom(bytes);
+    return outcome;
+}
+
+uint64_t measure_qubits_inplace(amplitude *state, int nqubits, const int *targets, int k, Rng *rng) {
+    assert(k <= 64);
+    if(!rng) rng = rng_default();
+    uint64_t outcome = 0;
+    for(int first = 0; first < k; first += MEASURE_JOINT_QUBITS) {
+        int group = (k - first < MEASURE_JOINT_QUBITS) ? k - first : MEASURE_JOINT_QUBITS;
+        outcome = (outcome << group) | measure_group_inplace(state, nqubits, targets + first, group, rng);
+    }
+    return outcome;
+}
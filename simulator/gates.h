@@ -2,12 +2,28 @@
 #define GATES_H
 
 #include "../builder/circuit.h"
+#include "../utils/rng.h"
+#include "../utils/precision.h"
 
 #include <complex.h>
+#include <stdint.h>
+
+/* -------- multithreading --------
+   Kernels run with OpenMP on states of at least PARALLEL_THRESHOLD_QUBITS
+   qubits and serially below (thread start-up dominates on small states).
+   The default can be overridden at compile time or changed at runtime.
+*/
+#ifndef PARALLEL_THRESHOLD_QUBITS
+#define PARALLEL_THRESHOLD_QUBITS 14
+#endif
+
+void gates_set_parallel_threshold(int nqubits);
+int gates_get_parallel_threshold(void);
 
 void apply_corresponding_gate(double complex g[4], SingleBitGate gt, double phase);
 
 /* -------- common gates (2x2) -------- */
+void gate_i(double complex g[4]);
 void gate_h(double complex g[4]);
 void gate_x(double complex g[4]);
 void gate_y(double complex g[4]);
@@ -20,34 +36,97 @@ void gate_phase(double complex g[4], double phase);
    target t: qubit index (LSB = 0)
    Complexity: O(2^n)
 */
-void apply_single_qubit_inplace(double complex *state, int nqubits, int t, double complex g[4]);
+void apply_single_qubit_inplace(amplitude *state, int nqubits, int t, double complex g[4]);
+
+/* -------- specialized single-qubit kernels --------
+   X : swap of the |0> and |1> halves
+   Y : swap with factors -i / i
+   phase : diag(1, phase), only the |1> half is scaled (Z is phase = -1)
+   H : real butterfly
+*/
+void apply_x_inplace(amplitude *state, int nqubits, int t);
+void apply_y_inplace(amplitude *state, int nqubits, int t);
+void apply_phase_inplace(amplitude *state, int nqubits, int t, double complex phase);
+void apply_h_inplace(amplitude *state, int nqubits, int t);
+
+/* -------- gate dispatch --------
+   Picks the dedicated kernel for the gate kind once per gate
+   (GATE_I is a no-op), falling back to the generic 2x2 kernels.
+*/
+void apply_unitary_gate_inplace(amplitude *state, int nqubits, int t, SingleBitGate gt, double phase);
+void apply_controlled_gate_inplace(amplitude *state, int nqubits, int c, int t, SingleBitGate gt, double phase);
 
 /* -------- two-qubit gate (in-place) --------
    Gate G : 4x4 row-major G[row*4+col]
    q0, q1: qubit indices (distinct), q0 < q1.
    Updates 4 amplitudes at a time.
 */
-void apply_two_qubit_inplace(double complex *state, int nqubits, int q0, int q1, double complex G[16]);
+void apply_two_qubit_inplace(amplitude *state, int nqubits, int q0, int q1, double complex G[16]);
 
 /* -------- controlled-U gate (generic) --------
    Control = c, Target = t
    Gate U : 2x2 row-major [u00,u01,u10,u11]
    When control bit = 1, apply U to target; leave amplitudes unchanged when control=0.
 */
-void apply_controlled_u_inplace(double complex *state, int nqubits, int c, int t, double complex U[4]);
+void apply_controlled_u_inplace(amplitude *state, int nqubits, int c, int t, double complex U[4]);
+
+/* -------- controlled diagonal gate --------
+   Controlled-U for U = diag(1, phase) (GATE_Z, GATE_PHASE).
+   Only the 2^(n-2) amplitudes with control = target = 1 are touched.
+*/
+void apply_controlled_phase_inplace(amplitude *state, int nqubits, int c, int t, double complex phase);
+
+/* -------- qubit swap --------
+   Exchanges the bits of q0 and q1 in every basis index : one pass over the
+   half of the state where they differ.
+*/
+void apply_swap_inplace(amplitude *state, int nqubits, int q0, int q1);
+// All the swaps q0[i] <-> q1[i] together, one pass per group of 8 large strides (the pairs must not share a qubit)
+void apply_swaps_inplace(amplitude *state, int nqubits, const int *q0, const int *q1, int count);
 
 /* -------- custom multi-qubit gate (in-place) --------
    Gate U : 2^k x 2^k row-major matrix
    targets: array of k target qubit indices
    k: number of target qubits
-   Applies U to the specified target qubits.
+   Applies U to the specified target qubits, in place : each of the 2^(n-k)
+   groups of amplitudes is gathered in a per-thread 2^k scratch buffer,
+   multiplied by U and scattered back.
+*/
+void apply_custom_inplace(amplitude *state, int nqbits, int *targets, int k, double complex *U);
+
+/* -------- diagonal multi-qubit gate (in-place) --------
+   phases : the 2^k diagonal entries, same index convention as the rows of
+   a custom gate (targets[0] is the most significant bit)
+   One complex multiply per amplitude, O(2^n) whatever k.
 */
-void apply_custom_inplace(double complex *state, int nqbits, int *targets, int k, double complex *U);
+void apply_diagonal_inplace(amplitude *state, int nqbits, int *targets, int k, double complex *phases);
 
 /* -------- measurement (single qubit) --------
    Collapses state and returns measurement result (0/1).
    Uses Born rule and renormalizes remaining amplitudes.
+   The draw comes from rng (rng_default() if NULL).
+*/
+int measure_qubit_inplace(amplitude *state, int nqubits, int t, Rng *rng);
+
+/* -------- marginal probabilities --------
+   marginal[key] (2^k entries) : probability of reading key on the targets,
+   targets[0] being the most significant bit. One pass over the state.
+*/
+#ifndef MARGINAL_PARALLEL_SIZE
+#define MARGINAL_PARALLEL_SIZE (1 << 16)   // Larger marginals are summed on one thread
+#endif
+void marginal_probabilities(const amplitude *state, int nqubits, const int *targets, int k, double *marginal);
+
+/* -------- joint measurement --------
+   Measures the k targets (distinct) at once : the outcome (targets[0] the
+   most significant bit) is drawn from their marginal distribution, then the
+   state is collapsed and renormalized in a single sweep. Two passes over the
+   state per MEASURE_JOINT_QUBITS targets, instead of two per target.
+   The draws come from rng (rng_default() if NULL).
 */
-int measure_qubit_inplace(double complex *state, int nqubits, int t);
+#ifndef MEASURE_JOINT_QUBITS
+#define MEASURE_JOINT_QUBITS 16
+#endif
+uint64_t measure_qubits_inplace(amplitude *state, int nqubits, const int *targets, int k, Rng *rng);
 
 #endif
\ No newline at end of file
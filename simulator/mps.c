@@ -0,0 +1,712 @@
+#include "mps.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <complex.h>
+#include <math.h>
+#include <float.h>
+
+#include <omp.h>
+
+#include "gates.h"
+#include "../builder/internal.h"
+#include "../utils/utils.h"
+
+#define SVD_SWEEPS 60
+// Gates looked ahead for the next multi-qubit one, which decides the qubit to move
+#define MPS_LOOKAHEAD 64
+// Multiply-adds from which a contraction is split between the threads
+#define MPS_PARALLEL_SIZE (1 << 18)
+
+struct Mps {
+    int nb_qbits;
+    MpsOptions options;
+    int *bond;                  // bond[s] : between sites s - 1 and s, bond[0] = bond[n] = 1
+    double complex **site;      // site[s][(l * 2 + p) * bond[s + 1] + r]
+    int *site_of;               // Site of every qubit
+    int *qubit_at;              // Qubit on every site
+    int center;                 // Sites on its left are left-orthonormal, on its right right-orthonormal
+    MpsStats stats;
+};
+
+MpsOptions mps_options_default(void) {
+    MpsOptions options = {
+        .max_bond = MPS_MAX_BOND,
+        .threshold = MPS_THRESHOLD
+    };
+    return options;
+}
+
+Mps *mps_create(int nb_qbits, const MpsOptions *options) {
+    assert(nb_qbits > 0);
+    Mps *mps = malloc_custom(sizeof(Mps));
+    mps->nb_qbits = nb_qbits;
+    mps->options = options ? *options : mps_options_default();
+    assert(mps->options.max_bond > 0 && mps->options.threshold >= 0.0);
+    mps->bond = malloc_custom((nb_qbits + 1) * sizeof(int));
+    mps->site = malloc_custom(nb_qbits * sizeof(double complex *));
+    mps->site_of = malloc_custom(nb_qbits * sizeof(int));
+    mps->qubit_at = malloc_custom(nb_qbits * sizeof(int));
+    for(int s = 0; s <= nb_qbits; s++) mps->bond[s] = 1;
+    for(int s = 0; s < nb_qbits; s++) {
+        mps->site[s] = calloc_custom(2, sizeof(double complex));
+        mps->site[s][0] = 1.0;
+        mps->site_of[s] = s;
+        mps->qubit_at[s] = s;
+    }
+    mps->center = 0;
+    memset(&mps->stats, 0, sizeof(MpsStats));
+    mps->stats.fidelity = 1.0;
+    mps->stats.max_bond = 1;
+    return mps;
+}
+
+void mps_free(Mps *mps) {
+    for(int s = 0; s < mps->nb_qbits; s++) free_custom(mps->site[s]);
+    free_custom(mps->site);
+    free_custom(mps->bond);
+    free_custom(mps->site_of);
+    free_custom(mps->qubit_at);
+    free_custom(mps);
+}
+
+int mps_get_num_qubits(const Mps *mps) {
+    return mps->nb_qbits;
+}
+
+MpsStats mps_get_stats(const Mps *mps) {
+    return mps->stats;
+}
+
+/* -------- linear algebra -------- */
+
+// c (m x n) = a (m x k) b (k x n), all row-major
+static void matmul(int m, int k, int n, const double complex *a, const double complex *b, double complex *c) {
+    #pragma omp parallel for schedule(static) if((long)m * k * n >= MPS_PARALLEL_SIZE)
+    for(int i = 0; i < m; i++) {
+        double *row = (double *)(c + (size_t)i * n);
+        for(int j = 0; j < 2 * n; j++) row[j] = 0.0;
+        for(int l = 0; l < k; l++) {
+            double fr = creal(a[(size_t)i * k + l]), fi = cimag(a[(size_t)i * k + l]);
+            if(fr == 0.0 && fi == 0.0) continue;
+            const double *line = (const double *)(b + (size_t)l * n);
+            for(int j = 0; j < n; j++) {
+                row[2 * j] += fr * line[2 * j] - fi * line[2 * j + 1];
+                row[2 * j + 1] += fr * line[2 * j + 1] + fi * line[2 * j];
+            }
+        }
+    }
+}
+
+static inline double norm2(double complex z) {
+    return creal(z) * creal(z) + cimag(z) * cimag(z);
+}
+
+// x <- c x - s e y, y <- s x + c e y over m entries, in real arithmetic
+static inline void rotate(double *x, double *y, int m, double c, double s, double er, double ei) {
+    for(int i = 0; i < m; i++) {
+        double ar = x[2 * i], ai = x[2 * i + 1];
+        double br = er * y[2 * i] - ei * y[2 * i + 1], bi = er * y[2 * i + 1] + ei * y[2 * i];
+        x[2 * i] = c * ar - s * br;
+        x[2 * i + 1] = c * ai - s * bi;
+        y[2 * i] = s * ar + c * br;
+        y[2 * i + 1] = s * ai + c * bi;
+    }
+}
+
+/* Rotates the columns j < k of w (and of v) into orthogonal ones, false if
+   they already are or if one is negligible */
+static bool orthogonalize(double complex *w, double complex *v, int m, int n, int j, int k, double tolerance,
+                          double negligible) {
+    double *x = (double *)(w + (size_t)j * m), *y = (double *)(w + (size_t)k * m);
+    double alpha = 0.0, beta = 0.0, gr = 0.0, gi = 0.0;
+    for(int i = 0; i < 2 * m; i += 2) {
+        alpha += x[i] * x[i] + x[i + 1] * x[i + 1];
+        beta += y[i] * y[i] + y[i + 1] * y[i + 1];
+        gr += x[i] * y[i] + x[i + 1] * y[i + 1];
+        gi += x[i] * y[i + 1] - x[i + 1] * y[i];
+    }
+    double g = hypot(gr, gi);
+    if(alpha <= negligible || beta <= negligible || g <= tolerance * sqrt(alpha) * sqrt(beta)) return false;
+    // Real rotation of x and e y, x^H e y being real
+    double zeta = (beta - alpha) / (2.0 * g);
+    double t = copysign(1.0, zeta) / (fabs(zeta) + sqrt(1.0 + zeta * zeta));
+    double c = 1.0 / sqrt(1.0 + t * t), s = c * t;
+    rotate(x, y, m, c, s, gr / g, -gi / g);
+    rotate((double *)(v + (size_t)j * n), (double *)(v + (size_t)k * n), n, c, s, gr / g, -gi / g);
+    return true;
+}
+
+static void swap_columns(double complex *w, int m, int j, int k) {
+    for(int i = 0; i < m; i++) {
+        double complex swap = w[(size_t)j * m + i];
+        w[(size_t)j * m + i] = w[(size_t)k * m + i];
+        w[(size_t)k * m + i] = swap;
+    }
+}
+
+/* One-sided Jacobi on the n columns (m entries each, contiguous) of w :
+   pairs of columns are rotated until all are orthogonal (to the rounding
+   of a dot product of m terms), the rotations accumulated in the n x n v
+   (column-major). Columns below the precision of the largest one, or
+   whose weight is below threshold / n of the total, are left alone :
+   together they stay below threshold, and truncate drops them */
+static void jacobi(int m, int n, double complex *w, double complex *v, double threshold) {
+    double *norms = malloc_custom(n * sizeof(double));
+    memset(v, 0, (size_t)n * n * sizeof(double complex));
+    for(int j = 0; j < n; j++) v[(size_t)j * n + j] = 1.0;
+    double tolerance = m * DBL_EPSILON;
+    for(int sweep = 0; sweep < SVD_SWEEPS; sweep++) {
+        bool rotated = false;
+        // Columns by decreasing norm (de Rijk) : the rotations converge faster
+        double largest = 0.0, total = 0.0;
+        for(int j = 0; j < n; j++) {
+            norms[j] = 0.0;
+            for(int i = 0; i < m; i++) norms[j] += norm2(w[(size_t)j * m + i]);
+            total += norms[j];
+        }
+        for(int j = 0; j < n; j++) {
+            int best = j;
+            for(int k = j + 1; k < n; k++) if(norms[k] > norms[best]) best = k;
+            if(best != j) {
+                swap_columns(w, m, j, best);
+                swap_columns(v, n, j, best);
+                double swap = norms[j];
+                norms[j] = norms[best];
+                norms[best] = swap;
+            }
+        }
+        largest = norms[0];
+        double negligible = fmax(DBL_EPSILON * DBL_EPSILON * largest, threshold * total / n);
+        for(int j = 0; j < n - 1; j++) {
+            for(int k = j + 1; k < n; k++) rotated = orthogonalize(w, v, m, n, j, k, tolerance, negligible) || rotated;
+        }
+        if(!rotated) break;
+    }
+    free_custom(norms);
+}
+
+/* a (m x n, row-major) = u diag(s) vh : the r = min(m, n) singular values
+   in decreasing order, u m x r and vh r x n row-major. Returns r. Those
+   truncate drops with threshold are only approximate */
+static int svd(int m, int n, const double complex *a, double complex *u, double *s, double complex *vh, double threshold) {
+    bool tall = m >= n;
+    int rows = tall ? m : n, r = tall ? n : m;
+    // Columns of a, or of its conjugate transpose when a is wide
+    double complex *w = malloc_custom((size_t)rows * r * sizeof(double complex));
+    double complex *v = malloc_custom((size_t)r * r * sizeof(double complex));
+    for(int i = 0; i < m; i++) {
+        for(int j = 0; j < n; j++) {
+            if(tall) w[(size_t)j * m + i] = a[(size_t)i * n + j];
+            else w[(size_t)i * n + j] = conj(a[(size_t)i * n + j]);
+        }
+    }
+    jacobi(rows, r, w, v, threshold);
+    int *order = malloc_custom(r * sizeof(int));
+    double *sigma = malloc_custom(r * sizeof(double));
+    for(int j = 0; j < r; j++) {
+        double sum = 0.0;
+        for(int i = 0; i < rows; i++) sum += norm2(w[(size_t)j * rows + i]);
+        sigma[j] = sqrt(sum);
+        // Insertion by decreasing value
+        int k = j;
+        while(k > 0 && sigma[order[k - 1]] < sigma[j]) {
+            order[k] = order[k - 1];
+            k--;
+        }
+        order[k] = j;
+    }
+    for(int k = 0; k < r; k++) {
+        int j = order[k];
+        double inverse = (sigma[j] > 0.0) ? 1.0 / sigma[j] : 0.0;
+        s[k] = sigma[j];
+        if(tall) {
+            for(int i = 0; i < m; i++) u[(size_t)i * r + k] = w[(size_t)j * m + i] * inverse;
+            for(int i = 0; i < n; i++) vh[(size_t)k * n + i] = conj(v[(size_t)j * n + i]);
+        } else {
+            for(int i = 0; i < m; i++) u[(size_t)i * r + k] = v[(size_t)j * m + i];
+            for(int i = 0; i < n; i++) vh[(size_t)k * n + i] = conj(w[(size_t)j * n + i]) * inverse;
+        }
+    }
+    free_custom(w);
+    free_custom(v);
+    free_custom(order);
+    free_custom(sigma);
+    return r;
+}
+
+/* Number of the r singular values s kept : at most max_bond, the smallest
+   dropped while their weight stays below threshold, and those below the
+   precision of the SVD whatever the threshold. scale renormalizes the
+   kept ones, the discarded weight goes to the stats */
+static int truncate(Mps *mps, const double *s, int r, double *scale) {
+    double total = 0.0, tail = 0.0;
+    for(int i = 0; i < r; i++) total += s[i] * s[i];
+    int keep = r;
+    while(keep > 1 && (keep > mps->options.max_bond || s[keep - 1] <= DBL_EPSILON * s[0]
+                       || tail + s[keep - 1] * s[keep - 1] <= mps->options.threshold * total)) {
+        keep--;
+        tail += s[keep] * s[keep];
+    }
+    mps->stats.svds++;
+    if(tail > 0.0) {
+        mps->stats.truncations++;
+        mps->stats.truncation_error += tail / total;
+        mps->stats.fidelity *= 1.0 - tail / total;
+    }
+    *scale = 1.0 / sqrt(total - tail);
+    if(keep > mps->stats.max_bond) mps->stats.max_bond = keep;
+    return keep;
+}
+
+/* -------- sites -------- */
+
+// The sites l .. l + k - 1 contracted : bond[l] x 2^k x bond[l + k]
+static double complex *contract(const Mps *mps, int l, int k) {
+    int rows = mps->bond[l] * 2, inner = mps->bond[l + 1];
+    double complex *theta = malloc_custom((size_t)rows * inner * sizeof(double complex));
+    memcpy(theta, mps->site[l], (size_t)rows * inner * sizeof(double complex));
+    for(int s = l + 1; s < l + k; s++) {
+        int right = mps->bond[s + 1];
+        double complex *next = malloc_custom((size_t)rows * 2 * right * sizeof(double complex));
+        matmul(rows, inner, 2 * right, theta, mps->site[s], next);
+        free_custom(theta);
+        theta = next;
+        rows *= 2;
+        inner = right;
+    }
+    return theta;
+}
+
+/* theta (bond[l] x 2^k x bond[l + k], the norm of the state) split back
+   into the sites l .. l + k - 1 by k - 1 SVDs, from left to right (the
+   center ends on site l + k - 1) or from right to left (on site l) */
+static void split(Mps *mps, int l, int k, double complex *theta, bool left) {
+    int first = mps->bond[l], last = mps->bond[l + k];
+    for(int j = 0; j < k - 1; j++) {
+        // Left to right : site s off the front. Right to left : off the back
+        int s = left ? l + k - 1 - j : l + j;
+        int m = left ? first << (k - 1 - j) : 2 * mps->bond[s];
+        int n = left ? 2 * mps->bond[s + 1] : (2 << (k - 2 - j)) * last;
+        int r = (m < n) ? m : n;
+        double complex *u = malloc_custom((size_t)m * r * sizeof(double complex));
+        double complex *vh = malloc_custom((size_t)r * n * sizeof(double complex));
+        double *sigma = malloc_custom(r * sizeof(double)), scale;
+        svd(m, n, theta, u, sigma, vh, mps->options.threshold);
+        int keep = truncate(mps, sigma, r, &scale);
+        double complex *rest;
+        free_custom(mps->site[s]);
+        if(left) {
+            // Site s : the first rows of vh, the rest : u diag(sigma)
+            mps->site[s] = malloc_custom((size_t)keep * n * sizeof(double complex));
+            memcpy(mps->site[s], vh, (size_t)keep * n * sizeof(double complex));
+            mps->bond[s] = keep;
+            rest = malloc_custom((size_t)m * keep * sizeof(double complex));
+            for(int i = 0; i < m; i++) {
+                for(int c = 0; c < keep; c++) rest[(size_t)i * keep + c] = u[(size_t)i * r + c] * sigma[c] * scale;
+            }
+        } else {
+            // Site s : the first columns of u, the rest : diag(sigma) vh
+            mps->site[s] = malloc_custom((size_t)m * keep * sizeof(double complex));
+            for(int i = 0; i < m; i++) memcpy(mps->site[s] + (size_t)i * keep, u + (size_t)i * r, keep * sizeof(double complex));
+            mps->bond[s + 1] = keep;
+            rest = malloc_custom((size_t)keep * n * sizeof(double complex));
+            for(int c = 0; c < keep; c++) {
+                for(int i = 0; i < n; i++) rest[(size_t)c * n + i] = vh[(size_t)c * n + i] * sigma[c] * scale;
+            }
+        }
+        free_custom(u);
+        free_custom(vh);
+        free_custom(sigma);
+        free_custom(theta);
+        theta = rest;
+    }
+    int s = left ? l : l + k - 1;
+    free_custom(mps->site[s]);
+    mps->site[s] = theta;
+    mps->center = s;
+}
+
+// One step of the center to the neighbouring site, by an SVD of the center
+static void step_center(Mps *mps, bool right) {
+    int c = mps->center, left = mps->bond[c], inner = mps->bond[c + 1];
+    int m = right ? 2 * left : left, n = right ? inner : 2 * inner;
+    int r = (m < n) ? m : n;
+    double complex *u = malloc_custom((size_t)m * r * sizeof(double complex));
+    double complex *vh = malloc_custom((size_t)r * n * sizeof(double complex));
+    double *sigma = malloc_custom(r * sizeof(double)), scale;
+    svd(m, n, mps->site[c], u, sigma, vh, mps->options.threshold);
+    int keep = truncate(mps, sigma, r, &scale);
+    if(right) {
+        // Site c : u, site c + 1 : diag(sigma) vh times site c + 1
+        int next = mps->bond[c + 2];
+        double complex *factor = malloc_custom((size_t)keep * n * sizeof(double complex));
+        for(int k = 0; k < keep; k++) {
+            for(int i = 0; i < n; i++) factor[(size_t)k * n + i] = vh[(size_t)k * n + i] * sigma[k] * scale;
+        }
+        double complex *site = malloc_custom((size_t)keep * 2 * next * sizeof(double complex));
+        matmul(keep, n, 2 * next, factor, mps->site[c + 1], site);
+        free_custom(mps->site[c + 1]);
+        mps->site[c + 1] = site;
+        free_custom(mps->site[c]);
+        mps->site[c] = malloc_custom((size_t)m * keep * sizeof(double complex));
+        for(int i = 0; i < m; i++) memcpy(mps->site[c] + (size_t)i * keep, u + (size_t)i * r, keep * sizeof(double complex));
+        mps->bond[c + 1] = keep;
+        free_custom(factor);
+    } else {
+        // Site c : vh, site c - 1 : site c - 1 times u diag(sigma)
+        int previous = mps->bond[c - 1];
+        double complex *factor = malloc_custom((size_t)m * keep * sizeof(double complex));
+        for(int i = 0; i < m; i++) {
+            for(int k = 0; k < keep; k++) factor[(size_t)i * keep + k] = u[(size_t)i * r + k] * sigma[k] * scale;
+        }
+        double complex *site = malloc_custom((size_t)previous * 2 * keep * sizeof(double complex));
+        matmul(previous * 2, m, keep, mps->site[c - 1], factor, site);
+        free_custom(mps->site[c - 1]);
+        mps->site[c - 1] = site;
+        free_custom(mps->site[c]);
+        mps->site[c] = malloc_custom((size_t)keep * n * sizeof(double complex));
+        memcpy(mps->site[c], vh, (size_t)keep * n * sizeof(double complex));
+        mps->bond[c] = keep;
+        free_custom(factor);
+    }
+    mps->center += right ? 1 : -1;
+    free_custom(u);
+    free_custom(vh);
+    free_custom(sigma);
+}
+
+// The center moved into the sites first .. last
+static void move_center(Mps *mps, int first, int last) {
+    while(mps->center < first) step_center(mps, true);
+    while(mps->center > last) step_center(mps, false);
+}
+
+/* Exchanges the physical indices of theta, the sites s and s + 1
+   contracted, and the qubits they hold : split then leaves them swapped */
+static void exchange(Mps *mps, int s, double complex *theta) {
+    size_t rows = mps->bond[s], columns = mps->bond[s + 2];
+    for(size_t l = 0; l < rows; l++) {
+        for(size_t r = 0; r < columns; r++) {
+            double complex *one = theta + (l * 4 + 1) * columns + r, *two = theta + (l * 4 + 2) * columns + r;
+            double complex swap = *one;
+            *one = *two;
+            *two = swap;
+        }
+    }
+    int q = mps->qubit_at[s];
+    mps->qubit_at[s] = mps->qubit_at[s + 1];
+    mps->qubit_at[s + 1] = q;
+    mps->site_of[mps->qubit_at[s]] = s;
+    mps->site_of[q] = s + 1;
+    mps->stats.swaps++;
+}
+
+// Exchanges the qubits of the sites s and s + 1, the center left on site s (left) or s + 1
+static void swap_sites(Mps *mps, int s, bool left) {
+    move_center(mps, s, s + 1);
+    double complex *theta = contract(mps, s, 2);
+    exchange(mps, s, theta);
+    split(mps, s, 2, theta, left);
+}
+
+// The qubit moved to site target by swaps, the center following it
+static void move_qubit(Mps *mps, int qbit, int target) {
+    while(mps->site_of[qbit] < target) swap_sites(mps, mps->site_of[qbit], false);
+    while(mps->site_of[qbit] > target) swap_sites(mps, mps->site_of[qbit] - 1, true);
+}
+
+/* The qubits moved around the site of anchor into neighbouring sites :
+   those on its right next to it in their order, then those on its left.
+   Returns the first site of the block */
+static int gather(Mps *mps, const int *qbits, int k, int anchor) {
+    int sites[MPS_GATE_MAX_QUBITS], count = 0;
+    int center = mps->site_of[anchor];
+    for(int i = 0; i < k; i++) sites[count++] = mps->site_of[qbits[i]];
+    for(int i = 1; i < count; i++) {
+        for(int j = i; j > 0 && sites[j - 1] > sites[j]; j--) {
+            int swap = sites[j];
+            sites[j] = sites[j - 1];
+            sites[j - 1] = swap;
+        }
+    }
+    int slot = center + 1, first = center;
+    for(int i = 0; i < count; i++) {
+        if(sites[i] > center) move_qubit(mps, mps->qubit_at[sites[i]], slot++);
+    }
+    for(int i = count - 1; i >= 0; i--) {
+        if(sites[i] < center) move_qubit(mps, mps->qubit_at[sites[i]], --first);
+    }
+    return first;
+}
+
+/* -------- gates -------- */
+
+// u (2 x 2) on the physical index of site s : the canonical form is kept
+static void apply_site(Mps *mps, int s, const double complex *u) {
+    size_t rows = mps->bond[s], columns = mps->bond[s + 1];
+    double complex *site = mps->site[s];
+    for(size_t l = 0; l < rows; l++) {
+        for(size_t r = 0; r < columns; r++) {
+            double complex a0 = site[(l * 2) * columns + r], a1 = site[(l * 2 + 1) * columns + r];
+            site[(l * 2) * columns + r] = u[0] * a0 + u[1] * a1;
+            site[(l * 2 + 1) * columns + r] = u[2] * a0 + u[3] * a1;
+        }
+    }
+}
+
+/* A gate on k >= 2 qubits, its 2^k x 2^k matrix dense (mat) or diagonal
+   (phases) : the qubits gathered around anchor, contracted with the
+   center, the matrix applied and the sites split back, the center ending
+   on the end of the block toward the next gate (next, nb_next qubits) */
+static void apply_block(Mps *mps, const int *qbits, int k, int anchor, const double complex *mat,
+                        const double complex *phases, const int *next, int nb_next) {
+    int first = gather(mps, qbits, k, anchor);
+    move_center(mps, first, first + k - 1);
+    double complex *theta = contract(mps, first, k);
+    size_t dim = 1ULL << k, rows = mps->bond[first], columns = mps->bond[first + k];
+    // index[p] : row of the matrix for the bits p of the sites (site first the most significant)
+    size_t index[1 << MPS_GATE_MAX_QUBITS];
+    for(size_t p = 0; p < dim; p++) {
+        index[p] = 0;
+        for(int j = 0; j < k; j++) {
+            int qbit = mps->qubit_at[first + j], position = 0;
+            while(qbits[position] != qbit) position++;
+            if(p >> (k - 1 - j) & 1) index[p] |= 1ULL << (k - 1 - position);
+        }
+    }
+    if(phases) {
+        for(size_t l = 0; l < rows; l++) {
+            for(size_t p = 0; p < dim; p++) {
+                double complex phase = phases[index[p]], *line = theta + (l * dim + p) * columns;
+                for(size_t r = 0; r < columns; r++) line[r] *= phase;
+            }
+        }
+    } else {
+        double complex *result = malloc_custom(rows * dim * columns * sizeof(double complex));
+        #pragma omp parallel for schedule(static) if(rows * dim * dim * columns >= MPS_PARALLEL_SIZE)
+        for(size_t l = 0; l < rows; l++) {
+            for(size_t p = 0; p < dim; p++) {
+                double complex *out = result + (l * dim + p) * columns;
+                for(size_t r = 0; r < columns; r++) out[r] = 0.0;
+                for(size_t q = 0; q < dim; q++) {
+                    double complex factor = mat[index[p] * dim + index[q]];
+                    if(factor == 0.0) continue;
+                    const double complex *in = theta + (l * dim + q) * columns;
+                    for(size_t r = 0; r < columns; r++) out[r] += factor * in[r];
+                }
+            }
+        }
+        free_custom(theta);
+        theta = result;
+    }
+    /* target : a qubit of the next gate outside the block. If that gate acts
+       on the moving qubit (two qubits) and not on the anchor, the moving
+       qubit crosses the anchor within this SVD */
+    int moving = (qbits[0] == anchor) ? qbits[1] : qbits[0], target = -1;
+    bool moves = false, stays = false;
+    for(int i = 0; i < nb_next; i++) {
+        if(next[i] == moving) moves = true;
+        else if(next[i] == anchor) stays = true;
+        else if(target < 0) target = next[i];
+    }
+    bool left = target >= 0 && mps->site_of[target] < first;
+    if(k == 2 && moves && !stays && target >= 0) {
+        int site = mps->site_of[target];
+        if((mps->site_of[moving] == first && site > first + 1) || (mps->site_of[moving] == first + 1 && site < first)) {
+            exchange(mps, first, theta);
+        }
+    }
+    split(mps, first, k, theta, left);
+}
+
+static const double complex SWAP_MATRIX[16] = {
+    1, 0, 0, 0,
+    0, 0, 1, 0,
+    0, 1, 0, 0,
+    0, 0, 0, 1
+};
+
+/* next : qubits of the next gate on several qubits (nb_next of them, 0 if
+   none), which the qubit to move and the end of the center follow */
+static void mps_apply(Mps *mps, Gate *gate, const int *next, int nb_next) {
+    int qbits[MPS_GATE_MAX_QUBITS];
+    double complex u[16];
+    const double complex *mat = NULL, *phases = NULL;
+    int k = 0;
+    switch(gate->class) {
+        case UNITARY:
+            apply_corresponding_gate(u, gate->gate.unitary.type, gate->gate.unitary.phase);
+            apply_site(mps, mps->site_of[gate->gate.unitary.qbit], u);
+            return;
+        case CONTROL: {
+            double complex g[4];
+            if(gate->gate.control.type == GATE_I) return;
+            apply_corresponding_gate(g, gate->gate.control.type, gate->gate.control.phase);
+            memset(u, 0, sizeof(u));
+            u[0] = u[5] = 1.0;
+            u[10] = g[0]; u[11] = g[1];
+            u[14] = g[2]; u[15] = g[3];
+            k = gate_get_qubits(gate, qbits);
+            mat = u;
+            break;
+        }
+        case CUSTOM:
+            k = gate->gate.custom.nb_qbits;
+            mat = gate->gate.custom.mat;
+            break;
+        case DIAGONAL:
+            k = gate->gate.diagonal.nb_qbits;
+            phases = gate->gate.diagonal.phases;
+            break;
+        default:
+            return;
+    }
+    assert(k <= MPS_GATE_MAX_QUBITS && "Gate on too many qubits for the MPS backend");
+    if(gate->class != CONTROL) gate_get_qubits(gate, qbits);
+    if(k == 1) {
+        if(phases) {
+            u[0] = phases[0]; u[1] = 0.0;
+            u[2] = 0.0; u[3] = phases[1];
+        }
+        apply_site(mps, mps->site_of[qbits[0]], phases ? u : mat);
+        return;
+    }
+    // A swap only relabels the sites
+    if(k == 2 && mat && memcmp(mat, SWAP_MATRIX, sizeof(SWAP_MATRIX)) == 0) {
+        int s0 = mps->site_of[qbits[0]], s1 = mps->site_of[qbits[1]];
+        mps->qubit_at[s0] = qbits[1];
+        mps->qubit_at[s1] = qbits[0];
+        mps->site_of[qbits[0]] = s1;
+        mps->site_of[qbits[1]] = s0;
+        return;
+    }
+    // Two qubits : the one the next gate also acts on moves. More : around the middle one
+    int anchor = qbits[1];
+    if(k == 2) {
+        bool first = false, second = false;
+        for(int i = 0; i < nb_next; i++) {
+            first = first || next[i] == qbits[0];
+            second = second || next[i] == qbits[1];
+        }
+        if(second && !first) anchor = qbits[0];
+    } else {
+        int below = 0;
+        for(int i = 0; i < k; i++) {
+            below = 0;
+            for(int j = 0; j < k; j++) below += mps->site_of[qbits[j]] < mps->site_of[qbits[i]];
+            if(below == k / 2) {
+                anchor = qbits[i];
+                break;
+            }
+        }
+    }
+    apply_block(mps, qbits, k, anchor, mat, phases, next, nb_next);
+}
+
+int mps_measure(Mps *mps, int qbit, Rng *rng) {
+    int s = mps->site_of[qbit];
+    move_center(mps, s, s);
+    size_t rows = mps->bond[s], columns = mps->bond[s + 1];
+    double complex *site = mps->site[s];
+    double p[2] = {0.0, 0.0};
+    for(size_t l = 0; l < rows; l++) {
+        for(int b = 0; b < 2; b++) {
+            for(size_t r = 0; r < columns; r++) p[b] += norm2(site[(l * 2 + b) * columns + r]);
+        }
+    }
+    double total = p[0] + p[1];
+    double draw = rng_uniform(rng ? rng : rng_default());
+    int result = (draw < p[0] / total) ? 0 : 1;
+    double norm = (p[result] > 0.0) ? 1.0 / sqrt(p[result]) : 1.0;
+    for(size_t l = 0; l < rows; l++) {
+        for(size_t r = 0; r < columns; r++) {
+            site[(l * 2 + result) * columns + r] *= norm;
+            site[(l * 2 + 1 - result) * columns + r] = 0.0;
+        }
+    }
+    return result;
+}
+
+double circuit_execute_mps(QuantumCircuit *circuit, Mps *mps, ClassicalRegister *cregister, Rng *rng) {
+    double t0 = now_seconds();
+    assert(circuit->nb_qbits == mps->nb_qbits);
+    int next[MPS_GATE_MAX_QUBITS];
+    for(int g = 0; g < circuit->nb_gates; g++) {
+        Gate *gate = &circuit->gates[g];
+        if(!gate_condition_holds(gate, cregister ? cregister->bits : NULL)) continue;
+        if(gate->class == MEAS) {
+            int result = mps_measure(mps, gate->gate.measure.qbit, rng);
+            if(cregister) cregister->bits[gate->gate.measure.cbit] = result;
+            continue;
+        }
+        int nb_next = 0;
+        if(gate->class != UNITARY) {
+            for(int h = g + 1; h < circuit->nb_gates && h <= g + MPS_LOOKAHEAD; h++) {
+                Gate *other = &circuit->gates[h];
+                int width = (other->class == CONTROL) ? 2
+                            : (other->class == CUSTOM) ? other->gate.custom.nb_qbits
+                            : (other->class == DIAGONAL) ? other->gate.diagonal.nb_qbits : 1;
+                if(width < 2) continue;
+                if(width <= MPS_GATE_MAX_QUBITS) nb_next = gate_get_qubits(other, next);
+                break;
+            }
+        }
+        mps_apply(mps, gate, next, nb_next);
+    }
+    return now_seconds() - t0;
+}
+
+/* -------- readout -------- */
+
+double complex mps_amplitude(const Mps *mps, const int *bits) {
+    int n = mps->nb_qbits;
+    double complex *vector = malloc_custom(sizeof(double complex)), *next;
+    vector[0] = 1.0;
+    for(int s = 0; s < n; s++) {
+        int columns = mps->bond[s + 1], bit = bits[mps->qubit_at[s]] & 1;
+        next = calloc_custom(columns, sizeof(double complex));
+        for(int l = 0; l < mps->bond[s]; l++) {
+            const double complex *line = mps->site[s] + ((size_t)l * 2 + bit) * columns;
+            for(int r = 0; r < columns; r++) next[r] += vector[l] * line[r];
+        }
+        free_custom(vector);
+        vector = next;
+    }
+    double complex amplitude = vector[0];
+    free_custom(vector);
+    return amplitude;
+}
+
+void mps_get_statevector(const Mps *mps, amplitude *state) {
+    int n = mps->nb_qbits;
+    assert(n < 40 && "Statevector too large");
+    // Contracted from the left : 2^s prefixes times bond[s]
+    double complex *prefix = malloc_custom(sizeof(double complex)), *next;
+    prefix[0] = 1.0;
+    for(int s = 0; s < n; s++) {
+        next = malloc_custom(((size_t)2 << s) * mps->bond[s + 1] * sizeof(double complex));
+        matmul(1 << s, mps->bond[s], 2 * mps->bond[s + 1], prefix, mps->site[s], next);
+        free_custom(prefix);
+        prefix = next;
+    }
+    // Bit n - 1 - s of the prefix : site s, bit n - 1 - q of the state : qubit q
+    #pragma omp parallel for schedule(static) if(n >= 20)
+    for(uint64_t i = 0; i < (1ULL << n); i++) {
+        uint64_t index = 0;
+        for(int s = 0; s < n; s++) index |= (i >> (n - 1 - s) & 1) << (n - 1 - mps->qubit_at[s]);
+        state[index] = (amplitude)prefix[i];
+    }
+    free_custom(prefix);
+}
+
+void mps_print(FILE *channel, const Mps *mps) {
+    fprintf(channel, "site  qubit  bond\n");
+    for(int s = 0; s < mps->nb_qbits; s++) {
+        fprintf(channel, "%4d  %5d  %4d%s\n", s, mps->qubit_at[s], mps->bond[s + 1], (s == mps->center) ? "  (center)" : "");
+    }
+}
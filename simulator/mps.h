@@ -0,0 +1,77 @@
+#ifndef MPS_H
+#define MPS_H
+
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../utils/rng.h"
+#include "../utils/precision.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <complex.h>
+
+/* -------- matrix product state backend --------
+   The state as a chain of n tensors, one per site, A[s] of shape
+   bond[s] x 2 x bond[s + 1] : the amplitude of a basis state is the
+   product of the matrices its bits select. The memory is O(n chi^2) for a
+   bond dimension chi instead of 2^n amplitudes, chi staying small for
+   weakly entangled states (QFT of product states, shallow 1D circuits).
+   The chain is kept in mixed canonical form around one site, the center :
+   a gate on k neighbouring sites contracts them with the center, applies
+   its matrix and splits them back by SVDs (one-sided Jacobi), where the
+   smallest singular values are dropped : at most max_bond of them are
+   kept, and the tail whose weight is below threshold (relative to the
+   norm) goes. The discarded weights add up in MpsStats::truncation_error
+   (1 - fidelity at first order).
+   Qubits are not bound to sites : a gate on distant qubits moves one of
+   them next to the other by swaps of neighbouring sites, and the qubits
+   stay where the swaps left them.
+*/
+#ifndef MPS_MAX_BOND
+#define MPS_MAX_BOND 256
+#endif
+#ifndef MPS_THRESHOLD
+#define MPS_THRESHOLD 1e-14
+#endif
+// Qubits of a custom or diagonal gate (its 2^k x 2^k matrix is contracted with k sites)
+#ifndef MPS_GATE_MAX_QUBITS
+#define MPS_GATE_MAX_QUBITS 8
+#endif
+
+typedef struct Mps Mps;
+
+typedef struct {
+    int max_bond;           // Largest bond dimension kept by a truncation
+    double threshold;       // Discarded weight allowed at every SVD (0 : exact up to max_bond)
+} MpsOptions;
+
+typedef struct {
+    double truncation_error;    // Sum of the weights discarded by the truncations
+    double fidelity;            // Product of (1 - weight) over the truncations
+    int max_bond;               // Largest bond dimension reached
+    long svds;
+    long truncations;           // SVDs that discarded a nonzero weight
+    long swaps;                 // Of neighbouring sites, routing the gates
+} MpsStats;
+
+MpsOptions mps_options_default(void);  // max_bond = MPS_MAX_BOND, threshold = MPS_THRESHOLD
+
+// The state |0...0> (options may be NULL)
+Mps *mps_create(int nb_qbits, const MpsOptions *options);
+void mps_free(Mps *mps);
+int mps_get_num_qubits(const Mps *mps);
+MpsStats mps_get_stats(const Mps *mps);
+
+// Outcome of a measurement of qbit (the state collapsed), one draw from rng (NULL : rng_default())
+int mps_measure(Mps *mps, int qbit, Rng *rng);
+// Applies the circuit, the measurements written in cregister if not NULL. Returns the time in seconds
+double circuit_execute_mps(QuantumCircuit *circuit, Mps *mps, ClassicalRegister *cregister, Rng *rng);
+
+// Amplitude of the basis state where qubit q reads bits[q]
+double complex mps_amplitude(const Mps *mps, const int *bits);
+// The 2^n amplitudes (qubit 0 the most significant)
+void mps_get_statevector(const Mps *mps, amplitude *state);
+// The bond dimensions along the chain and the qubit on every site
+void mps_print(FILE *channel, const Mps *mps);
+
+#endif
@@ -11,13 +11,273 @@
 #include <omp.h>
 
 #include "gates.h"
+#include "fusion.h"
+#include "blocking.h"
+#include "remap.h"
+#include "outofcore.h"
+#include "checkpoint.h"
+#include "stabilizer.h"
+#include "sparse.h"
 #include "../builder/internal.h"
-#include "../utils/list.h"
 #include "../utils/utils.h"
 #include "../utils/logger.h"
 
+ExecOptions exec_options_default(void) {
+    ExecOptions options = {
+        .log = false,
+        .fuse = true,
+        .fusion_qubits = 1,
+        .block_qubits = BLOCK_QUBITS,
+        .remap = true,
+        .rng = NULL,
+        .chunk_qubits = OUTOFCORE_CHUNK_QUBITS,
+        .state_file = NULL,
+        .stats = NULL,
+        .checkpoint_file = NULL,
+        .checkpoint_gates = 0,
+        .checkpoint_seconds = 0.0,
+        .checkpoint_overhead = 0.05,
+        .stabilizer = true,
+        .sparse_fill = SPARSE_MAX_FILL
+    };
+    return options;
+}
+
+static void execute_gate(Gate *gate, QuantumRegister *qregister, ClassicalRegister *cregister, Rng *rng, Logger *logger) {
+    bool log = logger != NULL;
+    char buffer[1024];
+    switch (gate->class) {
+        case UNITARY: 
+            if(log) sprintf(buffer, "Applying unitary gate on qubit %d.", gate->gate.unitary.qbit);
+            apply_unitary_gate_inplace(
+                qregister->statevector, qregister->nb_qbits, 
+                gate->gate.unitary.qbit, 
+                gate->gate.unitary.type, gate->gate.unitary.phase
+            );
+            break;
+        
+        case CONTROL:
+            if(log) sprintf(buffer, "Applying controlled gate with control qubit %d and target qubit %d.", gate->gate.control.control, gate->gate.control.qbit);
+            apply_controlled_gate_inplace(
+                qregister->statevector, qregister->nb_qbits, 
+                gate->gate.control.control, gate->gate.control.qbit, 
+                gate->gate.control.type, gate->gate.control.phase
+            );
+            break;
+        
+        case CUSTOM:
+            if(log) sprintf(buffer, "Applying custom gate on %d qubits.", gate->gate.custom.nb_qbits);
+            apply_custom_inplace(
+                qregister->statevector, qregister->nb_qbits, 
+                gate->gate.custom.qbits, gate->gate.custom.nb_qbits, 
+                gate->gate.custom.mat
+            );
+            break;
+        
+        case DIAGONAL:
+            if(log) sprintf(buffer, "Applying diagonal gate on %d qubits.", gate->gate.diagonal.nb_qbits);
+            apply_diagonal_inplace(
+                qregister->statevector, qregister->nb_qbits, 
+                gate->gate.diagonal.qbits, gate->gate.diagonal.nb_qbits, 
+                gate->gate.diagonal.phases
+            );
+            break;
+        
+        case MEAS:
+            if(log) sprintf(buffer, "Measuring qubit %d into classical bit %d.", gate->gate.measure.qbit, gate->gate.measure.cbit);
+            int result = measure_qubit_inplace(
+                qregister->statevector, qregister->nb_qbits, 
+                gate->gate.measure.qbit, rng
+            );
+            if (cregister) {
+                cregister->bits[gate->gate.measure.cbit] = result;
+            }
+            break;
+
+        default:
+            if(log) sprintf(buffer, "Unknown gate class encountered.");
+            break;
+    }
+    if(log) logger_message(logger, "INFO", buffer);
+}
+
+/* Measurements of distinct qubits commute : a run of them is one joint
+   measurement (two passes over the state instead of two per qubit). A qubit
+   measured twice gives the same bit to both classical bits */
+static void execute_measures(Gate **measures, int count, QuantumRegister *qregister, ClassicalRegister *cregister, Rng *rng, Logger *logger) {
+    int n = qregister->nb_qbits;
+    int *targets = malloc_custom(count * sizeof(int));
+    int *index = malloc_custom(count * sizeof(int)); // Position of the qubit of each measurement in targets
+    int k = 0;
+    for(int i = 0; i < count; i++) {
+        int physical = qregister->layout[measures[i]->gate.measure.qbit];
+        index[i] = -1;
+        for(int j = 0; j < k; j++) if(targets[j] == physical) index[i] = j;
+        if(index[i] < 0) {
+            index[i] = k;
+            targets[k++] = physical;
+        }
+    }
+
+    uint64_t outcome = measure_qubits_inplace(qregister->statevector, n, targets, k, rng);
+    for(int i = 0; i < count; i++) {
+        int result = (outcome >> (k - 1 - index[i])) & 1;
+        if(cregister) cregister->bits[measures[i]->gate.measure.cbit] = result;
+    }
+    if(logger) {
+        char buffer[1024];
+        sprintf(buffer, "Measuring %d qubits at once (%d measurements).", k, count);
+        logger_message(logger, "INFO", buffer);
+    }
+    free_custom(targets);
+    free_custom(index);
+}
+
+// Length of the qubit list of a view of the gate (custom and diagonal gates only)
+static int view_qubits(const Gate *gate) {
+    if(gate->class == CUSTOM) return gate->gate.custom.nb_qbits;
+    if(gate->class == DIAGONAL) return gate->gate.diagonal.nb_qbits;
+    return 0;
+}
+
+/* Runs of local gates (all their qubits among the last block_qubits ones)
+   are applied chunk by chunk, the other gates stream over the whole state.
+   On a mapped register (chunk_qubits > 0) the segment is local to the I/O
+   chunks and always streamed over them, cache blocks inside.
+   The segment holds views of the gates on the physical qubits, in storage
+   of the caller reused by the next segment */
+static void execute_segment(Gate **segment, int count, QuantumRegister *qregister, ClassicalRegister *cregister,
+                            int block_qubits, int chunk_qubits, Rng *rng, Logger *logger, ExecStats *stats) {
+    if(chunk_qubits > 0 && count > 0) {
+        if(logger) {
+            char buffer[1024];
+            sprintf(buffer, "Streaming %d gates over the file by chunks of 2^%d amplitudes.", count, chunk_qubits);
+            logger_message(logger, "INFO", buffer);
+        }
+        apply_gates_streamed(qregister, segment, count, chunk_qubits, block_qubits);
+        stats->segments++;
+        stats->blocked_gates += count;
+    } else if(count < 2) {
+        for(int g = 0; g < count; g++) execute_gate(segment[g], qregister, cregister, rng, logger);
+    } else {
+        if(logger) {
+            char buffer[1024];
+            sprintf(buffer, "Applying %d gates on qubits %d to %d by chunks of 2^%d amplitudes.", count,
+                    qregister->nb_qbits - block_qubits, qregister->nb_qbits - 1, block_qubits);
+            logger_message(logger, "INFO", buffer);
+        }
+        apply_gates_blocked(qregister->statevector, qregister->nb_qbits, segment, count, block_qubits);
+        stats->segments++;
+        stats->blocked_gates += count;
+    }
+}
+
+// Schedule of the checkpoints of an execution
+typedef struct {
+    CheckpointHeader header;    // The execution, for checkpoint_write / checkpoint_read
+    int last_gate;              // Of the last checkpoint (or of the start)
+    double last_time;
+    double bandwidth;           // Bytes / s of the last checkpoint (CHECKPOINT_BANDWIDTH before the first)
+    uint64_t bytes;             // Of the statevector
+} Checkpoints;
+
+static bool checkpoint_due(const ExecOptions *options, const Checkpoints *checkpoints, int g, double t0, const ExecStats *stats) {
+    if(g == checkpoints->last_gate) return false;
+    bool due = options->checkpoint_gates > 0 && g - checkpoints->last_gate >= options->checkpoint_gates;
+    if(!due && options->checkpoint_seconds <= 0.0) return false;
+    double now = now_seconds();
+    due = due || now - checkpoints->last_time >= options->checkpoint_seconds;
+    // Postponed while the next one would take the overhead above its share, its own time included
+    double cost = checkpoints->bytes / checkpoints->bandwidth;
+    return due && (options->checkpoint_overhead <= 0.0
+                   || stats->checkpoint_time + cost <= options->checkpoint_overhead * (now - t0 + cost));
+}
+
 double circuit_execute(QuantumCircuit *circuit, QuantumRegister *qregister, ClassicalRegister *cregister, bool log) {
+    ExecOptions options = exec_options_default();
+    options.log = log;
+    return circuit_execute_opts(circuit, qregister, cregister, &options);
+}
+
+// Amplitudes checked between two looks at the flag of register_is_zero
+#define ZERO_SCAN_BLOCK (1ULL << 16)
+
+/* The register holds |0...0>, where a tableau or a sparse state starts :
+   any other state is almost always refused on its first amplitudes, only
+   |0...0> costs a whole pass */
+static bool register_is_zero(const QuantumRegister *qregister) {
+    const amplitude *state = qregister->statevector;
+    if(state[0] != 1) return false;
+    uint64_t dim = 1ULL << qregister->nb_qbits, blocks = (dim + ZERO_SCAN_BLOCK - 1) / ZERO_SCAN_BLOCK;
+    int nonzero = 0;
+    #pragma omp parallel for schedule(static) if(qregister->nb_qbits >= gates_get_parallel_threshold())
+    for(uint64_t b = 0; b < blocks; b++) {
+        int found;
+        #pragma omp atomic read
+        found = nonzero;
+        if(found) continue;
+        uint64_t end = (b + 1) * ZERO_SCAN_BLOCK < dim ? (b + 1) * ZERO_SCAN_BLOCK : dim;
+        for(uint64_t i = (b == 0) ? 1 : b * ZERO_SCAN_BLOCK; i < end; i++) {
+            if(state[i] != 0) {
+                #pragma omp atomic write
+                nonzero = 1;
+                break;
+            }
+        }
+    }
+    return !nonzero;
+}
+
+// register_is_zero once per execution, for both backends (*zero : -1 until known)
+static bool starts_from_zero(const QuantumRegister *qregister, int *zero) {
+    if(*zero < 0) *zero = register_is_zero(qregister);
+    return *zero;
+}
+
+/* All-Clifford circuits run on a stabilizer tableau, the only way without
+   a register ; with one, if it starts from |0...0> in RAM and the circuit
+   is long enough to be worth the pass writing the final state */
+static bool use_stabilizer(QuantumCircuit *circuit, QuantumRegister *qregister, const ExecOptions *options, bool resume,
+                           int *zero) {
+    if(!options->stabilizer || resume || options->checkpoint_file || !circuit_is_clifford(circuit)) return false;
+    if(!qregister) return true;
+    return circuit->nb_gates >= STABILIZER_MIN_GATES && qregister->nb_qbits <= 64 && !qregister_is_mapped(qregister)
+           && starts_from_zero(qregister, zero);
+}
+
+/* Permutation-heavy circuits start on a sparse state, from a register in
+   RAM holding |0...0> (checking a mapped one would read the whole file),
+   if their first gates surely keep it sparse : the others would leave it
+   before paying for the check */
+static bool use_sparse(QuantumCircuit *plan, QuantumRegister *qregister, const ExecOptions *options, int *zero) {
+    if(options->sparse_fill <= 0.0 || qregister->nb_qbits >= 64 || qregister_is_mapped(qregister)) return false;
+    int sure = sparse_sure_gates(plan, options->sparse_fill, SPARSE_MIN_GATES);
+    return (sure >= SPARSE_MIN_GATES || sure == plan->nb_gates) && starts_from_zero(qregister, zero);
+}
+
+static double finish(double t0, Logger *logger, QuantumRegister *qregister, ClassicalRegister *cregister,
+                     const ExecOptions *options, const ExecStats *stats) {
+    double t1 = now_seconds();
+    if(logger) {
+        logger_message(logger, "INFO", "Circuit execution completed.");
+        if(qregister) {
+            logger_message(logger, "INFO", "Final statevector:");
+            qregister_print(logger->log_file, qregister);
+        }
+        if(cregister) {
+            logger_message(logger, "INFO", "Classical register contents:");
+            cregister_print(logger->log_file, cregister);
+        }
+        logger_free(logger);
+    }
+    if(options->stats) *options->stats = *stats;
+    //printf("Execution Time : %.6f s\n", t1 - t0);
+    return t1 - t0;
+}
+
+static double execute(QuantumCircuit *circuit, QuantumRegister *qregister, ClassicalRegister *cregister, const ExecOptions *options, bool resume) {
     double t0 = now_seconds();
+    bool log = options->log;
 
     Logger *logger = NULL;
     if(log) {
@@ -26,71 +286,202 @@ double circuit_execute(QuantumCircuit *circuit, QuantumRegister *qregister, Clas
         circuit_print(logger->log_file, circuit);
         logger_message(logger, "INFO", "Starting circuit execution.");
     }
-    
-    double complex gm[4] = {1, 0, 0, 1};
+
+    ExecStats stats = {0};
+    stats.gates = circuit->nb_gates;
+    Rng *rng = options->rng ? options->rng : rng_default();
 
     char buffer[1024];
+    int zero = -1;
+
+    if(use_stabilizer(circuit, qregister, options, resume, &zero)) {
+        if(log) logger_message(logger, "INFO", "Clifford circuit : running on a stabilizer tableau.");
+        Tableau *tableau = tableau_create(circuit->nb_qbits, qregister != NULL);
+        circuit_execute_tableau(circuit, tableau, cregister, rng);
+        if(qregister) {
+            tableau_get_statevector(tableau, qregister->statevector);
+            for(int q = 0; q < qregister->nb_qbits; q++) qregister->layout[q] = q;
+        }
+        tableau_free(tableau);
+        stats.stabilizer = true;
+        return finish(t0, logger, qregister, cregister, options, &stats);
+    }
+    assert(qregister != NULL && "Only all-Clifford circuits run without a register");
+
+    // The gates actually applied (the fused copy of the circuit if any)
+    QuantumCircuit *plan = circuit;
+    if(options->fuse) {
+        plan = circuit_fuse(circuit, options->fusion_qubits, &stats.passes_saved);
+        if(log) {
+            sprintf(buffer, "Fusion into %d-qubit blocks saved %d passes over the statevector.", options->fusion_qubits, stats.passes_saved);
+            logger_message(logger, "INFO", buffer);
+        }
+    }
     
-    ListIterator iter = list_iterator_begin(circuit->gates);
-    while (list_iterator_has_next(&iter)) {
-        Gate *gate = list_iterator_next(&iter);
-        switch (gate->class) {
-            case UNITARY: 
-                if(log) sprintf(buffer, "Applying unitary gate on qubit %d.", gate->gate.unitary.qbit);
-                apply_corresponding_gate(gm, gate->gate.unitary.type, gate->gate.unitary.phase);
-                apply_single_qubit_inplace(
-                    qregister->statevector, qregister->nb_qbits, 
-                    gate->gate.unitary.qbit, 
-                    gm
-                );
-                break;
-            
-            case CONTROL:
-                if(log) sprintf(buffer, "Applying controlled gate with control qubit %d and target qubit %d.", gate->gate.control.control, gate->gate.control.qbit);
-                apply_corresponding_gate(gm, gate->gate.control.type, gate->gate.control.phase);
-                apply_controlled_u_inplace(
-                    qregister->statevector, qregister->nb_qbits, 
-                    gate->gate.control.control, gate->gate.control.qbit, 
-                    gm
-                ); 
-                break;
-            
-            case CUSTOM:
-                if(log) sprintf(buffer, "Applying custom gate on %d qubits.", gate->gate.custom.nb_qbits);
-                apply_custom_inplace(
-                    qregister->statevector, qregister->nb_qbits, 
-                    gate->gate.custom.qbits, gate->gate.custom.nb_qbits, 
-                    gate->gate.custom.mat
-                );
-                break;
-            
-            case MEAS:
-                if(log) sprintf(buffer, "Measuring qubit %d into classical bit %d.", gate->gate.measure.qbit, gate->gate.measure.cbit);
-                int result = measure_qubit_inplace(
-                    qregister->statevector, qregister->nb_qbits, 
-                    gate->gate.measure.qbit
-                );
-                if (cregister) {
-                    cregister->bits[gate->gate.measure.cbit] = result;
-                }
-                break;
+    /* Blocking only makes sense when there are several chunks. A mapped
+    register is streamed by I/O chunks : they are the window of the segments
+    and of the remapping, the cache blocks being used inside them */
+    int n = qregister->nb_qbits;
+    int block_qubits = options->block_qubits;
+    int chunk_qubits = (qregister_is_mapped(qregister) && options->chunk_qubits > 0 && options->chunk_qubits < n) ? options->chunk_qubits : 0;
+    int window = chunk_qubits ? chunk_qubits : block_qubits;
+    bool blocking = window > 0 && window < n;
+    bool remap = options->remap && blocking;
 
-            default:
-                if(log) sprintf(buffer, "Unknown gate class encountered.");
-                break;
+    int total = plan->nb_gates;
+    int start = 0;
+    Checkpoints *checkpoints = NULL;
+    if(options->checkpoint_file) {
+        checkpoints = calloc_custom(1, sizeof(Checkpoints));
+        checkpoints->header.nb_gates = circuit->nb_gates;
+        checkpoints->header.plan_gates = total;
+        checkpoints->header.fusion_qubits = options->fuse ? options->fusion_qubits : 0;
+        checkpoints->header.fingerprint = circuit_fingerprint(circuit);
+        checkpoints->bandwidth = CHECKPOINT_BANDWIDTH;
+        checkpoints->bytes = sizeof(amplitude) << qregister->nb_qbits;
+    }
+    if(resume) {
+        CheckpointHeader restored;
+        CheckpointStatus status = checkpoint_read(options->checkpoint_file, &checkpoints->header, &restored, qregister, cregister, rng);
+        if(status == CHECKPOINT_INVALID) {
+            if(plan != circuit) circuit_free(plan);
+            free_custom(checkpoints);
+            if(logger) logger_free(logger);
+            return -1.0;
+        }
+        if(status == CHECKPOINT_RESTORED) start = (int)restored.gate;
+        if(log) {
+            sprintf(buffer, "Resuming at gate %d of %d.", start, total);
+            logger_message(logger, "INFO", buffer);
+        }
+    }
+    stats.resumed_gate = start;
+    // A restored checkpoint is past the sparse part, which runs before the first checkpoint
+    if(start == 0 && use_sparse(plan, qregister, options, &zero)) {
+        SparseState *sparse = sparse_create(n, 0);
+        start = circuit_execute_sparse(plan, sparse, cregister, rng, options->sparse_fill);
+        sparse_write_statevector(sparse, qregister->statevector);
+        for(int q = 0; q < n; q++) qregister->layout[q] = q;
+        stats.sparse_gates = start;
+        stats.sparse_peak = sparse_get_peak(sparse);
+        if(log) {
+            sprintf(buffer, "%d gates applied on a sparse state (at most %llu nonzeros).", start, (unsigned long long)stats.sparse_peak);
+            logger_message(logger, "INFO", buffer);
         }
-        if(log) logger_message(logger, "INFO", buffer);
+        sparse_free(sparse);
+    }
+    if(checkpoints) {
+        checkpoints->last_gate = start;
+        checkpoints->last_time = now_seconds();
     }
 
-    double t1 = now_seconds();
-    if(log) {
-        logger_message(logger, "INFO", "Circuit execution completed.");
-        logger_message(logger, "INFO", "Final statevector:");
-        qregister_print(logger->log_file, qregister);
-        logger_message(logger, "INFO", "Classical register contents:");
-        cregister_print(logger->log_file, cregister);
-        logger_free(logger);
+    /* The views of the gates on the physical qubits : one on the stack for
+    a gate applied at once, one slot per gate a segment may hold, the qubit
+    lists of custom and diagonal gates in buffers sized here */
+    Gate **gates = malloc_custom((total > 0 ? total : 1) * sizeof(Gate *));
+    Gate **segment = malloc_custom((total > 0 ? total : 1) * sizeof(Gate *));
+    Gate *slots = malloc_custom((total > 0 ? total : 1) * sizeof(Gate));
+    int count = 0, held = 0, lists = 0;
+    for(int g = 0; g < total; g++) {
+        gates[g] = &plan->gates[g];
+        if(g >= start) lists += view_qubits(gates[g]);
     }
-    //printf("Execution Time : %.6f s\n", t1 - t0);
-    return t1 - t0;
+    int *qbits = malloc_custom((n > 0 ? n : 1) * sizeof(int));
+    int *segment_qbits = malloc_custom((lists > 0 ? lists : 1) * sizeof(int));
+
+    for(int g = start; g < total; g++) {
+        // The state before gate g, once the pending segment is applied
+        if(checkpoints && checkpoint_due(options, checkpoints, g, t0, &stats)) {
+            execute_segment(segment, count, qregister, cregister, block_qubits, chunk_qubits, rng, logger, &stats);
+            count = 0;
+            double t = now_seconds();
+            checkpoints->header.gate = g;
+            if(checkpoint_write(options->checkpoint_file, &checkpoints->header, qregister, cregister, rng)) stats.checkpoints++;
+            checkpoints->last_gate = g;
+            checkpoints->last_time = now_seconds();
+            double cost = checkpoints->last_time - t;
+            if(cost > 0.0) checkpoints->bandwidth = checkpoints->bytes / cost;
+            stats.checkpoint_time += cost;
+            if(log) {
+                sprintf(buffer, "Checkpoint before gate %d written in %.3f s.", g, cost);
+                logger_message(logger, "INFO", buffer);
+            }
+        }
+
+        // Consecutive measurements are done at once
+        int run = 0;
+        while(g + run < total && gates[g + run]->class == MEAS && !gates[g + run]->condition) run++;
+        if(run >= 2) {
+            execute_segment(segment, count, qregister, cregister, block_qubits, chunk_qubits, rng, logger, &stats);
+            count = 0;
+            execute_measures(gates + g, run, qregister, cregister, rng, logger);
+            g += run - 1;
+            continue;
+        }
+
+        // The gate on the physical qubits (the register's layout may be permuted)
+        Gate view, *gate = &view;
+        gate_view_init(gate, gates[g], qregister->layout, 0, qbits);
+        bool local = blocking && gate_is_local(gate, n, window);
+
+        if(remap && !local && gate->class != MEAS && !gate->condition) {
+            // The pending segment uses the current layout
+            execute_segment(segment, count, qregister, cregister, block_qubits, chunk_qubits, rng, logger, &stats);
+            count = 0;
+            int swaps = remap_window(gates, g, total, qregister, window);
+            if(swaps > 0) {
+                if(log) {
+                    sprintf(buffer, "Swapped %d qubits onto the cache blocks.", swaps);
+                    logger_message(logger, "INFO", buffer);
+                }
+                stats.swaps += swaps;
+                gate_view_init(gate, gates[g], qregister->layout, 0, qbits);
+                local = gate_is_local(gate, n, window);
+            }
+        }
+
+        if(local) {
+            // A new segment reuses the qubit lists of the last one
+            if(count == 0) held = 0;
+            segment[count] = &slots[count];
+            gate_view_init(segment[count++], gates[g], qregister->layout, 0, segment_qbits + held);
+            held += view_qubits(gates[g]);
+            continue;
+        }
+        execute_segment(segment, count, qregister, cregister, block_qubits, chunk_qubits, rng, logger, &stats);
+        count = 0;
+        if(!gate_condition_holds(gate, cregister ? cregister->bits : NULL)) {
+            if(log) logger_message(logger, "INFO", "Skipping a gate : its classical condition doesn't hold.");
+        } else if(chunk_qubits && gate->class != MEAS) {
+            if(log) {
+                sprintf(buffer, "Applying a gate by exchange of the chunks it mixes.");
+                logger_message(logger, "INFO", buffer);
+            }
+            apply_gate_exchange(qregister, gate, chunk_qubits);
+            stats.exchanges++;
+        } else {
+            execute_gate(gate, qregister, cregister, rng, logger);
+        }
+    }
+    execute_segment(segment, count, qregister, cregister, block_qubits, chunk_qubits, rng, logger, &stats);
+    free_custom(qbits);
+    free_custom(segment_qbits);
+    free_custom(slots);
+    free_custom(segment);
+    free_custom(gates);
+    if(checkpoints) free_custom(checkpoints);
+
+    stats.passes = plan->nb_gates;
+    if(plan != circuit) circuit_free(plan);
+
+    return finish(t0, logger, qregister, cregister, options, &stats);
+}
+
+double circuit_execute_opts(QuantumCircuit *circuit, QuantumRegister *qregister, ClassicalRegister *cregister, const ExecOptions *options) {
+    return execute(circuit, qregister, cregister, options, false);
+}
+
+double circuit_execute_resume(QuantumCircuit *circuit, QuantumRegister *qregister, ClassicalRegister *cregister, const ExecOptions *options) {
+    assert(options->checkpoint_file != NULL && "circuit_execute_resume needs a checkpoint file");
+    return execute(circuit, qregister, cregister, options, true);
 }
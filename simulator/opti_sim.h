@@ -3,10 +3,70 @@
 
 #include "../builder/circuit.h"
 #include "../builder/register.h"
+#include "../utils/rng.h"
 
 #include <complex.h>
 #include <stdbool.h>
+#include <stdint.h>
 
+typedef struct {
+    int gates;          // Gates in the circuit
+    int passes;         // Gates actually applied (passes over the statevector)
+    int passes_saved;   // Passes removed by the fusion
+    int segments;       // Runs of gates applied chunk by chunk (cache blocking)
+    int blocked_gates;  // Gates in these runs
+    int swaps;          // Qubit swap passes inserted by the remapping
+    int exchanges;      // Gates applied by exchange of I/O chunks (mapped registers)
+    int checkpoints;    // Written during the execution
+    double checkpoint_time; // Seconds spent writing them
+    int resumed_gate;   // Gate of the plan circuit_execute_resume started from (0 : the first)
+    bool stabilizer;    // Run on a stabilizer tableau (see stabilizer.h)
+    int sparse_gates;   // Gates of the plan applied on a sparse state before the statevector (see sparse.h)
+    uint64_t sparse_peak;   // Largest number of nonzeros it held
+} ExecStats;
+
+typedef struct {
+    bool log;           // Full execution trace in logs/circuit_execution.log
+    bool fuse;          // Fuse consecutive gates into dense blocks before executing
+    int fusion_qubits;  // Max qubits per fused block (1 : runs of single-qubit gates only)
+    int block_qubits;   // Qubits of a cache block (see blocking.h), 0 : every gate streams over the state
+    bool remap;         // Swap the qubits of upcoming gate windows onto the cache blocks (see remap.h)
+    Rng *rng;           // Random stream of the measurements, NULL : rng_default() (see utils/rng.h)
+    int chunk_qubits;   // Qubits of an I/O chunk of a mapped register (see outofcore.h)
+    const char *state_file; // circuit_sample maps its register from this file (qregister_create_mapped), NULL : in RAM
+    ExecStats *stats;   // Filled after the execution if not NULL
+    /* Checkpoints of the execution in this file (see checkpoint.h), NULL :
+    none. One is due every checkpoint_gates gates of the plan or every
+    checkpoint_seconds (0 : no such limit), and only written if the time
+    spent in checkpoints stays under checkpoint_overhead of the run time
+    (0 : no limit), else postponed */
+    const char *checkpoint_file;
+    int checkpoint_gates;
+    double checkpoint_seconds;
+    double checkpoint_overhead;
+    /* All-Clifford circuits on a stabilizer tableau (see stabilizer.h) :
+    always without a register, with one from |0...0> (the final state
+    written from the tableau) */
+    bool stabilizer;
+    /* Circuits start on a sparse state (see sparse.h) from a register in
+    RAM holding |0...0>, until its nonzeros exceed this fraction of the 2^n
+    amplitudes : the state is then written into the register and the rest
+    runs on it (0 : statevector only) */
+    double sparse_fill;
+} ExecOptions;
+
+ExecOptions exec_options_default(void);
+
+/* Returns the execution time in seconds (default options, except log).
+   qregister may be NULL for an all-Clifford circuit : it then runs on a
+   stabilizer tableau, only the classical register gets the results */
 double circuit_execute(QuantumCircuit *circuit, QuantumRegister *qregister, ClassicalRegister *cregister, bool log);
+double circuit_execute_opts(QuantumCircuit *circuit, QuantumRegister *qregister, ClassicalRegister *cregister, const ExecOptions *options);
+/* Continues the execution from the checkpoint in options->checkpoint_file
+   (register, classical register and random stream restored), from the
+   start if there is none yet, with the same options. The circuit and the
+   fusion options must be those of the checkpointed run. Returns the time of
+   this execution, -1 if the checkpoint is invalid (message on stderr) */
+double circuit_execute_resume(QuantumCircuit *circuit, QuantumRegister *qregister, ClassicalRegister *cregister, const ExecOptions *options);
 
 #endif
\ No newline at end of file
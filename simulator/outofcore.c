@@ -0,0 +1,181 @@
+#define _GNU_SOURCE // sync_file_range
+#include "outofcore.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "gates.h"
+#include "blocking.h"
+#include "../builder/internal.h"
+#include "../utils/utils.h"
+
+static inline uint64_t chunk_insert_zero_bit(uint64_t j, uint64_t bit) {
+    uint64_t low = j & (bit - 1);
+    return ((j ^ low) << 1) | low;
+}
+
+/* -------- page cache pipeline --------
+   On amplitudes [first, first + count), widened to whole pages */
+
+static void page_range(uint64_t first, uint64_t count, off_t *offset, size_t *length) {
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t start = first * sizeof(amplitude) / page * page;
+    uint64_t end = ((first + count) * sizeof(amplitude) + page - 1) / page * page;
+    *offset = start;
+    *length = end - start;
+}
+
+// Asynchronous read of the pages
+static void storage_prefetch(QuantumRegister *qregister, uint64_t first, uint64_t count) {
+    off_t offset;
+    size_t length;
+    page_range(first, count, &offset, &length);
+    madvise((char *)qregister->statevector + offset, length, MADV_WILLNEED);
+}
+
+// Starts writing the dirty pages, without waiting
+static void storage_writeback(QuantumRegister *qregister, uint64_t first, uint64_t count) {
+    off_t offset;
+    size_t length;
+    page_range(first, count, &offset, &length);
+#ifdef __linux__
+    sync_file_range(qregister->fd, offset, length, SYNC_FILE_RANGE_WRITE);
+#else
+    msync((char *)qregister->statevector + offset, length, MS_ASYNC);
+#endif
+}
+
+// Waits for the write-back, then drops the pages from the mapping and the page cache
+static void storage_release(QuantumRegister *qregister, uint64_t first, uint64_t count) {
+    off_t offset;
+    size_t length;
+    page_range(first, count, &offset, &length);
+#ifdef __linux__
+    sync_file_range(qregister->fd, offset, length,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+    msync((char *)qregister->statevector + offset, length, MS_SYNC);
+#endif
+    madvise((char *)qregister->statevector + offset, length, MADV_DONTNEED);
+    posix_fadvise(qregister->fd, offset, length, POSIX_FADV_DONTNEED);
+}
+
+/* The gates of a segment on one chunk : runs of gates on the cache blocks
+   go through apply_gates_blocked, the others stream over the chunk */
+static void apply_chunk_gates(amplitude *chunk, int chunk_qubits, Gate **gates, int count, int block_qubits) {
+    bool blocking = block_qubits > 0 && block_qubits < chunk_qubits;
+    for(int g = 0; g < count; ) {
+        int run = 0;
+        while(blocking && g + run < count && gate_is_local(gates[g + run], chunk_qubits, block_qubits)) run++;
+        if(run >= 2) {
+            apply_gates_blocked(chunk, chunk_qubits, gates + g, run, block_qubits);
+            g += run;
+        } else {
+            apply_chunk_gate(chunk, chunk_qubits, gates[g]);
+            g++;
+        }
+    }
+}
+
+void apply_gates_streamed(QuantumRegister *qregister, Gate **gates, int count, int chunk_qubits, int block_qubits) {
+    int n = qregister->nb_qbits;
+    assert(chunk_qubits > 0 && chunk_qubits < n);
+
+    Gate **chunk_gates = malloc_custom(count * sizeof(Gate *));
+    for(int g = 0; g < count; g++) {
+        assert(gate_is_local(gates[g], n, chunk_qubits));
+        chunk_gates[g] = create_gate_view(gates[g], NULL, n - chunk_qubits);
+    }
+
+    uint64_t chunks = 1ULL << (n - chunk_qubits);
+    uint64_t size = 1ULL << chunk_qubits;
+    storage_prefetch(qregister, 0, size);
+    for(uint64_t c = 0; c < chunks; c++) {
+        if(c + 1 < chunks) storage_prefetch(qregister, (c + 1) * size, size);
+        apply_chunk_gates(qregister->statevector + c * size, chunk_qubits, chunk_gates, count, block_qubits);
+        storage_writeback(qregister, c * size, size);
+        if(c > 0) storage_release(qregister, (c - 1) * size, size);
+    }
+
+    for(int g = 0; g < count; g++) free_gate_view(chunk_gates[g]);
+    free_custom(chunk_gates);
+}
+
+void apply_gate_exchange(QuantumRegister *qregister, Gate *gate, int chunk_qubits) {
+    int n = qregister->nb_qbits;
+    int first = n - chunk_qubits; // Lowest qubit inside the chunks, also the bits of a chunk index
+    int *qbits = malloc_custom(n * sizeof(int));
+    int nb = gate_get_qubits(gate, qbits);
+
+    // High qubits of the gate, ascending (chunk index MSB first)
+    int high[OUTOFCORE_EXCHANGE_QUBITS];
+    int h = 0;
+    bool streamed = false;
+    for(int i = 0; i < nb; i++) {
+        if(qbits[i] >= first) continue;
+        if(h == OUTOFCORE_EXCHANGE_QUBITS) {
+            streamed = true;
+            break;
+        }
+        int j = h++;
+        for(; j > 0 && high[j - 1] > qbits[i]; j--) high[j] = high[j - 1];
+        high[j] = qbits[i];
+    }
+    free_custom(qbits);
+    if(streamed) {
+        apply_chunk_gate(qregister->statevector, n, gate);
+        return;
+    }
+
+    // In the buffer the high qubits come first, then the qubits of a chunk
+    int *map = malloc_custom(n * sizeof(int));
+    for(int q = 0; q < n; q++) map[q] = (q >= first) ? q - first + h : -1;
+    for(int i = 0; i < h; i++) map[high[i]] = i;
+    Gate *view = create_gate_view(gate, map, 0);
+    free_custom(map);
+
+    // Chunk index bit of each high qubit (sorted ascending : high is descending) and offset of each buffer chunk
+    uint64_t masks[OUTOFCORE_EXCHANGE_QUBITS], offsets[1 << OUTOFCORE_EXCHANGE_QUBITS];
+    for(int i = 0; i < h; i++) masks[i] = 1ULL << (first - 1 - high[h - 1 - i]);
+    for(uint64_t b = 0; b < (1ULL << h); b++) {
+        offsets[b] = 0;
+        for(int i = 0; i < h; i++) if((b >> (h - 1 - i)) & 1) offsets[b] |= 1ULL << (first - 1 - high[i]);
+    }
+
+    uint64_t size = 1ULL << chunk_qubits;
+    uint64_t parts = 1ULL << h;
+    uint64_t groups = 1ULL << (first - h);
+    amplitude *buffer = malloc_custom((size << h) * sizeof(amplitude));
+    uint64_t previous = 0;
+    for(uint64_t g = 0; g < groups; g++) {
+        uint64_t base = g;
+        for(int i = 0; i < h; i++) base = chunk_insert_zero_bit(base, masks[i]);
+        if(g + 1 < groups) {
+            uint64_t next = g + 1;
+            for(int i = 0; i < h; i++) next = chunk_insert_zero_bit(next, masks[i]);
+            for(uint64_t b = 0; b < parts; b++) storage_prefetch(qregister, (next | offsets[b]) * size, size);
+        }
+
+        for(uint64_t b = 0; b < parts; b++) {
+            memcpy(buffer + b * size, qregister->statevector + (base | offsets[b]) * size, size * sizeof(amplitude));
+        }
+        apply_chunk_gate(buffer, chunk_qubits + h, view);
+        for(uint64_t b = 0; b < parts; b++) {
+            memcpy(qregister->statevector + (base | offsets[b]) * size, buffer + b * size, size * sizeof(amplitude));
+            storage_writeback(qregister, (base | offsets[b]) * size, size);
+        }
+        if(g > 0) {
+            for(uint64_t b = 0; b < parts; b++) storage_release(qregister, (previous | offsets[b]) * size, size);
+        }
+        previous = base;
+    }
+    free_custom(buffer);
+    free_gate_view(view);
+}
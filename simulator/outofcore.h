@@ -0,0 +1,36 @@
+#ifndef OUTOFCORE_H
+#define OUTOFCORE_H
+
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+
+/* -------- out-of-core execution --------
+   A mapped register (qregister_create_mapped) is processed by I/O chunks of
+   2^chunk_qubits consecutive amplitudes, in storage order. Gates on the last
+   chunk_qubits qubits never mix two chunks : a segment of them is applied
+   chunk by chunk (with the cache blocks inside each chunk), one read and one
+   write of the file for the whole segment. While a chunk is computed, the
+   next one is prefetched (madvise WILLNEED) ; once done, its write-back is
+   started and the previous chunk, written by then, leaves the page cache.
+   I/O overlaps compute and the resident set stays at a few chunks.
+   A gate on the high qubits (stride of a chunk or more) is applied by
+   exchange : the 2^h chunks it mixes (h its high qubits, at most
+   OUTOFCORE_EXCHANGE_QUBITS) are gathered in RAM, updated and written back.
+   The executor first tries to swap those qubits into the chunks (remap.h,
+   with the chunk as window), one pass over the file for many gates.
+*/
+#ifndef OUTOFCORE_CHUNK_QUBITS
+#define OUTOFCORE_CHUNK_QUBITS 24
+#endif
+#ifndef OUTOFCORE_EXCHANGE_QUBITS
+#define OUTOFCORE_EXCHANGE_QUBITS 2
+#endif
+
+// Applies gates[0 .. count) (on the physical qubits, all local to the chunks) chunk by chunk
+void apply_gates_streamed(QuantumRegister *qregister, Gate **gates, int count, int chunk_qubits, int block_qubits);
+/* Applies a gate (on the physical qubits) having some of its qubits above
+   the chunks by exchange of the chunks it mixes. With more than
+   OUTOFCORE_EXCHANGE_QUBITS of them, the kernel streams over the mapping */
+void apply_gate_exchange(QuantumRegister *qregister, Gate *gate, int chunk_qubits);
+
+#endif
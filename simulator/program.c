@@ -0,0 +1,353 @@
+#include "program.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+
+#include <omp.h>
+
+#include "gates.h"
+#include "fusion.h"
+#include "blocking.h"
+#include "remap.h"
+#include "../builder/internal.h"
+#include "../utils/utils.h"
+
+/* -------- compilation -------- */
+
+typedef struct {
+    Program *program;
+    int op_capacity;
+    int64_t qubit_count, qubit_capacity;
+    int64_t matrix_count, matrix_capacity;
+} Builder;
+
+static Op *push_op(Builder *b, OpCode code) {
+    Program *p = b->program;
+    if(p->size == b->op_capacity) {
+        b->op_capacity *= 2;
+        p->ops = realloc(p->ops, b->op_capacity * sizeof(Op));
+        assert(p->ops != NULL);
+    }
+    Op *op = &p->ops[p->size++];
+    memset(op, 0, sizeof(Op));
+    op->code = code;
+    return op;
+}
+
+// Returns the offset of the copy
+static int64_t push_qubits(Builder *b, const int *qubits, int count) {
+    Program *p = b->program;
+    if(b->qubit_count + count > b->qubit_capacity) {
+        while(b->qubit_count + count > b->qubit_capacity) b->qubit_capacity *= 2;
+        p->qubits = realloc(p->qubits, b->qubit_capacity * sizeof(int));
+        assert(p->qubits != NULL);
+    }
+    int64_t offset = b->qubit_count;
+    memcpy(p->qubits + offset, qubits, count * sizeof(int));
+    b->qubit_count += count;
+    return offset;
+}
+
+static int64_t push_matrix(Builder *b, const double complex *matrix, uint64_t count) {
+    Program *p = b->program;
+    if(b->matrix_count + (int64_t)count > b->matrix_capacity) {
+        while(b->matrix_count + (int64_t)count > b->matrix_capacity) b->matrix_capacity *= 2;
+        p->matrices = realloc(p->matrices, b->matrix_capacity * sizeof(double complex));
+        assert(p->matrices != NULL);
+    }
+    int64_t offset = b->matrix_count;
+    memcpy(p->matrices + offset, matrix, count * sizeof(double complex));
+    b->matrix_count += count;
+    return offset;
+}
+
+// The op of a gate on the physical qubits (the same kernel as execute_gate), nothing for the identities
+static void emit_gate(Builder *b, Gate *gate) {
+    Op *op;
+    switch(gate->class) {
+        case UNITARY: {
+            int t = gate->gate.unitary.qbit;
+            switch(gate->gate.unitary.type) {
+                case GATE_I: return;
+                case GATE_H: op = push_op(b, OP_H); break;
+                case GATE_X: op = push_op(b, OP_X); break;
+                case GATE_Y: op = push_op(b, OP_Y); break;
+                case GATE_Z:
+                    op = push_op(b, OP_PHASE);
+                    op->m[0] = -1.0;
+                    break;
+                case GATE_PHASE:
+                    op = push_op(b, OP_PHASE);
+                    op->m[0] = cexp(I * gate->gate.unitary.phase);
+                    break;
+                default: return;
+            }
+            op->t = t;
+            break;
+        }
+        case CONTROL: {
+            SingleBitGate type = gate->gate.control.type;
+            if(type == GATE_I) return;
+            if(type == GATE_Z || type == GATE_PHASE) {
+                op = push_op(b, OP_CONTROLLED_PHASE);
+                op->m[0] = (type == GATE_Z) ? -1.0 : cexp(I * gate->gate.control.phase);
+            } else {
+                op = push_op(b, OP_CONTROLLED);
+                apply_corresponding_gate(op->m, type, gate->gate.control.phase);
+            }
+            op->c = gate->gate.control.control;
+            op->t = gate->gate.control.qbit;
+            break;
+        }
+        case CUSTOM: {
+            int k = gate->gate.custom.nb_qbits;
+            if(k == 1) {
+                op = push_op(b, OP_MATRIX);
+                memcpy(op->m, gate->gate.custom.mat, 4 * sizeof(double complex));
+                op->t = gate->gate.custom.qbits[0];
+                break;
+            }
+            int64_t qubits = push_qubits(b, gate->gate.custom.qbits, k);
+            int64_t matrix = push_matrix(b, gate->gate.custom.mat, 1ULL << (2 * k));
+            op = push_op(b, OP_CUSTOM);
+            op->k = k;
+            op->qubits = qubits;
+            op->matrix = matrix;
+            break;
+        }
+        case DIAGONAL: {
+            int k = gate->gate.diagonal.nb_qbits;
+            int64_t qubits = push_qubits(b, gate->gate.diagonal.qbits, k);
+            int64_t matrix = push_matrix(b, gate->gate.diagonal.phases, 1ULL << k);
+            op = push_op(b, OP_DIAGONAL);
+            op->k = k;
+            op->qubits = qubits;
+            op->matrix = matrix;
+            break;
+        }
+        case MEAS: {
+            int list[3] = {gate->gate.measure.qbit, 0, gate->gate.measure.cbit};
+            int64_t qubits = push_qubits(b, list, 3);
+            op = push_op(b, OP_MEASURE);
+            op->k = 1;
+            op->c = 1;
+            op->qubits = qubits;
+            break;
+        }
+    }
+}
+
+// A run of measurements (on the logical qubits) as one joint measurement, as execute_measures
+static void emit_measures(Builder *b, Gate **measures, int count, const int *layout) {
+    int *list = malloc_custom(3 * count * sizeof(int)); // At most count targets, then the pairs
+    int *pairs = malloc_custom(2 * count * sizeof(int));
+    int k = 0;
+    for(int i = 0; i < count; i++) {
+        int physical = layout[measures[i]->gate.measure.qbit];
+        int index = -1;
+        for(int j = 0; j < k; j++) if(list[j] == physical) index = j;
+        if(index < 0) {
+            index = k;
+            list[k++] = physical;
+        }
+        pairs[2 * i] = index;
+        pairs[2 * i + 1] = measures[i]->gate.measure.cbit;
+    }
+    memcpy(list + k, pairs, 2 * count * sizeof(int));
+    int64_t qubits = push_qubits(b, list, k + 2 * count);
+    Op *op = push_op(b, OP_MEASURE);
+    op->k = k;
+    op->c = count;
+    op->qubits = qubits;
+    free_custom(list);
+    free_custom(pairs);
+}
+
+// A conditional gate is an OP_IF followed by its op (none for an identity)
+static void emit_conditional(Builder *b, Gate *gate) {
+    if(!gate->condition) {
+        emit_gate(b, gate);
+        return;
+    }
+    int at = b->program->size;
+    Op *op = push_op(b, OP_IF);
+    op->t = gate->condition->first;
+    op->k = gate->condition->width;
+    op->value = gate->condition->value;
+    emit_gate(b, gate);
+    if(b->program->size == at + 1) b->program->size = at;
+}
+
+// As execute_segment : the views are released here
+static void emit_segment(Builder *b, Gate **segment, int count, int window) {
+    int n = b->program->nb_qbits;
+    if(count < 2) {
+        for(int g = 0; g < count; g++) emit_gate(b, segment[g]);
+    } else {
+        int header = b->program->size;
+        push_op(b, OP_BLOCK)->t = window;
+        for(int g = 0; g < count; g++) {
+            Gate *view = create_gate_view(segment[g], NULL, n - window);
+            emit_gate(b, view);
+            free_gate_view(view);
+        }
+        b->program->ops[header].k = b->program->size - header - 1;
+        b->program->stats.segments++;
+        b->program->stats.blocked_gates += count;
+    }
+    for(int g = 0; g < count; g++) free_gate_view(segment[g]);
+}
+
+Program *circuit_compile(QuantumCircuit *circuit, const ExecOptions *options) {
+    ExecOptions defaults = exec_options_default();
+    if(!options) options = &defaults;
+    int n = circuit->nb_qbits;
+
+    Program *program = calloc_custom(1, sizeof(Program));
+    program->nb_qbits = n;
+    program->stats.gates = circuit->nb_gates;
+    program->layout = malloc_custom(n * sizeof(int));
+    for(int q = 0; q < n; q++) program->layout[q] = q;
+    Builder b = {program, 64, 0, 64, 0, 64};
+    program->ops = malloc_custom(b.op_capacity * sizeof(Op));
+    program->qubits = malloc_custom(b.qubit_capacity * sizeof(int));
+    program->matrices = malloc_custom(b.matrix_capacity * sizeof(double complex));
+
+    QuantumCircuit *plan = options->fuse ? circuit_fuse(circuit, options->fusion_qubits, &program->stats.passes_saved) : circuit;
+
+    // The same walk as circuit_execute_opts on a register in RAM
+    int window = options->block_qubits;
+    bool blocking = window > 0 && window < n;
+    bool remap = options->remap && blocking;
+    int *layout = program->layout;
+
+    int total = plan->nb_gates;
+    Gate **gates = malloc_custom((total > 0 ? total : 1) * sizeof(Gate *));
+    Gate **segment = malloc_custom((total > 0 ? total : 1) * sizeof(Gate *));
+    int *swaps = malloc_custom(2 * n * sizeof(int));
+    int count = 0;
+    for(int g = 0; g < total; g++) gates[g] = &plan->gates[g];
+
+    for(int g = 0; g < total; g++) {
+        int run = 0;
+        while(g + run < total && gates[g + run]->class == MEAS && !gates[g + run]->condition) run++;
+        if(run >= 2) {
+            emit_segment(&b, segment, count, window);
+            count = 0;
+            emit_measures(&b, gates + g, run, layout);
+            g += run - 1;
+            continue;
+        }
+
+        Gate *gate = create_gate_view(gates[g], layout, 0);
+        bool local = blocking && gate_is_local(gate, n, window);
+
+        if(remap && !local && gate->class != MEAS && !gate->condition) {
+            emit_segment(&b, segment, count, window);
+            count = 0;
+            int nb = remap_plan(gates, g, total, n, layout, window, swaps, swaps + n);
+            if(nb > 0) {
+                memmove(swaps + nb, swaps + n, nb * sizeof(int));
+                int64_t qubits = push_qubits(&b, swaps, 2 * nb);
+                Op *op = push_op(&b, OP_SWAPS);
+                op->k = nb;
+                op->qubits = qubits;
+                program->stats.swaps += nb;
+                free_gate_view(gate);
+                gate = create_gate_view(gates[g], layout, 0);
+                local = gate_is_local(gate, n, window);
+            }
+        }
+
+        if(local) {
+            segment[count++] = gate;
+            continue;
+        }
+        emit_segment(&b, segment, count, window);
+        count = 0;
+        emit_conditional(&b, gate);
+        free_gate_view(gate);
+    }
+    emit_segment(&b, segment, count, window);
+    free_custom(segment);
+    free_custom(gates);
+    free_custom(swaps);
+
+    program->stats.passes = total;
+    if(plan != circuit) circuit_free(plan);
+    if(options->stats) *options->stats = program->stats;
+    return program;
+}
+
+void program_free(Program *program) {
+    free_custom(program->ops);
+    free_custom(program->qubits);
+    free_custom(program->matrices);
+    free_custom(program->layout);
+    free_custom(program);
+}
+
+/* -------- execution -------- */
+
+static void run_ops(const Program *program, const Op *ops, int count, amplitude *state, int n, ClassicalRegister *cregister, Rng *rng) {
+    for(int i = 0; i < count; i++) {
+        const Op *op = &ops[i];
+        int *qubits = program->qubits + op->qubits;
+        switch(op->code) {
+            case OP_H: apply_h_inplace(state, n, op->t); break;
+            case OP_X: apply_x_inplace(state, n, op->t); break;
+            case OP_Y: apply_y_inplace(state, n, op->t); break;
+            case OP_PHASE: apply_phase_inplace(state, n, op->t, op->m[0]); break;
+            case OP_MATRIX: apply_single_qubit_inplace(state, n, op->t, (double complex *)op->m); break;
+            case OP_CONTROLLED: apply_controlled_u_inplace(state, n, op->c, op->t, (double complex *)op->m); break;
+            case OP_CONTROLLED_PHASE: apply_controlled_phase_inplace(state, n, op->c, op->t, op->m[0]); break;
+            case OP_CUSTOM: apply_custom_inplace(state, n, qubits, op->k, program->matrices + op->matrix); break;
+            case OP_DIAGONAL: apply_diagonal_inplace(state, n, qubits, op->k, program->matrices + op->matrix); break;
+            case OP_MEASURE: {
+                uint64_t outcome = (op->k == 1) ? (uint64_t)measure_qubit_inplace(state, n, qubits[0], rng)
+                                                : measure_qubits_inplace(state, n, qubits, op->k, rng);
+                const int *pairs = qubits + op->k;
+                for(int j = 0; cregister && j < op->c; j++) {
+                    cregister->bits[pairs[2 * j + 1]] = (outcome >> (op->k - 1 - pairs[2 * j])) & 1;
+                }
+                break;
+            }
+            case OP_SWAPS:
+                if(op->k == 1) apply_swap_inplace(state, n, qubits[0], qubits[1]);
+                else apply_swaps_inplace(state, n, qubits, qubits + op->k, op->k);
+                break;
+            case OP_IF: {
+                uint64_t value = 0;
+                for(int j = 0; cregister && j < op->k; j++) value |= (uint64_t)(cregister->bits[op->t + j] & 1) << j;
+                if(value != op->value) i++;
+                break;
+            }
+            case OP_BLOCK: {
+                // As apply_gates_blocked
+                uint64_t chunks = 1ULL << (n - op->t);
+                uint64_t size = 1ULL << op->t;
+                bool parallel = n >= gates_get_parallel_threshold() && chunks >= (uint64_t)omp_get_max_threads();
+                #pragma omp parallel for schedule(static) if(parallel)
+                for(uint64_t c = 0; c < chunks; c++) run_ops(program, op + 1, op->k, state + c * size, op->t, NULL, NULL);
+                i += op->k;
+                break;
+            }
+        }
+    }
+}
+
+double program_execute(const Program *program, QuantumRegister *qregister, ClassicalRegister *cregister, Rng *rng) {
+    double t0 = now_seconds();
+    int n = program->nb_qbits;
+    assert(qregister->nb_qbits == n);
+    if(!rng) rng = rng_default();
+
+    qregister_restore_layout(qregister);
+    run_ops(program, program->ops, program->size, qregister->statevector, n, cregister, rng);
+    memcpy(qregister->layout, program->layout, n * sizeof(int));
+    return now_seconds() - t0;
+}
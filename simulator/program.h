@@ -0,0 +1,72 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+#include "../utils/rng.h"
+#include "opti_sim.h"
+
+#include <complex.h>
+#include <stdint.h>
+
+/* -------- compiled programs --------
+   circuit_compile does once what circuit_execute_opts does on every call :
+   the fusion, the choice of the kernel of every gate (2x2 matrices and
+   phases computed, cexp included), the remapping (the swaps and the
+   physical qubit of every op are planned from the identity layout), the
+   cache blocking (the ops of a segment numbered inside the chunks) and
+   the joint measurements. The result is a flat array of ops, the matrices
+   and qubit lists of all of them in two contiguous arrays owned by the
+   program : executing it walks the array, no list, no allocation and no
+   gate view.
+   A program is read only once compiled : it can be executed any number of
+   times, on several registers at once from different threads (each with
+   its own random stream). It doesn't depend on the circuit, which may be
+   freed. Mapped registers should go through circuit_execute_opts (the
+   program streams over the mapping without the I/O chunks).
+*/
+
+typedef enum {
+    OP_H, OP_X, OP_Y,       // On t
+    OP_PHASE,               // diag(1, m[0]) on t (Z and PHASE)
+    OP_MATRIX,              // m on t (fused single-qubit runs)
+    OP_CONTROLLED,          // m on t if c
+    OP_CONTROLLED_PHASE,    // m[0] on c and t both set
+    OP_CUSTOM,              // Dense matrix on the k qubits at qubits
+    OP_DIAGONAL,            // Diagonal on the k qubits at qubits
+    OP_MEASURE,             // Joint measurement of the k qubits at qubits, then c (index in them, cbit) pairs
+    OP_SWAPS,               // k disjoint swaps, qubits[i] <-> qubits[k + i]
+    OP_BLOCK,               // The k next ops (numbered inside the chunks) chunk by chunk, chunks of t qubits
+    OP_IF                   // Skips the next op unless the classical bits t .. t + k - 1 read value
+} OpCode;
+
+typedef struct {
+    OpCode code;
+    int t, c;               // Target and control (physical positions), measurements of OP_MEASURE
+    int k;                  // Qubits, swaps or ops depending on the code
+    int64_t qubits;         // Offset of its qubit list in Program::qubits
+    int64_t matrix;         // Offset of its matrix / diagonal in Program::matrices
+    uint64_t value;         // OP_IF
+    double complex m[4];    // 2x2 matrix, or the phase in m[0]
+} Op;
+
+typedef struct {
+    int nb_qbits;
+    int size;               // Ops
+    Op *ops;
+    int *qubits;            // Qubit lists (and classical bits of the measurements)
+    double complex *matrices;
+    int *layout;            // Of the register after an execution (see qregister_restore_layout)
+    ExecStats stats;        // Planned at compile time (execution times aside)
+} Program;
+
+/* Uses fuse, fusion_qubits, block_qubits and remap of options (NULL :
+   exec_options_default), fills options->stats if not NULL */
+Program *circuit_compile(QuantumCircuit *circuit, const ExecOptions *options);
+/* Executes the program on a register of the same size (its layout restored
+   first), measurements drawn from rng (NULL : rng_default()), the results
+   written in cregister if not NULL. Returns the execution time in seconds */
+double program_execute(const Program *program, QuantumRegister *qregister, ClassicalRegister *cregister, Rng *rng);
+void program_free(Program *program);
+
+#endif
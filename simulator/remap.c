@@ -0,0 +1,88 @@
+#include "remap.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "gates.h"
+#include "../builder/internal.h"
+#include "../utils/utils.h"
+
+// Gates looked at after the window to choose the qubits leaving the local positions
+#define REMAP_HORIZON 256
+
+int remap_plan(Gate **gates, int start, int count, int n, int *layout, int local, int *from, int *to) {
+    int first = n - local; // Lowest local position
+
+    bool *in_window = calloc_custom(n, sizeof(bool));
+    int *qbits = malloc_custom(n * sizeof(int));
+
+    // Longest window on at most `local` qubits
+    int size = 0;
+    int end = start;
+    for(; end < count && gates[end]->class != MEAS; end++) {
+        int nb = gate_get_qubits(gates[end], qbits);
+        int added = 0;
+        for(int i = 0; i < nb; i++) if(!in_window[qbits[i]]) added++;
+        if(size + added > local) break;
+        for(int i = 0; i < nb; i++) in_window[qbits[i]] = true;
+        size += added;
+    }
+
+    int needed = 0;
+    for(int q = 0; q < n; q++) if(in_window[q] && layout[q] < first) needed++;
+
+    int swaps = 0;
+    if(needed > 0 && end - start >= REMAP_GATES_PER_SWAP * needed) {
+        int *logical = malloc_custom(n * sizeof(int)); // Inverse of the layout
+        int *next_use = malloc_custom(n * sizeof(int));
+        for(int q = 0; q < n; q++) {
+            logical[layout[q]] = q;
+            next_use[q] = INT_MAX;
+        }
+        int horizon = (end + REMAP_HORIZON < count) ? end + REMAP_HORIZON : count;
+        for(int g = horizon - 1; g >= end; g--) {
+            int nb = gate_get_qubits(gates[g], qbits);
+            for(int i = 0; i < nb; i++) next_use[qbits[i]] = g;
+        }
+
+        // Disjoint swaps, done together
+        for(int q = 0; q < n; q++) {
+            if(!in_window[q] || layout[q] >= first) continue;
+            // Evicts the local qubit needed the latest (never one of the window)
+            int best = -1;
+            for(int p = first; p < n; p++) {
+                if(in_window[logical[p]]) continue;
+                if(best < 0 || next_use[logical[p]] > next_use[logical[best]]) best = p;
+            }
+            int r = logical[best];
+            from[swaps] = layout[q];
+            to[swaps] = best;
+            logical[layout[q]] = r;
+            logical[best] = q;
+            layout[r] = layout[q];
+            layout[q] = best;
+            swaps++;
+        }
+        free_custom(logical);
+        free_custom(next_use);
+    }
+
+    free_custom(in_window);
+    free_custom(qbits);
+    return swaps;
+}
+
+int remap_window(Gate **gates, int start, int count, QuantumRegister *qregister, int local) {
+    int n = qregister->nb_qbits;
+    int *from = malloc_custom(n * sizeof(int));
+    int *to = malloc_custom(n * sizeof(int));
+    int swaps = remap_plan(gates, start, count, n, qregister->layout, local, from, to);
+    if(swaps == 1) apply_swap_inplace(qregister->statevector, n, from[0], to[0]);
+    else if(swaps > 1) apply_swaps_inplace(qregister->statevector, n, from, to, swaps);
+    free_custom(from);
+    free_custom(to);
+    return swaps;
+}
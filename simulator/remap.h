@@ -0,0 +1,28 @@
+#ifndef REMAP_H
+#define REMAP_H
+
+#include "../builder/circuit.h"
+#include "../builder/register.h"
+
+/* -------- qubit remapping --------
+   The register keeps a logical -> physical qubit permutation (its layout).
+   Before a window of gates on at most `local` logical qubits, the ones
+   sitting on large strides are swapped with physical positions among the
+   last `local` ones, so the whole window is applied by cache blocks.
+   The swaps of a window are done together, in a few passes over the
+   state : a window is only remapped when it has at least
+   REMAP_GATES_PER_SWAP gates per swap.
+*/
+#ifndef REMAP_GATES_PER_SWAP
+#define REMAP_GATES_PER_SWAP 4
+#endif
+
+/* Looks at the window starting at gates[start] (the gates up to the first
+   measurement, or until more than `local` qubits are involved) and swaps its
+   qubits onto the local positions if worth it. Returns the number of swaps */
+int remap_window(Gate **gates, int start, int count, QuantumRegister *qregister, int local);
+/* The choice alone : updates the layout of an n-qubit state and returns the
+   swaps of positions from[i] <-> to[i] (arrays of n entries) to apply */
+int remap_plan(Gate **gates, int start, int count, int n, int *layout, int local, int *from, int *to);
+
+#endif
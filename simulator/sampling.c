@@ -0,0 +1,438 @@
+#include "sampling.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <complex.h>
+#include <assert.h>
+
+#include <omp.h>
+
+#include "gates.h"
+#include "simd.h"
+#include "program.h"
+#include "sparse.h"
+#include "../builder/internal.h"
+#include "../utils/utils.h"
+
+/* -------- alias table (Walker / Vose) --------
+   Outcome i is drawn by picking a column uniformly, then keeping i with
+   probability prob[i] or taking alias[i] */
+typedef struct {
+    uint64_t size;
+    double *prob;
+    uint64_t *alias;
+} AliasTable;
+
+// Takes the probabilities (not necessarily normalized), used for prob
+static AliasTable alias_create(double *p, uint64_t size) {
+    AliasTable table = {size, p, malloc_custom(size * sizeof(uint64_t))};
+    double total = 0.0;
+    for(uint64_t i = 0; i < size; i++) total += p[i];
+    for(uint64_t i = 0; i < size; i++) p[i] *= (double)size / total;
+
+    // Small columns from the start of work, large ones from the end
+    uint64_t *work = malloc_custom(size * sizeof(uint64_t));
+    uint64_t small = 0, large = size;
+    for(uint64_t i = 0; i < size; i++) {
+        if(p[i] < 1.0) work[small++] = i;
+        else work[--large] = i;
+    }
+    while(small > 0 && large < size) {
+        uint64_t s = work[--small];
+        uint64_t l = work[large++];
+        table.alias[s] = l; // prob[s] stays p[s]
+        p[l] -= 1.0 - p[s];
+        if(p[l] < 1.0) work[small++] = l;
+        else work[--large] = l;
+    }
+    // Left overs (rounding errors) are full columns
+    while(small > 0) {
+        uint64_t s = work[--small];
+        p[s] = 1.0;
+        table.alias[s] = s;
+    }
+    while(large < size) {
+        uint64_t l = work[large++];
+        p[l] = 1.0;
+        table.alias[l] = l;
+    }
+    free_custom(work);
+    return table;
+}
+
+static inline uint64_t alias_draw(const AliasTable *table, Rng *rng) {
+    double x = rng_uniform(rng) * (double)table->size;
+    uint64_t i = (uint64_t)x;
+    if(i >= table->size) i = table->size - 1;
+    return (x - (double)i < table->prob[i]) ? i : table->alias[i];
+}
+
+static void alias_free(AliasTable *table) {
+    free_custom(table->prob);
+    free_custom(table->alias);
+}
+
+static int compare_entries(const void *a, const void *b) {
+    uint64_t x = ((const HistogramEntry *)a)->outcome, y = ((const HistogramEntry *)b)->outcome;
+    return (x > y) - (x < y);
+}
+
+static int compare_keys(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Takes the entries, sorts them by outcome and merges the duplicates
+static Histogram *histogram_create(HistogramEntry *entries, uint64_t size, int nb_bits, uint64_t shots) {
+    qsort(entries, size, sizeof(HistogramEntry), compare_entries);
+    uint64_t distinct = 0;
+    for(uint64_t i = 0; i < size; i++) {
+        if(distinct > 0 && entries[distinct - 1].outcome == entries[i].outcome) entries[distinct - 1].count += entries[i].count;
+        else entries[distinct++] = entries[i];
+    }
+    Histogram *histogram = malloc_custom(sizeof(Histogram));
+    histogram->nb_bits = nb_bits;
+    histogram->shots = shots;
+    histogram->size = distinct;
+    histogram->entries = entries;
+    return histogram;
+}
+
+/* Copies the gates of the circuit whose index satisfies keep[i] == value
+   (the copies share the matrices of the original gates) */
+static QuantumCircuit *circuit_select(QuantumCircuit *circuit, const bool *keep, bool value, int from) {
+    QuantumCircuit *selected = circuit_create(circuit->nb_qbits);
+    for(int g = from; g < circuit->nb_gates; g++) {
+        if(keep[g] == value) circuit_append_gate(selected, &circuit->gates[g]);
+    }
+    return selected;
+}
+
+/* Terminal measurements : drawn from the final state of the unitary part */
+static Histogram *sample_terminal(QuantumCircuit *unitary, Gate **measures, int nb_measures, int nb_bits,
+                                  uint64_t shots, const ExecOptions *options) {
+    int n = unitary->nb_qbits;
+    Rng *rng = options->rng ? options->rng : rng_default();
+    // The statevector is only allocated once the sparse state gets too full
+    SparseState *sparse = NULL;
+    int start = 0;
+    if(options->sparse_fill > 0.0 && n < 64) {
+        sparse = sparse_create(n, 0);
+        start = circuit_execute_sparse(unitary, sparse, NULL, rng, options->sparse_fill);
+    }
+    uint64_t peak = sparse ? sparse_get_peak(sparse) : 0;
+    QuantumRegister *qregister = NULL;
+    if(!sparse || start < unitary->nb_gates) {
+        qregister = options->state_file ? qregister_create_mapped(n, options->state_file) : qregister_create(n);
+        assert(qregister);
+        if(sparse) {
+            sparse_write_statevector(sparse, qregister->statevector);
+            sparse_free(sparse);
+            sparse = NULL;
+        }
+        bool *keep = calloc_custom(unitary->nb_gates > 0 ? unitary->nb_gates : 1, sizeof(bool));
+        QuantumCircuit *rest = circuit_select(unitary, keep, false, start);
+        // Past the sparse part : no second look for |0...0> in the register
+        ExecOptions dense = *options;
+        dense.sparse_fill = 0.0;
+        circuit_execute_opts(rest, qregister, NULL, &dense);
+        circuit_free(rest);
+        free_custom(keep);
+    } else if(options->stats) {
+        *options->stats = (ExecStats){0};
+    }
+    if(options->stats) {
+        options->stats->gates = unitary->nb_gates;
+        options->stats->sparse_gates = start;
+        options->stats->sparse_peak = peak;
+    }
+
+    // Measured qubits, in order of first measurement
+    int *qbits = malloc_custom(n * sizeof(int));
+    int *index = malloc_custom(n * sizeof(int)); // Position of a qubit in qbits, -1 if not measured
+    int m = 0;
+    for(int q = 0; q < n; q++) index[q] = -1;
+    for(int i = 0; i < nb_measures; i++) {
+        int q = measures[i]->gate.measure.qbit;
+        if(index[q] < 0) {
+            index[q] = m;
+            qbits[m++] = q;
+        }
+    }
+
+    // The probabilities are read on the physical qubits, without restoring the layout
+    uint64_t size = 1ULL << m;
+    double *marginal = malloc_custom(size * sizeof(double));
+    if(sparse) {
+        sparse_marginal_probabilities(sparse, qbits, m, marginal);
+        sparse_free(sparse);
+    } else {
+        int *physical = malloc_custom(n * sizeof(int));
+        for(int j = 0; j < m; j++) physical[j] = qregister->layout[qbits[j]];
+        marginal_probabilities(qregister->statevector, n, physical, m, marginal);
+        qregister_free(qregister);
+        free_custom(physical);
+    }
+    AliasTable table = alias_create(marginal, size);
+
+    // A count per key if there are fewer keys than shots, the sorted draws otherwise
+    HistogramEntry *entries;
+    uint64_t distinct = 0;
+    if(size <= shots) {
+        uint64_t *counts = calloc_custom(size, sizeof(uint64_t));
+        for(uint64_t s = 0; s < shots; s++) counts[alias_draw(&table, rng)]++;
+        for(uint64_t k = 0; k < size; k++) if(counts[k]) distinct++;
+        entries = malloc_custom(distinct * sizeof(HistogramEntry));
+        distinct = 0;
+        for(uint64_t k = 0; k < size; k++) {
+            if(counts[k]) entries[distinct++] = (HistogramEntry){k, counts[k]};
+        }
+        free_custom(counts);
+    } else {
+        uint64_t *keys = malloc_custom(shots * sizeof(uint64_t));
+        for(uint64_t s = 0; s < shots; s++) keys[s] = alias_draw(&table, rng);
+        qsort(keys, shots, sizeof(uint64_t), compare_keys);
+        entries = malloc_custom(shots * sizeof(HistogramEntry));
+        for(uint64_t s = 0; s < shots; s++) {
+            if(distinct > 0 && entries[distinct - 1].outcome == keys[s]) entries[distinct - 1].count++;
+            else entries[distinct++] = (HistogramEntry){keys[s], 1};
+        }
+        free_custom(keys);
+    }
+    alias_free(&table);
+
+    // Key -> classical bits, the last measurement into a bit winning
+    for(uint64_t e = 0; e < distinct; e++) {
+        uint64_t key = entries[e].outcome, outcome = 0;
+        for(int i = 0; i < nb_measures; i++) {
+            int j = index[measures[i]->gate.measure.qbit];
+            uint64_t bit = 1ULL << (nb_bits - 1 - measures[i]->gate.measure.cbit);
+            if((key >> (m - 1 - j)) & 1) outcome |= bit;
+            else outcome &= ~bit;
+        }
+        entries[e].outcome = outcome;
+    }
+    free_custom(qbits);
+    free_custom(index);
+    return histogram_create(entries, distinct, nb_bits, shots);
+}
+
+/* Mid-circuit measurements : the head (up to the first one) is simulated
+   once, the tail for every shot from a copy of its final state.
+   Small states run a trajectory per worker (each with its own registers),
+   larger ones one trajectory at a time with threaded kernels. Block b of
+   TRAJECTORY_BLOCK shots draws from the b-th stream split from the
+   options' generator : the histogram doesn't depend on the number of
+   workers. Every worker counts its outcomes apart, the counts are merged
+   at the end */
+static Histogram *sample_trajectories(QuantumCircuit *head, QuantumCircuit *tail, int nb_bits, uint64_t shots, const ExecOptions *options) {
+    int n = head->nb_qbits;
+    uint64_t dim = 1ULL << n;
+    Rng *rng = options->rng ? options->rng : rng_default();
+    QuantumRegister *start = qregister_create(n);
+    circuit_execute_opts(head, start, NULL, options);
+    qregister_restore_layout(start); // The copies start from the layout of the program
+
+    // The tail is compiled once for all the shots and the workers
+    ExecOptions tail_options = *options;
+    tail_options.stats = NULL;
+    Program *program = circuit_compile(tail, &tail_options);
+
+    uint64_t blocks = (shots + TRAJECTORY_BLOCK - 1) / TRAJECTORY_BLOCK;
+    Rng *streams = malloc_custom(blocks * sizeof(Rng));
+    for(uint64_t b = 0; b < blocks; b++) streams[b] = rng_split(rng);
+
+    int workers = (n <= TRAJECTORY_PARALLEL_QUBITS && blocks > 1) ? omp_get_max_threads() : 1;
+    if((uint64_t)workers > blocks) workers = blocks;
+    HistogramEntry **counted = calloc_custom(workers, sizeof(HistogramEntry *));
+    uint64_t *sizes = calloc_custom(workers, sizeof(uint64_t));
+    simd_get_level(); // Detected before the workers start
+
+    #pragma omp parallel num_threads(workers) if(workers > 1)
+    {
+        int id = omp_get_thread_num();
+        QuantumRegister *qregister = qregister_create(n);
+        ClassicalRegister *cregister = cregister_create(nb_bits);
+        uint64_t capacity = TRAJECTORY_BLOCK, size = 0;
+        HistogramEntry *entries = malloc_custom(capacity * sizeof(HistogramEntry));
+
+        #pragma omp for schedule(dynamic)
+        for(uint64_t b = 0; b < blocks; b++) {
+            uint64_t end = (b + 1) * TRAJECTORY_BLOCK < shots ? (b + 1) * TRAJECTORY_BLOCK : shots;
+            for(uint64_t s = b * TRAJECTORY_BLOCK; s < end; s++) {
+                memcpy(qregister->statevector, start->statevector, dim * sizeof(amplitude));
+                memcpy(qregister->layout, start->layout, n * sizeof(int));
+                memset(cregister->bits, 0, nb_bits * sizeof(int));
+                program_execute(program, qregister, cregister, &streams[b]);
+
+                uint64_t outcome = 0;
+                for(int c = 0; c < nb_bits; c++) outcome = (outcome << 1) | (uint64_t)cregister->bits[c];
+                if(size == capacity) {
+                    // Merging the counts first keeps the array to the distinct outcomes
+                    Histogram *merged = histogram_create(entries, size, nb_bits, 0);
+                    size = merged->size;
+                    entries = merged->entries;
+                    free_custom(merged);
+                    if(size > capacity / 2) {
+                        capacity *= 2;
+                        entries = realloc(entries, capacity * sizeof(HistogramEntry));
+                        assert(entries != NULL);
+                    }
+                }
+                entries[size++] = (HistogramEntry){outcome, 1};
+            }
+        }
+        counted[id] = entries;
+        sizes[id] = size;
+        qregister_free(qregister);
+        cregister_free(cregister);
+    }
+
+    uint64_t total = 0;
+    for(int w = 0; w < workers; w++) total += sizes[w];
+    HistogramEntry *entries = malloc_custom((total > 0 ? total : 1) * sizeof(HistogramEntry));
+    uint64_t at = 0;
+    for(int w = 0; w < workers; w++) {
+        memcpy(entries + at, counted[w], sizes[w] * sizeof(HistogramEntry));
+        at += sizes[w];
+        free_custom(counted[w]);
+    }
+    free_custom(counted);
+    free_custom(sizes);
+    free_custom(streams);
+    qregister_free(start);
+    program_free(program);
+    return histogram_create(entries, total, nb_bits, shots);
+}
+
+Histogram *circuit_sample(QuantumCircuit *circuit, uint64_t shots, const ExecOptions *options) {
+    ExecOptions defaults = exec_options_default();
+    if(!options) options = &defaults;
+    assert(shots > 0);
+    int n = circuit->nb_qbits;
+    int total = circuit->nb_gates;
+
+    /* A measurement is terminal if no later gate (other than a measurement)
+    touches its qubit, no later condition reads its bit and no later
+    measurement writes it (the last write wins). A conditional one is
+    mid-circuit : its condition needs the bits of the trajectory */
+    bool *terminal = calloc_custom(total > 0 ? total : 1, sizeof(bool));
+    bool *touched = calloc_custom(n, sizeof(bool));
+    int *qbits = malloc_custom(n * sizeof(int));
+    Gate **gates = malloc_custom((total > 0 ? total : 1) * sizeof(Gate *));
+    int nb_bits = 0, first_mid = total;
+    for(int g = 0; g < total; g++) {
+        gates[g] = &circuit->gates[g];
+        const GateCondition *condition = gates[g]->condition;
+        if(condition && condition->first + condition->width > nb_bits) nb_bits = condition->first + condition->width;
+        if(gates[g]->class == MEAS && gates[g]->gate.measure.cbit + 1 > nb_bits) nb_bits = gates[g]->gate.measure.cbit + 1;
+    }
+    bool *read = calloc_custom(nb_bits > 0 ? nb_bits : 1, sizeof(bool));
+    bool *written = calloc_custom(nb_bits > 0 ? nb_bits : 1, sizeof(bool));
+
+    for(int g = total - 1; g >= 0; g--) {
+        const GateCondition *condition = gates[g]->condition;
+        if(gates[g]->class == MEAS && !condition) {
+            int cbit = gates[g]->gate.measure.cbit;
+            terminal[g] = !touched[gates[g]->gate.measure.qbit] && !read[cbit] && !written[cbit];
+            written[cbit] = true;
+            if(!terminal[g]) first_mid = g;
+            continue;
+        }
+        if(gates[g]->class == MEAS) {
+            written[gates[g]->gate.measure.cbit] = true;
+            first_mid = g;
+        }
+        if(condition) for(int i = 0; i < condition->width; i++) read[condition->first + i] = true;
+        int nb = gate_get_qubits(gates[g], qbits);
+        for(int i = 0; i < nb; i++) touched[qbits[i]] = true;
+    }
+    free_custom(read);
+    free_custom(written);
+    free_custom(touched);
+    free_custom(qbits);
+    assert(nb_bits <= 64 && n <= 64);
+
+    Histogram *histogram;
+    if(nb_bits == 0) {
+        // No measurement : every qubit into the bit of the same index
+        Gate *all = malloc_custom(n * sizeof(Gate));
+        Gate **measures = malloc_custom(n * sizeof(Gate *));
+        for(int q = 0; q < n; q++) {
+            all[q] = (Gate){.class = MEAS, .gate.measure = {q, q}};
+            measures[q] = &all[q];
+        }
+        histogram = sample_terminal(circuit, measures, n, n, shots, options);
+        free_custom(measures);
+        free_custom(all);
+    } else if(first_mid == total) {
+        Gate **measures = malloc_custom(total * sizeof(Gate *));
+        int nb_measures = 0;
+        for(int g = 0; g < total; g++) if(terminal[g]) measures[nb_measures++] = gates[g];
+        QuantumCircuit *unitary = circuit_select(circuit, terminal, false, 0);
+        histogram = sample_terminal(unitary, measures, nb_measures, nb_bits, shots, options);
+        circuit_free(unitary);
+        free_custom(measures);
+    } else {
+        // Head : the gates before the first mid-circuit measurement, except the terminal ones
+        bool *in_head = calloc_custom(total, sizeof(bool));
+        for(int g = 0; g < first_mid; g++) in_head[g] = !terminal[g];
+        QuantumCircuit *head = circuit_select(circuit, in_head, true, 0);
+        /* Tail : the rest, the terminal measurements of the head moved to the
+        end, in program order. No later gate writes their bits, so no write
+        changes order */
+        QuantumCircuit *tail = circuit_select(circuit, in_head, false, first_mid);
+        for(int g = 0; g < first_mid; g++) if(terminal[g]) circuit_append_gate(tail, gates[g]);
+        histogram = sample_trajectories(head, tail, nb_bits, shots, options);
+        circuit_free(head);
+        circuit_free(tail);
+        free_custom(in_head);
+    }
+    free_custom(terminal);
+    free_custom(gates);
+    return histogram;
+}
+
+uint64_t histogram_get_count(const Histogram *histogram, uint64_t outcome) {
+    HistogramEntry key = {outcome, 0};
+    HistogramEntry *entry = bsearch(&key, histogram->entries, histogram->size, sizeof(HistogramEntry), compare_entries);
+    return entry ? entry->count : 0;
+}
+
+void histogram_bitstring(const Histogram *histogram, uint64_t outcome, char *buffer) {
+    for(int c = 0; c < histogram->nb_bits; c++) buffer[c] = ((outcome >> (histogram->nb_bits - 1 - c)) & 1) ? '1' : '0';
+    buffer[histogram->nb_bits] = '\0';
+}
+
+static int compare_counts(const void *a, const void *b) {
+    const HistogramEntry *x = a, *y = b;
+    if(x->count != y->count) return (x->count < y->count) - (x->count > y->count);
+    return compare_entries(a, b);
+}
+
+void histogram_print(FILE *channel, const Histogram *histogram, int max_entries) {
+    uint64_t shown = histogram->size;
+    if(max_entries > 0 && (uint64_t)max_entries < shown) shown = max_entries;
+    HistogramEntry *sorted = malloc_custom(histogram->size * sizeof(HistogramEntry));
+    memcpy(sorted, histogram->entries, histogram->size * sizeof(HistogramEntry));
+    qsort(sorted, histogram->size, sizeof(HistogramEntry), compare_counts);
+
+    char *bits = malloc_custom(histogram->nb_bits + 1);
+    fprintf(channel, "%llu shots, %llu distinct outcomes\n", (unsigned long long)histogram->shots, (unsigned long long)histogram->size);
+    for(uint64_t e = 0; e < shown; e++) {
+        histogram_bitstring(histogram, sorted[e].outcome, bits);
+        fprintf(channel, "%s : %10llu  (%.6f)\n", bits, (unsigned long long)sorted[e].count,
+                (double)sorted[e].count / (double)histogram->shots);
+    }
+    if(shown < histogram->size) fprintf(channel, "... (%llu more)\n", (unsigned long long)(histogram->size - shown));
+    free_custom(bits);
+    free_custom(sorted);
+}
+
+void histogram_free(Histogram *histogram) {
+    free_custom(histogram->entries);
+    free_custom(histogram);
+}